@@ -0,0 +1,81 @@
+/*
+
+LoadedLibraries.cpp ... Libraries loaded for -h super, shared by many files.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "LoadedLibraries.h"
+#include "MachO_File_ObjC.h"
+
+using namespace std;
+
+LoadedLibraries::LoadedLibraries(const char* symbol_cache, MachO_File::CacheMode cache_mode) : m_symbol_cache(symbol_cache != NULL ? symbol_cache : ""), m_has_symbol_cache(symbol_cache != NULL), m_cache_mode(cache_mode) {
+#if !_MSC_VER
+	pthread_mutex_init(&m_mutex, NULL);
+#endif
+}
+
+LoadedLibraries::~LoadedLibraries() throw() {
+	for (tr1::unordered_map<string, MachO_File_ObjC*>::const_iterator cit = ma_libraries.begin(); cit != ma_libraries.end(); ++ cit)
+		delete cit->second;
+#if !_MSC_VER
+	pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+#if !_MSC_VER
+LoadedLibraries::Lock::Lock(LoadedLibraries& libraries) : m_libraries(libraries) { pthread_mutex_lock(&m_libraries.m_mutex); }
+LoadedLibraries::Lock::~Lock() throw() { pthread_mutex_unlock(&m_libraries.m_mutex); }
+#else
+LoadedLibraries::Lock::Lock(LoadedLibraries& libraries) : m_libraries(libraries) {}
+LoadedLibraries::Lock::~Lock() throw() {}
+#endif
+
+MachO_File_ObjC* LoadedLibraries::library(const char* path, const char* arch) {
+	string key = path;
+	key.push_back('\0');
+	key += arch;
+
+	{
+		Lock lock (*this);
+		tr1::unordered_map<string, MachO_File_ObjC*>::const_iterator cit = ma_libraries.find(key);
+		if (cit != ma_libraries.end())
+			return cit->second;
+	}
+
+	// analyze the library without holding the lock. If another thread wins the
+	// race its copy is kept.
+	MachO_File_ObjC* mf = NULL;
+	try {
+		mf = new MachO_File_ObjC(path, true, arch, m_has_symbol_cache ? m_symbol_cache.c_str() : NULL, m_cache_mode);
+		mf->set_shared_libraries(this);
+	} catch (...) {
+		mf = NULL;
+	}
+
+	Lock lock (*this);
+	pair<tr1::unordered_map<string, MachO_File_ObjC*>::iterator, bool> res = ma_libraries.insert(pair<string, MachO_File_ObjC*>(key, mf));
+	if (!res.second)
+		delete mf;
+	return res.first->second;
+}
+
+size_t LoadedLibraries::count() {
+	Lock lock (*this);
+	return ma_libraries.size();
+}
@@ -0,0 +1,77 @@
+/*
+
+LoadedLibraries.h ... Libraries loaded for -h super, shared by many files.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LOADED_LIBRARIES_H
+#define LOADED_LIBRARIES_H
+
+#include "MachO_File.h"
+#include <string>
+#include <tr1/unordered_map>
+#if !_MSC_VER
+#include <pthread.h>
+#endif
+
+class MachO_File_ObjC;
+
+// The libraries opened to hide inherited methods (-h super). One store is
+// shared by every file being analyzed, so each library is analyzed once per
+// run instead of once per file. library() may be called from many threads.
+// A library is never changed once loaded, so what it returns may be read
+// concurrently too.
+class LoadedLibraries {
+private:
+	std::string m_symbol_cache;
+	bool m_has_symbol_cache;
+	MachO_File::CacheMode m_cache_mode;
+	// path + '\0' + arch -> library, or NULL if it cannot be opened.
+	std::tr1::unordered_map<std::string, MachO_File_ObjC*> ma_libraries;
+#if !_MSC_VER
+	pthread_mutex_t m_mutex;
+#endif
+
+	LoadedLibraries(const LoadedLibraries&);
+	LoadedLibraries& operator= (const LoadedLibraries&);
+
+	class Lock {
+	private:
+		LoadedLibraries& m_libraries;
+		Lock(const Lock&);
+		Lock& operator= (const Lock&);
+	public:
+		explicit Lock(LoadedLibraries& libraries);
+		~Lock() throw();
+	};
+
+public:
+	// the symbol cache (see MachO_File::set_symbol_cache) of the libraries.
+	LoadedLibraries(const char* symbol_cache = NULL, MachO_File::CacheMode cache_mode = MachO_File::CM_Use);
+	~LoadedLibraries() throw();
+
+	// the reduced analysis of the library at path (with the sysroot already
+	// prepended), loaded on first use. NULL if it cannot be opened. arch must
+	// outlive the store.
+	MachO_File_ObjC* library(const char* path, const char* arch);
+
+	// the number of libraries opened so far.
+	std::size_t count();
+};
+
+#endif
@@ -30,6 +30,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stack>
 #include "pseudo_base64.h"
 #include "hash_combine.h"
+#include "LoadedLibraries.h"
 
 using namespace std;
 
@@ -57,11 +58,10 @@ namespace std
 			size_t operator() (const ::MachO_File_ObjC::ReducedProperty& p) const throw() {
 				size_t retval = 0;
 				hash_combine(retval, p.name);
-				hash_combine(retval, p.type);
 				hash_combine(retval, p.has_getter*32 + p.has_setter*16 + p.copy*8 + p.retain*4 + p.readonly*2 + p.nonatomic);
-				if (p.has_setter)
-					hash_combine(retval, p.getter);
 				if (p.has_getter)
+					hash_combine(retval, p.getter);
+				if (p.has_setter)
 					hash_combine(retval, p.setter);
 				return retval;
 			}
@@ -95,10 +95,26 @@ struct MachO_File_ObjC::OverlapperType {
 
 #pragma mark -
 
-MachO_File_ObjC::MachO_File_ObjC(const char* path, bool perform_reduced_analysis, const char* arch) : MachO_File(path, arch), m_guess_data_segment(1), m_guess_text_segment(0), m_class_filter(NULL), m_method_filter(NULL), m_class_filter_extra(NULL), m_method_filter_extra(NULL), m_arch(arch), m_has_whitespace(false), m_hide_cats(false), m_hide_dogs(false), m_hints_file(NULL) {
+MachO_File_ObjC::MachO_File_ObjC(const char* path, bool perform_reduced_analysis, const char* arch, const char* symbol_cache, CacheMode cache_mode) : MachO_File(path, arch), m_data_lookup_hint(0), m_text_lookup_hint(0), mp_shared_libraries(NULL), mp_class_cache(NULL), m_class_filter(NULL), m_method_filter(NULL), m_class_filter_extra(NULL), m_method_filter_extra(NULL), m_arch(arch), m_has_whitespace(false), m_hide_cats(false), m_hide_dogs(false), m_hints_file(NULL) {
+	set_symbol_cache(symbol_cache, cache_mode);
+	retrieve_info(perform_reduced_analysis);
+}
+
+MachO_File_ObjC::MachO_File_ObjC(const DataFile& file, const Slice& slice, bool perform_reduced_analysis, const char* symbol_cache, CacheMode cache_mode) : MachO_File(file, slice), m_data_lookup_hint(0), m_text_lookup_hint(0), mp_shared_libraries(NULL), mp_class_cache(NULL), m_class_filter(NULL), m_method_filter(NULL), m_class_filter_extra(NULL), m_method_filter_extra(NULL), m_arch(slice.arch != NULL ? slice.arch : "any"), m_has_whitespace(false), m_hide_cats(false), m_hide_dogs(false), m_hints_file(NULL) {
+	set_symbol_cache(symbol_cache, cache_mode);
+	retrieve_info(perform_reduced_analysis);
+}
+
+void MachO_File_ObjC::retrieve_info(bool perform_reduced_analysis) {
 	if (perform_reduced_analysis) {
-		retrieve_reduced_class_info();
+		if (symbol_cache_mode() != CM_Use || !load_class_cache()) {
+			analyze(AF_All);
+			retrieve_reduced_class_info();
+			if (symbol_cache_mode() != CM_Bypass)
+				save_class_cache();
+		}
 	} else {
+		analyze(AF_All);
 		retrieve_protocol_info();
 		retrieve_class_info();
 		retrieve_category_info();
@@ -300,6 +316,13 @@ void MachO_File_ObjC::recursive_union_with_protocols(unsigned i, std::vector<Ove
 		}	
 	}
 }
+// libpath as installed under sysroot.
+static string path_in_sysroot(const char* sysroot, const char* libpath) {
+	size_t sysroot_len = strlen(sysroot);
+	bool sysroot_ends_with_slash = sysroot_len > 0 && sysroot[sysroot_len-1] == '/';
+	return string(sysroot, sysroot_len) + (libpath + (libpath[0]=='/'&&sysroot_ends_with_slash));
+}
+
 void MachO_File_ObjC::recursive_union_with_superclasses(ObjCTypeRecord::TypeIndex ti, tr1::unordered_map<ObjCTypeRecord::TypeIndex, OverlapperType>& superclass_overlappers, const char* sysroot) throw() {
 	OverlapperType& ovlp = superclass_overlappers[ti];
 	if (!ovlp.defined) {
@@ -316,39 +339,66 @@ void MachO_File_ObjC::recursive_union_with_superclasses(ObjCTypeRecord::TypeInde
 		} else {
 			tr1::unordered_map<ObjCTypeRecord::TypeIndex, const char*>::const_iterator lit = ma_lib_path.find(ti);
 			if (lit != ma_lib_path.end()) {
-				const char* libpath = lit->second;
-				tr1::unordered_map<const char*, MachO_File_ObjC*>::iterator loaded_lib = ma_loaded_libraries.find(libpath);
-				if (loaded_lib == ma_loaded_libraries.end()) {
-					size_t sysroot_len = strlen(sysroot);
-					bool sysroot_ends_with_slash = sysroot[sysroot_len-1] == '/';				
-					char* the_path = reinterpret_cast<char*>(alloca(sysroot_len + strlen(libpath) + 1));
-					memcpy(the_path, sysroot, sysroot_len);
-					strcpy(the_path+sysroot_len, libpath+(libpath[0]=='/'&&sysroot_ends_with_slash));
-					MachO_File_ObjC* mf = NULL;
-					try {
-						mf = new MachO_File_ObjC(the_path, true, m_arch);
-					} catch (...) {
-						mf = NULL;
-					}
-					loaded_lib = ma_loaded_libraries.insert( pair<const char*, MachO_File_ObjC*>(libpath, mf) ).first;
-				}
-				
-				MachO_File_ObjC* mf = loaded_lib->second;
-				if (mf != NULL) {
-					tr1::unordered_map<ObjCTypeRecord::TypeIndex, OverlapperType> remote_superclass_overlappers;
-					ObjCTypeRecord::TypeIndex remote_index = mf->m_record.parse(m_record.encoding_of_type(ti), false);
-					mf->recursive_union_with_superclasses(remote_index, remote_superclass_overlappers, sysroot);
-					for (tr1::unordered_map<ObjCTypeRecord::TypeIndex, OverlapperType>::iterator tit = remote_superclass_overlappers.begin(); tit != remote_superclass_overlappers.end(); ++ tit) {
-						tit->second.localize(m_record, mf->m_record);
-						ObjCTypeRecord::TypeIndex local_index = m_record.parse(mf->m_record.encoding_of_type(tit->first), false);
-						superclass_overlappers[local_index].union_with(tit->second);
-					}
-				}
+				const MachO_File_ObjC* mf = library(lit->second, sysroot);
+				if (mf != NULL)
+					union_with_library_superclasses(*mf, ti, ovlp, sysroot);
 			}
 		}
 	}
 }
 
+MachO_File_ObjC* MachO_File_ObjC::library(const char* libpath, const char* sysroot) throw() {
+	if (mp_shared_libraries != NULL)
+		return mp_shared_libraries->library(path_in_sysroot(sysroot, libpath).c_str(), m_arch);
+	
+	tr1::unordered_map<const char*, MachO_File_ObjC*>::iterator loaded_lib = ma_loaded_libraries.find(libpath);
+	if (loaded_lib == ma_loaded_libraries.end()) {
+		MachO_File_ObjC* mf = NULL;
+		try {
+			mf = new MachO_File_ObjC(path_in_sysroot(sysroot, libpath).c_str(), true, m_arch, symbol_cache_directory(), symbol_cache_mode());
+		} catch (...) {
+			mf = NULL;
+		}
+		loaded_lib = ma_loaded_libraries.insert( pair<const char*, MachO_File_ObjC*>(libpath, mf) ).first;
+	}
+	return loaded_lib->second;
+}
+
+void MachO_File_ObjC::union_with_library_superclasses(const MachO_File_ObjC& mf, ObjCTypeRecord::TypeIndex ti, OverlapperType& ovlp, const char* sysroot) throw() {
+	// follow the superclasses from library to library. The libraries may be
+	// shared by other files, so they are only read, and every class is
+	// localized into this file's record directly.
+	const MachO_File_ObjC* lib = &mf;
+	const char* encoding = m_record.encoding_of_type(ti);
+	vector<pair<const MachO_File_ObjC*, ObjCTypeRecord::TypeIndex> > visited;
+	while (lib != NULL) {
+		ObjCTypeRecord::TypeIndex remote_index;
+		if (!lib->m_record.find_type(encoding, &remote_index))
+			return;
+		pair<const MachO_File_ObjC*, ObjCTypeRecord::TypeIndex> key (lib, remote_index);
+		if (std::find(visited.begin(), visited.end(), key) != visited.end())
+			return;
+		visited.push_back(key);
+		
+		tr1::unordered_map<ObjCTypeRecord::TypeIndex, unsigned>::const_iterator cit = lib->ma_classes_typeindex_index.find(remote_index);
+		if (cit != lib->ma_classes_typeindex_index.end()) {
+			const ClassType& cls = lib->ma_classes[cit->second];
+			OverlapperType class_ovlp;
+			class_ovlp.union_with(cls);
+			class_ovlp.localize(m_record, lib->m_record);
+			ovlp.union_with(class_ovlp);
+			if (cls.attributes & RO_ROOT)
+				return;
+			encoding = lib->m_record.encoding_of_type(cls.superclass_index);
+		} else {
+			tr1::unordered_map<ObjCTypeRecord::TypeIndex, const char*>::const_iterator lit = lib->ma_lib_path.find(remote_index);
+			if (lit == lib->ma_lib_path.end())
+				return;
+			lib = library(lit->second, sysroot);
+		}
+	}
+}
+
 void MachO_File_ObjC::hide_overlapping_methods(ClassType& target, const OverlapperType& reference, MachO_File_ObjC::HiddenMethodType hiding_method) throw() {
 	for (vector<Property>::iterator it = target.properties.begin(); it != target.properties.end(); ++ it)
 		if (it->hidden == PS_None && reference.properties.find(*it) != reference.properties.end())
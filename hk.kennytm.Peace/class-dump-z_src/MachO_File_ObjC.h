@@ -34,6 +34,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <pcre.h>
 #include "TSVParser.h"
 
+class ThreadPool;
+class LoadedLibraries;
+
 class MachO_File_ObjC : public MachO_File {
 private:
 	enum HiddenMethodType {
@@ -99,6 +102,8 @@ private:
 		HiddenMethodType hidden;
 		bool optional;
 		
+		const char* attributes;	// as in the binary, or NULL. Kept for the class cache.
+		
 		enum {
 			IM_None,
 			IM_Synthesized,	// V
@@ -111,9 +116,11 @@ private:
 			GC_Weak			// W
 		} gc_strength;
 		
-		Property() : ReducedProperty(), getter_vm_address(0), setter_vm_address(0), hidden(PS_None), optional(false), impl_method(IM_None), gc_strength(GC_None) {}
+		Property() : ReducedProperty(), getter_vm_address(0), setter_vm_address(0), hidden(PS_None), optional(false), attributes(NULL), impl_method(IM_None), gc_strength(GC_None) {}
 		
-		std::string format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments) const throw();
+		bool is_printed(const MachO_File_ObjC& self, int print_comments) const throw();
+		// only if is_printed().
+		void format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments) const throw();
 	};
 	
 	struct Ivar {
@@ -136,12 +143,16 @@ private:
 		// components = "", "", ""
 		bool optional;
 		
+		const char* types_encoding;	// as in the binary, or NULL. Kept for the class cache.
+		
 		std::vector<std::string> components;
 		std::vector<std::string> argname;
 		
-		Method() : vm_address(0), propertize_status(PS_None), components(3) {}
+		Method() : vm_address(0), propertize_status(PS_None), types_encoding(NULL), components(3) {}
 		
-		std::string format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, const ClassType& cls) const throw();
+		bool is_printed(const MachO_File_ObjC& self, int print_comments) const throw();
+		// only if is_printed().
+		void format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, const ClassType& cls) const throw();
 	};
 	
 	struct ClassType {
@@ -167,10 +178,14 @@ private:
 				
 		std::vector<unsigned> adopted_protocols;
 		
-		std::string format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, bool print_ivar_offsets, MachO_File_ObjC::SortBy sort_by, bool show_only_exported_classes) const throw();
+		void format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, bool print_ivar_offsets, MachO_File_ObjC::SortBy sort_by, bool show_only_exported_classes) const throw();
 	};
 	
 	struct OverlapperType;
+	struct ClassFormatJob;
+	static void format_class_job(unsigned index, void* context) throw();
+	struct HeaderWriteJob;
+	static void write_header_job(unsigned index, void* context) throw();
 	
 	friend struct Method_AlphabeticSorter;
 	friend struct Property_AlphabeticSorter;
@@ -179,7 +194,8 @@ private:
 	
 //-------------------------------------------------------------------------------------------------------------------------------------------
 	
-	int m_guess_data_segment, m_guess_text_segment;
+	// locality hints for the address index, one per region being scanned.
+	int m_data_lookup_hint, m_text_lookup_hint;
 	
 	unsigned m_class_count, m_protocol_count, m_category_count;
 	std::vector<ClassType> ma_classes;	// classes, categories & protocols.
@@ -189,20 +205,30 @@ private:
 	std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, const char*> ma_lib_path;
 	
 	std::tr1::unordered_map<const char*, MachO_File_ObjC*> ma_loaded_libraries;
+	LoadedLibraries* mp_shared_libraries;	// used instead of ma_loaded_libraries if not NULL.
 	
 	ObjCTypeRecord m_record;
 	
 	void adopt_protocols(ClassType& cls, const protocol_list_t* protocols) throw();
 	void add_properties(ClassType& cls, const objc_property_list* prop_list) throw();
+	void parse_property_attributes(ClassType& cls, Property& prop, const char* attributes) throw();
 	void add_methods(ClassType& cls, const method_list_t* method_list_ptr, bool class_method, bool optional, bool reduced_method = false) throw();
 	
 	const char* get_superclass_name(unsigned superclass_addr, unsigned pointer_to_superclass_addr, ObjCTypeRecord::TypeIndex& superclass_index) throw();
-	const char* get_cstring(const void* vmaddr, int* guess_segment, unsigned symaddr, unsigned symoffset, const char* defsym) const throw();
+	void set_superclass_library(ObjCTypeRecord::TypeIndex superclass_index, const char* lib_path) throw();
+	const char* get_cstring(const void* vmaddr, int* p_hint, unsigned symaddr, unsigned symoffset, const char* defsym) const throw();
 	
 	void retrieve_protocol_info() throw();
 	void retrieve_class_info() throw();
 	void retrieve_reduced_class_info() throw();
 	void retrieve_category_info() throw();
+	void retrieve_info(bool perform_reduced_analysis);
+	
+	// the reduced analysis of the libraries loaded for -h super is kept next
+	// to their symbol cache. The names point into mp_class_cache.
+	DataFile* mp_class_cache;
+	bool load_class_cache();
+	void save_class_cache() const;
 	
 	void tag_propertized_methods(ClassType& cls) throw();
 	
@@ -211,6 +237,9 @@ private:
 	
 	void recursive_union_with_protocols(unsigned i, std::vector<OverlapperType>& overlappers) const throw();
 	void recursive_union_with_superclasses(ObjCTypeRecord::TypeIndex ti, std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, OverlapperType>& superclass_overlappers, const char* sysroot) throw();
+	void union_with_library_superclasses(const MachO_File_ObjC& mf, ObjCTypeRecord::TypeIndex ti, OverlapperType& ovlp, const char* sysroot) throw();
+	// the library at libpath (relative to sysroot), loaded on first use.
+	MachO_File_ObjC* library(const char* libpath, const char* sysroot) throw();
 	
 //-------------------------------------------------------------------------------------------------------------------------------------------
 	
@@ -222,7 +251,6 @@ private:
 		
 	friend bool mfoc_AlphabeticSorter(const ClassType* a, const ClassType* b) throw();
 	
-	std::vector<std::string> ma_string_store;	// store C-strings.
 	std::vector<Method> ma_method_store;
 	std::vector<Property> ma_property_store;
 	
@@ -236,12 +264,15 @@ private:
 
 public:
 	static std::string reconstruct_raw_name(const ClassType& cls, const ReducedMethod& method);
-	std::string format_type_with_hints(const ObjCTypeRecord& record, const std::string& reconstructed_raw_name, const ReducedMethod& method, int index) const;
+	void format_type_with_hints(OutputSink& out, const ObjCTypeRecord& record, const std::string& reconstructed_raw_name, const ReducedMethod& method, int index) const;
 	
 //-------------------------------------------------------------------------------------------------------------------------------------------
 	
 public:	
-	MachO_File_ObjC(const char* path, bool perform_reduced_analysis = false, const char* arch = "any");
+	// the symbol cache (see MachO_File::set_symbol_cache) is also used for the
+	// libraries loaded to hide overlapping methods.
+	MachO_File_ObjC(const char* path, bool perform_reduced_analysis = false, const char* arch = "any", const char* symbol_cache = NULL, CacheMode cache_mode = CM_Use);
+	MachO_File_ObjC(const DataFile& file, const Slice& slice, bool perform_reduced_analysis = false, const char* symbol_cache = NULL, CacheMode cache_mode = CM_Use);
 	~MachO_File_ObjC() throw() {
 		if (m_class_filter != NULL) pcre_free(m_class_filter);
 		if (m_method_filter != NULL) pcre_free(m_method_filter);
@@ -250,14 +281,18 @@ public:
 		for (std::tr1::unordered_map<const char*, MachO_File_ObjC*>::iterator it = ma_loaded_libraries.begin(); it != ma_loaded_libraries.end(); ++ it)
 			delete it->second;
 		delete m_hints_file;
+		delete mp_class_cache;
 	}
 	
 	unsigned total_class_type_count() const throw() { return ma_classes.size(); }
 	unsigned class_count() const throw() { return m_class_count; }
 	unsigned categories_count() const throw() { return m_category_count; }
 	unsigned protocols_count() const throw() { return m_protocol_count; }
+	bool loaded_from_class_cache() const throw() { return mp_class_cache != NULL; }
 	
-	void print_class_type(SortBy sort_by, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_methods_by, bool show_only_exported_classes) const throw();
+	// with a pool of more than 1 thread, the classes are formatted in
+	// parallel and printed in the same order as the serial run.
+	void print_class_type(SortBy sort_by, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_methods_by, bool show_only_exported_classes, ThreadPool* pool = NULL, FILE* f = stdout) const throw();
 	
 	void set_pointers_right_aligned(bool right_aligned = true) throw() { m_record.pointers_right_aligned = right_aligned; }
 	void set_prettify_struct_names(bool prettify_struct_names = true) throw() { m_record.prettify_struct_names = prettify_struct_names; }
@@ -268,6 +303,9 @@ public:
 	void set_hide_cats_and_dogs(bool hide_cats, bool hide_dogs) throw() { m_hide_cats = hide_cats; m_hide_dogs = hide_dogs; }
 	void set_dont_typedef(bool dont_typedef) throw() { m_dont_typedef = dont_typedef; }
 	void set_ida_pro_mode(bool ida_pro_mode) throw() { m_ida_pro_mode = ida_pro_mode; }
+	// load the libraries for hide_overlapping_methods() from a store shared
+	// with other files, instead of loading them for this file only.
+	void set_shared_libraries(LoadedLibraries* libraries) throw() { mp_shared_libraries = libraries; }
 	
 	void set_hints_file(const char* filename);
 	void write_hints_file(const char* filename) const;
@@ -278,9 +316,13 @@ public:
 	}
 	void hide_overlapping_methods(bool hide_super, bool hide_proto, const char* sysroot) throw();
 	
-	void print_struct_declaration(SortBy sort_by) const throw();
+	void print_struct_declaration(SortBy sort_by, FILE* f = stdout) const throw();
 	
-	void write_header_files(const char* filename, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_by, bool show_only_exported_classes) const throw();
+	// the headers are written into directory, or the current directory if it
+	// is NULL. Headers whose content did not change are not rewritten. The
+	// number of headers of each OutputSink::FileStatus is added to
+	// status_counts.
+	void write_header_files(const char* filename, const char* directory, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_by, bool show_only_exported_classes, ThreadPool* pool, unsigned status_counts[3]) const throw();
 	
 //-------------------------------------------------------------------------------------------------------------------------------------------
 	
@@ -0,0 +1,337 @@
+/*
+
+MachO_File_ObjC_cache.cpp ... Persistent cache of the reduced class info of a library.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MachO_File_ObjC.h"
+#include "cache_file.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+// The libraries loaded to hide inherited methods (-h super) only need the
+// reduced class info (see retrieve_reduced_class_info()). It is kept in the
+// symbol cache directory, one file per slice, keyed like the symbol cache:
+//
+//   ClassCacheHeader
+//   CachedClass      classes[class_count]
+//   CachedProperty   properties[property_count]
+//   CachedMethod     methods[method_count]
+//   char             strings[strings_size]		(NUL-terminated, deduplicated)
+//
+// The properties and methods of each class follow those of the previous
+// class, in the order of ClassType::properties and ClassType::methods. The
+// encodings are stored as found in the binary, and loading parses them in
+// the same order as the analysis does, so the type record is the same.
+
+static const char ClassCacheMagic[8] = {'P', 'e', 'a', 'c', 'e', 'O', 'C', '\0'};
+static const unsigned ClassCacheVersion = 1;
+static const unsigned NoInternalSuperclass = ~0u;
+
+enum ClassCacheTable {
+	CCT_Classes,
+	CCT_Properties,
+	CCT_Methods,
+	CCT_Strings,
+	CCT_Count
+};
+
+struct ClassCacheHeader {
+	char magic[8];
+	unsigned version;
+	unsigned header_size;
+	unsigned char key[16];
+	int cputype, cpusubtype;
+	unsigned counts[CCT_Count];		// the count of CCT_Strings is the size of the pool in bytes.
+	unsigned offsets[CCT_Count];
+};
+
+struct CachedClass {
+	unsigned name, vm_address, attributes;
+	unsigned superclass;	// index into the classes, or NoInternalSuperclass.
+	unsigned superclass_name, superclass_library;	// for an external superclass.
+	unsigned property_count, method_count;
+};
+
+struct CachedProperty {
+	unsigned name, attributes;
+};
+
+struct CachedMethod {
+	unsigned raw_name, types;
+	unsigned type_count;	// used when the types are missing.
+	unsigned vm_address;
+	unsigned is_class_method;
+};
+
+static const size_t ClassCacheRecordSizes[CCT_Count] = {
+	sizeof(CachedClass),
+	sizeof(CachedProperty),
+	sizeof(CachedMethod),
+	1
+};
+
+#pragma mark -
+#pragma mark Loading
+
+bool MachO_File_ObjC::load_class_cache() {
+	string path = cache_file_path(".classcache");
+	if (access(path.c_str(), R_OK) != 0)
+		return false;
+
+	DataFile* cache;
+	try {
+		cache = new DataFile(path.c_str());
+	} catch (const TRException&) {
+		return false;
+	}
+
+	const ClassCacheHeader* p_cache_header = cache->peek_data_at<ClassCacheHeader>(0);
+	const mach_header* p_header = this->peek_data_at<mach_header>(m_origin);
+	unsigned char key[16];
+	cache_key(key);
+
+	bool ok = p_cache_header != NULL
+		&& memcmp(p_cache_header->magic, ClassCacheMagic, 8) == 0
+		&& p_cache_header->version == ClassCacheVersion
+		&& p_cache_header->header_size == sizeof(ClassCacheHeader)
+		&& memcmp(p_cache_header->key, key, 16) == 0
+		&& p_cache_header->cputype == p_header->cputype
+		&& p_cache_header->cpusubtype == p_header->cpusubtype;
+	for (unsigned t = 0; ok && t < CCT_Count; ++ t) {
+		unsigned long long end = static_cast<unsigned long long>(p_cache_header->offsets[t]) + static_cast<unsigned long long>(p_cache_header->counts[t]) * ClassCacheRecordSizes[t];
+		ok = p_cache_header->offsets[t] % 4 == 0 && end <= static_cast<unsigned long long>(cache->filesize());
+	}
+
+	const char* base = cache->data();
+	const char* pool = NULL;
+	unsigned pool_size = 0;
+	if (ok) {
+		pool = base + p_cache_header->offsets[CCT_Strings];
+		pool_size = p_cache_header->counts[CCT_Strings];
+		ok = pool_size == 0 || pool[pool_size-1] == '\0';
+	}
+
+#define CACHED_TABLE(T, table) reinterpret_cast<const T*>(base + p_cache_header->offsets[table])
+#define CACHED_STRING(offset) ((offset) == NullStringOffset ? NULL : pool + (offset))
+#define CHECK_STRING(offset) if ((offset) != NullStringOffset && (offset) >= pool_size) { ok = false; break; }
+#define CHECK_NONNULL_STRING(offset) if ((offset) >= pool_size) { ok = false; break; }
+
+	// check every reference before anything is added to the type record.
+	const CachedClass* classes = NULL;
+	const CachedProperty* properties = NULL;
+	const CachedMethod* methods = NULL;
+	unsigned class_count = 0;
+	if (ok) {
+		classes = CACHED_TABLE(CachedClass, CCT_Classes);
+		properties = CACHED_TABLE(CachedProperty, CCT_Properties);
+		methods = CACHED_TABLE(CachedMethod, CCT_Methods);
+		class_count = p_cache_header->counts[CCT_Classes];
+
+		unsigned long long property_count = 0, method_count = 0;
+		for (unsigned i = 0; i < class_count; ++ i) {
+			CHECK_NONNULL_STRING(classes[i].name);
+			if (!(classes[i].attributes & RO_ROOT)) {
+				if (classes[i].superclass != NoInternalSuperclass) {
+					if (classes[i].superclass >= class_count) {
+						ok = false;
+						break;
+					}
+				} else {
+					CHECK_NONNULL_STRING(classes[i].superclass_name);
+					CHECK_STRING(classes[i].superclass_library);
+				}
+			}
+			property_count += classes[i].property_count;
+			method_count += classes[i].method_count;
+		}
+		if (ok)
+			ok = property_count == p_cache_header->counts[CCT_Properties] && method_count == p_cache_header->counts[CCT_Methods];
+
+		for (unsigned i = 0; ok && i < p_cache_header->counts[CCT_Properties]; ++ i) {
+			CHECK_NONNULL_STRING(properties[i].name);
+			CHECK_STRING(properties[i].attributes);
+		}
+		for (unsigned i = 0; ok && i < p_cache_header->counts[CCT_Methods]; ++ i) {
+			CHECK_NONNULL_STRING(methods[i].raw_name);
+			CHECK_STRING(methods[i].types);
+		}
+
+		// the class methods of each class come before its instance methods.
+		const CachedMethod* class_methods = methods;
+		for (unsigned i = 0; ok && i < class_count; ++ i) {
+			for (unsigned j = 0; ok && j < classes[i].method_count; ++ j)
+				ok = class_methods[j].is_class_method <= (j == 0 ? 1 : class_methods[j-1].is_class_method);
+			class_methods += classes[i].method_count;
+		}
+	}
+
+	if (!ok) {
+		delete cache;
+		return false;
+	}
+
+	// Phase 1: classes.
+	unsigned class_start_index = ma_classes.size();
+	for (unsigned i = 0; i < class_count; ++ i) {
+		ClassType cls;
+		cls.vm_address = classes[i].vm_address;
+		cls.type = ClassType::CT_Class;
+		cls.attributes = classes[i].attributes;
+		cls.name = CACHED_STRING(classes[i].name);
+		cls.type_index = m_record.add_internal_objc_class(cls.name);
+
+		ma_classes_typeindex_index.insert( pair<ObjCTypeRecord::TypeIndex,unsigned>(cls.type_index, ma_classes.size()) );
+		ma_classes_vm_address_index.insert( pair<unsigned,unsigned>(cls.vm_address, ma_classes.size()) );
+		ma_classes.push_back(cls);
+	}
+	m_class_count = class_count;
+
+	for (unsigned i = 0; i < class_count; ++ i) {
+		// Phase 2: superclass.
+		ClassType& cls = ma_classes[i + class_start_index];
+		const CachedClass& cached_class = classes[i];
+
+		if (cls.attributes & RO_ROOT)
+			cls.superclass_name = NULL;
+		else {
+			if (cached_class.superclass != NoInternalSuperclass) {
+				const ClassType& superclass = ma_classes[cached_class.superclass + class_start_index];
+				cls.superclass_name = superclass.name;
+				cls.superclass_index = superclass.type_index;
+			} else {
+				cls.superclass_name = CACHED_STRING(cached_class.superclass_name);
+				cls.superclass_index = m_record.add_external_objc_class(cls.superclass_name);
+				set_superclass_library(cls.superclass_index, CACHED_STRING(cached_class.superclass_library));
+			}
+			m_record.add_strong_class_link(cls.type_index, cls.superclass_index);
+		}
+
+		// Phase 5 to 7: properties, class methods and instance methods. The
+		// analysis reads each list backwards (see add_properties()).
+		cls.properties.resize(cached_class.property_count);
+		for (unsigned j = cached_class.property_count; j-- > 0; ) {
+			Property& prop = cls.properties[j];
+			prop.name = CACHED_STRING(properties[j].name);
+			prop.attributes = CACHED_STRING(properties[j].attributes);
+			parse_property_attributes(cls, prop, prop.attributes);
+		}
+		properties += cached_class.property_count;
+
+		cls.methods.resize(cached_class.method_count);
+		unsigned class_method_count = 0;
+		while (class_method_count < cached_class.method_count && methods[class_method_count].is_class_method)
+			++ class_method_count;
+		unsigned list_ends[2] = {class_method_count, cached_class.method_count};
+		unsigned list_start = 0;
+		for (unsigned l = 0; l < 2; ++ l) {
+			for (unsigned j = list_ends[l]; j-- > list_start; ) {
+				Method& method = cls.methods[j];
+				method.is_class_method = methods[j].is_class_method != 0;
+				method.optional = false;
+				method.vm_address = methods[j].vm_address;
+				method.raw_name = CACHED_STRING(methods[j].raw_name);
+				method.types_encoding = CACHED_STRING(methods[j].types);
+				if (method.types_encoding != NULL) {
+					m_record.parse_signature(method.types_encoding, method.types);
+					for (vector<ObjCTypeRecord::TypeIndex>::const_iterator cit = method.types.begin(); cit != method.types.end(); ++ cit)
+						m_record.add_strong_link(cls.type_index, *cit);
+				} else
+					method.types = vector<ObjCTypeRecord::TypeIndex>(methods[j].type_count, m_record.unknown_type());
+			}
+			list_start = list_ends[l];
+		}
+		methods += cached_class.method_count;
+	}
+
+#undef CHECK_NONNULL_STRING
+#undef CHECK_STRING
+#undef CACHED_STRING
+#undef CACHED_TABLE
+
+	mp_class_cache = cache;
+	return true;
+}
+
+#pragma mark -
+#pragma mark Saving
+
+template<typename T>
+static void append_table(string& out, ClassCacheHeader& header, ClassCacheTable table, const vector<T>& records) {
+	append_cache_table(out, records, header.offsets[table], header.counts[table]);
+}
+
+void MachO_File_ObjC::save_class_cache() const {
+	CacheStringPool strings;
+	vector<CachedClass> classes;
+	vector<CachedProperty> properties;
+	vector<CachedMethod> methods;
+	classes.reserve(ma_classes.size());
+
+	for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit) {
+		CachedClass cached_class = {strings.offset_of(cit->name), cit->vm_address, cit->attributes, NoInternalSuperclass, NullStringOffset, NullStringOffset, static_cast<unsigned>(cit->properties.size()), static_cast<unsigned>(cit->methods.size())};
+		if (!(cit->attributes & RO_ROOT)) {
+			// an internal superclass shares the name with its class.
+			tr1::unordered_map<ObjCTypeRecord::TypeIndex, unsigned>::const_iterator sit = ma_classes_typeindex_index.find(cit->superclass_index);
+			if (sit != ma_classes_typeindex_index.end() && ma_classes[sit->second].name == cit->superclass_name)
+				cached_class.superclass = sit->second;
+			else {
+				cached_class.superclass_name = strings.offset_of(cit->superclass_name);
+				tr1::unordered_map<ObjCTypeRecord::TypeIndex, const char*>::const_iterator lit = ma_lib_path.find(cit->superclass_index);
+				if (lit != ma_lib_path.end())
+					cached_class.superclass_library = strings.offset_of(lit->second);
+			}
+		}
+		classes.push_back(cached_class);
+
+		for (vector<Property>::const_iterator pit = cit->properties.begin(); pit != cit->properties.end(); ++ pit) {
+			CachedProperty cached_property = {strings.offset_of(pit->name.c_str()), strings.offset_of(pit->attributes)};
+			properties.push_back(cached_property);
+		}
+		for (vector<Method>::const_iterator mit = cit->methods.begin(); mit != cit->methods.end(); ++ mit) {
+			CachedMethod cached_method = {strings.offset_of(mit->raw_name), strings.offset_of(mit->types_encoding), static_cast<unsigned>(mit->types.size()), mit->vm_address, mit->is_class_method ? 1u : 0u};
+			methods.push_back(cached_method);
+		}
+	}
+
+	const mach_header* p_header = this->peek_data_at<mach_header>(m_origin);
+	ClassCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ClassCacheMagic, 8);
+	header.version = ClassCacheVersion;
+	header.header_size = sizeof(ClassCacheHeader);
+	cache_key(header.key);
+	header.cputype = p_header->cputype;
+	header.cpusubtype = p_header->cpusubtype;
+
+	string out (sizeof(ClassCacheHeader), '\0');
+	append_table(out, header, CCT_Classes, classes);
+	append_table(out, header, CCT_Properties, properties);
+	append_table(out, header, CCT_Methods, methods);
+	header.offsets[CCT_Strings] = static_cast<unsigned>(out.size());
+	header.counts[CCT_Strings] = static_cast<unsigned>(strings.pool.size());
+	out.append(strings.pool);
+	memcpy(&out[0], &header, sizeof(header));
+
+	string path = cache_file_path(".classcache");
+	if (!write_cache_file(path, out))
+		fprintf(stderr, "Warning: Cannot write the class cache \"%s\".\n", path.c_str());
+}
@@ -29,6 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "combine_dependencies.h"
 #include "or.h"
 #include "snprintf.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
@@ -41,6 +42,16 @@ static void print_banner (FILE* f, const char* selfpath) {
 			" */\n\n", selfpath);
 }
 
+static void print_banner (OutputSink& out, const char* selfpath) {
+	out.append("/**\n"
+			   " * This header is generated by class-dump-z 0.2b.\n"
+			   " *\n"
+			   " * Source: ");
+	out.append(selfpath != NULL ? selfpath : "(null)");
+	out.append("\n"
+			   " */\n\n");
+}
+
 void MachO_File_ObjC::set_class_filter(const char* regexp) {
 	if (m_class_filter != NULL) pcre_free(m_class_filter);
 	if (m_class_filter_extra != NULL) pcre_free(m_class_filter_extra);
@@ -115,75 +126,78 @@ struct Property_AlphabeticSorter {
 	bool operator() (unsigned a, unsigned b) { return v[a].name < v[b].name; }
 };
 
-string MachO_File_ObjC::Property::format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments) const throw() {
+bool MachO_File_ObjC::Property::is_printed(const MachO_File_ObjC& self, int print_comments) const throw() {
 	if (hidden != PS_None && print_comments == 0)
-		return "";
+		return false;
 	
 	if (self.m_method_filter != NULL)
 		if (0 != pcre_exec(self.m_method_filter, self.m_method_filter_extra, name.c_str(), name.size(), 0, 0, NULL, 0))
-			return "";
+			return false;
 	
-	string res;
+	return true;
+}
+
+void MachO_File_ObjC::Property::format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments) const throw() {
 	switch (hidden) {
-		case PS_AdoptingProtocol: res = "// in a protocol: "; break;
-		case PS_Inherited: res = "// inherited: "; break;
+		case PS_AdoptingProtocol: out.append("// in a protocol: "); break;
+		case PS_Inherited: out.append("// inherited: "); break;
 		default:
 			break;
 	}
 	
-	res += "@property(";
+	out.append("@property(");
 	if (readonly)
-		res += "readonly, ";
+		out.append("readonly, ");
 	if (copy)
-		res += "copy";
+		out.append("copy");
 	else if (retain)
-		res += "retain";
+		out.append("retain");
 	else
-		res += "assign";
+		out.append("assign");
 	if (nonatomic)
-		res += ", nonatomic";
+		out.append(", nonatomic");
 	if (has_getter) {
-		res += ", getter=";
-		res += getter;
+		out.append(", getter=");
+		out.append(getter);
 	}
 	if (has_setter) {
-		res += ", setter=";
-		res += setter;
+		out.append(", setter=");
+		out.append(setter);
 	}
-	res += ") ";
+	out.append(") ");
 	if (gc_strength == GC_Strong)
-		res += "__strong ";
+		out.append("__strong ");
 	else if (gc_strength == GC_Weak)
-		res += "__weak ";
-	res += record.format(type, name, 0, false, self.m_dont_typedef);
-	res.push_back(';');
+		out.append("__weak ");
+	record.format(out, type, name, 0, false, self.m_dont_typedef);
+	out.push_back(';');
 	
 	bool printed_double_slash = false;
 	if (print_method_addresses) {
 		if (getter_vm_address != 0 || setter_vm_address != 0) {
 			printed_double_slash = true;
-			res += "\t// ";
-			if (getter_vm_address != 0) res += numeric_format("G=0x%x; ", getter_vm_address);
-			if (setter_vm_address != 0) res += numeric_format("S=0x%x; ", setter_vm_address);
+			out.append("\t// ");
+			if (getter_vm_address != 0) out.append_format("G=0x%x; ", getter_vm_address);
+			if (setter_vm_address != 0) out.append_format("S=0x%x; ", setter_vm_address);
 		}
 	}
 	if (print_comments >= 2) {
 		if (impl_method != IM_None) {
 			if (!printed_double_slash)
-				res += "\t// ";
+				out.append("\t// ");
 			switch (impl_method) {
 				case IM_Synthesized:
-					res += "@synthesize";
+					out.append("@synthesize");
 					if (name != synthesized_to) {
-						res.push_back('=');
-						res += synthesized_to;
+						out.push_back('=');
+						out.append(synthesized_to);
 					}
 					break;
 				case IM_Dynamic:
-					res += "@dynamic";
+					out.append("@dynamic");
 					break;
 				case IM_Converted:
-					res += "converted property";
+					out.append("converted property");
 					break;
 				default:
 					break;
@@ -191,12 +205,10 @@ string MachO_File_ObjC::Property::format(const ObjCTypeRecord& record, const Mac
 		}
 	}
 	
-	res.push_back('\n');
-	
-	return res;
+	out.push_back('\n');
 }
 
-std::string MachO_File_ObjC::format_type_with_hints(const ObjCTypeRecord& record, const std::string& reconstructed_raw_name, const ReducedMethod& method, int index) const {
+void MachO_File_ObjC::format_type_with_hints(OutputSink& out, const ObjCTypeRecord& record, const std::string& reconstructed_raw_name, const ReducedMethod& method, int index) const {
 	if (m_hints_file != NULL) {
 		TSVFile::RowID row = m_hints_file->find_row_for_table(m_hints_method_table, reconstructed_raw_name);
 		if (row != TSVFile::invalid_row) {
@@ -205,28 +217,32 @@ std::string MachO_File_ObjC::format_type_with_hints(const ObjCTypeRecord& record
 				++ index;
 			else
 				-- index;
-			return row_content[index];
+			out.append(row_content[index]);
+			return;
 		}
 	}
-	return record.format(method.types[index], "", 0, false, m_dont_typedef);
+	record.format(out, method.types[index], "", 0, false, m_dont_typedef);
 }
 
-string MachO_File_ObjC::Method::format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, const ClassType& cls) const throw() {
+bool MachO_File_ObjC::Method::is_printed(const MachO_File_ObjC& self, int print_comments) const throw() {
 	if (propertize_status != PS_None && (print_comments == 0 || (print_comments == 1 && propertize_status != PS_AdoptingProtocol && propertize_status != PS_Inherited)))
-		return "";
+		return false;
 	
 	if (self.m_method_filter != NULL)
 		if (0 != pcre_exec(self.m_method_filter, self.m_method_filter_extra, raw_name, strlen(raw_name), 0, 0, NULL, 0))
-			return "";
+			return false;
 	
-	string res;
+	return true;
+}
+
+void MachO_File_ObjC::Method::format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, const ClassType& cls) const throw() {
 	switch (propertize_status) {
-		case PS_DeclaredGetter: res = "// declared property getter: "; break;
-		case PS_DeclaredSetter: res = "// declared property setter: "; break;
-		case PS_ConvertedGetter: res = "// converted property getter: "; break;
-		case PS_ConvertedSetter: res = "// converted property setter: "; break;
-		case PS_AdoptingProtocol: res = "// in a protocol: "; break;
-		case PS_Inherited: res = "// inherited: "; break;
+		case PS_DeclaredGetter: out.append("// declared property getter: "); break;
+		case PS_DeclaredSetter: out.append("// declared property setter: "); break;
+		case PS_ConvertedGetter: out.append("// converted property getter: "); break;
+		case PS_ConvertedSetter: out.append("// converted property setter: "); break;
+		case PS_AdoptingProtocol: out.append("// in a protocol: "); break;
+		case PS_Inherited: out.append("// inherited: "); break;
 		default:
 			break;
 	}
@@ -234,91 +250,86 @@ string MachO_File_ObjC::Method::format(const ObjCTypeRecord& record, const MachO
 	string rrname = MachO_File_ObjC::reconstruct_raw_name(cls, *this);
 	
 	if (is_class_method)
-		res.push_back('+');
+		out.push_back('+');
 	else
-		res.push_back('-');
+		out.push_back('-');
 	if (self.m_has_whitespace)
-		res.push_back(' ');
-	res.push_back('(');
+		out.push_back(' ');
+	out.push_back('(');
 	
-	res += self.format_type_with_hints(record, rrname, *this, 0);
-	res.push_back(')');
+	self.format_type_with_hints(out, record, rrname, *this, 0);
+	out.push_back(')');
 	
 	if (components.size() == 3) {
-		res += raw_name;
-		if (res[res.size()-1] == ']')
-			res.erase(res.size()-1);
+		out.append(raw_name);
+		if (out[out.size()-1] == ']')
+			out.truncate(out.size()-1);
 	} else {
 		for (unsigned i = 3; i < components.size(); ++ i) {
 			if (i != 3)
-				res.push_back(' ');
-			res += components[i];
-			res += ":(";
-			res += self.format_type_with_hints(record, rrname, *this, i);
-			res.push_back(')');
-			res += argname[i];
+				out.push_back(' ');
+			out.append(components[i]);
+			out.append(":(");
+			self.format_type_with_hints(out, record, rrname, *this, i);
+			out.push_back(')');
+			out.append(argname[i]);
 		}
 	}
-	res.push_back(';');
+	out.push_back(';');
 	
 	if (print_method_addresses && vm_address != 0)
-		res += numeric_format("\t// 0x%x", vm_address);
+		out.append_format("\t// 0x%x", vm_address);
 	
-	res.push_back('\n');
-	
-	return res;
+	out.push_back('\n');
 }
 
-string MachO_File_ObjC::ClassType::format(const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, bool print_ivar_offsets, MachO_File_ObjC::SortBy sort_by, bool show_only_exported_classes) const throw() {
+void MachO_File_ObjC::ClassType::format(OutputSink& out, const ObjCTypeRecord& record, const MachO_File_ObjC& self, bool print_method_addresses, int print_comments, bool print_ivar_offsets, MachO_File_ObjC::SortBy sort_by, bool show_only_exported_classes) const throw() {
 	if ((self.m_hide_cats && type == CT_Category) || (self.m_hide_dogs && type == CT_Protocol))
-		return "";
+		return;
 	
 	if (self.name_killable(name, strlen(name), type != CT_Category)) {
 		if (type != CT_Category || self.name_killable(superclass_name, strlen(superclass_name), false))
-			return "";
+			return;
 	}
 	
 	
 	bool all_methods_filtered = true;
 	
-	string res;
+	size_t start = out.size();
 	
 	if (self.m_ida_pro_mode) {
-		res = "struct ";
-		res += name;
-		res += " {\n";
+		out.append("struct ");
+		out.append(name);
+		out.append(" {\n");
 		if (superclass_name != NULL) {
 			if (self.ma_classes_typeindex_index.find(superclass_index) == self.ma_classes_typeindex_index.end()) {
-				res += numeric_format("\tuint8_t $super[%u];\n", superclass_size & ~(sizeof(void*)-1));
+				out.append_format("\tuint8_t $super[%u];\n", static_cast<unsigned>(superclass_size & ~(sizeof(void*)-1)));
 			} else {
-				res += "\tstruct ";
-				res += superclass_name;
-				res += " $super;\n";
+				out.append("\tstruct ");
+				out.append(superclass_name);
+				out.append(" $super;\n");
 			}
 		}
 		for (vector<Ivar>::const_iterator cit = ivars.begin(); cit != ivars.end(); ++ cit) {
-			res += record.format(cit->type, cit->name, 1, false, self.m_dont_typedef, true);
-			res.push_back(';');
-			if (print_ivar_offsets) {
-				char offset_string[32];
-				snprintf(offset_string, 32, "\t// %u = 0x%x", cit->offset, cit->offset);
-				res += offset_string;
-			}
-			res.push_back('\n');			
+			record.format(out, cit->type, cit->name, 1, false, self.m_dont_typedef, true);
+			out.push_back(';');
+			if (print_ivar_offsets)
+				out.append_format("\t// %u = 0x%x", cit->offset, cit->offset);
+			out.push_back('\n');			
 		}
-		res += "};\n\n";
-		return res;
+		out.append("};\n\n");
+		return;
 	}
 	
 	if (attributes & RO_HIDDEN) {
 		if (show_only_exported_classes)
-			return "";
+			return;
 		if (attributes & RO_EXCEPTION)
-			res += "__attribute__((visibility(\"hidden\"),objc_exception))\n";
+			out.append("__attribute__((visibility(\"hidden\"),objc_exception))\n");
 		else
-			res += "__attribute__((visibility(\"hidden\")))\n";
+			out.append("__attribute__((visibility(\"hidden\")))\n");
 	} else if (attributes & RO_EXCEPTION) {
-		res += "__attribute__((objc_exception))\n";
+		out.append("__attribute__((objc_exception))\n");
 	}
 	
 	vector<unsigned> property_index_remap (properties.size());
@@ -339,104 +350,99 @@ string MachO_File_ObjC::ClassType::format(const ObjCTypeRecord& record, const Ma
 	
 	switch (type) {
 		case CT_Class:
-			res += "@interface ";
-			res += name;
+			out.append("@interface ");
+			out.append(name);
 			if (superclass_name != NULL) {
-				res += " : ";
-				res += superclass_name;
+				out.append(" : ");
+				out.append(superclass_name);
 			}
 			break;
 			
 		case CT_Protocol:
-			res += "@protocol ";
-			res += name;
+			out.append("@protocol ");
+			out.append(name);
 			break;
 			
 		case CT_Category:
-			res += "@interface ";
-			res += superclass_name;
-			res += " (";
-			res += name;
-			res.push_back(')');
+			out.append("@interface ");
+			out.append(superclass_name);
+			out.append(" (");
+			out.append(name);
+			out.push_back(')');
 			break;
 			
 		default:
-			res += numeric_format("@wtf_type%u ", type);
+			out.append_format("@wtf_type%u ", static_cast<unsigned>(type));
 			break;
 	}
 	
 	if (adopted_protocols.size() > 0) {
-		res += " <";
+		out.append(" <");
 		bool is_first = true;
 		for (vector<unsigned>::const_iterator cit = adopted_protocols.begin(); cit != adopted_protocols.end(); ++ cit) {
 			if (is_first)
 				is_first = false;
 			else
-				res += ", ";
-			res += self.ma_classes[*cit].name;
+				out.append(", ");
+			out.append(self.ma_classes[*cit].name);
 		}
 		
-		res.push_back('>');
+		out.push_back('>');
 	}
 	
 	if (type == CT_Class && (self.m_method_filter == NULL || self.m_ida_pro_mode)) {
-		res += " {\n";
+		out.append(" {\n");
 		bool is_private = false;
 		for (vector<Ivar>::const_iterator cit = ivars.begin(); cit != ivars.end(); ++ cit) {
 			if (is_private != cit->is_private) {
 				if (cit->is_private)
-					res += "@private\n";
+					out.append("@private\n");
 				else
-					res += "@protected\n";
+					out.append("@protected\n");
 				is_private = cit->is_private;
 			}
-			res += record.format(cit->type, cit->name, 1, false, self.m_dont_typedef);
-			res.push_back(';');
-			if (print_ivar_offsets) {
-				char offset_string[32];
-				snprintf(offset_string, 32, "\t// %u = 0x%x", cit->offset, cit->offset);
-				res += offset_string;
-			}
-			res.push_back('\n');
+			record.format(out, cit->type, cit->name, 1, false, self.m_dont_typedef);
+			out.push_back(';');
+			if (print_ivar_offsets)
+				out.append_format("\t// %u = 0x%x", cit->offset, cit->offset);
+			out.push_back('\n');
 		}
-		res.push_back('}');
+		out.push_back('}');
 	}
 	
-	res.push_back('\n');
+	out.push_back('\n');
 	
 	bool is_optional = false;
 	for (vector<unsigned>::const_iterator cit = property_index_remap.begin(); cit != property_index_remap.end(); ++ cit) {
 		const Property& property = properties[*cit];
-		string formatted_property = property.format(record, self, print_method_addresses, print_comments);
-		if (!formatted_property.empty()) {
+		if (property.is_printed(self, print_comments)) {
 			if (property.optional != is_optional) {
 				is_optional = property.optional;
-				res += is_optional ? "@optional\n" : "@required\n";
+				out.append(is_optional ? "@optional\n" : "@required\n");
 			}
 			all_methods_filtered = false;
-			res += formatted_property;
+			property.format(out, record, self, print_method_addresses, print_comments);
 		}
 	}
 	
 	for (vector<unsigned>::const_iterator cit = method_index_remap.begin(); cit != method_index_remap.end(); ++ cit) {
 		const Method& method = methods[*cit];
-		string formatted_method = method.format(record, self, print_method_addresses, print_comments, *this);
-		if (!formatted_method.empty()) {
+		if (method.is_printed(self, print_comments)) {
 			if (method.optional != is_optional) {
 				is_optional = method.optional;
-				res += is_optional ? "@optional\n" : "@required\n";
+				out.append(is_optional ? "@optional\n" : "@required\n");
 			}
 			all_methods_filtered = false;
-			res += formatted_method;
+			method.format(out, record, self, print_method_addresses, *this);
 		}
 	}
 	
-	if (all_methods_filtered && self.m_method_filter != NULL)
-		return "";
-	
-	res += "@end\n\n";
+	if (all_methods_filtered && self.m_method_filter != NULL) {
+		out.truncate(start);
+		return;
+	}
 	
-	return res;
+	out.append("@end\n\n");
 }
 
 #pragma mark -
@@ -470,48 +476,121 @@ bool mfoc_AlphabeticSorter(const MachO_File_ObjC::ClassType* a, const MachO_File
 		return false;
 }
 
-void MachO_File_ObjC::print_class_type(SortBy sort_by, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_methods_by, bool show_only_exported_classes) const throw() {	
+struct MachO_File_ObjC::ClassFormatJob {
+	const MachO_File_ObjC* self;
+	const ClassType* const* classes;	// the current batch.
+	OutputSink* outputs;	// one per class in the batch.
+	bool print_method_addresses;
+	int print_comments;
+	bool print_ivar_offsets;
+	SortBy sort_methods_by;
+	bool show_only_exported_classes;
+};
+
+void MachO_File_ObjC::format_class_job(unsigned index, void* context) throw() {
+	const ClassFormatJob& job = *static_cast<const ClassFormatJob*>(context);
+	job.outputs[index].clear();
+	job.classes[index]->format(job.outputs[index], job.self->m_record, *job.self, job.print_method_addresses, job.print_comments, job.print_ivar_offsets, job.sort_methods_by, job.show_only_exported_classes);
+}
+
+void MachO_File_ObjC::print_class_type(SortBy sort_by, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_methods_by, bool show_only_exported_classes, ThreadPool* pool, FILE* f) const throw() {	
+	// the classes in printing order. NULL stands for a type index without a
+	// class, which is printed as "Not found".
+	vector<const ClassType*> remap;
+	vector<ObjCTypeRecord::TypeIndex> not_found;
+	remap.reserve(ma_classes.size());
+	for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit)
+		remap.push_back(&*cit);
+	
 	switch (sort_by) {
 		default:
-			for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit)
-				printf("%s", cit->format(m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes).c_str());
 			break;
-		case SB_Alphabetic: {
-			vector<const ClassType*> remap;
-			remap.reserve(ma_classes.size());
-			for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit)
-				remap.push_back(&*cit);
+		case SB_Alphabetic:
 			sort(remap.begin(), remap.end(), mfoc_AlphabeticSorter);
-			
-			for (vector<const ClassType*>::const_iterator cit = remap.begin(); cit != remap.end(); ++ cit)
-				printf("%s", (*cit)->format(m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes).c_str());
 			break;
-		}
 		case SB_Inherit: {
-			vector<ObjCTypeRecord::TypeIndex> remap;
-			remap.reserve(ma_classes.size());
+			// the lazily computed links are not thread-safe, so sort before
+			// any formatting starts.
+			vector<ObjCTypeRecord::TypeIndex> type_indices;
+			type_indices.reserve(ma_classes.size());
 			for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit)
-				remap.push_back(cit->type_index);
+				type_indices.push_back(cit->type_index);
 			
-			m_record.sort_by_strong_links(remap.begin(), remap.begin() + m_protocol_count);
-			m_record.sort_by_strong_links(remap.begin() + m_protocol_count, remap.begin() + m_protocol_count + m_class_count);
-
-			for (vector<ObjCTypeRecord::TypeIndex>::const_iterator cit = remap.begin(); cit != remap.end(); ++ cit) {
+			m_record.sort_by_strong_links(type_indices.begin(), type_indices.begin() + m_protocol_count);
+			m_record.sort_by_strong_links(type_indices.begin() + m_protocol_count, type_indices.begin() + m_protocol_count + m_class_count);
+			
+			remap.clear();
+			for (vector<ObjCTypeRecord::TypeIndex>::const_iterator cit = type_indices.begin(); cit != type_indices.end(); ++ cit) {
 				tr1::unordered_map<ObjCTypeRecord::TypeIndex, unsigned>::const_iterator iit = ma_classes_typeindex_index.find(*cit);
 				if (iit != ma_classes_typeindex_index.end())
-					printf("%s", ma_classes[iit->second].format(m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes).c_str());
+					remap.push_back(&ma_classes[iit->second]);
 				else {
-					printf("Not found %d\n",*cit);
+					remap.push_back(NULL);
+					not_found.push_back(*cit);
 				}
-
 			}
 			break;
 		}
 	}
+	
+	OutputSink out (f);
+	vector<ObjCTypeRecord::TypeIndex>::const_iterator nit = not_found.begin();
+	
+	if (pool == NULL || pool->thread_count() <= 1) {
+		for (vector<const ClassType*>::const_iterator cit = remap.begin(); cit != remap.end(); ++ cit) {
+			if (*cit != NULL)
+				(*cit)->format(out, m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes);
+			else
+				out.append_format("Not found %d\n", *(nit++));
+			out.flush_if_full();
+		}
+		return;
+	}
+	
+	// Format a batch of classes into their own buffers, then print the buffers
+	// in order. The batches are large enough to keep every thread busy, and
+	// small enough that the output does not pile up in memory.
+	unsigned batch_size = 16 * pool->thread_count();
+	OutputSink* outputs = new OutputSink[batch_size];
+	vector<const ClassType*> batch;
+	batch.reserve(batch_size);
+	
+	ClassFormatJob job;
+	job.self = this;
+	job.outputs = outputs;
+	job.print_method_addresses = print_method_addresses;
+	job.print_comments = print_comments;
+	job.print_ivar_offsets = print_ivar_offsets;
+	job.sort_methods_by = sort_methods_by;
+	job.show_only_exported_classes = show_only_exported_classes;
+	
+	vector<const ClassType*>::const_iterator cit = remap.begin();
+	while (cit != remap.end()) {
+		batch.clear();
+		while (cit != remap.end() && *cit != NULL && batch.size() < batch_size)
+			batch.push_back(*(cit++));
+		
+		if (!batch.empty()) {
+			job.classes = &batch[0];
+			pool->parallel_for(static_cast<unsigned>(batch.size()), format_class_job, &job);
+			for (unsigned i = 0; i < batch.size(); ++ i)
+				if (!outputs[i].empty()) {
+					out.append(outputs[i].data(), outputs[i].size());
+					out.flush_if_full();
+				}
+		}
+		
+		while (cit != remap.end() && *cit == NULL) {
+			out.append_format("Not found %d\n", *(nit++));
+			++ cit;
+		}
+	}
+	
+	delete[] outputs;
 }
 
-void MachO_File_ObjC::print_struct_declaration(SortBy sort_by) const throw() {
-	print_banner(stdout, self_path());
+void MachO_File_ObjC::print_struct_declaration(SortBy sort_by, FILE* f) const throw() {
+	print_banner(f, self_path());
 	
 	vector<ObjCTypeRecord::TypeIndex> public_struct_types = m_record.all_public_struct_types();
 	if (sort_by == SB_Alphabetic)
@@ -519,10 +598,14 @@ void MachO_File_ObjC::print_struct_declaration(SortBy sort_by) const throw() {
 	else if (sort_by == SB_Inherit)
 		m_record.sort_by_strong_links(public_struct_types.begin(), public_struct_types.end());
 	
+	OutputSink out (f);
 	for (vector<ObjCTypeRecord::TypeIndex>::const_iterator cit = public_struct_types.begin(); cit != public_struct_types.end(); ++ cit) {
 		const string& name = m_record.name_of_type(*cit);
-		if (!name_killable(name.c_str(), name.size(), true))		
-			printf("%s;\n\n", m_record.format(*cit, "", 0, true, m_dont_typedef, m_ida_pro_mode).c_str());
+		if (!name_killable(name.c_str(), name.size(), true)) {
+			m_record.format(out, *cit, "", 0, true, m_dont_typedef, m_ida_pro_mode);
+			out.append(";\n\n");
+			out.flush_if_full();
+		}
 	}
 }
 
@@ -531,11 +614,84 @@ namespace {
 		bool include_common;
 		string struct_declarations;
 		string declaration;
-		tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength> dependencies;
+		ObjCTypeRecord::DependencyList dependencies;
 	};
+	
+	OutputSink::FileStatus write_header(const OutputSink& out, const string& filename) {
+		OutputSink::FileStatus status = out.write_file(filename.c_str());
+		if (status == OutputSink::FS_Failed)
+			fprintf(stderr, "Warning: Cannot write to '%s'.\n", filename.c_str());
+		return status;
+	}
+}
+
+struct MachO_File_ObjC::HeaderWriteJob {
+	const MachO_File_ObjC* self;
+	const char* self_path;
+	const string* aggr_filename;
+	const string* directory;	// empty, or ending with a slash.
+	vector<const pair<const string, Header>*> headers;
+	vector<OutputSink::FileStatus> statuses;	// one per header.
+};
+
+void MachO_File_ObjC::write_header_job(unsigned index, void* context) throw() {
+	HeaderWriteJob& job = *static_cast<HeaderWriteJob*>(context);
+	const ObjCTypeRecord& record = job.self->m_record;
+	const pair<const string, Header>& header = *job.headers[index];
+	
+	OutputSink out;
+	print_banner(out, job.self_path);
+	
+	bool include_structs = true;
+	vector<ObjCTypeRecord::TypeIndex> weak_dependencies;
+	tr1::unordered_set<string> already_included;
+	// Write imports.
+	for (ObjCTypeRecord::DependencyList::const_iterator dit = header.second.dependencies.begin(); dit != header.second.dependencies.end(); ++ dit) {
+		if (record.is_struct_type(dit->type_index)) {
+			if (include_structs) {
+				include_structs = false;
+				out.append("#import \"");
+				out.append(*job.aggr_filename);
+				out.append("-Structs.h\"\n");
+			}
+		} else if (dit->strength == ObjCTypeRecord::ES_Strong) {
+			if (record.is_external_type(dit->type_index)) {
+				tr1::unordered_map<ObjCTypeRecord::TypeIndex, string>::const_iterator lib_it = job.self->ma_include_paths.find(dit->type_index);
+				if (lib_it != job.self->ma_include_paths.end()) {
+					string lib_inc_path = lib_it->second;
+					if (lib_inc_path[lib_inc_path.size()-1] == '/') {
+						lib_inc_path += record.name_of_type(dit->type_index);
+						lib_inc_path += ".h";
+					}
+					if (already_included.find(lib_inc_path) == already_included.end()) {
+						out.append("#import <");
+						out.append(lib_inc_path);
+						out.append(">\n");
+						already_included.insert(lib_inc_path);
+					}
+				} else {
+					out.append("#import <");
+					out.append(record.name_of_type(dit->type_index));
+					out.append(".h> // Unknown library\n");
+				}
+			} else {
+				out.append("#import \"");
+				out.append(record.name_of_type(dit->type_index));
+				out.append(".h\"\n");
+			}
+		} else if (dit->strength == ObjCTypeRecord::ES_Weak)
+			weak_dependencies.push_back(dit->type_index);
+	}
+	
+	out.push_back('\n');
+	record.format_forward_declaration(out, weak_dependencies);
+	out.push_back('\n');
+	out.append(header.second.declaration);
+	
+	job.statuses[index] = write_header(out, *job.directory + header.first + ".h");
 }
 
-void MachO_File_ObjC::write_header_files(const char* filename, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_by, bool show_only_exported_classes) const throw() {
+void MachO_File_ObjC::write_header_files(const char* filename, const char* directory, bool print_method_addresses, int print_comments, bool print_ivar_offsets, SortBy sort_by, bool show_only_exported_classes, ThreadPool* pool, unsigned status_counts[3]) const throw() {
 	vector<ObjCTypeRecord::TypeIndex> public_struct_types = m_record.all_public_struct_types();
 	tr1::unordered_map<string, Header> headers;
 	
@@ -545,6 +701,9 @@ void MachO_File_ObjC::write_header_files(const char* filename, bool print_method
 	if (*last_component == '/') ++ last_component;
 	const char* dot_position = strrchr(last_component, '.');
 	string aggr_filename = dot_position == NULL ? last_component : string(last_component, dot_position);	
+	string directory_prefix = directory != NULL ? directory : "";
+	if (!directory_prefix.empty() && directory_prefix[directory_prefix.size()-1] != '/')
+		directory_prefix.push_back('/');
 	
 	// Filter out those structs not matching the regexp or having specified prefix.
 	bool need_killer_check = m_class_filter != NULL || !m_kill_prefix.empty();
@@ -558,12 +717,15 @@ void MachO_File_ObjC::write_header_files(const char* filename, bool print_method
 	}
 	
 	// Distribute each class into files. 
+	OutputSink declaration;
 	for (vector<ClassType>::const_iterator cit = ma_classes.begin(); cit != ma_classes.end(); ++ cit) {
 		Header h;
-		h.declaration = cit->format(m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_by, show_only_exported_classes);
+		declaration.clear();
+		cit->format(declaration, m_record, *this, print_method_addresses, print_comments, print_ivar_offsets, sort_by, show_only_exported_classes);
+		h.declaration = declaration.str();
 		// we still need to pay lip service to create an empty file for the filtered types if someone else it going to include us.
 		if (!h.declaration.empty() || m_record.link_count(cit->type_index, true) > 0) {
-			const tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>* dep = m_record.dependencies(cit->type_index);
+			const ObjCTypeRecord::DependencyList* dep = m_record.dependencies(cit->type_index);
 			if (dep != NULL)
 				h.dependencies = *dep;
 			string file_name = cit->type == ClassType::CT_Category ? cit->superclass_name : cit->name;
@@ -581,65 +743,44 @@ void MachO_File_ObjC::write_header_files(const char* filename, bool print_method
 	
 	// Write the aggregation file first.
 	
-	FILE* f_aggr = fopen((aggr_filename + ".h").c_str(), "wt");
-	print_banner(f_aggr, cached_self_path);
-	fprintf(f_aggr, "#import \"%s-Structs.h\"\n", aggr_filename.c_str());
+	OutputSink out;
+	print_banner(out, cached_self_path);
+	out.append("#import \"");
+	out.append(aggr_filename);
+	out.append("-Structs.h\"\n");
 	for (tr1::unordered_map<string, Header>::const_iterator hit = headers.begin(); hit != headers.end(); ++ hit) {
-		fprintf(f_aggr, "#import \"%s.h\"\n", hit->first.c_str());
+		out.append("#import \"");
+		out.append(hit->first);
+		out.append(".h\"\n");
 	}
-	fclose(f_aggr);
+	++ status_counts[write_header(out, directory_prefix + aggr_filename + ".h")];
 	
 	// Print the structs.
-	FILE* f_structs = fopen((aggr_filename + "-Structs.h").c_str(), "wt");
-	print_banner(f_structs, cached_self_path);
-	fprintf(f_structs, "%s\n", m_record.format_structs_with_forward_declarations(public_struct_types).c_str());
-	fclose(f_structs);
+	out.clear();
+	print_banner(out, cached_self_path);
+	m_record.format_structs_with_forward_declarations(out, public_struct_types);
+	out.push_back('\n');
+	++ status_counts[write_header(out, directory_prefix + aggr_filename + "-Structs.h")];
 	
 	// Now print to each file.
-	vector<ObjCTypeRecord::TypeIndex> weak_dependencies;
-	tr1::unordered_set<string> already_included;
-
-	for (tr1::unordered_map<string, Header>::const_iterator hit = headers.begin(); hit != headers.end(); ++ hit) {
-		string cur_filename = hit->first;
-		cur_filename += ".h";
-		FILE* f = fopen(cur_filename.c_str(), "wt");
-		print_banner(f, cached_self_path);
-		
-		bool include_structs = true;
-		weak_dependencies.clear();
-		already_included.clear();
-		// Write imports.
-		for (tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>::const_iterator dit = hit->second.dependencies.begin(); dit != hit->second.dependencies.end(); ++ dit) {
-			if (m_record.is_struct_type(dit->first)) {
-				if (include_structs) {
-					include_structs = false;
-					fprintf(f, "#import \"%s-Structs.h\"\n", aggr_filename.c_str());
-				}
-			} else if (dit->second == ObjCTypeRecord::ES_Strong) {
-				if (m_record.is_external_type(dit->first)) {
-					tr1::unordered_map<ObjCTypeRecord::TypeIndex, string>::const_iterator lib_it = ma_include_paths.find(dit->first);
-					if (lib_it != ma_include_paths.end()) {
-						string lib_inc_path = lib_it->second;
-						if (lib_inc_path[lib_inc_path.size()-1] == '/') {
-							lib_inc_path += m_record.name_of_type(dit->first);
-							lib_inc_path += ".h";
-						}
-						if (already_included.find(lib_inc_path) == already_included.end()) {
-							fprintf(f, "#import <%s>\n", lib_inc_path.c_str());
-							already_included.insert(lib_inc_path);
-						}
-					} else
-						fprintf(f, "#import <%s.h> // Unknown library\n", m_record.name_of_type(dit->first).c_str());
-				} else
-					fprintf(f, "#import \"%s.h\"\n", m_record.name_of_type(dit->first).c_str());
-			} else if (dit->second == ObjCTypeRecord::ES_Weak)
-				weak_dependencies.push_back(dit->first);
-		}
-		
-		fprintf(f, "\n%s", m_record.format_forward_declaration(weak_dependencies).c_str());
-		fprintf(f, "\n%s", hit->second.declaration.c_str());
-		fclose(f);
-	}
+	HeaderWriteJob job;
+	job.self = this;
+	job.self_path = cached_self_path;
+	job.aggr_filename = &aggr_filename;
+	job.directory = &directory_prefix;
+	job.headers.reserve(headers.size());
+	for (tr1::unordered_map<string, Header>::const_iterator hit = headers.begin(); hit != headers.end(); ++ hit)
+		job.headers.push_back(&*hit);
+	job.statuses.resize(headers.size());
+	
+	if (pool == NULL)
+		for (unsigned i = 0; i < job.headers.size(); ++ i)
+			write_header_job(i, &job);
+	else
+		pool->parallel_for(static_cast<unsigned>(job.headers.size()), write_header_job, &job);
+	
+	for (vector<OutputSink::FileStatus>::const_iterator sit = job.statuses.begin(); sit != job.statuses.end(); ++ sit)
+		++ status_counts[*sit];
 }
 
 std::string MachO_File_ObjC::reconstruct_raw_name(const ClassType& cls, const ReducedMethod& method) {
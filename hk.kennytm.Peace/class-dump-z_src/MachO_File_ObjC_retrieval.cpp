@@ -29,8 +29,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
-const char* MachO_File_ObjC::get_cstring(const void* vmaddr, int* guess_segment, unsigned symaddr, unsigned symoffset, const char* defsym) const throw() {
-	off_t offset = this->to_file_offset(reinterpret_cast<unsigned>(vmaddr), guess_segment);
+const char* MachO_File_ObjC::get_cstring(const void* vmaddr, int* p_hint, unsigned symaddr, unsigned symoffset, const char* defsym) const throw() {
+	off_t offset = this->to_file_offset(reinterpret_cast<unsigned>(vmaddr), p_hint);
 	if (this->file_offset_encrypted(offset)) {
 		if (symaddr == 0)
 			return defsym;
@@ -44,7 +44,7 @@ const char* MachO_File_ObjC::get_cstring(const void* vmaddr, int* guess_segment,
 		return this->peek_data_at<char>(offset);
 }
 
-#define PEEK_VM_ADDR(data, type, seg) (this->peek_data_at_vm_address<type>(reinterpret_cast<unsigned>(data), &(m_guess_##seg##_segment)))
+#define PEEK_VM_ADDR(data, type, seg) (this->peek_data_at_vm_address<type>(reinterpret_cast<unsigned>(data), &(m_##seg##_lookup_hint)))
 
 void MachO_File_ObjC::adopt_protocols(ClassType& cls, const protocol_list_t* protocols) throw() {
 	unsigned start = cls.adopted_protocols.size();
@@ -64,99 +64,104 @@ void MachO_File_ObjC::add_properties(ClassType& cls, const objc_property_list* p
 	for (unsigned i = 0; i < prop_list->count; ++ i, ++ cur_property) {
 		Property& prop = cls.properties[start + prop_list->count - i - 1];	// Note that the initial declaration order is the reverse of layout order.
 		
-		const char* property_name = this->get_cstring(cur_property->name, &m_guess_text_segment, 0, 0, NULL);
+		const char* property_name = this->get_cstring(cur_property->name, &m_text_lookup_hint, 0, 0, NULL);
 		if (property_name != NULL)
 			prop.name = property_name;
 		else
 			prop.name = numeric_format("XXEncryptedProperty_%04x", reinterpret_cast<unsigned>(cur_property->name));
 				
-		const char* property_type = this->get_cstring(cur_property->attributes, &m_guess_text_segment, 0, 0, NULL);
-		if (property_type == NULL)
-			prop.type = m_record.unknown_type();
-		else {
-			while (*property_type != '\0') {
-				switch (*property_type) {
-					case 'T': {
-						const char* type_start = ++property_type;
-						while (*property_type != ',' && *property_type != '\0')
-							property_type = skip_balanced_substring(property_type);
-						prop.type = m_record.parse(string(type_start, property_type), false);
-						m_record.add_strong_link(cls.type_index, prop.type);
-						break;
-					}
-						
-					case 'G': {
-						prop.has_getter = true;
-						const char* getter_start = ++property_type;
-						property_type += strcspn(property_type, ",");
-						prop.getter = string(getter_start, property_type);
-						break;
-					}
-						
-					case 'S': {
-						prop.has_setter = true;
-						const char* setter_start = ++property_type;
-						property_type += strcspn(property_type, ",");
-						prop.setter = string(setter_start, property_type);
-						break;
-					}
-						
-					case 'C':
-						prop.copy = true;
-						++ property_type;
-						break;
-						
-					case '&':
-						prop.retain = true;
-						++ property_type;
-						break;
-						
-					case 'R':
-						prop.readonly = true;
-						++ property_type;
-						break;
-						
-					case 'N':
-						prop.nonatomic = true;
-						++ property_type;
-						break;
-						
-					case 'D':
-						prop.impl_method = Property::IM_Dynamic;
-						++ property_type;
-						break;
-						
-					case 'V': {
-						prop.impl_method = Property::IM_Synthesized;
-						const char* synth_start = ++property_type;
-						property_type += strcspn(property_type, ",");
-						prop.synthesized_to = string(synth_start, property_type);
-						break;
-					}
-						
-					case 'P':
-						prop.gc_strength = Property::GC_Strong;
-						++ property_type;
-						break;
-						
-					case 'W':
-						prop.gc_strength = Property::GC_Weak;
-						++ property_type;
-						break;
-						
-					default:
-						++ property_type;
-						break;
+		prop.attributes = this->get_cstring(cur_property->attributes, &m_text_lookup_hint, 0, 0, NULL);
+		parse_property_attributes(cls, prop, prop.attributes);
+	}
+}
+
+// the attribute string of a declared property, e.g. T@"NSString",C,N,V_name.
+void MachO_File_ObjC::parse_property_attributes(ClassType& cls, Property& prop, const char* property_type) throw() {
+	if (property_type == NULL)
+		prop.type = m_record.unknown_type();
+	else {
+		while (*property_type != '\0') {
+			switch (*property_type) {
+				case 'T': {
+					const char* type_start = ++property_type;
+					while (*property_type != ',' && *property_type != '\0')
+						property_type = skip_balanced_substring(property_type);
+					prop.type = m_record.parse(string(type_start, property_type), false);
+					m_record.add_strong_link(cls.type_index, prop.type);
+					break;
+				}
+					
+				case 'G': {
+					prop.has_getter = true;
+					const char* getter_start = ++property_type;
+					property_type += strcspn(property_type, ",");
+					prop.getter = string(getter_start, property_type);
+					break;
+				}
+					
+				case 'S': {
+					prop.has_setter = true;
+					const char* setter_start = ++property_type;
+					property_type += strcspn(property_type, ",");
+					prop.setter = string(setter_start, property_type);
+					break;
+				}
+					
+				case 'C':
+					prop.copy = true;
+					++ property_type;
+					break;
+					
+				case '&':
+					prop.retain = true;
+					++ property_type;
+					break;
+					
+				case 'R':
+					prop.readonly = true;
+					++ property_type;
+					break;
+					
+				case 'N':
+					prop.nonatomic = true;
+					++ property_type;
+					break;
+					
+				case 'D':
+					prop.impl_method = Property::IM_Dynamic;
+					++ property_type;
+					break;
+					
+				case 'V': {
+					prop.impl_method = Property::IM_Synthesized;
+					const char* synth_start = ++property_type;
+					property_type += strcspn(property_type, ",");
+					prop.synthesized_to = string(synth_start, property_type);
+					break;
 				}
+					
+				case 'P':
+					prop.gc_strength = Property::GC_Strong;
+					++ property_type;
+					break;
+					
+				case 'W':
+					prop.gc_strength = Property::GC_Weak;
+					++ property_type;
+					break;
+					
+				default:
+					++ property_type;
+					break;
 			}
 		}
-		
-		if (!prop.has_getter)
-			prop.getter = prop.name;
-		if (!prop.has_setter) {
-			prop.setter = "set" + prop.name + ":";
-			prop.setter[3] = static_cast<char>(toupper(prop.setter[3]));
-		}
+	}
+	
+	if (!prop.has_getter)
+		prop.getter = prop.name;
+	if (!prop.has_setter) {
+		prop.setter = "set" + prop.name + ":";
+		prop.setter[3] = static_cast<char>(toupper(prop.setter[3]));
 	}
 }
 
@@ -171,10 +176,9 @@ void MachO_File_ObjC::add_methods(ClassType& cls, const method_list_t* method_li
 		method.optional = optional;
 		
 		method.vm_address = reinterpret_cast<unsigned>(cur_method->imp);
-		method.raw_name = this->get_cstring(cur_method->name, &m_guess_text_segment, method.vm_address, 0, NULL);
+		method.raw_name = this->get_cstring(cur_method->name, &m_text_lookup_hint, method.vm_address, 0, NULL);
 		if (method.raw_name == NULL) {
-			ma_string_store.push_back(numeric_format("XXEncryptedMethod_%04x", OR(method.vm_address, reinterpret_cast<unsigned>(cur_method->name))));
-			method.raw_name = ma_string_store.back().c_str();
+			method.raw_name = ma_string_store.intern(numeric_format("XXEncryptedMethod_%04x", OR(method.vm_address, reinterpret_cast<unsigned>(cur_method->name))));
 		} else if (method.raw_name[0] == '-' || method.raw_name[0] == '+')
 			method.raw_name = strchr(method.raw_name, ' ') + 1;
 		
@@ -195,20 +199,12 @@ void MachO_File_ObjC::add_methods(ClassType& cls, const method_list_t* method_li
 		}
 		
 		// split method types into type strings and build strong links.
-		const char* method_type = this->get_cstring(cur_method->types, &m_guess_text_segment, 0, 0, NULL);
+		const char* method_type = this->get_cstring(cur_method->types, &m_text_lookup_hint, 0, 0, NULL);
+		method.types_encoding = method_type;
 		if (method_type != NULL) {
-			string type_string;
-			while (*method_type != '\0') {
-				const char* type_begin = method_type;
-				while (!(*method_type >= '0' && *method_type <= '9'))
-					method_type = skip_balanced_substring(method_type);
-				type_string.assign(type_begin, method_type);
-				ObjCTypeRecord::TypeIndex index = m_record.parse(type_string, false);
-				method.types.push_back(index);
-				m_record.add_strong_link(cls.type_index, index);
-				while (*method_type >= '0' && *method_type <= '9')
-					++ method_type;
-			}
+			m_record.parse_signature(method_type, method.types);
+			for (vector<ObjCTypeRecord::TypeIndex>::const_iterator cit = method.types.begin(); cit != method.types.end(); ++ cit)
+				m_record.add_strong_link(cls.type_index, *cit);
 		} else
 			method.types = vector<ObjCTypeRecord::TypeIndex>(method.components.size(), m_record.unknown_type());
 		
@@ -299,6 +295,13 @@ static inline string make_include_path (const char* lib_path) {
 	}
 }
 
+void MachO_File_ObjC::set_superclass_library(ObjCTypeRecord::TypeIndex superclass_index, const char* lib_path) throw() {
+	if (lib_path != NULL) {
+		ma_include_paths[superclass_index] = make_include_path(lib_path);
+		ma_lib_path[superclass_index] = lib_path;
+	}
+}
+
 const char* MachO_File_ObjC::get_superclass_name(unsigned superclass_addr, unsigned pointer_to_superclass_addr, ObjCTypeRecord::TypeIndex& superclass_index) throw() {
 	if (superclass_addr == 0) {
 		// superclass should be an external class. read from relocation entry.
@@ -311,11 +314,7 @@ const char* MachO_File_ObjC::get_superclass_name(unsigned superclass_addr, unsig
 			ext_name = "XXUnknownSuperclass";
 		superclass_index = m_record.add_external_objc_class(ext_name);
 		
-		const char* lib_path = library_of_relocated_symbol(pointer_to_superclass_addr);
-		if (lib_path != NULL) {
-			ma_include_paths[superclass_index] = make_include_path(lib_path);
-			ma_lib_path[superclass_index] = lib_path;
-		}
+		set_superclass_library(superclass_index, library_of_relocated_symbol(pointer_to_superclass_addr));
 		return ext_name;
 	} else {
 		// superclass should be an internal class. search from vm addresses.
@@ -330,11 +329,7 @@ const char* MachO_File_ObjC::get_superclass_name(unsigned superclass_addr, unsig
 				ext_name = "XXUnknownSuperclass";
 			superclass_index = m_record.add_external_objc_class(ext_name);
 			
-			const char* lib_path = library_of_relocated_symbol(superclass_addr);
-			if (lib_path != NULL) {
-				ma_include_paths[superclass_index] = make_include_path(lib_path);
-				ma_lib_path[superclass_index] = lib_path;
-			}
+			set_superclass_library(superclass_index, library_of_relocated_symbol(superclass_addr));
 			return ext_name;
 		} else {
 			superclass_index = ma_classes[cit->second].type_index;
@@ -362,17 +357,16 @@ void MachO_File_ObjC::retrieve_protocol_info() throw() {
 		ClassType cls;
 		
 		cls.vm_address = this->read_integer();
-		const protocol_t* proto = this->peek_data_at_vm_address<protocol_t>(cls.vm_address, &m_guess_data_segment);
+		const protocol_t* proto = this->peek_data_at_vm_address<protocol_t>(cls.vm_address, &m_data_lookup_hint);
 		
 		if (proto == NULL)
 			continue;
 		
-		cls.name = get_cstring(proto->name, &m_guess_text_segment, cls.vm_address, 0, NULL);
+		cls.name = get_cstring(proto->name, &m_text_lookup_hint, cls.vm_address, 0, NULL);
 		if (cls.name == NULL) {
 			// Protocol's original name is never store in the symbol section.
 			// So we need to synthesize a protocol name.
-			ma_string_store.push_back(numeric_format("XXEncryptedProtocol_%04x", cls.vm_address));
-			cls.name = ma_string_store.back().c_str();
+			cls.name = ma_string_store.intern(numeric_format("XXEncryptedProtocol_%04x", cls.vm_address));
 		}
 		
 		// Make sure the same protocol hasn't been declared.
@@ -442,7 +436,7 @@ void MachO_File_ObjC::retrieve_class_info() throw() {
 		cls.vm_address = this->read_integer();
 		cls.type = ClassType::CT_Class;
 		
-		const class_t* class_ptr = this->peek_data_at_vm_address<class_t>(cls.vm_address, &m_guess_data_segment);
+		const class_t* class_ptr = this->peek_data_at_vm_address<class_t>(cls.vm_address, &m_data_lookup_hint);
 		if (class_ptr == NULL)
 			continue;
 		
@@ -455,10 +449,9 @@ void MachO_File_ObjC::retrieve_class_info() throw() {
 		
 		cls.attributes = class_data_ptr->flags;
 		cls.superclass_size = class_data_ptr->instanceStart;
-		cls.name = this->get_cstring(class_data_ptr->name, &m_guess_text_segment, cls.vm_address, strlen("_OBJC_CLASS_$_"), NULL);
+		cls.name = this->get_cstring(class_data_ptr->name, &m_text_lookup_hint, cls.vm_address, strlen("_OBJC_CLASS_$_"), NULL);
 		if (cls.name == NULL) {
-			ma_string_store.push_back(numeric_format("XXEncryptedClass_%04x", cls.vm_address));
-			cls.name = ma_string_store.back().c_str();
+			cls.name = ma_string_store.intern(numeric_format("XXEncryptedClass_%04x", cls.vm_address));
 		}
 		cls.type_index = m_record.add_internal_objc_class(cls.name);
 		
@@ -502,18 +495,17 @@ void MachO_File_ObjC::retrieve_class_info() throw() {
 			
 				Ivar ivar;
 				
-				ivar.name = get_cstring(cur_ivar->name, &m_guess_text_segment, reinterpret_cast<unsigned>(cur_ivar->offset), 0, NULL);
+				ivar.name = get_cstring(cur_ivar->name, &m_text_lookup_hint, reinterpret_cast<unsigned>(cur_ivar->offset), 0, NULL);
 				ivar.offset = *PEEK_VM_ADDR(cur_ivar->offset, unsigned, text);
 				ivar.is_private = is_symbol(reinterpret_cast<unsigned>(cur_ivar->offset)) && !is_extern_symbol(reinterpret_cast<unsigned>(cur_ivar->offset));
 				if (ivar.name == NULL) {
-					ma_string_store.push_back(numeric_format("XXEncryptedIvar_%02x", ivar.offset));
-					ivar.name = ma_string_store.back().c_str();
+					ivar.name = ma_string_store.intern(numeric_format("XXEncryptedIvar_%02x", ivar.offset));
 				} else {
 					const char* last_dot = strrchr(ivar.name, '.');
 					if (last_dot != NULL)
 						ivar.name = last_dot + 1;
 				}
-				const char* ivar_type = get_cstring(cur_ivar->type, &m_guess_text_segment, 0, 0, NULL);
+				const char* ivar_type = get_cstring(cur_ivar->type, &m_text_lookup_hint, 0, 0, NULL);
 				if (ivar_type != NULL) {
 					ivar.type = m_record.parse(ivar_type, true);
 					m_record.add_strong_link(cls.type_index, ivar.type);
@@ -559,7 +551,7 @@ void MachO_File_ObjC::retrieve_reduced_class_info() throw() {
 		cls.vm_address = this->read_integer();
 		cls.type = ClassType::CT_Class;
 		
-		const class_t* class_ptr = this->peek_data_at_vm_address<class_t>(cls.vm_address, &m_guess_data_segment);
+		const class_t* class_ptr = this->peek_data_at_vm_address<class_t>(cls.vm_address, &m_data_lookup_hint);
 		if (class_ptr == NULL)
 			continue;
 		
@@ -571,10 +563,9 @@ void MachO_File_ObjC::retrieve_reduced_class_info() throw() {
 		all_class_data_ptr.push_back(class_data_ptr);
 		
 		cls.attributes = class_data_ptr->flags;
-		cls.name = this->get_cstring(class_data_ptr->name, &m_guess_text_segment, cls.vm_address, strlen("_OBJC_CLASS_$_"), NULL);
+		cls.name = this->get_cstring(class_data_ptr->name, &m_text_lookup_hint, cls.vm_address, strlen("_OBJC_CLASS_$_"), NULL);
 		if (cls.name == NULL) {
-			ma_string_store.push_back(numeric_format("XXEncryptedClass_%04x", cls.vm_address));
-			cls.name = ma_string_store.back().c_str();
+			cls.name = ma_string_store.intern(numeric_format("XXEncryptedClass_%04x", cls.vm_address));
 		}
 		cls.type_index = m_record.add_internal_objc_class(cls.name);
 		
@@ -628,13 +619,13 @@ void MachO_File_ObjC::retrieve_category_info() throw() {
 			ClassType cls;
 			
 			cls.vm_address = this->read_integer();
-			const category_t* cat = this->peek_data_at_vm_address<category_t>(cls.vm_address, &m_guess_data_segment);
+			const category_t* cat = this->peek_data_at_vm_address<category_t>(cls.vm_address, &m_data_lookup_hint);
 			if (cat == NULL)
 				continue;
 			
 			cls.type = ClassType::CT_Category;
 			cls.attributes = 0;
-			cls.name = this->get_cstring(cat->name, &m_guess_text_segment, 0, 0, NULL);
+			cls.name = this->get_cstring(cat->name, &m_text_lookup_hint, 0, 0, NULL);
 			if (cls.name == NULL) {
 				// the class name is empty! check if we have symbols of this category's method.
 				// if yes, we can still extract the category name as the stuff between ( ... ).
@@ -645,14 +636,12 @@ void MachO_File_ObjC::retrieve_category_info() throw() {
 						if (rep != NULL) {
 							const char* first_open_parenthesis = strchr(rep, '(')+1;
 							const char* first_close_parenthesis = strchr(first_open_parenthesis, ')');
-							ma_string_store.push_back(string(first_open_parenthesis, first_close_parenthesis));
-							cls.name = ma_string_store.back().c_str();
+							cls.name = ma_string_store.intern(first_open_parenthesis, static_cast<size_t>(first_close_parenthesis - first_open_parenthesis));
 							goto found_name;
 						}
 					}
 				}
-				ma_string_store.push_back(numeric_format("XXEncryptedCategory_%04x", cls.vm_address));
-				cls.name = ma_string_store.back().c_str();
+				cls.name = ma_string_store.intern(numeric_format("XXEncryptedCategory_%04x", cls.vm_address));
 			found_name:;
 			}
 			
@@ -0,0 +1,189 @@
+/*
+
+ObjCTypeTokenizer.cpp ... Split Objective-C type encodings without copying them.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ObjCTypeTokenizer.h"
+#include "balanced_substr.h"
+#include <cstring>
+
+using namespace std;
+
+static inline bool is_modifier(char c) throw() {
+	switch (c) {
+		case '^':
+		case 'j':
+		case 'r':
+		case 'R':
+		case 'n':
+		case 'N':
+		case 'o':
+		case 'O':
+		case 'V':
+		case '!':
+			return true;
+		default:
+			return false;
+	}
+}
+
+static inline bool is_end_of_members(char c) throw() { return c == '}' || c == ')' || c == '\0'; }
+static inline bool is_digit(char c) throw() { return c >= '0' && c <= '9'; }
+
+const char* ObjCTypeTokenizer::skip_unit(const char* encoding) throw() {
+	switch (*encoding) {
+		case '\0':
+			return encoding;
+		case '{':
+		case '[':
+		case '(':
+		case '<':
+		case '\'':
+		case '"':
+			return skip_balanced_substring(encoding);
+		default:
+			return encoding+1;
+	}
+}
+
+unsigned ObjCTypeTokenizer::push(TokenKind kind, const char* begin, const char* end) {
+	Token token;
+	token.begin = begin;
+	token.length = static_cast<unsigned>(end - begin);
+	token.next = 0;
+	token.kind = kind;
+	ma_tokens.push_back(token);
+	return static_cast<unsigned>(ma_tokens.size() - 1);
+}
+
+// The children of the type [encoding, end): the pointee of a pointer, the
+// element of an array, or the name and members of a struct.
+const char* ObjCTypeTokenizer::add_type(const char* encoding, unsigned depth) {
+	unsigned index = size() - 1;
+	const char* end = ma_tokens[index].end();
+
+	if (depth > 0 && encoding != end) {
+		if (is_modifier(*encoding)) {
+			if (encoding+1 != end) {
+				push(TK_Type, encoding+1, end);
+				add_type(encoding+1, depth-1);
+			}
+		} else if (*encoding == '[') {
+			const char* element = encoding+1;
+			while (is_digit(*element))
+				++ element;
+			if (element < end-1) {
+				push(TK_Type, element, end-1);
+				add_type(element, depth-1);
+			}
+		} else if (*encoding == '{' || *encoding == '(') {
+			const char* name_end = encoding+1;
+			if (*name_end == '?')
+				++ name_end;
+			else
+				while (*name_end != '=' && !is_end_of_members(*name_end))
+					name_end = skip_unit(name_end);
+			push(TK_Name, encoding+1, name_end);
+			ma_tokens.back().next = size();
+			if (*name_end == '=')
+				add_members(name_end+1, depth-1);
+		}
+	}
+
+	ma_tokens[index].next = size();
+	return end;
+}
+
+// A member is a unit (see skip_unit()) after any number of modifiers, or a
+// bitfield. An '@' followed by a quoted string is an object with a class
+// name, unless the string is the name of the next field.
+const char* ObjCTypeTokenizer::add_member_type(const char* members, bool has_field_names, unsigned depth) {
+	const char* p = members;
+	while (is_modifier(*p)) {
+		++ p;
+		if (*p == '"' || is_end_of_members(*p)) {	// Avoid WebKit segfault.
+			push(TK_IncompleteType, members, p);
+			ma_tokens.back().next = size();
+			return p;
+		}
+	}
+
+	const char* end;
+	if (*p == 'b') {
+		end = p+1;
+		while (is_digit(*end))
+			++ end;
+	} else {
+		end = skip_unit(p);
+		if (*p == '@' && *end == '"') {
+			const char* after_class_name = skip_unit(end);
+			if (!has_field_names || *after_class_name == '"' || is_end_of_members(*after_class_name))
+				end = after_class_name;
+		}
+	}
+
+	push(TK_Type, members, end);
+	return add_type(members, depth);
+}
+
+const char* ObjCTypeTokenizer::add_members(const char* members, unsigned depth) {
+	bool has_field_names = (*members == '"');
+	bool expecting_field_name = has_field_names;
+	while (!is_end_of_members(*members)) {
+		if (expecting_field_name) {
+			const char* end = skip_unit(members);
+			unsigned length = static_cast<unsigned>(end - members);
+			push(TK_FieldName, members+1, members+1 + (length >= 2 ? length-2 : 0));
+			ma_tokens.back().next = size();
+			members = end;
+		} else
+			members = add_member_type(members, has_field_names, depth);
+		if (has_field_names)
+			expecting_field_name = !expecting_field_name;
+	}
+	return members;
+}
+
+unsigned ObjCTypeTokenizer::tokenize(const char* encoding, unsigned max_depth) {
+	unsigned first = size();
+	push(TK_Type, encoding, encoding + strlen(encoding));
+	add_type(encoding, max_depth);
+	return first;
+}
+
+unsigned ObjCTypeTokenizer::tokenize_members(const char* members, bool& has_field_names, unsigned max_depth) {
+	unsigned first = size();
+	has_field_names = (*members == '"');
+	add_members(members, max_depth);
+	return first;
+}
+
+unsigned ObjCTypeTokenizer::tokenize_signature(const char* signature, unsigned max_depth) {
+	unsigned first = size();
+	while (*signature != '\0') {
+		const char* type_begin = signature;
+		while (*signature != '\0' && !is_digit(*signature))
+			signature = skip_unit(signature);
+		push(TK_Type, type_begin, signature);
+		add_type(type_begin, max_depth);
+		while (is_digit(*signature))
+			++ signature;
+	}
+	return first;
+}
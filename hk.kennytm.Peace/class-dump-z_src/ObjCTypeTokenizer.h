@@ -0,0 +1,93 @@
+/*
+
+ObjCTypeTokenizer.h ... Split Objective-C type encodings without copying them.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OBJC_TYPE_TOKENIZER_H
+#define OBJC_TYPE_TOKENIZER_H
+
+#include <string>
+#include <vector>
+
+// Tokens point into the encoding being tokenized, which must outlive them.
+//
+// The tokens of one call are stored in pre-order: the children of token i
+// are i+1 up to (but excluding) token i's "next", and "next" of a child is
+// the index of its next sibling. So a whole tree lives in one vector, and
+// the vector is reused between calls.
+//
+// Calls may be nested, e.g. while walking the tokens of a struct, the
+// caller may tokenize one of its members: new tokens are appended after the
+// existing ones. Every call returns the index of its first token, and
+// truncate() to that index drops them again.
+class ObjCTypeTokenizer {
+public:
+	enum TokenKind {
+		TK_Type,			// a complete type, e.g. i, ^{CGPoint=ff}, @"NSString", b4.
+		TK_IncompleteType,	// a pointer or qualifier without a pointee, e.g. the ^ in {x="a"^"b"i}. Read as if it were followed by '?'.
+		TK_Name,			// the name of a struct or union, e.g. CGPoint or ?.
+		TK_FieldName		// a field name of a struct or union, without the quotes.
+	};
+
+	struct Token {
+		const char* begin;
+		unsigned length;
+		unsigned next;
+		TokenKind kind;
+
+		const char* end() const throw() { return begin + length; }
+		std::string str() const { return std::string(begin, length); }
+	};
+
+private:
+	std::vector<Token> ma_tokens;
+
+	unsigned push(TokenKind kind, const char* begin, const char* end);
+	const char* add_type(const char* encoding, unsigned depth);
+	const char* add_member_type(const char* members, bool has_field_names, unsigned depth);
+	const char* add_members(const char* members, unsigned depth);
+
+public:
+	// Skip one unit of an encoding, with the same result as
+	// skip_balanced_substring(), but without its state machine for the
+	// common single-character types.
+	static const char* skip_unit(const char* encoding) throw();
+
+	// Tokenize a single type, e.g. "^{CGPoint=ff}". Members and pointees are
+	// tokenized up to max_depth levels below the type: with max_depth = 1, a
+	// struct gets its name, field names and member types, but the member
+	// types have no children.
+	unsigned tokenize(const char* encoding, unsigned max_depth = ~0u);
+
+	// Tokenize the members of a struct or union, i.e. everything after the
+	// '=' up to the closing bracket, as a list of TK_FieldName (if present)
+	// and TK_Type/TK_IncompleteType tokens.
+	unsigned tokenize_members(const char* members, bool& has_field_names, unsigned max_depth = 0);
+
+	// Tokenize a method signature, e.g. "v12@0:4@8", into one TK_Type per
+	// return value and argument. The stack offsets are skipped.
+	unsigned tokenize_signature(const char* signature, unsigned max_depth = 0);
+
+	const Token& operator[] (unsigned i) const throw() { return ma_tokens[i]; }
+	unsigned size() const throw() { return static_cast<unsigned>(ma_tokens.size()); }
+	void truncate(unsigned first) { ma_tokens.resize(first); }
+	void clear() throw() { ma_tokens.clear(); }
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+
+ObjCTypeTokenizer_bench.cpp ... Throughput of the type encoding tokenizer.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ObjCTypeTokenizer.h"
+#include "objc_type.h"
+#include "balanced_substr.h"
+#include "wall_clock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Method signatures and ivar/property types as they appear in the UIKit,
+// Foundation, QuartzCore and WebCore binaries.
+static const char* const corpus[] = {
+	"v8@0:4",
+	"@8@0:4",
+	"c8@0:4",
+	"v12@0:4@8",
+	"v12@0:4c8",
+	"@12@0:4@8",
+	"I8@0:4",
+	"i12@0:4I8",
+	"f8@0:4",
+	"v12@0:4f8",
+	"v16@0:4@8:12",
+	"@20@0:4@8@12@16",
+	"v20@0:4@8i12@16",
+	"{CGRect={CGPoint=ff}{CGSize=ff}}8@0:4",
+	"v24@0:4{CGRect={CGPoint=ff}{CGSize=ff}}8",
+	"{CGPoint=ff}16@0:4{CGPoint=ff}8",
+	"{CGSize=ff}16@0:4{CGSize=ff}8",
+	"@28@0:4{CGRect={CGPoint=ff}{CGSize=ff}}8@24",
+	"v12@0:4^{CGContext=}8",
+	"^{__CFString=}8@0:4",
+	"{_NSRange=II}8@0:4",
+	"v16@0:4{_NSRange=II}8",
+	"@16@0:4@8^@12",
+	"c16@0:4@8^@12",
+	"v52@0:4{CGAffineTransform=ffffff}8@32c36c40@44@48",
+	"{CATransform3D=ffffffffffffffff}8@0:4",
+	"v72@0:4{CATransform3D=ffffffffffffffff}8",
+	"v20@0:4@?8@?12B16",
+	"r^{__CFArray=}8@0:4",
+	"v12@0:4^{WebCoreFrameBridge=}8",
+	"@\"NSString\"",
+	"@\"NSMutableArray\"",
+	"@\"<UITableViewDelegate>\"",
+	"@\"NSObject<UIScrollViewDelegate><UITextFieldDelegate>\"",
+	"{CGRect=\"origin\"{CGPoint=\"x\"f\"y\"f}\"size\"{CGSize=\"width\"f\"height\"f}}",
+	"{?=\"delegateRespondsToWillDisplay\"b1\"delegateRespondsToDidEnd\"b1\"style\"b2\"reserved\"b28}",
+	"{__CFRuntimeBase=\"_cfisa\"I\"_cfinfo\"[4C]}",
+	"{_opaque_pthread_mutex_t=\"__sig\"l\"__opaque\"[40c]}",
+	"{__siginfo=\"si_signo\"i\"si_errno\"i\"si_code\"i\"si_pid\"i\"si_uid\"I\"si_status\"i\"si_addr\"^v\"si_value\"(sigval=\"sival_int\"i\"sival_ptr\"^v)\"si_band\"l\"__pad\"[7L]}",
+	"^{RefPtr<WebCore::Node>=^{Node}}",
+	"{Vector<WebCore::IntRect,0ul>=\"m_size\"I\"m_buffer\"{VectorBuffer<WebCore::IntRect,0ul>=\"m_buffer\"^{IntRect}\"m_capacity\"I}}",
+	"{UIEdgeInsets=ffff}",
+	"[16{?=\"key\"@\"NSString\"\"value\"@}]",
+	"^^{__CFDictionary}",
+	"{_UIWebViewScrollViewFlags=\"dragging\"b1\"decelerating\"b1\"hasScrolled\"b1}",
+	"(?=\"f\"f\"i\"i\"p\"^v)",
+};
+
+static bool is_signature(const string& encoding) {
+	return !encoding.empty() && encoding[encoding.size()-1] >= '0' && encoding[encoding.size()-1] <= '9';
+}
+
+// The splitting done before the tokenizer: every type (and every struct
+// member, one level deep) copied into its own string.
+static void split_with_copies(const string& encoding, vector<string>& parts) {
+	const char* p = encoding.c_str();
+	if (is_signature(encoding)) {
+		while (*p != '\0') {
+			const char* type_begin = p;
+			while (*p != '\0' && !(*p >= '0' && *p <= '9'))
+				p = skip_balanced_substring(p);
+			parts.push_back(string(type_begin, p));
+			while (*p >= '0' && *p <= '9')
+				++ p;
+		}
+	} else if (*p == '{' || *p == '(') {
+		++ p;
+		while (*p != '=' && *p != '}' && *p != ')' && *p != '\0')
+			p = skip_balanced_substring(p);
+		parts.push_back(string(encoding.c_str()+1, p));
+		if (*p == '=') {
+			const char* member_begin = ++ p;
+			while (*p != '}' && *p != ')' && *p != '\0') {
+				p = skip_balanced_substring(p);
+				parts.push_back(string(member_begin, p));
+				member_begin = p;
+			}
+		}
+	} else
+		parts.push_back(encoding);
+}
+
+int main (int argc, const char* argv[]) {
+	vector<string> encodings;
+	if (argc >= 2) {
+		// one encoding per line.
+		FILE* f = fopen(argv[1], "r");
+		if (f == NULL) {
+			perror(argv[1]);
+			return 1;
+		}
+		char line[4096];
+		while (fgets(line, sizeof(line), f) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] != '\0')
+				encodings.push_back(line);
+		}
+		fclose(f);
+	} else
+		encodings.assign(corpus, corpus + sizeof(corpus)/sizeof(corpus[0]));
+	unsigned rounds = argc >= 3 ? static_cast<unsigned>(strtoul(argv[2], NULL, 0)) : 20000;
+
+	size_t bytes = 0;
+	for (vector<string>::const_iterator cit = encodings.begin(); cit != encodings.end(); ++ cit)
+		bytes += cit->size();
+	double total = static_cast<double>(encodings.size()) * rounds;
+	double total_bytes = static_cast<double>(bytes) * rounds;
+
+	printf("%lu encodings, %lu bytes, %u rounds\n\n", static_cast<unsigned long>(encodings.size()), static_cast<unsigned long>(bytes), rounds);
+	printf("%-28s %12s %14s %10s %12s\n", "", "time (ms)", "encodings/s", "MB/s", "tokens");
+
+	// 1. split one level deep, into strings.
+	double t = wall_clock();
+	size_t token_count = 0;
+	for (unsigned round = 0; round < rounds; ++ round)
+		for (vector<string>::const_iterator cit = encodings.begin(); cit != encodings.end(); ++ cit) {
+			vector<string> parts;
+			split_with_copies(*cit, parts);
+			token_count += parts.size();
+		}
+	t = wall_clock() - t;
+	printf("%-28s %12.3f %14.0f %10.1f %12lu\n", "split into strings", t * 1000, total / t, total_bytes / t / 1e6, static_cast<unsigned long>(token_count));
+
+	// 2. the same, with the tokenizer.
+	ObjCTypeTokenizer tokenizer;
+	t = wall_clock();
+	token_count = 0;
+	for (unsigned round = 0; round < rounds; ++ round)
+		for (vector<string>::const_iterator cit = encodings.begin(); cit != encodings.end(); ++ cit) {
+			tokenizer.clear();
+			if (is_signature(*cit))
+				tokenizer.tokenize_signature(cit->c_str());
+			else
+				tokenizer.tokenize(cit->c_str(), 1);
+			token_count += tokenizer.size();
+		}
+	t = wall_clock() - t;
+	printf("%-28s %12.3f %14.0f %10.1f %12lu\n", "tokenize, one level", t * 1000, total / t, total_bytes / t / 1e6, static_cast<unsigned long>(token_count));
+
+	// 3. the whole token tree.
+	t = wall_clock();
+	token_count = 0;
+	for (unsigned round = 0; round < rounds; ++ round)
+		for (vector<string>::const_iterator cit = encodings.begin(); cit != encodings.end(); ++ cit) {
+			tokenizer.clear();
+			if (is_signature(*cit))
+				tokenizer.tokenize_signature(cit->c_str(), ~0u);
+			else
+				tokenizer.tokenize(cit->c_str());
+			token_count += tokenizer.size();
+		}
+	t = wall_clock() - t;
+	printf("%-28s %12.3f %14.0f %10.1f %12lu\n", "tokenize, whole tree", t * 1000, total / t, total_bytes / t / 1e6, static_cast<unsigned long>(token_count));
+
+	// 4. method signatures into a type record, type by type and memoized.
+	vector<string> signatures;
+	for (vector<string>::const_iterator cit = encodings.begin(); cit != encodings.end(); ++ cit)
+		if (is_signature(*cit))
+			signatures.push_back(*cit);
+	if (!signatures.empty()) {
+		double total_signatures = static_cast<double>(signatures.size()) * rounds;
+
+		ObjCTypeRecord record;
+		t = wall_clock();
+		token_count = 0;
+		for (unsigned round = 0; round < rounds; ++ round)
+			for (vector<string>::const_iterator cit = signatures.begin(); cit != signatures.end(); ++ cit) {
+				vector<string> parts;
+				split_with_copies(*cit, parts);
+				for (vector<string>::const_iterator pit = parts.begin(); pit != parts.end(); ++ pit)
+					record.parse(*pit, false);
+				token_count += parts.size();
+			}
+		t = wall_clock() - t;
+		printf("%-28s %12.3f %14.0f %10s %12lu\n", "parse each type", t * 1000, total_signatures / t, "", static_cast<unsigned long>(token_count));
+
+		ObjCTypeRecord memo_record;
+		t = wall_clock();
+		token_count = 0;
+		for (unsigned round = 0; round < rounds; ++ round)
+			for (vector<string>::const_iterator cit = signatures.begin(); cit != signatures.end(); ++ cit) {
+				vector<ObjCTypeRecord::TypeIndex> types;
+				memo_record.parse_signature(cit->c_str(), types);
+				token_count += types.size();
+			}
+		t = wall_clock() - t;
+		printf("%-28s %12.3f %14.0f %10s %12lu\n", "parse_signature", t * 1000, total_signatures / t, "", static_cast<unsigned long>(token_count));
+
+		if (record.types_count() != memo_record.types_count())
+			printf("\nType counts differ: %lu vs %lu.\n", static_cast<unsigned long>(record.types_count()), static_cast<unsigned long>(memo_record.types_count()));
+	}
+
+	return 0;
+}
@@ -20,9 +20,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "MachO_File_ObjC.h"
+#include "ThreadPool.h"
+#include "LoadedLibraries.h"
+#include "wall_clock.h"
 #include <getopt.h>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <tr1/unordered_set>
 #include <unistd.h>
 #include <sys/stat.h>
 #if !_MSC_VER
@@ -33,7 +38,7 @@ using namespace std;
 
 void print_usage () {
 	fprintf(stderr,
-			"Usage: class-dump-z [<options>] <filename>\n"
+			"Usage: class-dump-z [<options>] <filename>...\n"
 			"\n"
 			"where options are:\n"
 			"\n  Analysis:\n"
@@ -42,6 +47,9 @@ void print_usage () {
 			"    -h super   Hide inherited methods.\n"
 			"    -y <root>  Choose the sysroot. Default to the path of latest iPhoneOS SDK, or /.\n"
 			"    -u <arch>  Choose a specific architecture in a fat binary (e.g. armv6, armv7, etc.)\n"
+			"    -u <list>  Analyze several architectures concurrently (e.g. armv6,armv7 or all).\n"
+			"    -c <dir>   Store the symbol analysis and the -h super libraries in this directory for later runs.\n"
+			"    -r         Rebuild the stored analysis (with -c).\n"
 			"\n  Formatting:\n"
 			"    -a         Print ivar offsets\n"
 			"    -A         Print implementation VM addresses.\n"
@@ -68,10 +76,278 @@ void print_usage () {
 			"\n  Output:\n"
 			"    -H         Separate into header files\n"
 			"    -o <dir>   Put header files into this directory instead of current directory.\n"
+			"    -j <n>     Format classes and write headers on n threads (0 = one per processor). Default to 1.\n"
+			"\n  Batch:\n"
+			"    -B <dir>   Analyze the files concurrently, and write each into its own subdirectory of dir.\n"
+			"               A directory argument stands for the files in it, and - for the paths read from\n"
+			"               stdin. The libraries of -h super are loaded once for all files.\n"
 			"\n"
 			);
 }
 
+// everything done to a slice before printing it.
+struct SliceAnalysis {
+	const DataFile* file;
+	vector<MachO_File::Slice> slices;
+	vector<MachO_File_ObjC*> results;
+	vector<string> errors;
+	
+	bool diagnose_only;
+	bool prettify_struct_names, pointers_right_align, has_blank;
+	bool hide_cats, hide_dogs, dont_typedef, ida_pro_mode;
+	bool hide_super, hide_protocols, propertize;
+	const char* hints_file;
+	const char* type_regexp;
+	const char* method_regexp;
+	const vector<string>* kill_prefix;
+	const char* sysroot;
+	const char* symbol_cache;
+	MachO_File::CacheMode cache_mode;
+	
+	// if not NULL, the libraries of -h super are loaded from here.
+	LoadedLibraries* shared_libraries;
+};
+
+static void analyze_slice(unsigned index, void* context) {
+	SliceAnalysis& an = *static_cast<SliceAnalysis*>(context);
+	
+	try {
+		MachO_File_ObjC* p_mf = new MachO_File_ObjC(*an.file, an.slices[index], false, an.symbol_cache, an.cache_mode);
+		an.results[index] = p_mf;
+		MachO_File_ObjC& mf = *p_mf;
+		
+		if (!an.diagnose_only) {
+			mf.set_prettify_struct_names(an.prettify_struct_names);
+			mf.set_pointers_right_aligned(an.pointers_right_align);
+			mf.set_method_has_whitespace(an.has_blank);
+			mf.set_hide_cats_and_dogs(an.hide_cats, an.hide_dogs);
+			mf.set_hints_file(an.hints_file);
+			mf.set_dont_typedef(an.dont_typedef);
+			mf.set_ida_pro_mode(an.ida_pro_mode);
+			
+			if (an.type_regexp != NULL)
+				mf.set_class_filter(an.type_regexp);
+			if (an.method_regexp != NULL)
+				mf.set_method_filter(an.method_regexp);
+			if (!an.kill_prefix->empty())
+				mf.set_kill_prefix(*an.kill_prefix);
+			mf.set_shared_libraries(an.shared_libraries);
+			
+			mf.hide_overlapping_methods(an.hide_super, an.hide_protocols, an.sysroot);
+			if (an.propertize)
+				mf.propertize();
+		}
+	} catch (const TRException& e) {
+		an.errors[index] = e.what();
+	}
+}
+
+// the name of the path without the directories and the extension.
+static string stem_of(const char* path) {
+	const char* last_component = strrchr(path, '/');
+	last_component = last_component != NULL ? last_component + 1 : path;
+	const char* dot_position = strrchr(last_component, '.');
+	return dot_position == NULL || dot_position == last_component ? string(last_component) : string(last_component, dot_position);
+}
+
+// A file of a batch (-B). It is analyzed on the pool, where analyze_slice()
+// also hides the overlapping methods, and then written on the pool. The
+// libraries of -h super are shared by all files, but are only read once
+// loaded, so each file is dumped as if it were alone.
+struct BatchFile {
+	string path, directory;
+	SliceAnalysis an;
+	DataFile* file;
+	
+	double seconds;
+	unsigned class_count;
+	unsigned status_counts[3];	// of the headers, with -H.
+	string error;
+};
+
+struct BatchJob {
+	BatchFile* files;	// of the current chunk.
+	
+	const char* arch;
+	bool generate_headers, print_method_addresses, print_ivar_offsets, show_only_exported_classes;
+	int print_comments;
+	MachO_File_ObjC::SortBy sort_by, sort_methods_by;
+};
+
+static void analyze_batch_file(unsigned index, void* context) {
+	const BatchJob& job = *static_cast<const BatchJob*>(context);
+	BatchFile& bf = job.files[index];
+	double start_time = wall_clock();
+	
+	try {
+		bf.file = new DataFile(bf.path.c_str());
+		bf.an.file = bf.file;
+		bf.an.slices = MachO_File::select_slices(*bf.file, job.arch);
+		bf.an.results.assign(bf.an.slices.size(), NULL);
+		bf.an.errors.assign(bf.an.slices.size(), string());
+		for (unsigned i = 0; i < bf.an.slices.size(); ++ i)
+			analyze_slice(i, &bf.an);
+	} catch (const TRException& e) {
+		bf.error = e.what();
+	}
+	
+	bf.seconds += wall_clock() - start_time;
+}
+
+static void write_batch_file(unsigned index, void* context) {
+	const BatchJob& job = *static_cast<const BatchJob*>(context);
+	BatchFile& bf = job.files[index];
+	double start_time = wall_clock();
+	
+	bool multiple_slices = bf.an.slices.size() > 1;
+	if (bf.error.empty())
+		mkdir(bf.directory.c_str(), 0755);
+	
+	for (unsigned i = 0; i < bf.an.results.size(); ++ i) {
+		const char* slice_arch = bf.an.slices[i].arch != NULL ? bf.an.slices[i].arch : "any";
+		MachO_File_ObjC* p_mf = bf.an.results[i];
+		
+		if (p_mf == NULL || !bf.an.errors[i].empty()) {
+			if (bf.error.empty())
+				bf.error = multiple_slices ? string(slice_arch) + ": " + bf.an.errors[i] : bf.an.errors[i];
+		} else {
+			MachO_File_ObjC& mf = *p_mf;
+			
+			// each architecture gets a subdirectory of its own.
+			string directory = bf.directory;
+			if (multiple_slices) {
+				directory += '/';
+				directory += slice_arch;
+				mkdir(directory.c_str(), 0755);
+			}
+			
+			if (job.generate_headers)
+				mf.write_header_files(bf.path.c_str(), directory.c_str(), job.print_method_addresses, job.print_comments, job.print_ivar_offsets, job.sort_methods_by, job.show_only_exported_classes, NULL, bf.status_counts);
+			else {
+				string dump_path = directory + "/" + stem_of(bf.path.c_str()) + ".h";
+				FILE* f = fopen(dump_path.c_str(), "wt");
+				if (f == NULL) {
+					if (bf.error.empty())
+						bf.error = "Cannot write to '" + dump_path + "'.";
+				} else {
+					mf.print_struct_declaration(job.sort_by, f);
+					mf.print_class_type(job.sort_by, job.print_method_addresses, job.print_comments, job.print_ivar_offsets, job.sort_methods_by, job.show_only_exported_classes, NULL, f);
+					fclose(f);
+				}
+			}
+			bf.class_count += mf.class_count();
+		}
+		
+		delete p_mf;
+		bf.an.results[i] = NULL;
+	}
+	
+	delete bf.file;
+	bf.file = NULL;
+	
+	bf.seconds += wall_clock() - start_time;
+}
+
+// append the files named by a batch argument: a file, the files directly in
+// a directory (in alphabetical order), or the paths in stdin for "-".
+static void add_batch_inputs(const char* arg, vector<string>& paths) {
+	if (strcmp(arg, "-") == 0) {
+		char line[4096];
+		while (fgets(line, sizeof(line), stdin) != NULL) {
+			size_t length = strlen(line);
+			while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r'))
+				-- length;
+			if (length > 0)
+				paths.push_back(string(line, length));
+		}
+		return;
+	}
+	
+#if !_MSC_VER
+	DIR* dir = opendir(arg);
+	if (dir != NULL) {
+		string prefix = arg;
+		if (prefix[prefix.size()-1] != '/')
+			prefix.push_back('/');
+		vector<string> names;
+		struct dirent* de;
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			struct stat st;
+			if (stat((prefix + de->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+				names.push_back(de->d_name);
+		}
+		closedir(dir);
+		sort(names.begin(), names.end());
+		for (vector<string>::const_iterator cit = names.begin(); cit != names.end(); ++ cit)
+			paths.push_back(prefix + *cit);
+		return;
+	}
+#endif
+	
+	paths.push_back(arg);
+}
+
+static void run_batch(const vector<string>& paths, const char* output_directory, const SliceAnalysis& settings, BatchJob& job, ThreadPool& pool) {
+	double start_time = wall_clock();
+	mkdir(output_directory, 0755);
+	
+	vector<BatchFile> files (paths.size());
+	tr1::unordered_set<string> used_names;
+	for (unsigned i = 0; i < paths.size(); ++ i) {
+		BatchFile& bf = files[i];
+		bf.path = paths[i];
+		bf.an = settings;
+		bf.file = NULL;
+		bf.seconds = 0;
+		bf.class_count = 0;
+		bf.status_counts[0] = bf.status_counts[1] = bf.status_counts[2] = 0;
+		
+		// files with the same name get a numbered directory.
+		const char* last_component = strrchr(bf.path.c_str(), '/');
+		string name = last_component != NULL ? last_component + 1 : bf.path;
+		string unique_name = name;
+		for (unsigned n = 2; !used_names.insert(unique_name).second; ++ n)
+			unique_name = name + numeric_format("-%u", n);
+		bf.directory = output_directory;
+		if (bf.directory[bf.directory.size()-1] != '/')
+			bf.directory.push_back('/');
+		bf.directory += unique_name;
+	}
+	
+	// every file of a chunk is alive at the same time, so the chunks are only
+	// large enough to keep the pool busy.
+	unsigned chunk_size = 2 * pool.thread_count();
+	for (unsigned first = 0; first < files.size(); first += chunk_size) {
+		unsigned count = std::min(chunk_size, static_cast<unsigned>(files.size()) - first);
+		job.files = &files[first];
+		pool.parallel_for(count, analyze_batch_file, &job);
+		pool.parallel_for(count, write_batch_file, &job);
+	}
+	
+	unsigned failed_count = 0;
+	printf("// Batch of %lu files written to '%s':\n", static_cast<unsigned long>(files.size()), output_directory);
+	for (vector<BatchFile>::const_iterator cit = files.begin(); cit != files.end(); ++ cit) {
+		if (!cit->error.empty()) {
+			++ failed_count;
+			printf("//   %8.3f s  failed        %s: %s\n", cit->seconds, cit->path.c_str(), cit->error.c_str());
+		} else {
+			printf("//   %8.3f s  %5u classes  %s -> %s", cit->seconds, cit->class_count, cit->path.c_str(), cit->directory.c_str());
+			if (job.generate_headers) {
+				printf(" (%u headers written, %u unchanged", cit->status_counts[OutputSink::FS_Written], cit->status_counts[OutputSink::FS_Unchanged]);
+				if (cit->status_counts[OutputSink::FS_Failed] > 0)
+					printf(", %u failed", cit->status_counts[OutputSink::FS_Failed]);
+				printf(")");
+			}
+			printf("\n");
+		}
+	}
+	printf("// %lu files in %.3f s on %u threads, %u failed.\n", static_cast<unsigned long>(files.size()), wall_clock() - start_time, pool.thread_count(), failed_count);
+	if (settings.hide_super && settings.shared_libraries != NULL)
+		printf("// %lu libraries loaded for -h super.\n", static_cast<unsigned long>(settings.shared_libraries->count()));
+}
+
 int main (int argc, char* argv[]) {
 	if (argc == 1) {
 		print_usage();
@@ -95,6 +371,10 @@ int main (int argc, char* argv[]) {
 		vector<string> kill_prefix;
 		const char* arch = "any";
 		const char* hints_file = NULL;
+		const char* symbol_cache = NULL;
+		MachO_File::CacheMode cache_mode = MachO_File::CM_Use;
+		unsigned format_jobs = 1;
+		const char* batch_directory = NULL;
 		
 		// search for a suitable sysroot.
 #if !_MSC_VER
@@ -126,7 +406,7 @@ int main (int argc, char* argv[]) {
 		
 		// const char* regexp_string = NULL;
 		while (argc > 1) {
-			switch (c = getopt(argc, argv, "aAkC:ISsD:Rf:gpHo:X:Nh:y:u:bzi:T")) {
+			switch (c = getopt(argc, argv, "aAkC:ISsD:Rf:gpHo:X:Nh:y:u:bzi:Tc:rj:B:")) {
 				case 'a': print_ivar_offsets = true; break;
 				case 'A': print_method_addresses = true; break;
 				case 'k': ++ print_comments; break;
@@ -196,6 +476,18 @@ int main (int argc, char* argv[]) {
 					ida_pro_mode = true;
 					hide_cats = hide_dogs = true;
 					break;
+				case 'c':
+					symbol_cache = optarg;
+					break;
+				case 'r':
+					cache_mode = MachO_File::CM_Rebuild;
+					break;
+				case 'j':
+					format_jobs = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+					break;
+				case 'B':
+					batch_directory = optarg;
+					break;
 #if EOF != -1
 				case EOF:
 #endif
@@ -215,18 +507,94 @@ int main (int argc, char* argv[]) {
 			print_usage();
 		} else {
 		
+		// the slices of each file are analyzed concurrently, and then printed in
+		// the order they were requested.
+		ThreadPool pool;
+		// the classes and headers of the printed slice are written on their own
+		// pool, since that work is started from the main thread.
+		ThreadPool format_pool (format_jobs);
+		
+		SliceAnalysis an;
+		an.diagnose_only = diagnosis_option != '\0';
+		an.prettify_struct_names = prettify_struct_names;
+		an.pointers_right_align = pointers_right_align;
+		an.has_blank = has_blank;
+		an.hide_cats = hide_cats;
+		an.hide_dogs = hide_dogs;
+		an.dont_typedef = dont_typedef;
+		an.ida_pro_mode = ida_pro_mode;
+		an.hide_super = hide_super;
+		an.hide_protocols = hide_protocols;
+		an.propertize = propertize;
+		an.hints_file = hints_file;
+		an.type_regexp = type_regexp;
+		an.method_regexp = method_regexp;
+		an.kill_prefix = &kill_prefix;
+		an.sysroot = sysroot;
+		an.symbol_cache = symbol_cache;
+		an.cache_mode = cache_mode;
+		an.shared_libraries = NULL;
+		
+		if (batch_directory != NULL) {
+			if (diagnosis_option != '\0')
+				fprintf(stderr, "Warning: -D is ignored with -B.\n");
+			if (hints_file != NULL)
+				fprintf(stderr, "Warning: The hints file is read but not updated with -B.\n");
+			
+			vector<string> paths;
+			for (vector<const char*>::const_iterator fit = filenames.begin(); fit != filenames.end(); ++ fit)
+				add_batch_inputs(*fit, paths);
+			
+			LoadedLibraries shared_libraries (symbol_cache, cache_mode);
+			an.diagnose_only = false;
+			an.shared_libraries = &shared_libraries;
+			
+			BatchJob job;
+			job.arch = arch;
+			job.generate_headers = generate_headers;
+			job.print_method_addresses = print_method_addresses;
+			job.print_ivar_offsets = print_ivar_offsets;
+			job.show_only_exported_classes = show_only_exported_classes;
+			job.print_comments = print_comments;
+			job.sort_by = sort_by;
+			job.sort_methods_by = sort_methods_by;
+			
+			run_batch(paths, batch_directory, an, job, pool);
+		} else {
+		
 		for (vector<const char*>::const_iterator fit = filenames.begin(); fit != filenames.end(); ++ fit) {
 			
 		try {
 			
-			MachO_File_ObjC mf = MachO_File_ObjC(*fit, false, arch);
+			DataFile file (*fit);
+			an.file = &file;
+			an.slices = MachO_File::select_slices(file, arch);
+			an.results.assign(an.slices.size(), NULL);
+			an.errors.assign(an.slices.size(), string());
+			
+			pool.parallel_for(static_cast<unsigned>(an.slices.size()), analyze_slice, &an);
+			
+			bool multiple_slices = an.slices.size() > 1;
+			
+			for (unsigned i = 0; i < an.slices.size(); ++ i) {
+			
+			const char* slice_arch = an.slices[i].arch != NULL ? an.slices[i].arch : "any";
+			if (multiple_slices)
+				printf("/*\n * %s (for architecture %s)\n */\n\n", *fit, slice_arch);
+			
+			if (an.results[i] == NULL) {
+				printf("/*\n\nAn exception was thrown while analyzing '%s' (with sysroot '%s'):\n\n%s\n\n*/\n", *fit, sysroot, an.errors[i].c_str());
+				continue;
+			}
+			
+			MachO_File_ObjC& mf = *an.results[i];
 		
 			if (diagnosis_option != '\0') {
 				switch (diagnosis_option) {
 					case 't': mf.print_all_types(); break;
 					case 'n': mf.print_network(); break;
 					case 'e': 
-						printf("// Sysroot: %s; arch: %s\n", sysroot, arch);
+						printf("// Sysroot: %s; arch: %s\n", sysroot, multiple_slices ? slice_arch : arch);
 						mf.print_extern_symbols(); 
 						break;
 						
@@ -240,50 +608,44 @@ int main (int argc, char* argv[]) {
 							   "//   -D s = Print class inheritance tree (in MediaWiki format).\n");
 						break;
 				}
+			} else if (!an.errors[i].empty()) {
+				printf("/*\n\nAn exception was thrown while analyzing '%s' (with sysroot '%s'):\n\n%s\n\n*/\n", *fit, sysroot, an.errors[i].c_str());
 			} else {
-				mf.set_prettify_struct_names(prettify_struct_names);
-				mf.set_pointers_right_aligned(pointers_right_align);
-				mf.set_method_has_whitespace(has_blank);
-				mf.set_hide_cats_and_dogs(hide_cats, hide_dogs);
-				mf.set_hints_file(hints_file);
-				mf.set_dont_typedef(dont_typedef);
-				mf.set_ida_pro_mode(ida_pro_mode);
-				
-				if (type_regexp != NULL)
-					mf.set_class_filter(type_regexp);
-				if (method_regexp != NULL)
-					mf.set_method_filter(method_regexp);
-				if (!kill_prefix.empty())
-					mf.set_kill_prefix(kill_prefix);
-			
-				mf.hide_overlapping_methods(hide_super, hide_protocols, sysroot);
-				if (propertize)
-					mf.propertize();
-								
 				if (generate_headers) {
-					if (output_directory != NULL) {
-						if (chdir(output_directory) == -1) {
-							if (mkdir(output_directory, 0755) == -1) {
-								perror("Cannot create directory for header generation. ");
-								return 1;
-							} else
-								chdir(output_directory);
-						}
+					// each architecture gets a subdirectory of its own.
+					string directory = output_directory != NULL ? output_directory : "";
+					if (output_directory != NULL)
+						mkdir(output_directory, 0755);
+					if (multiple_slices) {
+						directory += directory.empty() ? "" : "/";
+						directory += slice_arch;
+						mkdir(directory.c_str(), 0755);
 					}
 					
-					mf.write_header_files(*fit, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes);
+					unsigned status_counts[3] = {0, 0, 0};
+					mf.write_header_files(*fit, directory.c_str(), print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes, &format_pool, status_counts);
+					printf("// Wrote %u header files, %u unchanged.\n", status_counts[OutputSink::FS_Written], status_counts[OutputSink::FS_Unchanged]);
+					if (status_counts[OutputSink::FS_Failed] > 0)
+						printf("// Failed to write %u header files.\n", status_counts[OutputSink::FS_Failed]);
 				} else {
 					mf.print_struct_declaration(sort_by);
-					mf.print_class_type(sort_by, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes);
+					mf.print_class_type(sort_by, print_method_addresses, print_comments, print_ivar_offsets, sort_methods_by, show_only_exported_classes, &format_pool);
 				}
 				
 				mf.write_hints_file(hints_file);
 			}
 			
+			delete an.results[i];
+			an.results[i] = NULL;
+			
+			}
+			
 		} catch (const TRException& e) {
 			printf("/*\n\nAn exception was thrown while analyzing '%s' (with sysroot '%s'):\n\n%s\n\n*/\n", *fit, sysroot, e.what());
 		}
 			
+		}
+		
 		}
 
 		}
@@ -22,22 +22,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef COMBINE_DEPENDENCIES_H
 #define COMBINE_DEPENDENCIES_H
 
-static void combine_dependencies( std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>& a, const std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>& b, std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, unsigned>* p_ma_k_in = NULL, std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, unsigned>* p_ma_strong_k_in = NULL ) {
-	for (std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>::const_iterator bit = b.begin(); bit != b.end(); ++ bit) {
-		std::pair<std::tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>::iterator, bool> res = a.insert(*bit);
-		if (!res.second) {
-			if (res.first->second < bit->second) {
-				if (p_ma_strong_k_in != NULL && res.first->second < ObjCTypeRecord::ES_StrongIndirect)
-					++ (*p_ma_strong_k_in)[bit->first];
-				res.first->second = bit->second;
+// merge the sorted list b into a, keeping the stronger link to each type.
+static void combine_dependencies(ObjCTypeRecord::DependencyList& a, const ObjCTypeRecord::DependencyList& b, std::vector<unsigned>* p_ma_k_in = NULL, std::vector<unsigned>* p_ma_strong_k_in = NULL) {
+	ObjCTypeRecord::DependencyList merged;
+	merged.reserve(a.size() + b.size());
+	ObjCTypeRecord::DependencyList::const_iterator ait = a.begin();
+	for (ObjCTypeRecord::DependencyList::const_iterator bit = b.begin(); bit != b.end(); ++ bit) {
+		for (; ait != a.end() && ait->type_index < bit->type_index; ++ ait)
+			merged.push_back(*ait);
+		if (ait != a.end() && ait->type_index == bit->type_index) {
+			ObjCTypeRecord::Dependency dep = *ait;
+			++ ait;
+			if (dep.strength < bit->strength) {
+				if (p_ma_strong_k_in != NULL && dep.strength < ObjCTypeRecord::ES_StrongIndirect)
+					++ (*p_ma_strong_k_in)[bit->type_index];
+				dep.strength = bit->strength;
 			}
+			merged.push_back(dep);
 		} else {
 			if (p_ma_k_in != NULL)
-				++ (*p_ma_k_in)[bit->first];
-			if (p_ma_strong_k_in != NULL && bit->second >= ObjCTypeRecord::ES_StrongIndirect)
-				++ (*p_ma_strong_k_in)[bit->first];
+				++ (*p_ma_k_in)[bit->type_index];
+			if (p_ma_strong_k_in != NULL && bit->strength >= ObjCTypeRecord::ES_StrongIndirect)
+				++ (*p_ma_strong_k_in)[bit->type_index];
+			merged.push_back(*bit);
 		}
 	}
+	merged.insert(merged.end(), ait, static_cast<const ObjCTypeRecord::DependencyList&>(a).end());
+	a.swap(merged);
 }
 
 #endif
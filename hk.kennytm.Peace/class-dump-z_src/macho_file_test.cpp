@@ -0,0 +1,1210 @@
+/*
+
+macho_file_test.cpp ... Test if MachO_File.cpp reads the dyld info and caches correctly.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MachO_File_ObjC.h"
+#include "SharedCache_File.h"
+#include "get_arch_from_flag.h"
+#include <mach-o/loader.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+
+static unsigned failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++ failures; } } while (0)
+
+// where the images are written. Removed with its content at the end.
+static string temp_directory;
+
+#pragma mark -
+#pragma mark Images
+
+static void append_uleb128(string& out, unsigned value) {
+	do {
+		unsigned char c = static_cast<unsigned char>(value & 0x7f);
+		value >>= 7;
+		if (value != 0)
+			c = static_cast<unsigned char>(c | 0x80);
+		out.push_back(static_cast<char>(c));
+	} while (value != 0);
+}
+
+template<typename T>
+static void append_struct(string& out, const T& value) {
+	out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void append_sleb128(string& out, int value) {
+	bool more = true;
+	while (more) {
+		unsigned char c = static_cast<unsigned char>(value & 0x7f);
+		value >>= 7;
+		more = !((value == 0 && !(c & 0x40)) || (value == -1 && (c & 0x40)));
+		if (more)
+			c = static_cast<unsigned char>(c | 0x80);
+		out.push_back(static_cast<char>(c));
+	}
+}
+
+// appends a dylib command naming the path, padded to 4 bytes.
+static void append_dylib_command(string& out, unsigned cmd, const string& path) {
+	dylib_command dylib;
+	memset(&dylib, 0, sizeof(dylib));
+	dylib.cmd = cmd;
+	dylib.cmdsize = static_cast<unsigned>((sizeof(dylib_command) + path.size() + 4) & ~3u);
+	dylib.dylib.name.offset = static_cast<unsigned>(sizeof(dylib_command));
+	append_struct(out, dylib);
+	out.append(path);
+	out.append(dylib.cmdsize - sizeof(dylib_command) - path.size(), '\0');
+}
+
+// A thin armv7 dylib assembled in memory. It has a __TEXT and a __DATA
+// segment of one section each, links to libraries, and the dyld info
+// streams follow the load commands. With a class list, the section of
+// __DATA is the __objc_classlist.
+struct TestImage {
+	vector<string> libraries;
+	string text;
+	vector<unsigned> class_list;
+	string binds, weak_binds, lazy_binds, exports;
+
+	string build() const;
+};
+
+static const unsigned TextAddress = 0x1000, DataAddress = 0x2000, SectionSize = 0x1000;
+
+string TestImage::build() const {
+	string dylib_commands;
+	for (vector<string>::const_iterator cit = libraries.begin(); cit != libraries.end(); ++ cit)
+		append_dylib_command(dylib_commands, LC_LOAD_DYLIB, *cit);
+
+	unsigned ncmds = 3 + static_cast<unsigned>(libraries.size());
+	unsigned sizeofcmds = static_cast<unsigned>(2 * (sizeof(segment_command) + sizeof(section)) + sizeof(dyld_info_command) + dylib_commands.size());
+
+	// the sections come first, then the streams.
+	unsigned text_offset = static_cast<unsigned>(sizeof(mach_header)) + sizeofcmds;
+	unsigned data_offset = text_offset + SectionSize;
+	unsigned binds_offset = data_offset + SectionSize;
+	unsigned weak_binds_offset = binds_offset + static_cast<unsigned>(binds.size());
+	unsigned lazy_binds_offset = weak_binds_offset + static_cast<unsigned>(weak_binds.size());
+	unsigned exports_offset = lazy_binds_offset + static_cast<unsigned>(lazy_binds.size());
+
+	string out;
+	mach_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MH_MAGIC;
+	header.cputype = CPU_TYPE_ARM;
+	header.cpusubtype = CPU_SUBTYPE_ARM_V7;
+	header.filetype = MH_DYLIB;
+	header.ncmds = ncmds;
+	header.sizeofcmds = sizeofcmds;
+	append_struct(out, header);
+
+	// the analysis reads the class list with read_integer(), but counts the
+	// entries in pointers.
+	string data;
+	for (vector<unsigned>::const_iterator cit = class_list.begin(); cit != class_list.end(); ++ cit)
+		append_struct(data, *cit);
+
+	const char* segment_names[] = {"__TEXT", "__DATA"};
+	const char* section_names[] = {"__text", class_list.empty() ? "__data" : "__objc_classlist"};
+	const unsigned addresses[] = {TextAddress, DataAddress};
+	const unsigned offsets[] = {text_offset, data_offset};
+	const unsigned sizes[] = {SectionSize, class_list.empty() ? SectionSize : static_cast<unsigned>(class_list.size() * sizeof(const class_t*))};
+	for (unsigned i = 0; i < 2; ++ i) {
+		segment_command seg;
+		memset(&seg, 0, sizeof(seg));
+		seg.cmd = LC_SEGMENT;
+		seg.cmdsize = static_cast<unsigned>(sizeof(segment_command) + sizeof(section));
+		memcpy(seg.segname, segment_names[i], strlen(segment_names[i]));
+		seg.vmaddr = addresses[i];
+		seg.vmsize = SectionSize;
+		seg.fileoff = offsets[i];
+		seg.filesize = SectionSize;
+		seg.nsects = 1;
+		append_struct(out, seg);
+
+		section sect;
+		memset(&sect, 0, sizeof(sect));
+		memcpy(sect.sectname, section_names[i], strlen(section_names[i]));
+		memcpy(sect.segname, segment_names[i], strlen(segment_names[i]));
+		sect.addr = addresses[i];
+		sect.size = sizes[i];
+		sect.offset = offsets[i];
+		append_struct(out, sect);
+	}
+
+	dyld_info_command dyld_info;
+	memset(&dyld_info, 0, sizeof(dyld_info));
+	dyld_info.cmd = LC_DYLD_INFO_ONLY;
+	dyld_info.cmdsize = static_cast<unsigned>(sizeof(dyld_info_command));
+	dyld_info.bind_off = binds_offset;
+	dyld_info.bind_size = static_cast<unsigned>(binds.size());
+	dyld_info.weak_bind_off = weak_binds_offset;
+	dyld_info.weak_bind_size = static_cast<unsigned>(weak_binds.size());
+	dyld_info.lazy_bind_off = lazy_binds_offset;
+	dyld_info.lazy_bind_size = static_cast<unsigned>(lazy_binds.size());
+	dyld_info.export_off = exports_offset;
+	dyld_info.export_size = static_cast<unsigned>(exports.size());
+	append_struct(out, dyld_info);
+	out.append(dylib_commands);
+
+	out.append(text);
+	out.append(SectionSize - text.size(), '\0');
+	out.append(data);
+	out.append(SectionSize - data.size(), '\0');
+	out.append(binds);
+	out.append(weak_binds);
+	out.append(lazy_binds);
+	out.append(exports);
+	return out;
+}
+
+static void write_file(const string& path, const string& content) {
+	FILE* f = fopen(path.c_str(), "wb");
+	if (f == NULL || fwrite(content.data(), 1, content.size(), f) != content.size()) {
+		printf("Cannot write '%s'.\n", path.c_str());
+		exit(2);
+	}
+	fclose(f);
+}
+
+static string write_image(const char* name, const string& content) {
+	string path = temp_directory + "/" + name;
+	write_file(path, content);
+	return path;
+}
+
+#pragma mark -
+#pragma mark Bind streams
+
+// appends the opcodes of a bind stream.
+struct BindStream {
+	string bytes;
+
+	BindStream& op(unsigned char opcode, unsigned imm = 0) { bytes.push_back(static_cast<char>(opcode | imm)); return *this; }
+	BindStream& uleb(unsigned value) { append_uleb128(bytes, value); return *this; }
+	BindStream& sleb(int value) { append_sleb128(bytes, value); return *this; }
+	BindStream& symbol(const char* name, unsigned flags = 0) { op(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, flags); bytes.append(name, strlen(name) + 1); return *this; }
+	BindStream& segment(unsigned index, unsigned offset) { return op(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB, index).uleb(offset); }
+};
+
+static bool has_binding(const MachO_File::BindRecord& r, unsigned address, const char* symbol, int library_ordinal, int addend, unsigned type, unsigned symbol_flags, MachO_File::BindKind kind) {
+	return r.address == address && r.symbol != NULL && strcmp(r.symbol, symbol) == 0 && r.library_ordinal == library_ordinal && r.addend == addend && r.type == type && r.symbol_flags == symbol_flags && r.kind == kind;
+}
+
+static void check_bind_opcodes() {
+	TestImage image;
+	image.libraries.push_back("/usr/lib/libone.dylib");
+	image.libraries.push_back("/usr/lib/libtwo.dylib");
+
+	BindStream binds;
+	binds.op(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM, 1).symbol("_one").op(BIND_OPCODE_SET_TYPE_IMM, BIND_TYPE_POINTER)
+		.segment(1, 0).op(BIND_OPCODE_DO_BIND)							// 0x2000
+		.op(BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB).uleb(8)						// 0x2004, then skip 8
+		.op(BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED, 1)						// 0x2010, then skip 4
+		.op(BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB).uleb(2).symbol("_two", BIND_SYMBOL_FLAGS_WEAK_IMPORT).op(BIND_OPCODE_SET_ADDEND_SLEB).sleb(-12)
+		.op(BIND_OPCODE_ADD_ADDR_ULEB).uleb(4)
+		.op(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB).uleb(3).uleb(4)	// 0x201c, 0x2024, 0x202c
+		.op(BIND_OPCODE_SET_DYLIB_SPECIAL_IMM, BIND_SPECIAL_DYLIB_FLAT_LOOKUP & BIND_IMMEDIATE_MASK).symbol("_flat").segment(0, 0x40).op(BIND_OPCODE_DO_BIND)
+		.op(BIND_OPCODE_DONE);
+	image.binds = binds.bytes;
+
+	BindStream weak_binds;
+	weak_binds.symbol("_weak").op(BIND_OPCODE_SET_TYPE_IMM, BIND_TYPE_TEXT_ABSOLUTE32).segment(1, 0x80).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE);
+	image.weak_binds = weak_binds.bytes;
+
+	// the lazy binding of 0x2000 comes last, so the first binding wins.
+	BindStream lazy_binds;
+	lazy_binds.op(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM, 2).symbol("_lazy").segment(1, 0x90).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE)
+		.symbol("_late").segment(1, 0).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE);
+	image.lazy_binds = lazy_binds.bytes;
+
+	MachO_File f (write_image("bind_opcodes.dylib", image.build()).c_str());
+	f.analyze(MachO_File::AF_All);
+	const vector<MachO_File::BindRecord>& records = f.bindings();
+
+	// every stream in order: bind, weak bind, lazy bind.
+	CHECK(records.size() == 10);
+	if (records.size() == 10) {
+		CHECK(has_binding(records[0], DataAddress, "_one", 1, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_Bind));
+		CHECK(has_binding(records[1], DataAddress + 0x4, "_one", 1, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_Bind));
+		CHECK(has_binding(records[2], DataAddress + 0x10, "_one", 1, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_Bind));
+		CHECK(has_binding(records[3], DataAddress + 0x1c, "_two", 2, -12, BIND_TYPE_POINTER, BIND_SYMBOL_FLAGS_WEAK_IMPORT, MachO_File::BK_Bind));
+		CHECK(has_binding(records[4], DataAddress + 0x24, "_two", 2, -12, BIND_TYPE_POINTER, BIND_SYMBOL_FLAGS_WEAK_IMPORT, MachO_File::BK_Bind));
+		CHECK(has_binding(records[5], DataAddress + 0x2c, "_two", 2, -12, BIND_TYPE_POINTER, BIND_SYMBOL_FLAGS_WEAK_IMPORT, MachO_File::BK_Bind));
+		CHECK(has_binding(records[6], TextAddress + 0x40, "_flat", BIND_SPECIAL_DYLIB_FLAT_LOOKUP, -12, BIND_TYPE_POINTER, 0, MachO_File::BK_Bind));
+		CHECK(has_binding(records[7], DataAddress + 0x80, "_weak", 0, 0, BIND_TYPE_TEXT_ABSOLUTE32, 0, MachO_File::BK_WeakBind));
+		CHECK(has_binding(records[8], DataAddress + 0x90, "_lazy", 2, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_LazyBind));
+		CHECK(has_binding(records[9], DataAddress, "_late", 2, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_LazyBind));
+	}
+
+	// the bound pointers are named after their symbols and libraries.
+	CHECK(f.string_representation(DataAddress) != NULL && strcmp(f.string_representation(DataAddress), "_one") == 0);
+	CHECK(f.string_representation(DataAddress + 0x24) != NULL && strcmp(f.string_representation(DataAddress + 0x24), "_two") == 0);
+	CHECK(f.string_representation(DataAddress + 0x90) != NULL && strcmp(f.string_representation(DataAddress + 0x90), "_lazy") == 0);
+	CHECK(f.library_of_relocated_symbol(DataAddress) != NULL && strcmp(f.library_of_relocated_symbol(DataAddress), "/usr/lib/libone.dylib") == 0);
+	CHECK(f.library_of_relocated_symbol(DataAddress + 0x2c) != NULL && strcmp(f.library_of_relocated_symbol(DataAddress + 0x2c), "/usr/lib/libtwo.dylib") == 0);
+	CHECK(f.library_of_relocated_symbol(TextAddress + 0x40) == NULL);
+}
+
+// malformed streams lose the affected bindings, but nothing else.
+static void check_bind_malformed() {
+	TestImage image;
+
+	// a count larger than the stream can mean, and a segment which does not
+	// exist (its offset is then taken as the address).
+	BindStream binds;
+	binds.symbol("_many").segment(1, 0).op(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB).uleb(0x10000000).uleb(0)
+		.segment(7, 0x30).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE);
+	image.binds = binds.bytes;
+
+	// a symbol name running to the end of the stream.
+	BindStream lazy_binds;
+	lazy_binds.symbol("_ok").segment(1, 0x40).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+	lazy_binds.bytes += "_cut";
+	image.lazy_binds = lazy_binds.bytes;
+
+	MachO_File f (write_image("bind_malformed.dylib", image.build()).c_str());
+	f.analyze(MachO_File::AF_Symbols);
+	const vector<MachO_File::BindRecord>& records = f.bindings();
+	CHECK(records.size() == 2);
+	if (records.size() == 2) {
+		CHECK(has_binding(records[0], 0x30, "_many", 0, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_Bind));
+		CHECK(has_binding(records[1], DataAddress + 0x40, "_ok", 0, 0, BIND_TYPE_POINTER, 0, MachO_File::BK_LazyBind));
+	}
+
+	// a stream past the end of the file is skipped as a whole.
+	string content = image.build();
+	content.resize(content.size() - image.lazy_binds.size() / 2);
+	MachO_File g (write_image("bind_truncated.dylib", content).c_str());
+	g.analyze(MachO_File::AF_Symbols);
+	CHECK(g.bindings().size() == 1);
+}
+
+#pragma mark -
+#pragma mark Export trie
+
+// A node of an export trie. The children refer to other nodes by index.
+struct TrieNode {
+	bool terminal;
+	unsigned flags, address;
+	vector<pair<string, unsigned> > children;
+
+	TrieNode() : terminal(false), flags(0), address(0) {}
+	TrieNode(unsigned flags_, unsigned address_) : terminal(true), flags(flags_), address(address_) {}
+	TrieNode& child(const char* label, unsigned node) { children.push_back(pair<string, unsigned>(label, node)); return *this; }
+};
+
+// lay out the nodes in order, node 0 being the root. The offsets of the
+// children change the size of the nodes, so repeat until they settle.
+static string assemble_trie(const vector<TrieNode>& nodes) {
+	vector<unsigned> offsets (nodes.size() + 1, 0);
+	string out;
+	while (true) {
+		out.clear();
+		vector<unsigned> new_offsets (nodes.size() + 1, 0);
+		for (unsigned i = 0; i < nodes.size(); ++ i) {
+			const TrieNode& node = nodes[i];
+			new_offsets[i] = static_cast<unsigned>(out.size());
+			string terminal;
+			if (node.terminal) {
+				append_uleb128(terminal, node.flags);
+				append_uleb128(terminal, node.address);
+			}
+			append_uleb128(out, static_cast<unsigned>(terminal.size()));
+			out.append(terminal);
+			out.push_back(static_cast<char>(node.children.size()));
+			for (vector<pair<string, unsigned> >::const_iterator cit = node.children.begin(); cit != node.children.end(); ++ cit) {
+				out.append(cit->first.c_str(), cit->first.size() + 1);
+				append_uleb128(out, offsets[cit->second]);
+			}
+		}
+		new_offsets[nodes.size()] = static_cast<unsigned>(out.size());
+		if (new_offsets == offsets)
+			return out;
+		offsets.swap(new_offsets);
+	}
+}
+
+struct ExportedSymbol {
+	string name;
+	unsigned flags, address;
+};
+
+static void collect_export(const char* name, unsigned flags, unsigned address, void* context) {
+	ExportedSymbol sym = {name, flags, address};
+	static_cast<vector<ExportedSymbol>*>(context)->push_back(sym);
+}
+
+// walk the exports of an image with this trie.
+static bool walk_trie(const char* name, const string& trie, vector<ExportedSymbol>& exports) {
+	TestImage image;
+	image.exports = trie;
+	MachO_File f (write_image(name, image.build()).c_str());
+
+	off_t location = f.tell();
+	bool retval = f.for_each_export(collect_export, &exports);
+	CHECK(f.tell() == location);
+	return retval;
+}
+
+static void check_export_trie_order() {
+	vector<TrieNode> nodes (5);
+	nodes[0].child("_a", 1).child("_b", 3).child("_c", 4);
+	nodes[1] = TrieNode(0, TextAddress + 0x10);
+	nodes[1].child("b", 2);
+	nodes[2] = TrieNode(EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION, TextAddress + 0x20);
+	nodes[3] = TrieNode(EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION, 1);
+	nodes[4] = TrieNode(0, DataAddress + 0x8);
+
+	vector<ExportedSymbol> exports;
+	CHECK(walk_trie("trie_order.dylib", assemble_trie(nodes), exports));
+	// depth first, with the children in their order in the file. The prefix
+	// is cut back after a subtree.
+	CHECK(exports.size() == 4);
+	if (exports.size() == 4) {
+		CHECK(exports[0].name == "_a" && exports[0].address == TextAddress + 0x10 && exports[0].flags == 0);
+		CHECK(exports[1].name == "_ab" && exports[1].address == TextAddress + 0x20 && exports[1].flags == EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION);
+		CHECK(exports[2].name == "_b" && exports[2].flags == EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION);
+		CHECK(exports[3].name == "_c" && exports[3].address == DataAddress + 0x8);
+	}
+
+	// the exports are loaded into the symbol index, except re-exports.
+	TestImage image;
+	image.exports = assemble_trie(nodes);
+	MachO_File f (write_image("trie_index.dylib", image.build()).c_str());
+	f.analyze(MachO_File::AF_Symbols | MachO_File::AF_SymbolNames);
+	CHECK(f.is_symbol(TextAddress + 0x10) && f.is_extern_symbol(TextAddress + 0x10));
+	CHECK(f.address_of_symbol("_ab") == TextAddress + 0x20);
+	CHECK(f.address_of_symbol("_c") == DataAddress + 0x8);
+	CHECK(f.address_of_symbol("_b") == 0);
+}
+
+// a chain of single-letter edges, deeper than a recursive walk would like.
+static void check_export_trie_deep() {
+	const unsigned depth = 20000;
+	vector<TrieNode> nodes (depth + 1);
+	for (unsigned i = 0; i < depth; ++ i)
+		nodes[i].child("x", i + 1);
+	nodes[depth] = TrieNode(0, TextAddress);
+
+	vector<ExportedSymbol> exports;
+	CHECK(walk_trie("trie_deep.dylib", assemble_trie(nodes), exports));
+	CHECK(exports.size() == 1 && exports[0].name == string(depth, 'x') && exports[0].address == TextAddress);
+}
+
+// malformed tries stop the walk with false. What was reported before stays.
+static void check_export_trie_malformed() {
+	vector<ExportedSymbol> exports;
+
+	// a child pointing back to the root.
+	vector<TrieNode> nodes (2);
+	nodes[0].child("_x", 1);
+	nodes[1] = TrieNode(0, TextAddress);
+	nodes[1].child("y", 0);
+	CHECK(!walk_trie("trie_cycle.dylib", assemble_trie(nodes), exports));
+	CHECK(!exports.empty() && exports[0].name == "_x");
+
+	// a child beyond the end of the trie.
+	exports.clear();
+	string trie = assemble_trie(vector<TrieNode>(1, TrieNode().child("_a", 0)));
+	trie[trie.size()-1] = 0x7f;
+	CHECK(!walk_trie("trie_beyond.dylib", trie, exports));
+	CHECK(exports.empty());
+
+	// a label running to the end of the trie.
+	exports.clear();
+	trie = assemble_trie(vector<TrieNode>(1, TrieNode().child("_a", 0)));
+	trie.resize(trie.size() - 2);
+	CHECK(!walk_trie("trie_label.dylib", trie, exports));
+
+	// a terminal without the children count.
+	exports.clear();
+	trie.clear();
+	trie.push_back(2);
+	trie.push_back(0);
+	trie.push_back(0x10);
+	CHECK(!walk_trie("trie_truncated.dylib", trie, exports));
+	CHECK(exports.size() == 1 && exports[0].name.empty() && exports[0].address == 0x10);
+}
+
+#pragma mark -
+#pragma mark Symbol cache
+
+// the header of a .symcache file, as written by MachO_File_cache.cpp.
+struct SymbolCacheHeader {
+	char magic[8];
+	unsigned version;
+	unsigned header_size;
+	unsigned char key[16];
+	int cputype, cpusubtype;
+	unsigned facets;
+	unsigned counts[7];
+	unsigned offsets[7];
+};
+enum { SCT_Index, SCT_IndexStrings, SCT_ObjCMethods, SCT_ExternalSymbols, SCT_LibraryOrdinals, SCT_Bindings, SCT_Strings };
+
+static string read_file(const string& path) {
+	string content;
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f != NULL) {
+		char buffer[4096];
+		size_t count;
+		while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			content.append(buffer, count);
+		fclose(f);
+	}
+	return content;
+}
+
+// the only file in the directory with the extension.
+static string find_cache_file(const string& directory, const char* extension) {
+	string path;
+	DIR* dir = opendir(directory.c_str());
+	if (dir != NULL) {
+		while (const dirent* entry = readdir(dir)) {
+			size_t length = strlen(entry->d_name);
+			if (length > strlen(extension) && strcmp(entry->d_name + length - strlen(extension), extension) == 0)
+				path = directory + "/" + entry->d_name;
+		}
+		closedir(dir);
+	}
+	return path;
+}
+
+// The checks below are shared by the symbol and the class cache. Loader opens
+// the image with its cache directory, and its load() tells whether the cache
+// was read and prints what the cache stores.
+
+// the first analysis writes the cache, the second one reads it. Returns the
+// cache, or an empty string if none was written.
+template<typename Loader>
+static string check_cache_round_trip(const string& path, const string& reference) {
+	string snapshot;
+	CHECK(!Loader::load(path, snapshot));
+	CHECK(snapshot == reference);
+
+	string cache = read_file(find_cache_file(Loader::directory(), Loader::extension()));
+	CHECK(cache.size() > Loader::header_size());
+	if (cache.size() <= Loader::header_size())
+		return "";
+
+	CHECK(Loader::load(path, snapshot));
+	CHECK(snapshot == reference);
+	return cache;
+}
+
+// the strings really come from the cache: a name renamed in its string pool
+// is printed renamed.
+template<typename Loader>
+static void check_cache_strings(const string& path, const string& cache, const char* name, const char* renamed, const char* expected) {
+	string tampered = cache;
+	size_t position = tampered.find(name, Loader::strings_offset(tampered));
+	CHECK(position != string::npos);
+	if (position == string::npos)
+		return;
+	tampered.replace(position, strlen(renamed), renamed);
+	write_file(find_cache_file(Loader::directory(), Loader::extension()), tampered);
+
+	string snapshot;
+	CHECK(Loader::load(path, snapshot));
+	CHECK(snapshot.find(expected) != string::npos);
+}
+
+// a valid cache, changed by corrupt, must be ignored and written again.
+template<typename Loader>
+static void check_cache_fallback(const string& path, const string& reference, const string& cache, void(*corrupt)(string& cache)) {
+	string cache_path = find_cache_file(Loader::directory(), Loader::extension());
+	string corrupted = cache;
+	corrupt(corrupted);
+	write_file(cache_path, corrupted);
+
+	string snapshot;
+	CHECK(!Loader::load(path, snapshot));
+	CHECK(snapshot == reference);
+	CHECK(read_file(cache_path) == cache);
+}
+
+
+static void append_indexed_symbol(unsigned addr, const char* symbol, MachO_File::StringType type, void* context) {
+	char line[32];
+	sprintf(line, "%08x %d ", addr, type);
+	string& out = *static_cast<string*>(context);
+	out += line;
+	out += symbol;
+	out += '\n';
+}
+
+// everything the symbol cache stores, as text.
+static string snapshot_symbols(const MachO_File& f) {
+	string out;
+	char line[64];
+	f.for_each_symbol(append_indexed_symbol, &out);
+	for (vector<MachO_File::BindRecord>::const_iterator cit = f.bindings().begin(); cit != f.bindings().end(); ++ cit) {
+		sprintf(line, "bind %08x %d %d %d %d %d ", cit->address, cit->library_ordinal, cit->addend, cit->type, cit->symbol_flags, cit->kind);
+		out += line;
+		out += cit->symbol;
+		out += '\n';
+	}
+	for (unsigned address = TextAddress; address < DataAddress + SectionSize; address += 4) {
+		sprintf(line, "%08x", address);
+		if (f.is_extern_symbol(address))
+			out += string("extern ") + line + '\n';
+		if (f.library_of_relocated_symbol(address) != NULL)
+			out += string("library ") + line + ' ' + f.library_of_relocated_symbol(address) + '\n';
+	}
+	return out;
+}
+
+static string symbol_cache_image() {
+	TestImage image;
+	image.libraries.push_back("/usr/lib/libone.dylib");
+	image.libraries.push_back("/usr/lib/libtwo.dylib");
+
+	BindStream binds;
+	binds.op(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM, 1).symbol("_one").segment(1, 0).op(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB).uleb(3).uleb(0)
+		.op(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM, 2).symbol("_two", BIND_SYMBOL_FLAGS_WEAK_IMPORT).op(BIND_OPCODE_SET_ADDEND_SLEB).sleb(-4).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE);
+	image.binds = binds.bytes;
+
+	vector<TrieNode> nodes (4);
+	nodes[0].child("_exported", 1).child("_other", 2).child("_third", 3);
+	nodes[1] = TrieNode(0, TextAddress + 0x10);
+	nodes[2] = TrieNode(0, TextAddress + 0x20);
+	nodes[3] = TrieNode(0, DataAddress + 0x40);
+	image.exports = assemble_trie(nodes);
+	return image.build();
+}
+
+static SymbolCacheHeader& cache_header(string& cache) { return *reinterpret_cast<SymbolCacheHeader*>(&cache[0]); }
+
+// only the symbols are asked for, but the cache covers every facet.
+struct SymbolCacheLoader {
+	static string directory() { return temp_directory + "/symbol_cache"; }
+	static const char* extension() { return ".symcache"; }
+	static size_t header_size() { return sizeof(SymbolCacheHeader); }
+	static size_t strings_offset(string& cache) { return cache_header(cache).offsets[SCT_Strings]; }
+
+	static bool load(const string& path, string& snapshot) {
+		MachO_File f (path.c_str());
+		f.set_symbol_cache(directory().c_str());
+		f.analyze(MachO_File::AF_Symbols);
+		CHECK(f.analyzed(MachO_File::AF_All));
+		snapshot = snapshot_symbols(f);
+		return f.loaded_from_symbol_cache();
+	}
+};
+
+static void truncate_cache(string& cache) {
+	cache.resize(cache.size() - cache_header(cache).counts[SCT_Strings] / 2 - 1);
+}
+static void corrupt_string_offset(string& cache) {
+	SymbolCacheHeader& header = cache_header(cache);
+	unsigned offset = header.counts[SCT_Strings] + 8;
+	memcpy(&cache[header.offsets[SCT_IndexStrings]], &offset, sizeof(offset));
+}
+static void unsort_index(string& cache) {
+	SymbolCacheHeader& header = cache_header(cache);
+	const size_t entry_size = 3 * sizeof(unsigned);
+	string first = cache.substr(header.offsets[SCT_Index], entry_size);
+	cache.replace(header.offsets[SCT_Index], entry_size, cache, header.offsets[SCT_Index] + entry_size, entry_size);
+	cache.replace(header.offsets[SCT_Index] + entry_size, entry_size, first);
+}
+static void unsort_external_symbols(string& cache) {
+	SymbolCacheHeader& header = cache_header(cache);
+	unsigned* externals = reinterpret_cast<unsigned*>(&cache[header.offsets[SCT_ExternalSymbols]]);
+	unsigned first = externals[0];
+	externals[0] = externals[1];
+	externals[1] = first;
+}
+
+static void check_symbol_cache() {
+	string path = write_image("symcache.dylib", symbol_cache_image());
+
+	MachO_File reference_file (path.c_str());
+	reference_file.analyze(MachO_File::AF_All);
+	string reference = snapshot_symbols(reference_file);
+	CHECK(reference.find("_exported") != string::npos && reference.find("bind ") != string::npos && reference.find("extern ") != string::npos && reference.find("library ") != string::npos);
+
+	string cache = check_cache_round_trip<SymbolCacheLoader>(path, reference);
+	if (cache.empty())
+		return;
+	check_cache_strings<SymbolCacheLoader>(path, cache, "_one", "_onE", " _onE\n");
+
+	check_cache_fallback<SymbolCacheLoader>(path, reference, cache, truncate_cache);
+	check_cache_fallback<SymbolCacheLoader>(path, reference, cache, corrupt_string_offset);
+	check_cache_fallback<SymbolCacheLoader>(path, reference, cache, unsort_index);
+	check_cache_fallback<SymbolCacheLoader>(path, reference, cache, unsort_external_symbols);
+}
+
+#pragma mark -
+#pragma mark Class cache
+
+template<typename T>
+static T vm_pointer(unsigned address) {
+	return reinterpret_cast<T>(static_cast<uintptr_t>(address));
+}
+
+// the Objective-C metadata in the __text section, in the structures of
+// objc-runtime-new.h.
+struct ObjCMetadata {
+	string bytes;
+
+	unsigned aligned_address() {
+		bytes.append((sizeof(void*) - bytes.size() % sizeof(void*)) % sizeof(void*), '\0');
+		return TextAddress + static_cast<unsigned>(bytes.size());
+	}
+	template<typename T>
+	unsigned add(const T& value) {
+		unsigned address = aligned_address();
+		append_struct(bytes, value);
+		return address;
+	}
+	unsigned add_string(const char* str) {
+		unsigned address = TextAddress + static_cast<unsigned>(bytes.size());
+		bytes.append(str, strlen(str) + 1);
+		return address;
+	}
+
+	method_t method(const char* name, const char* types, unsigned imp) {
+		method_t m;
+		m.name = vm_pointer<SEL>(add_string(name));
+		m.types = vm_pointer<const char*>(add_string(types));
+		m.imp = vm_pointer<IMP>(imp);
+		return m;
+	}
+	objc_property property(const char* name, const char* attributes) {
+		objc_property p;
+		p.name = vm_pointer<const char*>(add_string(name));
+		p.attributes = vm_pointer<const char*>(add_string(attributes));
+		return p;
+	}
+
+	// a method_list_t or objc_property_list with the entries.
+	template<typename T>
+	unsigned add_list(const vector<T>& entries) {
+		if (entries.empty())
+			return 0;
+		uint32_t header[2] = {static_cast<uint32_t>(sizeof(T)), static_cast<uint32_t>(entries.size())};
+		unsigned address = add(header);
+		for (typename vector<T>::const_iterator cit = entries.begin(); cit != entries.end(); ++ cit)
+			append_struct(bytes, *cit);
+		return address;
+	}
+
+	unsigned add_class(const char* name, unsigned flags, unsigned superclass, const vector<method_t>& class_methods, const vector<method_t>& instance_methods, const vector<objc_property>& properties);
+};
+
+unsigned ObjCMetadata::add_class(const char* name, unsigned flags, unsigned superclass, const vector<method_t>& class_methods, const vector<method_t>& instance_methods, const vector<objc_property>& properties) {
+	unsigned name_address = add_string(name);
+
+	class_ro_t meta_ro;
+	memset(&meta_ro, 0, sizeof(meta_ro));
+	meta_ro.flags = flags | RO_META;
+	meta_ro.name = vm_pointer<const char*>(name_address);
+	meta_ro.baseMethods = vm_pointer<const method_list_t*>(add_list(class_methods));
+	class_t metaclass;
+	memset(&metaclass, 0, sizeof(metaclass));
+	metaclass.data = vm_pointer<class_rw_t*>(add(meta_ro));
+	unsigned metaclass_address = add(metaclass);
+
+	class_ro_t ro;
+	memset(&ro, 0, sizeof(ro));
+	ro.flags = flags;
+	ro.name = vm_pointer<const char*>(name_address);
+	ro.baseMethods = vm_pointer<const method_list_t*>(add_list(instance_methods));
+	ro.baseProperties = vm_pointer<const objc_property_list*>(add_list(properties));
+	class_t cls;
+	memset(&cls, 0, sizeof(cls));
+	cls.isa = vm_pointer<class_t*>(metaclass_address);
+	cls.superclass = vm_pointer<class_t*>(superclass);
+	cls.data = vm_pointer<class_rw_t*>(add(ro));
+	return add(cls);
+}
+
+// the header of a .classcache file, as written by MachO_File_ObjC_cache.cpp.
+struct ClassCacheHeader {
+	char magic[8];
+	unsigned version;
+	unsigned header_size;
+	unsigned char key[16];
+	int cputype, cpusubtype;
+	unsigned counts[4];
+	unsigned offsets[4];
+};
+enum { CCT_Classes, CCT_Properties, CCT_Methods, CCT_Strings };
+struct CachedClass {
+	unsigned name, vm_address, attributes, superclass, superclass_name, superclass_library, property_count, method_count;
+};
+struct CachedMethod {
+	unsigned raw_name, types, type_count, vm_address, is_class_method;
+};
+
+// a root class, a subclass of it and a subclass of NSObject from libobjc.
+static string class_cache_image() {
+	TestImage image;
+	image.libraries.push_back("/usr/lib/libobjc.A.dylib");
+	ObjCMetadata objc;
+
+	vector<method_t> class_methods, instance_methods;
+	vector<objc_property> properties;
+	class_methods.push_back(objc.method("alloc", "@8@0:4", TextAddress + 0xf00));
+	instance_methods.push_back(objc.method("init", "@8@0:4", TextAddress + 0xf04));
+	instance_methods.push_back(objc.method("description", "@8@0:4", TextAddress + 0xf08));
+	properties.push_back(objc.property("description", "T@\"NSString\",R,C,N"));
+	unsigned root = objc.add_class("TestRoot", RO_ROOT, 0, class_methods, instance_methods, properties);
+
+	class_methods.clear();
+	instance_methods.clear();
+	properties.clear();
+	instance_methods.push_back(objc.method("init", "@8@0:4", TextAddress + 0xf0c));
+	instance_methods.push_back(objc.method("setValue:", "v12@0:4i8", TextAddress + 0xf10));
+	instance_methods.push_back(objc.method("value", "i8@0:4", TextAddress + 0xf14));
+	properties.push_back(objc.property("value", "Ti,N,V_value"));
+	unsigned derived = objc.add_class("TestDerived", 0, root, class_methods, instance_methods, properties);
+
+	instance_methods.clear();
+	properties.clear();
+	class_methods.push_back(objc.method("sharedObject", "@8@0:4", TextAddress + 0xf18));
+	instance_methods.push_back(objc.method("run", "v8@0:4", TextAddress + 0xf1c));
+	unsigned external = objc.add_class("TestExternal", 0, 0, class_methods, instance_methods, properties);
+
+	BindStream binds;
+	binds.op(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM, 1).symbol("_OBJC_CLASS_$_NSObject")
+		.segment(0, external + static_cast<unsigned>(offsetof(class_t, superclass)) - TextAddress).op(BIND_OPCODE_DO_BIND).op(BIND_OPCODE_DONE);
+	image.binds = binds.bytes;
+
+	image.text = objc.bytes;
+	image.class_list.push_back(root);
+	image.class_list.push_back(derived);
+	image.class_list.push_back(external);
+	return image.build();
+}
+
+// the number of classes, and the classes as class-dump-z prints them.
+static string snapshot_classes(MachO_File_ObjC& f) {
+	f.set_dont_typedef(false);
+	f.set_ida_pro_mode(false);
+	FILE* out = tmpfile();
+	if (out == NULL)
+		return "";
+	fprintf(out, "%u classes\n", f.class_count());
+	f.print_class_type(MachO_File_ObjC::SB_None, true, 0, false, MachO_File_ObjC::SB_None, false, NULL, out);
+	string content;
+	char buffer[4096];
+	size_t count;
+	rewind(out);
+	while ((count = fread(buffer, 1, sizeof(buffer), out)) > 0)
+		content.append(buffer, count);
+	fclose(out);
+	return content;
+}
+
+static ClassCacheHeader& class_cache_header(string& cache) { return *reinterpret_cast<ClassCacheHeader*>(&cache[0]); }
+
+struct ClassCacheLoader {
+	static string directory() { return temp_directory + "/class_cache"; }
+	static const char* extension() { return ".classcache"; }
+	static size_t header_size() { return sizeof(ClassCacheHeader); }
+	static size_t strings_offset(string& cache) { return class_cache_header(cache).offsets[CCT_Strings]; }
+
+	static bool load(const string& path, string& snapshot) {
+		MachO_File_ObjC f (path.c_str(), true, "any", directory().c_str());
+		snapshot = snapshot_classes(f);
+		return f.loaded_from_class_cache();
+	}
+};
+
+static void truncate_class_cache(string& cache) {
+	cache.resize(class_cache_header(cache).offsets[CCT_Methods] + sizeof(CachedMethod));
+}
+static void corrupt_class_name_offset(string& cache) {
+	ClassCacheHeader& header = class_cache_header(cache);
+	CachedClass* classes = reinterpret_cast<CachedClass*>(&cache[header.offsets[CCT_Classes]]);
+	classes[0].name = header.counts[CCT_Strings] + 8;
+}
+// +alloc of TestRoot follows one of its instance methods.
+static void unsort_class_methods(string& cache) {
+	ClassCacheHeader& header = class_cache_header(cache);
+	CachedMethod* methods = reinterpret_cast<CachedMethod*>(&cache[header.offsets[CCT_Methods]]);
+	CHECK(methods[0].is_class_method == 1 && methods[1].is_class_method == 0);
+	methods[0].is_class_method = 0;
+	methods[1].is_class_method = 1;
+}
+
+static void check_class_cache() {
+	string path = write_image("classcache.dylib", class_cache_image());
+
+	MachO_File_ObjC reference_file (path.c_str(), true);
+	string reference = snapshot_classes(reference_file);
+	CHECK(reference.find("3 classes\n") == 0);
+	CHECK(reference.find("@interface TestDerived : TestRoot") != string::npos);
+	CHECK(reference.find("@interface TestExternal : NSObject") != string::npos);
+	CHECK(reference.find("+(id)alloc;") != string::npos && reference.find("@property(assign, nonatomic) int value;") != string::npos);
+
+	string cache = check_cache_round_trip<ClassCacheLoader>(path, reference);
+	if (cache.empty())
+		return;
+	check_cache_strings<ClassCacheLoader>(path, cache, "TestDerived", "TestXerived", "@interface TestXerived : TestRoot");
+
+	check_cache_fallback<ClassCacheLoader>(path, reference, cache, truncate_class_cache);
+	check_cache_fallback<ClassCacheLoader>(path, reference, cache, corrupt_class_name_offset);
+	check_cache_fallback<ClassCacheLoader>(path, reference, cache, unsort_class_methods);
+}
+
+#pragma mark -
+#pragma mark Shared cache
+
+// A dyld shared cache assembled in memory. The TEXT mapping starts at file
+// offset 0 and holds the cache header, the tables, and the headers and
+// __text of every image, one page each. The DATA mapping follows TEXT in
+// memory but not in the file, and holds the __data of every image after a
+// free slot. With a span, the first image also has a __span section which
+// starts at the end of TEXT and runs into that slot.
+struct TestCache {
+	unsigned image_count;
+	bool span;
+
+	TestCache(unsigned image_count_, bool span_) : image_count(image_count_), span(span_) {}
+	string build() const;
+};
+
+static const unsigned CacheAddress = 0x30000000, CachePageSize = 0x1000, CacheSectionSize = 0x100, CacheSpanSize = 0x20;
+
+static string cache_image_path(unsigned i) {
+	char path[64];
+	sprintf(path, "/usr/lib/libtest%u.dylib", i);
+	return path;
+}
+
+static unsigned round_to_page(size_t size) {
+	return static_cast<unsigned>((size + CachePageSize - 1) & ~static_cast<size_t>(CachePageSize - 1));
+}
+
+static void append_cache_section(string& out, const char* segment_name, const char* section_name, unsigned address, unsigned size, unsigned offset) {
+	section sect;
+	memset(&sect, 0, sizeof(sect));
+	memcpy(sect.sectname, section_name, strlen(section_name));
+	memcpy(sect.segname, segment_name, strlen(segment_name));
+	sect.addr = address;
+	sect.size = size;
+	sect.offset = offset;
+	append_struct(out, sect);
+}
+
+static void append_cache_segment(string& out, const char* name, unsigned address, unsigned size, unsigned offset, unsigned nsects) {
+	segment_command seg;
+	memset(&seg, 0, sizeof(seg));
+	seg.cmd = LC_SEGMENT;
+	seg.cmdsize = static_cast<unsigned>(sizeof(segment_command) + nsects * sizeof(section));
+	memcpy(seg.segname, name, strlen(name));
+	seg.vmaddr = address;
+	seg.vmsize = size;
+	seg.fileoff = offset;
+	seg.filesize = size;
+	seg.nsects = nsects;
+	append_struct(out, seg);
+}
+
+string TestCache::build() const {
+	unsigned mappings_offset = static_cast<unsigned>(sizeof(dyld_cache_header));
+	unsigned images_offset = mappings_offset + static_cast<unsigned>(2 * sizeof(dyld_cache_mapping_info));
+	unsigned paths_offset = images_offset + image_count * static_cast<unsigned>(sizeof(dyld_cache_image_info));
+
+	string paths;
+	vector<unsigned> path_offsets;
+	for (unsigned i = 0; i < image_count; ++ i) {
+		path_offsets.push_back(paths_offset + static_cast<unsigned>(paths.size()));
+		paths.append(cache_image_path(i));
+		paths.push_back('\0');
+	}
+
+	// a page is left out between the mappings in the file.
+	unsigned images_begin = round_to_page(paths_offset + paths.size());
+	unsigned text_size = images_begin + image_count * CachePageSize;
+	unsigned data_offset = text_size + CachePageSize;
+	unsigned data_address = CacheAddress + text_size;
+	unsigned data_size = round_to_page((image_count + 1) * CacheSectionSize);
+
+	string out (data_offset + data_size, '\0');
+
+	dyld_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "dyld_v1   armv7", sizeof(header.magic));
+	header.mappingOffset = mappings_offset;
+	header.mappingCount = 2;
+	header.imagesOffset = images_offset;
+	header.imagesCount = image_count;
+	string tables;
+	append_struct(tables, header);
+
+	const unsigned mapping_addresses[] = {CacheAddress, data_address};
+	const unsigned mapping_sizes[] = {text_size, data_size};
+	const unsigned mapping_offsets[] = {0, data_offset};
+	for (unsigned i = 0; i < 2; ++ i) {
+		dyld_cache_mapping_info mapping;
+		memset(&mapping, 0, sizeof(mapping));
+		mapping.address = mapping_addresses[i];
+		mapping.size = mapping_sizes[i];
+		mapping.fileOffset = mapping_offsets[i];
+		mapping.maxProt = mapping.initProt = i == 0 ? 5 : 3;
+		append_struct(tables, mapping);
+	}
+
+	for (unsigned i = 0; i < image_count; ++ i) {
+		dyld_cache_image_info image;
+		memset(&image, 0, sizeof(image));
+		image.address = CacheAddress + images_begin + i * CachePageSize;
+		image.pathFileOffset = path_offsets[i];
+		append_struct(tables, image);
+	}
+	tables.append(paths);
+	out.replace(0, tables.size(), tables);
+
+	for (unsigned i = 0; i < image_count; ++ i) {
+		string path = cache_image_path(i);
+		unsigned header_offset = images_begin + i * CachePageSize;
+		unsigned header_address = CacheAddress + header_offset;
+		unsigned text_offset = header_offset + CachePageSize / 2;
+		unsigned image_data_offset = data_offset + (i+1) * CacheSectionSize;
+		unsigned image_data_address = data_address + (i+1) * CacheSectionSize;
+		bool has_span = span && i == 0;
+
+		string commands;
+		append_cache_segment(commands, "__TEXT", header_address, CachePageSize, header_offset, has_span ? 2 : 1);
+		append_cache_section(commands, "__TEXT", "__text", CacheAddress + text_offset, CacheSectionSize, text_offset);
+		if (has_span)
+			append_cache_section(commands, "__TEXT", "__span", data_address - CacheSpanSize / 2, CacheSpanSize, text_size - CacheSpanSize / 2);
+		append_cache_segment(commands, "__DATA", image_data_address, CacheSectionSize, image_data_offset, 1);
+		append_cache_section(commands, "__DATA", "__data", image_data_address, CacheSectionSize, image_data_offset);
+		append_dylib_command(commands, LC_ID_DYLIB, path);
+		append_dylib_command(commands, LC_LOAD_DYLIB, i == 0 ? "/usr/lib/libSystem.B.dylib" : cache_image_path(i-1));
+
+		mach_header image_header;
+		memset(&image_header, 0, sizeof(image_header));
+		image_header.magic = MH_MAGIC;
+		image_header.cputype = CPU_TYPE_ARM;
+		image_header.cpusubtype = CPU_SUBTYPE_ARM_V7;
+		image_header.filetype = MH_DYLIB;
+		image_header.ncmds = 4;
+		image_header.sizeofcmds = static_cast<unsigned>(commands.size());
+		string image;
+		append_struct(image, image_header);
+		image.append(commands);
+		out.replace(header_offset, image.size(), image);
+
+		string text = "text of " + path, data = "data of " + path;
+		out.replace(text_offset, text.size(), text);
+		out.replace(image_data_offset, data.size(), data);
+	}
+
+	return out;
+}
+
+static dyld_cache_header& shared_cache_header(string& cache) { return *reinterpret_cast<dyld_cache_header*>(&cache[0]); }
+static dyld_cache_mapping_info& shared_cache_mapping(string& cache, unsigned i) {
+	return *reinterpret_cast<dyld_cache_mapping_info*>(&cache[shared_cache_header(cache).mappingOffset + i * sizeof(dyld_cache_mapping_info)]);
+}
+
+// checks that the marker of the section is read through the image.
+static bool has_marker(const MachO_File_Simple& image, const char* segment_name, const char* section_name, const string& marker) {
+	const section* s = image.section_having_name(segment_name, section_name);
+	if (s == NULL)
+		return false;
+	const char* content = image.peek_data_at_vm_address<char>(s->addr);
+	return content != NULL && marker == content;
+}
+
+static void check_shared_cache_images() {
+	const unsigned count = 12;
+	string path = write_image("dyld_shared_cache_armv7", TestCache(count, true).build());
+	SharedCache_File cache (path.c_str());
+	CHECK(cache.valid());
+	CHECK(strcmp(cache.arch(), "armv7") == 0);
+	CHECK(cache.images().size() == count);
+	if (cache.images().size() != count)
+		return;
+
+	// "libtest10" sorts before "libtest2", so the path index is not the
+	// image order.
+	for (unsigned i = 0; i < count; ++ i) {
+		string image_path = cache_image_path(i);
+		CHECK(image_path == cache.images()[i].path);
+		CHECK(cache.image_index(image_path.c_str()) == static_cast<int>(i));
+
+		MachO_File_Simple image (cache, i);
+		CHECK(image.valid());
+		CHECK(image.origin() == cache.images()[i].offset);
+		CHECK(image.self_path() != NULL && image_path == image.self_path());
+		vector<string> libraries = image.linked_libraries("/sysroot");
+		CHECK(libraries.size() == 1 && libraries[0] == "/sysroot" + (i == 0 ? string("/usr/lib/libSystem.B.dylib") : cache_image_path(i-1)));
+		CHECK(has_marker(image, "__TEXT", "__text", "text of " + image_path));
+		CHECK(has_marker(image, "__DATA", "__data", "data of " + image_path));
+	}
+	CHECK(cache.image_index("/usr/lib/libtest") == -1);
+	CHECK(cache.image_index("/usr/lib/libtest1.dylib/") == -1);
+	CHECK(cache.image_index("") == -1);
+
+	// both ends of the span are mapped, but not next to each other.
+	MachO_File_Simple first (cache, 0);
+	const section* span = first.section_having_name("__TEXT", "__span");
+	CHECK(span != NULL);
+	if (span != NULL) {
+		off_t begin = cache.to_file_offset(span->addr), end = cache.to_file_offset(span->addr + span->size - 1);
+		CHECK(begin != 0 && end != 0 && end != begin + static_cast<off_t>(span->size - 1));
+		CHECK(first.to_file_offset(span->addr) == 0);
+		CHECK(first.peek_data_at_vm_address<char>(span->addr + span->size - 1) == NULL);
+	}
+
+	bool thrown = false;
+	try {
+		MachO_File_Simple missing (cache, count);
+	} catch (const TRException&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+static bool shared_cache_rejected(const string& content) {
+	string path = write_image("damaged_cache", content);
+	try {
+		SharedCache_File cache (path.c_str());
+	} catch (const TRException&) {
+		return true;
+	}
+	return false;
+}
+
+static void check_shared_cache_damaged() {
+	const string reference = TestCache(3, false).build();
+	string cache;
+
+	// tables which run past the end of the file.
+	cache = reference;
+	shared_cache_header(cache).mappingCount = 0xffffffff;
+	CHECK(shared_cache_rejected(cache));
+	cache = reference;
+	shared_cache_header(cache).imagesCount = 0x10000000;
+	CHECK(shared_cache_rejected(cache));
+	cache = reference;
+	shared_cache_header(cache).mappingOffset = static_cast<uint32_t>(cache.size());
+	CHECK(shared_cache_rejected(cache));
+	CHECK(shared_cache_rejected(reference.substr(0, sizeof(dyld_cache_header) + sizeof(dyld_cache_mapping_info) + 8)));
+	CHECK(!shared_cache_rejected(reference));
+
+	// not a cache.
+	cache = reference;
+	memcpy(shared_cache_header(cache).magic, "dyld_v2 ", 8);
+	{
+		string path = write_image("damaged_cache", cache);
+		SharedCache_File damaged (path.c_str());
+		CHECK(!damaged.valid());
+	}
+
+	// the TEXT mapping starts past the end of the file, so it is dropped with
+	// the headers of all images.
+	cache = reference;
+	shared_cache_mapping(cache, 0).fileOffset = cache.size();
+	{
+		string path = write_image("damaged_cache", cache);
+		SharedCache_File damaged (path.c_str());
+		CHECK(damaged.valid());
+		CHECK(damaged.images().empty());
+	}
+
+	// the file ends after the __data of the first image. The DATA mapping is
+	// clipped there.
+	cache = reference;
+	cache.resize(static_cast<size_t>(shared_cache_mapping(cache, 1).fileOffset) + 2 * CacheSectionSize);
+	{
+		string path = write_image("damaged_cache", cache);
+		SharedCache_File damaged (path.c_str());
+		CHECK(damaged.valid());
+		CHECK(damaged.images().size() == 3);
+		if (damaged.images().size() == 3) {
+			MachO_File_Simple first (damaged, 0), second (damaged, 1);
+			CHECK(has_marker(first, "__DATA", "__data", "data of " + cache_image_path(0)));
+			CHECK(!has_marker(second, "__DATA", "__data", "data of " + cache_image_path(1)));
+			CHECK(has_marker(second, "__TEXT", "__text", "text of " + cache_image_path(1)));
+			const section* data = second.section_having_name("__DATA", "__data");
+			CHECK(data != NULL && damaged.to_file_offset(data->addr) == 0);
+		}
+	}
+}
+
+#pragma mark -
+
+static void remove_directory(const string& directory) {
+	DIR* dir = opendir(directory.c_str());
+	if (dir != NULL) {
+		while (const dirent* entry = readdir(dir)) {
+			if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+				string path = directory + "/" + entry->d_name;
+				if (remove(path.c_str()) != 0)
+					remove_directory(path);
+			}
+		}
+		closedir(dir);
+	}
+	rmdir(directory.c_str());
+}
+
+int main (int argc, char* argv[]) {
+	// writes a cache for macho_bench -shared-cache instead.
+	if (argc == 4 && strcmp(argv[1], "-shared-cache") == 0) {
+		write_file(argv[2], TestCache(static_cast<unsigned>(strtoul(argv[3], NULL, 0)), false).build());
+		return 0;
+	}
+
+	char directory[] = "/tmp/macho_file_test.XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		perror("Cannot create the temporary directory");
+		return 2;
+	}
+	temp_directory = directory;
+
+	try {
+		check_bind_opcodes();
+		check_bind_malformed();
+		check_export_trie_order();
+		check_export_trie_deep();
+		check_export_trie_malformed();
+		check_symbol_cache();
+		check_class_cache();
+		check_shared_cache_images();
+		check_shared_cache_damaged();
+	} catch (const TRException& e) {
+		printf("Unexpected exception: %s\n", e.what());
+		++ failures;
+	}
+
+	remove_directory(temp_directory);
+
+	if (failures == 0)
+		printf("All checks passed.\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -25,7 +25,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 #include <cctype>
 #include "crc32.h"
-#include "balanced_substr.h"
 #include "string_util.h"
 #include "combine_dependencies.h"
 #include "hash_combine.h"
@@ -34,6 +33,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define __alignof__ __alignof
 #endif
 
+#ifdef BOOST_FUNCTIONAL_HASH_HASH_HPP
+using boost::hash_combine;
+#endif
+
 using namespace std;
 
 static const char* map314[] = {
@@ -93,8 +96,127 @@ static inline bool name_Refable(const string& pretty_name) throw() {
 
 
 
+// Two types can only be compatible (see is_compatible_with()) if they have the
+// same leading character and value, and
+//  - the same name, when both are named, or
+//  - compatible subtypes, when both have subtypes, or
+//  - one of them has neither a name nor subtypes.
+// Field names and missing content do not matter. So every type is filed under
+//  - its name, if any,
+//  - the index of its only subtype, or the leading characters and values of
+//    its subtypes if there are more (which never change when a type is
+//    replaced by a more complete one),
+//  - the bare leading character and value, if it has neither,
+//  - and the leading character and value ("any type"),
+// and a new type is only checked against the types filed under one of the
+// keys it could match. A type with one subtype (a pointer, an array...) looks
+// up every stored type compatible with that subtype, so ^{Foo} is only checked
+// against pointers to some struct Foo.
+enum MergeKeyKind {
+	MK_Bare,
+	MK_Name,
+	MK_Subtype,
+	MK_Shape,
+	MK_Any
+};
+
+static size_t merge_key(MergeKeyKind kind, char type, const string& value) throw() {
+	size_t key = 0;
+	hash_combine(key, static_cast<int>(kind));
+	hash_combine(key, static_cast<int>(type));
+	hash_combine(key, value);
+	return key;
+}
+
+void ObjCTypeRecord::merge_keys(const Type& type, vector<size_t>& res) const {
+	if (!type.name.empty()) {
+		size_t key = merge_key(MK_Name, type.type, type.value);
+		hash_combine(key, type.name);
+		res.push_back(key);
+	}
+	if (type.subtypes.size() == 1) {
+		size_t key = merge_key(MK_Subtype, type.type, type.value);
+		hash_combine(key, type.subtypes[0]);
+		res.push_back(key);
+	} else if (!type.subtypes.empty()) {
+		size_t key = merge_key(MK_Shape, type.type, type.value);
+		hash_combine(key, type.subtypes.size());
+		for (vector<TypeIndex>::const_iterator cit = type.subtypes.begin(); cit != type.subtypes.end(); ++ cit) {
+			const Type& subtype = ma_type_store[*cit];
+			hash_combine(key, static_cast<int>(subtype.type));
+			hash_combine(key, subtype.value);
+		}
+		res.push_back(key);
+	} else if (type.name.empty())
+		res.push_back(merge_key(MK_Bare, type.type, type.value));
+	res.push_back(merge_key(MK_Any, type.type, type.value));
+}
+
+void ObjCTypeRecord::add_merge_candidate(const Type& type, TypeIndex type_index) {
+	vector<size_t> keys;
+	merge_keys(type, keys);
+	for (vector<size_t>::const_iterator cit = keys.begin(); cit != keys.end(); ++ cit) {
+		vector<TypeIndex>& bucket = ma_merge_candidates[*cit];
+		// a replaced type keeps its index, and may be filed under new keys.
+		if (bucket.empty() || bucket.back() < type_index)
+			bucket.push_back(type_index);
+		else {
+			vector<TypeIndex>::iterator it = lower_bound(bucket.begin(), bucket.end(), type_index);
+			if (*it != type_index)
+				bucket.insert(it, type_index);
+		}
+	}
+}
+
+void ObjCTypeRecord::append_bucket(size_t key, vector<TypeIndex>& res) const {
+	tr1::unordered_map<size_t, vector<TypeIndex> >::const_iterator bucket = ma_merge_candidates.find(key);
+	if (bucket != ma_merge_candidates.end())
+		res.insert(res.end(), bucket->second.begin(), bucket->second.end());
+}
+
+void ObjCTypeRecord::merge_candidates(const Type& type, vector<TypeIndex>& res, vector<TypeIndex>& expanding) const {
+	if (!type.name.empty()) {
+		size_t key = merge_key(MK_Name, type.type, type.value);
+		hash_combine(key, type.name);
+		append_bucket(key, res);
+	}
+	if (type.subtypes.size() == 1) {
+		// anything filed under a subtype compatible with ours. A recursive type
+		// can only be checked against everything of the same kind.
+		TypeIndex subtype_index = type.subtypes[0];
+		const Type& subtype = ma_type_store[subtype_index];
+		vector<TypeIndex> subtype_candidates;
+		if (find(expanding.begin(), expanding.end(), subtype_index) == expanding.end()) {
+			expanding.push_back(subtype_index);
+			merge_candidates(subtype, subtype_candidates, expanding);
+			expanding.pop_back();
+		} else
+			append_bucket(merge_key(MK_Any, subtype.type, subtype.value), subtype_candidates);
+		subtype_candidates.push_back(subtype_index);
+		for (vector<TypeIndex>::const_iterator cit = subtype_candidates.begin(); cit != subtype_candidates.end(); ++ cit) {
+			tr1::unordered_set<TypePointerPair> banned_pairs;
+			if (*cit == subtype_index || ma_type_store[*cit].is_compatible_with(subtype, *this, banned_pairs)) {
+				size_t key = merge_key(MK_Subtype, type.type, type.value);
+				hash_combine(key, *cit);
+				append_bucket(key, res);
+			}
+		}
+	} else if (!type.subtypes.empty()) {
+		vector<size_t> keys;
+		merge_keys(type, keys);
+		append_bucket(keys[type.name.empty() ? 0 : 1], res);
+	} else if (type.name.empty() || (type.type != '{' && type.type != '('))
+		// a named undeclared struct only matches its own name (see (3) in
+		// is_compatible_with()).
+		append_bucket(merge_key(MK_Any, type.type, type.value), res);
+	append_bucket(merge_key(MK_Bare, type.type, type.value), res);
+	
+	sort(res.begin(), res.end());
+	res.erase(unique(res.begin(), res.end()), res.end());
+}
+
 ObjCTypeRecord::TypeIndex ObjCTypeRecord::parse(const string& type_to_parse, bool is_struct_used_locally) {
-	tr1::unordered_map<string, TypeIndex>::const_iterator p_index = ma_indexed_types.find(type_to_parse);
+	tr1::unordered_map<const char*, TypeIndex, EncodingHash, EncodingEqual>::const_iterator p_index = ma_indexed_types.find(type_to_parse.c_str());
 		
 	if (p_index != ma_indexed_types.end()) {
 		Type& retval = ma_type_store[p_index->second];
@@ -107,33 +229,41 @@ ObjCTypeRecord::TypeIndex ObjCTypeRecord::parse(const string& type_to_parse, boo
 	}
 	
 	Type t = Type(*this, type_to_parse, is_struct_used_locally);
+	t.encoding = m_encodings.store(type_to_parse);
 	
 	TypeIndex ret_index = ma_type_store.size();
 	t.type_index = ret_index;
 	
 	// merge struct with the same name, typesignature etc. 
 	if (t.type != '@' && (!t.subtypes.empty() || !t.name.empty())) {
-		ret_index = 0;
+		// in the order of the store, as if every type were checked.
+		vector<TypeIndex> candidates, expanding;
+		merge_candidates(t, candidates, expanding);
+		
 		tr1::unordered_set<TypePointerPair> banned_pairs;
-		for (vector<Type>::iterator cit = ma_type_store.begin(); cit != ma_type_store.end(); ++ cit, ++ ret_index) {
-			if (cit->is_compatible_with(t, *this, banned_pairs)) {
+		for (vector<TypeIndex>::const_iterator cit = candidates.begin(); cit != candidates.end(); ++ cit) {
+			Type& other = ma_type_store[*cit];
+			if (other.is_compatible_with(t, *this, banned_pairs)) {
+				ret_index = *cit;
 				if (is_struct_used_locally) {
-					t.refcount = cit->refcount;
+					t.refcount = other.refcount;
 				} else
-					cit->refcount = Type::used_globally;
-				ma_indexed_types.insert(pair<string,unsigned>(type_to_parse, ret_index));
-				if (t.is_more_complete_than(*cit)) {
-					t.type_index = cit->type_index;
-					*cit = t;
+					other.refcount = Type::used_globally;
+				ma_indexed_types.insert(pair<const char*,unsigned>(t.encoding, ret_index));
+				if (t.is_more_complete_than(other)) {
+					t.type_index = other.type_index;
+					other = t;
+					add_merge_candidate(other, ret_index);
 				} else
-					t = *cit;
+					t = other;
 				goto combined;
 			}
 		}
 	}
 	
 	ma_type_store.push_back(t);
-	ma_indexed_types.insert(pair<string,unsigned>(type_to_parse, ret_index));
+	ma_indexed_types.insert(pair<const char*,unsigned>(t.encoding, ret_index));
+	add_merge_candidate(t, ret_index);
 	
 combined:
 	// add strong link to its children. (only for unions & structs.)
@@ -144,8 +274,29 @@ combined:
 	return ret_index;
 }
 
-string ObjCTypeRecord::format_forward_declaration(const vector<TypeIndex>& type_indices) const throw() {
-	string class_refs, protocol_refs, struct_refs;
+void ObjCTypeRecord::parse_signature(const char* signature, vector<TypeIndex>& types) {
+	if (ma_signature_memo.empty())
+		ma_signature_memo.resize(signature_memo_size);
+	SignatureMemo& memo = ma_signature_memo[EncodingHash()(signature) & (signature_memo_size-1)];
+	
+	if (memo.signature != signature) {
+		memo.types.clear();
+		unsigned first = m_tokenizer.tokenize_signature(signature);
+		unsigned last = m_tokenizer.size();
+		string type_string;
+		for (unsigned i = first; i < last; ++ i) {
+			type_string.assign(m_tokenizer[i].begin, m_tokenizer[i].length);
+			memo.types.push_back(parse(type_string, false));
+		}
+		m_tokenizer.truncate(first);
+		memo.signature = signature;
+	}
+	
+	types.insert(types.end(), memo.types.begin(), memo.types.end());
+}
+
+void ObjCTypeRecord::format_forward_declaration(OutputSink& out, const vector<TypeIndex>& type_indices) const throw() {
+	string class_refs, protocol_refs;
 	
 	for (vector<TypeIndex>::const_iterator cit = type_indices.begin(); cit != type_indices.end(); ++ cit) {
 		if (*cit == m_id_type_index)
@@ -170,16 +321,16 @@ string ObjCTypeRecord::format_forward_declaration(const vector<TypeIndex>& type_
 			case '{':
 				if (type.name.empty() || type.subtypes.empty()) {
 					std::vector<TypeIndex> dummy;
-					struct_refs += type.format(*this, "", 0, true, true, pointers_right_aligned, false, &dummy, false);
+					type.format(out, *this, "", 0, true, true, pointers_right_aligned, false, &dummy, false);
 				} else {
 					// doesn't matter template<> or not. You can't forward reference a template class. It must be converted to a strong link.
-					struct_refs += "typedef ";
-					struct_refs += (type.type == '(') ? "union " : "struct ";
-					struct_refs += type.name;
-					struct_refs.push_back(' ');
-					struct_refs += type.get_pretty_name(prettify_struct_names);
+					out.append("typedef ");
+					out.append((type.type == '(') ? "union " : "struct ");
+					out.append(type.name);
+					out.push_back(' ');
+					out.append(type.get_pretty_name(prettify_struct_names));
 				}
-				struct_refs += ";\n";
+				out.append(";\n");
 				break;
 			default:
 				break;
@@ -187,15 +338,13 @@ string ObjCTypeRecord::format_forward_declaration(const vector<TypeIndex>& type_
 	}
 		
 	if (!class_refs.empty()) {
-		struct_refs += class_refs;
-		struct_refs += ";\n";
+		out.append(class_refs);
+		out.append(";\n");
 	}
 	if (!protocol_refs.empty()) {
-		struct_refs += protocol_refs;
-		struct_refs += ";\n";
+		out.append(protocol_refs);
+		out.append(";\n");
 	}
-	
-	return struct_refs;
 }
 
 ObjCTypeRecord::TypeIndex ObjCTypeRecord::add_external_objc_class(const std::string& objc_class) {
@@ -269,46 +418,108 @@ recurse:
 			return;
 	}
 	
-	tr1::unordered_map<TypeIndex, EdgeStrength>& from_adjs = ma_adjlist[from];
+	ma_pending_links.push_back(Link(from, to, target_strength));
+}
+
+size_t ObjCTypeRecord::EncodingHash::operator() (const char* encoding) const throw() {
+	size_t h = 2166136261u;
+	for (; *encoding != '\0'; ++ encoding)
+		h = (h ^ static_cast<unsigned char>(*encoding)) * 16777619u;
+	return h;
+}
+
+ObjCTypeRecord::EdgeStrength ObjCTypeRecord::link_strength(TypeIndex a, TypeIndex b) const throw() {
+	const DependencyList* deps = dependencies(a);
+	if (deps == NULL)
+		return ES_None;
+	DependencyList::const_iterator cit = lower_bound(deps->begin(), deps->end(), Dependency(b, ES_None));
+	if (cit == deps->end() || cit->type_index != b)
+		return ES_None;
+	else
+		return cit->strength;
+}
+
+// The links are replayed in the order they were added. Adding a strong link
+// from A to B also makes an indirect strong link from A to everything strongly
+// reachable from B *at that time*: a strong link added later from B (or from
+// anything after it) is not propagated back to A. The results therefore depend
+// on the order the links were added, as they did when the closure was computed
+// in add_link_with_strength() itself.
+void ObjCTypeRecord::resolve_links() const {
+	size_t type_count = ma_type_store.size();
+	ma_links.resize(type_count);
+	ma_linked.resize(type_count, false);
+	ma_k_in.resize(type_count, 0);
+	ma_strong_k_in.resize(type_count, 0);
+	
+	// visited[i] == stamp iff type i has been reached by the current search.
+	vector<unsigned> visited;
+	unsigned stamp = 0;
+	vector<TypeIndex> search_stack, reached;
+	DependencyList merged;
 	
-	EdgeStrength& strength = from_adjs[to];
-	bool need_bfs = false;
-	if (strength < target_strength) {
-		if (strength == 0)
+	for (vector<Link>::const_iterator cit = ma_pending_links.begin(); cit != ma_pending_links.end(); ++ cit) {
+		TypeIndex from = cit->from, to = cit->to;
+		EdgeStrength target_strength = cit->strength;
+		DependencyList& from_adjs = ma_links[from];
+		ma_linked[from] = true;
+		
+		DependencyList::iterator dit = lower_bound(from_adjs.begin(), from_adjs.end(), Dependency(to, ES_None));
+		if (dit == from_adjs.end() || dit->type_index != to)
+			dit = from_adjs.insert(dit, Dependency(to, ES_None));
+		if (dit->strength >= target_strength)
+			continue;
+		if (dit->strength == ES_None)
 			++ ma_k_in[to];
 		if (target_strength == ES_Strong)
 			++ ma_strong_k_in[to];
+		dit->strength = target_strength;
+		if (target_strength < ES_StrongIndirect)
+			continue;
 		
-		strength = target_strength;
-		if (target_strength >= ES_StrongIndirect)
-			need_bfs = true;
-	}
-	if (!need_bfs)
-		return;
-	
-	// BFS through all strong (direct or indirect) neighbors of the target node and make an indirect strong link with them.
-	vector<TypeIndex> bfs_stack;
-	bfs_stack.push_back(to);
-	tr1::unordered_set<TypeIndex> visited;
-	visited.insert(to);
-	
-	while (bfs_stack.size() != 0) {
-		TypeIndex cur = bfs_stack.back();
-		bfs_stack.pop_back();
-		tr1::unordered_map<TypeIndex, EdgeStrength>& cur_adjs = ma_adjlist[cur];
-		
-		for (tr1::unordered_map<TypeIndex, EdgeStrength>::iterator cit = cur_adjs.begin(); cit != cur_adjs.end(); ++ cit) {
-			if (cit->second >= ES_StrongIndirect && visited.insert(cit->first).second) {
-				EdgeStrength& orig_strength = from_adjs[cit->first];
-				if (orig_strength < ES_StrongIndirect) {
-					if (orig_strength == 0)
-						++ ma_k_in[cit->first];
-					orig_strength = ES_StrongIndirect;
+		// search through all strong (direct or indirect) neighbors of the target.
+		if (visited.empty())
+			visited.resize(type_count, 0);
+		++ stamp;
+		visited[to] = stamp;
+		search_stack.push_back(to);
+		reached.clear();
+		while (!search_stack.empty()) {
+			TypeIndex cur = search_stack.back();
+			search_stack.pop_back();
+			ma_linked[cur] = true;
+			const DependencyList& cur_adjs = ma_links[cur];
+			for (DependencyList::const_iterator ait = cur_adjs.begin(); ait != cur_adjs.end(); ++ ait)
+				if (ait->strength >= ES_StrongIndirect && visited[ait->type_index] != stamp) {
+					visited[ait->type_index] = stamp;
+					reached.push_back(ait->type_index);
+					search_stack.push_back(ait->type_index);
 				}
-				bfs_stack.push_back(cit->first);
+		}
+		if (reached.empty())
+			continue;
+		
+		// and make an indirect strong link with them.
+		sort(reached.begin(), reached.end());
+		merged.clear();
+		DependencyList::const_iterator mit = from_adjs.begin();
+		for (vector<TypeIndex>::const_iterator rit = reached.begin(); rit != reached.end(); ++ rit) {
+			for (; mit != from_adjs.end() && mit->type_index < *rit; ++ mit)
+				merged.push_back(*mit);
+			EdgeStrength strength = ES_None;
+			if (mit != from_adjs.end() && mit->type_index == *rit) {
+				strength = mit->strength;
+				++ mit;
 			}
+			if (strength == ES_None)
+				++ ma_k_in[*rit];
+			merged.push_back(Dependency(*rit, max(strength, static_cast<EdgeStrength>(ES_StrongIndirect))));
 		}
+		merged.insert(merged.end(), mit, static_cast<const DependencyList&>(from_adjs).end());
+		// copied, so that the lists do not keep the spare capacity of merged.
+		from_adjs.assign(merged.begin(), merged.end());
 	}
+	vector<Link>().swap(ma_pending_links);
 }
 
 // for 2 types to be equal...
@@ -405,95 +616,12 @@ bool ObjCTypeRecord::Type::is_more_complete_than (const Type& another) const thr
 		return false;
 }
 
-/** Find the name of the struct given the type string.
- Returns an empty string if the struct is anonymous (i.e. having a name of ? or $_123).
- The parameter typestr will be advanced until to end of the struct name.
- @param[inout] typestr C string that contains the type string of the struct/union, with the leading ( or { removed. 
- */
-static string parse_struct_name (const char* typestr, const char** res) {
-	if (*typestr == '?') {
-		*res = ++typestr;
-		return "";
-	}
-	
-	const char* identifier_start = typestr;
-	while (*typestr != '=' && *typestr != ')' && *typestr != '}')
-		typestr = skip_balanced_substring(typestr);
-	*res = typestr;
-	
-	string name = string(identifier_start, typestr);
-	// $_123 are g++'s way to denote an anonymous struct.
-	if (name.size() > 2 && name.substr(0, 2) == "$_" && name.find_first_not_of("0123456789", 2) == string::npos)
-		return "";
-	
-	return name;
-}
-
-static vector<string> parse_struct_members (const char* member_typestrings, bool& has_field_names) {
-	vector<string> typestrings_list;
-	const char* subtype_begin = member_typestrings;
-	has_field_names = (*member_typestrings == '"');
-	bool finish = false;
-	
-	// Parse the whole string into tokens.
-	while (!finish) {
-		switch (*member_typestrings) {
-			default:
-				member_typestrings = skip_balanced_substring(member_typestrings);
-				typestrings_list.push_back(string(subtype_begin, member_typestrings));
-				subtype_begin = member_typestrings;
-				break;
-				
-			case '}':
-			case ')':
-			case '\0':
-				finish = true;
-				break;
-				
-			case 'b':
-				member_typestrings += strspn(member_typestrings+1, "0123456789")+1;
-				typestrings_list.push_back(string(subtype_begin, member_typestrings));
-				subtype_begin = member_typestrings;
-				break;
-				
-			case '^':
-			case 'j':
-			case 'r':
-			case 'R':
-			case 'n':
-			case 'N':
-			case 'o':
-			case 'O':
-			case 'V':
-			case '!':
-				++ member_typestrings;
-				if (*member_typestrings == '"' || *member_typestrings == '\0' || *member_typestrings == ')' || *member_typestrings == '}') {	// Avoid WebKit segfault.
-					typestrings_list.push_back(string(subtype_begin, member_typestrings) + "?");
-					subtype_begin = member_typestrings;
-				}
-				break;
-		}
-	}
-	
-	// Merge @ and "xxx" into @"xxx" if possible.
-	vector<string> retval;
-	for (vector<string>::const_iterator cit = typestrings_list.begin(); cit != typestrings_list.end(); ++ cit) {
-		if ((*cit)[cit->size()-1] == '@') {
-			if (cit+1 != typestrings_list.end() && (*(cit+1))[0] == '"') {
-				if (!has_field_names || cit+2 == typestrings_list.end() || (*(cit+2))[0] == '"') {
-					retval.push_back(*cit + *(cit+1));
-					++ cit;
-					continue;
-				}
-			}
-		}
-		retval.push_back(*cit);
-	}
-	
-	return retval;
+// $_123 are g++'s way to denote an anonymous struct.
+static inline bool is_anonymous_struct_name (const string& name) throw() {
+	return name.size() > 2 && name.compare(0, 2, "$_") == 0 && name.find_first_not_of("0123456789", 2) == string::npos;
 }
 
-ObjCTypeRecord::Type::Type(ObjCTypeRecord& record, const string& type_to_parse, bool is_struct_used_locally) : type(type_to_parse[0]), external(true), refcount(is_struct_used_locally ? 1 : Type::used_globally), encoding(type_to_parse) {
+ObjCTypeRecord::Type::Type(ObjCTypeRecord& record, const string& type_to_parse, bool is_struct_used_locally) : type(type_to_parse[0]), external(true), refcount(is_struct_used_locally ? 1 : Type::used_globally), encoding(NULL) {
 	switch (type) {
 		case '6': {	// category -- for internal use only.
 			external = false;
@@ -576,25 +704,36 @@ ObjCTypeRecord::Type::Type(ObjCTypeRecord& record, const string& type_to_parse,
 				break;
 			}
 			
-			const char* typestr = type_to_parse.c_str()+1;
+			// the name and the members, but not the members' own members:
+			// each member is tokenized when it is parsed.
+			ObjCTypeTokenizer& tokenizer = record.m_tokenizer;
+			unsigned first = tokenizer.tokenize(type_to_parse.c_str(), 1);
+			unsigned last = tokenizer[first].next;
 			
-			name = parse_struct_name(typestr, &typestr);
+			const ObjCTypeTokenizer::Token& name_token = tokenizer[first+1];
+			if (*name_token.begin != '?') {
+				name = name_token.str();
+				if (is_anonymous_struct_name(name))
+					name.clear();
+			}
 			
-			if (*typestr == '=') {
-				bool has_field_names;
-				vector<string> raw_subtypes = parse_struct_members(typestr+1, has_field_names);
+			string member;
+			for (unsigned i = first+2; i < last; ++ i) {
+				// parsing a member tokenizes it after these tokens, which may move them.
+				ObjCTypeTokenizer::Token token = tokenizer[i];
 #if OBJC_TYPE_DEBUG
-				for (vector<string>::const_iterator cit = raw_subtypes.begin(); cit != raw_subtypes.end(); ++ cit)
-					printf("%s\n", cit->c_str());
+				printf("%s\n", token.str().c_str());
 #endif
-				for (vector<string>::const_iterator cit = raw_subtypes.begin(); cit != raw_subtypes.end(); ++ cit) {
-					if (has_field_names) {
-						field_names.push_back( cit->substr(1, cit->size()-2) );
-						++ cit;
-					}
-					subtypes.push_back( record.parse(*cit, true) );
+				if (token.kind == ObjCTypeTokenizer::TK_FieldName)
+					field_names.push_back(token.str());
+				else {
+					member.assign(token.begin, token.length);
+					if (token.kind == ObjCTypeTokenizer::TK_IncompleteType)
+						member.push_back('?');
+					subtypes.push_back( record.parse(member, true) );
 				}
 			}
+			tokenizer.truncate(first);
 			
 			if (!name.empty()) {
 				if (name == "__siginfo")
@@ -621,37 +760,40 @@ ObjCTypeRecord::Type::Type(ObjCTypeRecord& record, const string& type_to_parse,
 }
 
 // as_declaration = true: present struct as typedef struct ABC { ... } ABC; = false: present as ABC.
-string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string& argname, unsigned tabs, bool treat_char_as_bool, bool as_declaration, bool pointers_right_aligned, bool dont_typedef, std::vector<TypeIndex>* append_struct_if_matching, bool treat_objcls_as_struct) const throw() {
-	string retval = string(tabs, '\t');
+void ObjCTypeRecord::Type::format (OutputSink& out, const ObjCTypeRecord& record, const string& argname, unsigned tabs, bool treat_char_as_bool, bool as_declaration, bool pointers_right_aligned, bool dont_typedef, std::vector<TypeIndex>* append_struct_if_matching, bool treat_objcls_as_struct) const throw() {
+	size_t start = out.size();
+	// arrays are indented by their element type.
+	if (type != '[')
+		out.append(tabs, '\t');
 	switch (type) {
 		case '*':
 			if (pointers_right_aligned) {
-				retval += "char *";
-				retval += argname;
-				return retval;
+				out.append("char *");
+				out.append(argname);
+				return;
 			}
 			// fall-through
 			
 		default: {
 			const char* map_type = map314[static_cast<unsigned char>(type)];
 			if (map_type != NULL) {
-				retval += map_type;
+				out.append(map_type);
 				if (subtypes.size() == 1) {
-					retval.push_back(' ');
-					retval += record.ma_type_store[subtypes[0]].format(record, argname, 0, false, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
-					return retval;
+					out.push_back(' ');
+					record.ma_type_store[subtypes[0]].format(out, record, argname, 0, false, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
+					return;
 				}
 			} else {
 				fprintf(stderr, "Warning: Unrecognized type encoding '%c'.\n", type);
-				retval += "/*unknown-type-(";
-				retval.push_back(type);
-				retval += ")*/ void*";
+				out.append("/*unknown-type-(");
+				out.push_back(type);
+				out.append(")*/ void*");
 			}
 			break;
 		}
 			
 		case 'c':
-			retval += treat_char_as_bool ? "BOOL" : "char";
+			out.append(treat_char_as_bool ? "BOOL" : "char");
 			break;
 			
 		case '^': {
@@ -661,39 +803,39 @@ string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string&
 				string pseudo_argname = "(*";
 				pseudo_argname += argname;
 				pseudo_argname.push_back(')');
-				retval += subtype.format(record, pseudo_argname, 0, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
-				return retval;
+				subtype.format(out, record, pseudo_argname, 0, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
+				return;
 			} else if (record.prettify_struct_names && subtype.type == '{' && subtype.subtypes.empty() && !subtype.name.empty() && subtype.name.find('<') == string::npos && name_Refable(subtype.pretty_name)) {
-				retval += subtype.pretty_name;
-				retval += "Ref";
+				out.append(subtype.pretty_name);
+				out.append("Ref");
 			} else {
 				string pseudo_argname = "*";
 				pseudo_argname += argname;
 				// if it's char* it will be encoded as ^* instead of ^^c, so it's OK to treat_char_as_bool.
-				retval += subtype.format(record, pseudo_argname, 0, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
+				subtype.format(out, record, pseudo_argname, 0, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
 				// change all int ***c to int*** c.
 				if (!pointers_right_aligned) {
-					size_t string_length_1 = retval.size()-1;
-					for (unsigned i = 0; i < string_length_1; ++ i) {
-						if (retval[i] == ' ' && retval[i+1] == '*') {
-							retval[i] = '*';
-							retval[i+1] = ' ';
+					size_t string_length_1 = out.size()-1;
+					for (size_t i = start; i < string_length_1; ++ i) {
+						if (out[i] == ' ' && out[i+1] == '*') {
+							out[i] = '*';
+							out[i+1] = ' ';
 						}
 					}
-					if (retval[string_length_1] == ' ')
-						retval.erase(string_length_1);
+					if (out[string_length_1] == ' ')
+						out.truncate(string_length_1);
 				}
-				return retval;
+				return;
 			}
 			break;
 		}
 			
 		case 'b':
-			retval += "unsigned ";
-			retval += argname;
-			retval += " : ";
-			retval += value;
-			return retval;
+			out.append("unsigned ");
+			out.append(argname);
+			out.append(" : ");
+			out.append(value);
+			return;
 			
 		case '[': {
 			const Type& subtype = record.ma_type_store[subtypes[0]];
@@ -701,34 +843,34 @@ string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string&
 			pseudo_argname.push_back('[');
 			pseudo_argname += value;
 			pseudo_argname.push_back(']');
-			retval = subtype.format(record, pseudo_argname, tabs, true, as_declaration, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
-			return retval;
+			subtype.format(out, record, pseudo_argname, tabs, true, as_declaration, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
+			return;
 		}
 			
 		case '@':
 			if (name.empty())
-				retval += "id";
+				out.append("id");
 			else {
 				if (treat_objcls_as_struct)
-					retval += "struct ";
-				retval += name;
+					out.append("struct ");
+				out.append(name);
 			}
 			if (!treat_objcls_as_struct)
-				retval += value;
+				out.append(value);
 			if (!name.empty()) {
 				if (pointers_right_aligned) {
-					retval += " *";
-					retval += argname;
-					return retval;
+					out.append(" *");
+					out.append(argname);
+					return;
 				} else
-					retval.push_back('*');
+					out.push_back('*');
 			}
 			break;
 			
 		case '(':
 		case '{':
 			if (name.empty() && subtypes.empty() ) {
-				retval += type == '(' ? "union {}" : "struct {}";
+				out.append(type == '(' ? "union {}" : "struct {}");
 				
 			} else if (!as_declaration && (!name.empty() || refcount > 1)) {
 				bool do_append_struct = (append_struct_if_matching == NULL);
@@ -741,40 +883,38 @@ string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string&
 				}
 				
 				if (do_append_struct)
-					retval += (type == '(') ? "union " : "struct ";
-				retval += get_pretty_name(record.prettify_struct_names);
+					out.append((type == '(') ? "union " : "struct ");
+				out.append(get_pretty_name(record.prettify_struct_names));
 				
 			} else {
-				string tab_string = retval;
-				
 				if (name.find('<') != string::npos) {
-					retval += "template<>\n";
-					retval += tab_string;
+					out.append("template<>\n");
+					out.append(tabs, '\t');
 				} else if (!dont_typedef && (!name.empty() || refcount > 1))
-					retval += "typedef ";
+					out.append("typedef ");
 				
-				retval += (type == '(') ? "union" : "struct";
+				out.append((type == '(') ? "union" : "struct");
 				
 				if (!name.empty()) {
-					retval.push_back(' ');
-					retval += name;
+					out.push_back(' ');
+					out.append(name);
 					if (!dont_typedef && subtypes.empty() && name.find('<') == string::npos) {
 						if (record.prettify_struct_names && type == '{' && name_Refable(pretty_name)) {
-							retval += pointers_right_aligned ? " *" : "* ";
-							retval += get_pretty_name(record.prettify_struct_names);
-							retval += "Ref";
+							out.append(pointers_right_aligned ? " *" : "* ");
+							out.append(get_pretty_name(record.prettify_struct_names));
+							out.append("Ref");
 						} else {
-							retval.push_back(' ');
-							retval += get_pretty_name(record.prettify_struct_names);
+							out.push_back(' ');
+							out.append(get_pretty_name(record.prettify_struct_names));
 						}
 					}
 				} else if (dont_typedef && !subtypes.empty()) {
-					retval.push_back(' ');
-					retval += get_pretty_name(record.prettify_struct_names);
+					out.push_back(' ');
+					out.append(get_pretty_name(record.prettify_struct_names));
 				}
 				
 				if (!subtypes.empty()) {
-					retval += " {\n";
+					out.append(" {\n");
 					string field_name;
 					if (append_struct_if_matching)
 						append_struct_if_matching->push_back(type_index);
@@ -783,17 +923,17 @@ string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string&
 							field_name = field_names[i];
 						else
 							field_name = numeric_format("_field%u", i+1);
-						retval += record.ma_type_store[subtypes[i]].format(record, field_name, tabs+1, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
-						retval += ";\n";
+						record.ma_type_store[subtypes[i]].format(out, record, field_name, tabs+1, true, false, pointers_right_aligned, false, append_struct_if_matching, treat_objcls_as_struct);
+						out.append(";\n");
 					}
 					if (append_struct_if_matching)
 						append_struct_if_matching->pop_back();
 					
-					retval += tab_string;
-					retval.push_back('}');
+					out.append(tabs, '\t');
+					out.push_back('}');
 					if (!dont_typedef && (name.find('<') == string::npos && (!name.empty() || refcount > 1))) {
-						retval.push_back(' ');
-						retval += get_pretty_name(record.prettify_struct_names);
+						out.push_back(' ');
+						out.append(get_pretty_name(record.prettify_struct_names));
 					}
 				}
 			}
@@ -802,11 +942,9 @@ string ObjCTypeRecord::Type::format (const ObjCTypeRecord& record, const string&
 	}
 	
 	if (!argname.empty()) {
-		retval.push_back(' ');
-		retval += argname;
+		out.push_back(' ');
+		out.append(argname);
 	}
-	
-	return retval;
 }
 
 bool ObjCTypeRecord::can_dereference_to_id_type(TypeIndex idx) const throw() {
@@ -899,15 +1037,15 @@ void ObjCTypeRecord::sort_alphabetically(vector<TypeIndex>::iterator type_indice
 }
 
 // Basically an uglified topological sort.
-static void octr_visit(const tr1::unordered_map<ObjCTypeRecord::TypeIndex, tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength> >& adjlist, tr1::unordered_map<ObjCTypeRecord::TypeIndex, bool>& visited, vector<ObjCTypeRecord::TypeIndex>& result, ObjCTypeRecord::TypeIndex ti) {
+static void octr_visit(const vector<ObjCTypeRecord::DependencyList>& links, const vector<bool>& linked, tr1::unordered_map<ObjCTypeRecord::TypeIndex, bool>& visited, vector<ObjCTypeRecord::TypeIndex>& result, ObjCTypeRecord::TypeIndex ti) {
 	tr1::unordered_map<ObjCTypeRecord::TypeIndex, bool>::iterator vit = visited.find(ti);
 	if (vit != visited.end() && !vit->second) {
 		vit->second = true;
-		tr1::unordered_map<ObjCTypeRecord::TypeIndex, tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength> >::const_iterator cit = adjlist.find(ti);
-		if (cit != adjlist.end()) {
-			for (tr1::unordered_map<ObjCTypeRecord::TypeIndex, ObjCTypeRecord::EdgeStrength>::const_iterator nit = cit->second.begin(); nit != cit->second.end(); ++ nit) {
-				if (nit->second >= ObjCTypeRecord::ES_StrongIndirect)
-					octr_visit(adjlist, visited, result, nit->first);
+		if (ti < linked.size() && linked[ti]) {
+			const ObjCTypeRecord::DependencyList& adjs = links[ti];
+			for (ObjCTypeRecord::DependencyList::const_iterator nit = adjs.begin(); nit != adjs.end(); ++ nit) {
+				if (nit->strength >= ObjCTypeRecord::ES_StrongIndirect)
+					octr_visit(links, linked, visited, result, nit->type_index);
 			}
 			result.push_back(ti);
 		}
@@ -915,6 +1053,7 @@ static void octr_visit(const tr1::unordered_map<ObjCTypeRecord::TypeIndex, tr1::
 }
 
 void ObjCTypeRecord::sort_by_strong_links(vector<TypeIndex>::iterator type_indices_begin, vector<TypeIndex>::iterator type_indices_end) const throw() {
+	update_links();
 	// sort(type_indices_begin, type_indices_end, octr_StrongLinkSorter(*this));
 	tr1::unordered_map<TypeIndex, bool> visited;
 	for (vector<TypeIndex>::iterator it = type_indices_begin; it != type_indices_end; ++ it)
@@ -925,15 +1064,14 @@ void ObjCTypeRecord::sort_by_strong_links(vector<TypeIndex>::iterator type_indic
 	result.reserve(length);
 	
 	for (vector<TypeIndex>::iterator it = type_indices_begin; it != type_indices_end; ++ it)
-		octr_visit(ma_adjlist, visited, result, *it);
+		octr_visit(ma_links, ma_linked, visited, result, *it);
 	
 	copy(result.begin(), result.end(), type_indices_begin);
 }
 
-string ObjCTypeRecord::format_structs_with_forward_declarations(const vector<TypeIndex>& type_indices) const throw() {
+void ObjCTypeRecord::format_structs_with_forward_declarations(OutputSink& out, const vector<TypeIndex>& type_indices) const throw() {
 	vector<TypeIndex> indices = type_indices;
 	sort_by_strong_links(indices.begin(), indices.end());
-	string res;
 	tr1::unordered_set<TypeIndex> forward_declared; //, index_set (indices.begin(), indices.end());
 	
 	vector<TypeIndex> weak_dependecies;
@@ -941,42 +1079,45 @@ string ObjCTypeRecord::format_structs_with_forward_declarations(const vector<Typ
 		// Forward declare any weak dependencies first.
 		weak_dependecies.clear();
 		
-		const tr1::unordered_map<TypeIndex, EdgeStrength>* cur_dependencies = dependencies(*cit);
+		const DependencyList* cur_dependencies = dependencies(*cit);
 		if (cur_dependencies != NULL)
-			for (tr1::unordered_map<TypeIndex, EdgeStrength>::const_iterator dit = cur_dependencies->begin(); dit != cur_dependencies->end(); ++ dit) {
-				if (dit->second == ES_Weak && dit->first != *cit && forward_declared.find(dit->first) == forward_declared.end()) {
-					forward_declared.insert(dit->first);
-					weak_dependecies.push_back(dit->first);
+			for (DependencyList::const_iterator dit = cur_dependencies->begin(); dit != cur_dependencies->end(); ++ dit) {
+				if (dit->strength == ES_Weak && dit->type_index != *cit && forward_declared.find(dit->type_index) == forward_declared.end()) {
+					forward_declared.insert(dit->type_index);
+					weak_dependecies.push_back(dit->type_index);
 				}
 			}
 		
-		res += format_forward_declaration(weak_dependecies);
-		res += format(*cit, "", 0, true, forward_declared.find(*cit) != forward_declared.end());
-		res += ";\n\n";
+		format_forward_declaration(out, weak_dependecies);
+		format(out, *cit, "", 0, true, forward_declared.find(*cit) != forward_declared.end());
+		out.append(";\n\n");
 		
 		forward_declared.insert(*cit);
 	}
-	
-	return res;
 }
 
 void ObjCTypeRecord::print_network() const throw() {
+	update_links();
 	printf("digraph G {\n");
-	for (tr1::unordered_map<TypeIndex, tr1::unordered_map<TypeIndex, EdgeStrength> >::const_iterator cit = ma_adjlist.begin(); cit != ma_adjlist.end(); ++ cit) {
-		const Type& t = ma_type_store[cit->first];
+	for (TypeIndex i = 0; i < ma_links.size(); ++ i) {
+		if (!ma_linked[i])
+			continue;
+		const Type& t = ma_type_store[i];
 		char tp = t.type;
 		const char* shape = (tp == '(' || tp == '{') ? "box" : t.external ? "doublecircle" : "circle";
 		printf("\t\"%c%s%s\" [shape=%s]\n", tp, t.name.c_str(), t.value.c_str(), shape);
 	}
 	string s;
-	for (tr1::unordered_map<TypeIndex, tr1::unordered_map<TypeIndex, EdgeStrength> >::const_iterator cit = ma_adjlist.begin(); cit != ma_adjlist.end(); ++ cit) {
-		const Type& t = ma_type_store[cit->first];
+	for (TypeIndex i = 0; i < ma_links.size(); ++ i) {
+		if (!ma_linked[i])
+			continue;
+		const Type& t = ma_type_store[i];
 		s = string(1, t.type);
 		s += t.name;
 		s += t.value;
-		for (tr1::unordered_map<TypeIndex, EdgeStrength>::const_iterator dit = cit->second.begin(); dit != cit->second.end(); ++ dit) {
-			const Type& t2 = ma_type_store[dit->first];
-			printf("\t\"%s\" -> \"%c%s%s\" [color=%s]\n", s.c_str(), t2.type, t2.name.c_str(), t2.value.c_str(), dit->second == ES_Strong ? "black" : dit->second == ES_StrongIndirect ? "gray50" : "gray");
+		for (DependencyList::const_iterator dit = ma_links[i].begin(); dit != ma_links[i].end(); ++ dit) {
+			const Type& t2 = ma_type_store[dit->type_index];
+			printf("\t\"%s\" -> \"%c%s%s\" [color=%s]\n", s.c_str(), t2.type, t2.name.c_str(), t2.value.c_str(), dit->strength == ES_Strong ? "black" : dit->strength == ES_StrongIndirect ? "gray50" : "gray");
 		}
 	}
 	printf("}\n");
@@ -992,23 +1133,25 @@ void ObjCTypeRecord::print_network() const throw() {
  */
 
 void ObjCTypeRecord::create_short_circuit_weak_links() throw() {
-	for (TypeIndex i = 0; i < ma_type_store.size(); ++ i) {
+	update_links();
+	for (TypeIndex i = 0; i < ma_links.size(); ++ i) {
 		const Type& t = ma_type_store[i];
 		if (t.refcount > 1 && (t.type == '@' || t.type == '{' || t.type == '[')) {
-			tr1::unordered_map<TypeIndex, EdgeStrength>& adjs = ma_adjlist[i];
+			DependencyList& adjs = ma_links[i];
+			ma_linked[i] = true;
 			bool modified;
 			do {
-				vector<pair<TypeIndex, EdgeStrength> > unmodified_adjs (adjs.begin(), adjs.end());
+				DependencyList unmodified_adjs = adjs;
 				modified = false;
 				
-				for (vector<pair<TypeIndex, EdgeStrength> >::const_iterator cit = unmodified_adjs.begin(); cit != unmodified_adjs.end(); ++ cit) {
-					if (cit->second >= ES_StrongIndirect) {
-						const Type& s = ma_type_store[cit->first];
+				for (DependencyList::const_iterator cit = unmodified_adjs.begin(); cit != unmodified_adjs.end(); ++ cit) {
+					if (cit->strength >= ES_StrongIndirect) {
+						const Type& s = ma_type_store[cit->type_index];
 						if (s.refcount == 1 && s.name.empty()) {
-							combine_dependencies(adjs, ma_adjlist[cit->first], &ma_k_in, &ma_strong_k_in);
-							adjs.erase(cit->first);
-							-- ma_k_in[cit->first];
-							-- ma_strong_k_in[cit->first];
+							combine_dependencies(adjs, ma_links[cit->type_index], &ma_k_in, &ma_strong_k_in);
+							adjs.erase(lower_bound(adjs.begin(), adjs.end(), *cit));
+							-- ma_k_in[cit->type_index];
+							-- ma_strong_k_in[cit->type_index];
 							modified = true;
 						}
 					}
@@ -28,6 +28,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <tr1/unordered_map>
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include "StringArena.h"
+#include "ObjCTypeTokenizer.h"
+#include "OutputSink.h"
 
 class ObjCTypeRecord {
 public:
@@ -41,6 +45,15 @@ public:
 		ES_Strong			// direct strong link: The target type must be completely declared before the source type, and a class must #include this type in a header file.
 	};
 	
+	struct Dependency {
+		TypeIndex type_index;
+		EdgeStrength strength;
+		Dependency(TypeIndex type_index_, EdgeStrength strength_) throw() : type_index(type_index_), strength(strength_) {}
+		bool operator< (const Dependency& other) const throw() { return type_index < other.type_index; }
+	};
+	// sorted by type_index, one entry per type.
+	typedef std::vector<Dependency> DependencyList;
+	
 private:
 	class Type;
 	
@@ -60,7 +73,7 @@ private:
 		bool external;
 		unsigned refcount;
 		
-		std::string encoding;
+		const char* encoding;	// interned in the record's string arena.
 		
 		std::string name;	// struct name or objc class name. This is an optional field for equality.
 		std::string value;	// array size, bitfield size, objc protocols. This is a required field for equality.
@@ -75,7 +88,7 @@ private:
 		//----
 		
 		Type(ObjCTypeRecord& record, const std::string& type_to_parse, bool is_struct_used_locally);
-		std::string format(const ObjCTypeRecord& record, const std::string& argname, unsigned tabs, bool treat_char_as_bool, bool as_declaration, bool pointers_right_aligned, bool dont_typedef, std::vector<TypeIndex>* append_struct_if_matching, bool treat_objcls_as_struct) const throw();
+		void format(OutputSink& out, const ObjCTypeRecord& record, const std::string& argname, unsigned tabs, bool treat_char_as_bool, bool as_declaration, bool pointers_right_aligned, bool dont_typedef, std::vector<TypeIndex>* append_struct_if_matching, bool treat_objcls_as_struct) const throw();
 		
 		bool is_compatible_with(const Type& another, const ObjCTypeRecord& record, std::tr1::unordered_set<TypePointerPair>& banned_pairs) const throw();
 		bool is_more_complete_than(const Type& another) const throw();
@@ -85,11 +98,49 @@ private:
 		friend class ObjCTypeRecord;
 	};
 	
-	std::tr1::unordered_map<std::string, TypeIndex> ma_indexed_types;
+	struct EncodingHash { std::size_t operator() (const char* encoding) const throw(); };
+	struct EncodingEqual { bool operator() (const char* a, const char* b) const throw() { return std::strcmp(a, b) == 0; } };
+	
+	// every encoding is stored once, and shared by ma_indexed_types and the types.
+	StringArena m_encodings;
+	std::tr1::unordered_map<const char*, TypeIndex, EncodingHash, EncodingEqual> ma_indexed_types;
 	std::vector<Type> ma_type_store;
 	
-	std::tr1::unordered_map<TypeIndex, std::tr1::unordered_map<TypeIndex, EdgeStrength> > ma_adjlist;
-	std::tr1::unordered_map<TypeIndex, unsigned> ma_k_in, ma_strong_k_in;
+	// Types which may be merged with a new type, bucketed by structural keys
+	// which compatible types always share (see merge_keys()). The indices in
+	// each bucket are in ascending order.
+	std::tr1::unordered_map<std::size_t, std::vector<TypeIndex> > ma_merge_candidates;
+	
+	struct Link {
+		TypeIndex from, to;
+		EdgeStrength strength;
+		Link(TypeIndex from_, TypeIndex to_, EdgeStrength strength_) throw() : from(from_), to(to_), strength(strength_) {}
+		bool operator< (const Link& other) const throw() { return from < other.from || (from == other.from && to < other.to); }
+	};
+	
+	// Links are only appended to ma_pending_links when they are added, and are
+	// resolved when the links are next read (see resolve_links()): the links
+	// from each type are merged into ma_links[type], sorted by target and with
+	// the indirect strong links added. ma_linked marks the types which links
+	// were made from or strong links to, and ma_k_in / ma_strong_k_in count the
+	// links / direct strong links to each type.
+	mutable std::vector<Link> ma_pending_links;
+	mutable std::vector<DependencyList> ma_links;
+	mutable std::vector<bool> ma_linked;
+	mutable std::vector<unsigned> ma_k_in, ma_strong_k_in;
+	
+	// the tokens of the struct being parsed, see Type::Type().
+	ObjCTypeTokenizer m_tokenizer;
+	
+	// A direct-mapped cache of the method signatures parsed recently. Many
+	// methods share a signature (v8@0:4, @12@0:4@8, ...), and parsing it
+	// again always gives the same types.
+	struct SignatureMemo {
+		std::string signature;
+		std::vector<TypeIndex> types;
+	};
+	static const unsigned signature_memo_size = 4096;
+	std::vector<SignatureMemo> ma_signature_memo;
 	
 	TypeIndex m_void_type_index;
 	TypeIndex m_id_type_index;
@@ -99,8 +150,16 @@ private:
 	friend class Type;
 	
 private:
+	void merge_keys(const Type& type, std::vector<std::size_t>& res) const;
+	void add_merge_candidate(const Type& type, TypeIndex type_index);
+	void append_bucket(std::size_t key, std::vector<TypeIndex>& res) const;
+	// every type which may be compatible with type, in ascending order.
+	void merge_candidates(const Type& type, std::vector<TypeIndex>& res, std::vector<TypeIndex>& expanding) const;
+	
 	void add_objc_class_private(const std::string& objc_class);
 	void add_link_with_strength(TypeIndex from, TypeIndex to, EdgeStrength strength, bool convert_class_strength_to_weak = true);
+	void resolve_links() const;
+	inline void update_links() const { if (!ma_pending_links.empty() || ma_links.size() != ma_type_store.size()) resolve_links(); }
 	
 public:
 	bool pointers_right_aligned;
@@ -116,12 +175,19 @@ public:
 	void add_weak_link(TypeIndex from, TypeIndex to) { add_link_with_strength(from, to, ES_Weak); }
 	
 	TypeIndex parse(const std::string& type_to_parse, bool is_struct_used_locally);
-	std::string format(TypeIndex type_index, const std::string& argname, unsigned tabs, bool as_declaration, bool dont_typedef, bool treat_objcls_as_struct = false) const throw() {
+	// parse every type in a method signature (e.g. v12@0:4@8) as by parse(type, false), and append them to types.
+	void parse_signature(const char* signature, std::vector<TypeIndex>& types);
+	void format(OutputSink& out, TypeIndex type_index, const std::string& argname, unsigned tabs, bool as_declaration, bool dont_typedef, bool treat_objcls_as_struct = false) const throw() {
 		std::vector<TypeIndex> ti;
-		return ma_type_store[type_index].format(*this, argname, tabs, true, as_declaration, pointers_right_aligned, dont_typedef, dont_typedef ? NULL : &ti, treat_objcls_as_struct);
+		ma_type_store[type_index].format(out, *this, argname, tabs, true, as_declaration, pointers_right_aligned, dont_typedef, dont_typedef ? NULL : &ti, treat_objcls_as_struct);
+	}
+	std::string format(TypeIndex type_index, const std::string& argname, unsigned tabs, bool as_declaration, bool dont_typedef, bool treat_objcls_as_struct = false) const throw() {
+		OutputSink out;
+		format(out, type_index, argname, tabs, as_declaration, dont_typedef, treat_objcls_as_struct);
+		return out.str();
 	}
 	
-	std::string format_forward_declaration(const std::vector<TypeIndex>& type_indices) const throw();
+	void format_forward_declaration(OutputSink& out, const std::vector<TypeIndex>& type_indices) const throw();
 	
 	size_t types_count() const throw() { return ma_type_store.size(); }
 	
@@ -150,7 +216,15 @@ public:
 		const Type& t = ma_type_store[idx];
 		return t.type == '7' ?  ma_type_store[idx].value : ma_type_store[idx].name;
 	}
-	const std::string& encoding_of_type(TypeIndex idx) const throw() { return ma_type_store[idx].encoding; }
+	const char* encoding_of_type(TypeIndex idx) const throw() { return ma_type_store[idx].encoding; }
+	// the type parsed from exactly this encoding, if any. Unlike parse(), the record is never changed.
+	bool find_type(const char* encoding, TypeIndex* p_type_index) const throw() {
+		std::tr1::unordered_map<const char*, TypeIndex, EncodingHash, EncodingEqual>::const_iterator cit = ma_indexed_types.find(encoding);
+		if (cit == ma_indexed_types.end())
+			return false;
+		*p_type_index = cit->second;
+		return true;
+	}
 	
 	void print_network() const throw();
 	
@@ -164,34 +238,22 @@ public:
 	std::vector<TypeIndex> all_public_struct_types() const throw();
 	void sort_alphabetically(std::vector<TypeIndex>::iterator type_indices_begin, std::vector<TypeIndex>::iterator type_indices_end) const throw();
 	void sort_by_strong_links(std::vector<TypeIndex>::iterator type_indices_begin, std::vector<TypeIndex>::iterator type_indices_end) const throw();
-	std::string format_structs_with_forward_declarations(const std::vector<TypeIndex>& type_indices) const throw();
+	void format_structs_with_forward_declarations(OutputSink& out, const std::vector<TypeIndex>& type_indices) const throw();
 	
-	const std::tr1::unordered_map<TypeIndex, EdgeStrength>* dependencies(TypeIndex type_index) const throw() { 
-		std::tr1::unordered_map<TypeIndex, std::tr1::unordered_map<TypeIndex, EdgeStrength> >::const_iterator cit = ma_adjlist.find(type_index);
-		if (cit == ma_adjlist.end())
+	// NULL if the type is not linked.
+	const DependencyList* dependencies(TypeIndex type_index) const throw() { 
+		update_links();
+		if (type_index >= ma_links.size() || !ma_linked[type_index])
 			return NULL;
 		else
-			return &(cit->second);
-	}
-	EdgeStrength link_strength(TypeIndex a, TypeIndex b) const throw() {
-		std::tr1::unordered_map<TypeIndex, std::tr1::unordered_map<TypeIndex, EdgeStrength> >::const_iterator ait = ma_adjlist.find(a);
-		if (ait == ma_adjlist.end())
-			return ES_None;
-		else {
-			std::tr1::unordered_map<TypeIndex, EdgeStrength>::const_iterator bit = ait->second.find(b);
-			if (bit == ait->second.end())
-				return ES_None;
-			else
-				return bit->second;
-		}
+			return &(ma_links[type_index]);
 	}
+	EdgeStrength link_strength(TypeIndex a, TypeIndex b) const throw();
 	
 	unsigned link_count(TypeIndex type_index, bool strong_only = false) const throw() { 
-		std::tr1::unordered_map<TypeIndex, unsigned>::const_iterator cit = (strong_only ? ma_strong_k_in : ma_k_in).find(type_index);
-		if (cit == (strong_only ? ma_strong_k_in : ma_k_in).end())
-			return 0;
-		else
-			return cit->second;
+		update_links();
+		const std::vector<unsigned>& k_in = strong_only ? ma_strong_k_in : ma_k_in;
+		return type_index < k_in.size() ? k_in[type_index] : 0;
 	}
 	
 	// Strongly-linked anonymous structs used only once will be embedded in its containing struct.
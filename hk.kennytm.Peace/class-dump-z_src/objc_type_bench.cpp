@@ -0,0 +1,120 @@
+/*
+
+objc_type_bench.cpp ... Time ObjCTypeRecord::parse on synthetic struct encodings.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "objc_type.h"
+#include "wall_clock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// a fixed LCG, so every run parses the same encodings.
+static unsigned g_seed;
+static unsigned next_random(unsigned bound) {
+	g_seed = g_seed * 1103515245u + 12345u;
+	return (g_seed >> 8) % bound;
+}
+
+static const char* const primitives[] = {"i", "I", "c", "C", "s", "S", "f", "d", "q", "Q", "l", "L", "B", "*", "^v", ":"};
+
+static string struct_name(unsigned i) {
+	char name[24];
+	snprintf(name, sizeof(name), "Struct%u", i);
+	return name;
+}
+
+// the fields of struct i. A field may point to any struct, or embed an earlier
+// one.
+static vector<string> struct_fields(unsigned i) {
+	vector<string> fields;
+	unsigned field_count = 1 + next_random(6);
+	for (unsigned k = 0; k < field_count; ++ k) {
+		unsigned r = next_random(100);
+		if (r < 55)
+			fields.push_back(primitives[next_random(sizeof(primitives)/sizeof(primitives[0]))]);
+		else if (r < 65) {
+			char array[16];
+			snprintf(array, sizeof(array), "[%u%s]", 1 + next_random(8), primitives[next_random(8)]);
+			fields.push_back(array);
+		} else if (r < 80)
+			fields.push_back("^{" + struct_name(next_random(i+1)) + "}");
+		else if (r < 90)
+			fields.push_back(string("{?=") + primitives[next_random(8)] + primitives[next_random(8)] + "}");
+		else if (i > 0)
+			fields.push_back("{" + struct_name(next_random(i)) + "}");
+		else
+			fields.push_back("i");
+	}
+	return fields;
+}
+
+// every struct is seen in several forms, as in a real binary: with and
+// without field names, incomplete, anonymous, and behind a pointer.
+static vector<string> encodings(unsigned struct_count) {
+	g_seed = 1;
+	vector<vector<string> > all_fields;
+	for (unsigned i = 0; i < struct_count; ++ i)
+		all_fields.push_back(struct_fields(i));
+
+	vector<string> retval;
+	for (unsigned i = 0; i < struct_count; ++ i) {
+		const vector<string>& fields = all_fields[i];
+		string plain, named;
+		for (unsigned k = 0; k < fields.size(); ++ k) {
+			char field_name[16];
+			snprintf(field_name, sizeof(field_name), "\"f%u\"", k);
+			plain += fields[k];
+			named += field_name + fields[k];
+		}
+		retval.push_back("{" + struct_name(i) + "=" + plain + "}");
+		retval.push_back("{" + struct_name(i) + "=" + named + "}");
+		retval.push_back("^{" + struct_name(i) + "}");
+		retval.push_back("{" + struct_name(i) + "=}");
+		retval.push_back("{?=" + plain + "}");
+	}
+
+	// shuffle, so the complete forms do not always come first.
+	for (size_t i = retval.size(); i > 1; -- i)
+		swap(retval[i-1], retval[next_random(static_cast<unsigned>(i))]);
+	return retval;
+}
+
+int main (int argc, const char* argv[]) {
+	unsigned struct_count = argc >= 2 ? static_cast<unsigned>(strtoul(argv[1], NULL, 0)) : 1000;
+	unsigned rounds = argc >= 3 ? static_cast<unsigned>(strtoul(argv[2], NULL, 0)) : 4;
+
+	printf("%10s %10s %10s %12s %14s\n", "structs", "encodings", "types", "time (ms)", "encodings/s");
+	for (unsigned round = 0; round < rounds; ++ round, struct_count *= 2) {
+		vector<string> all_encodings = encodings(struct_count);
+
+		double t = wall_clock();
+		ObjCTypeRecord record;
+		for (vector<string>::const_iterator cit = all_encodings.begin(); cit != all_encodings.end(); ++ cit)
+			record.parse(*cit, true);
+		t = wall_clock() - t;
+
+		printf("%10u %10lu %10lu %12.3f %14.0f\n", struct_count, static_cast<unsigned long>(all_encodings.size()), static_cast<unsigned long>(record.types_count()), t * 1000, t > 0 ? static_cast<double>(all_encodings.size()) / t : 0.);
+	}
+	return 0;
+}
@@ -24,7 +24,107 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
-int main () {
+#pragma mark -
+#pragma mark Checks (-c)
+
+static unsigned failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++ failures; } } while (0)
+
+typedef ObjCTypeRecord::TypeIndex TypeIndex;
+
+// A strong link only carries over what is reachable from its target when it
+// is added. Superclass links are added in the order of the classes in the
+// binary, so a subclass often comes before its superclass.
+static void check_class_chain(bool superclass_first, bool read_in_between) {
+	ObjCTypeRecord record;
+	TypeIndex a = record.add_internal_objc_class("A");
+	TypeIndex b = record.add_internal_objc_class("B");
+	TypeIndex c = record.add_internal_objc_class("C");
+	
+	if (superclass_first) {
+		record.add_strong_class_link(b, c);
+		if (read_in_between)
+			record.link_count(c);
+		record.add_strong_class_link(a, b);
+	} else {
+		record.add_strong_class_link(a, b);
+		if (read_in_between)
+			record.link_count(c);
+		record.add_strong_class_link(b, c);
+	}
+	
+	CHECK(record.link_strength(a, b) == ObjCTypeRecord::ES_Strong);
+	CHECK(record.link_strength(b, c) == ObjCTypeRecord::ES_Strong);
+	CHECK(record.link_strength(b, a) == ObjCTypeRecord::ES_None);
+	CHECK(record.link_strength(c, a) == ObjCTypeRecord::ES_None);
+	CHECK(record.link_count(b) == 1);
+	CHECK(record.link_count(c, true) == 1);
+	if (superclass_first) {
+		CHECK(record.link_strength(a, c) == ObjCTypeRecord::ES_StrongIndirect);
+		CHECK(record.link_count(c) == 2);
+	} else {
+		CHECK(record.link_strength(a, c) == ObjCTypeRecord::ES_None);
+		CHECK(record.link_count(c) == 1);
+	}
+	CHECK(record.dependencies(a) != NULL && record.dependencies(a)->size() == (superclass_first ? 2u : 1u));
+	CHECK(record.dependencies(c) != NULL && record.dependencies(c)->empty());
+}
+
+// a weak link made strong later still carries over the strong links of its
+// target, and counts as one link.
+static void check_weak_link_made_strong() {
+	ObjCTypeRecord record;
+	TypeIndex a = record.parse("{A=\"x\"i}", true);
+	TypeIndex b = record.parse("{B=\"c\"{C=\"x\"i}}", true);
+	TypeIndex c = record.parse("{C=\"x\"i}", true);
+	
+	record.add_weak_link(a, b);
+	CHECK(record.link_strength(a, b) == ObjCTypeRecord::ES_Weak);
+	CHECK(record.link_strength(a, c) == ObjCTypeRecord::ES_None);
+	record.add_strong_link(a, b);
+	CHECK(record.link_strength(a, b) == ObjCTypeRecord::ES_Strong);
+	CHECK(record.link_strength(a, c) == ObjCTypeRecord::ES_StrongIndirect);
+	CHECK(record.link_count(b) == 1);
+	CHECK(record.link_count(b, true) == 1);
+	CHECK(record.link_count(c) == 2);
+}
+
+// the fields of a struct are parsed before it, so its links always reach
+// through the nested structs.
+static void check_nested_structs() {
+	ObjCTypeRecord record;
+	TypeIndex outer = record.parse("{Outer=\"middle\"{Middle=\"inner\"{Inner=\"x\"i}}}", true);
+	TypeIndex middle = record.parse("{Middle=\"inner\"{Inner=\"x\"i}}", true);
+	TypeIndex inner = record.parse("{Inner=\"x\"i}", true);
+	
+	CHECK(record.link_strength(outer, middle) == ObjCTypeRecord::ES_Strong);
+	CHECK(record.link_strength(middle, inner) == ObjCTypeRecord::ES_Strong);
+	CHECK(record.link_strength(outer, inner) == ObjCTypeRecord::ES_StrongIndirect);
+	CHECK(record.link_count(inner) == 2);
+	CHECK(record.link_count(inner, true) == 1);
+	CHECK(record.dependencies(inner) != NULL && record.dependencies(inner)->empty());
+}
+
+static int run_checks() {
+	check_class_chain(false, false);
+	check_class_chain(false, true);
+	check_class_chain(true, false);
+	check_class_chain(true, true);
+	check_weak_link_made_strong();
+	check_nested_structs();
+	
+	if (failures == 0)
+		printf("All checks passed.\n");
+	return failures == 0 ? 0 : 1;
+}
+
+#pragma mark -
+
+int main (int argc, char* argv[]) {
+	if (argc >= 2 && strcmp(argv[1], "-c") == 0)
+		return run_checks();
+	
 	ObjCTypeRecord record;
 	unsigned last_index = 3;
 	while (!cin.fail()) {
@@ -39,14 +139,14 @@ int main () {
 	printf("\nParsed into %lu types.\n\n", record.types_count());
 	
 	for (unsigned i = 0; i < record.types_count(); ++ i) {
-		printf("%s;\n", record.format(i, "", 0, true).c_str());
+		printf("%s;\n", record.format(i, "", 0, true, false).c_str());
 	}
 	printf("\n");
 	
 	for (unsigned i = 0; i < record.types_count(); ++ i) {
 		char argname[32];
 		snprintf(argname, 32, "_arg%u", i);
-		printf("%s;\n", record.format(i, argname, 0, false).c_str());
+		printf("%s;\n", record.format(i, argname, 0, false, false).c_str());
 	}
 	
 	return 0;
@@ -0,0 +1,215 @@
+/*
+
+CSR_Graph.cpp ... Compressed sparse row form of the dependency graph.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CSR_Graph.h"
+#include "DataFile.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// The binary file is
+//
+//   GraphFileHeader
+//   unsigned offsets[node_count+1]
+//   unsigned targets[arc_count]
+//   unsigned reverse_offsets[node_count+1]
+//   unsigned reverse_targets[arc_count]
+//   unsigned name_offsets[node_count]
+//   char     names[names_size]				(NUL-terminated)
+//
+// All integers are in host byte order.
+
+static const char GraphFileMagic[8] = {'P', 'e', 'a', 'c', 'e', 'D', 'G', '\0'};
+static const unsigned GraphFileVersion = 1;
+
+struct GraphFileHeader {
+	char magic[8];
+	unsigned version;
+	unsigned node_count;
+	unsigned arc_count;
+	unsigned names_size;
+};
+
+// sort the arcs by source with a counting sort, which keeps the order of the
+// arcs of each node.
+static void build_rows(unsigned node_count, const vector<pair<int, int> >& arcs, bool reverse, unsigned* offsets, unsigned* targets) {
+	memset(offsets, 0, (node_count+1) * sizeof(unsigned));
+	for (vector<pair<int, int> >::const_iterator cit = arcs.begin(); cit != arcs.end(); ++ cit)
+		++ offsets[(reverse ? cit->second : cit->first) + 1];
+	for (unsigned i = 0; i < node_count; ++ i)
+		offsets[i+1] += offsets[i];
+	vector<unsigned> next (offsets, offsets + node_count);
+	for (vector<pair<int, int> >::const_iterator cit = arcs.begin(); cit != arcs.end(); ++ cit) {
+		unsigned source = static_cast<unsigned>(reverse ? cit->second : cit->first);
+		targets[next[source] ++] = static_cast<unsigned>(reverse ? cit->first : cit->second);
+	}
+}
+
+CSR_Graph::CSR_Graph(const vector<string>& names, const vector<pair<int, int> >& arcs) : m_node_count(static_cast<unsigned>(names.size())), m_arc_count(static_cast<unsigned>(arcs.size())), mp_file(NULL) {
+	ma_storage.resize(3*m_node_count + 2 + 2*m_arc_count + 1);
+	unsigned* p = &ma_storage[0];
+	build_rows(m_node_count, arcs, false, p, p + m_node_count+1);
+	build_rows(m_node_count, arcs, true, p + m_node_count+1 + m_arc_count, p + 2*(m_node_count+1) + m_arc_count);
+	unsigned* name_offsets = p + 2*(m_node_count+1 + m_arc_count);
+
+	for (unsigned i = 0; i < m_node_count; ++ i) {
+		name_offsets[i] = static_cast<unsigned>(ma_names_storage.size());
+		ma_names_storage.insert(ma_names_storage.end(), names[i].begin(), names[i].end());
+		ma_names_storage.push_back('\0');
+	}
+	if (ma_names_storage.empty())
+		ma_names_storage.push_back('\0');
+	m_names_size = static_cast<unsigned>(ma_names_storage.size());
+
+	mp_offsets = p;
+	mp_targets = p + m_node_count+1;
+	mp_reverse_offsets = mp_targets + m_arc_count;
+	mp_reverse_targets = mp_reverse_offsets + m_node_count+1;
+	mp_name_offsets = name_offsets;
+	mp_names = &ma_names_storage[0];
+}
+
+CSR_Graph::CSR_Graph(const char* path) : mp_file(new DataFile(path)) {
+	const GraphFileHeader* p_header = mp_file->peek_data_at<GraphFileHeader>(0);
+	if (p_header == NULL || memcmp(p_header->magic, GraphFileMagic, 8) != 0 || p_header->version != GraphFileVersion) {
+		delete mp_file;
+		throw TRException("CSR_Graph::CSR_Graph(const char*):\n\t\"%s\" is not a dependency graph file.", path);
+	}
+
+	m_node_count = p_header->node_count;
+	m_arc_count = p_header->arc_count;
+	m_names_size = p_header->names_size;
+	unsigned long long integers = 3ULL*m_node_count + 2 + 2ULL*m_arc_count;
+	if (sizeof(GraphFileHeader) + integers*sizeof(unsigned) + m_names_size != static_cast<unsigned long long>(mp_file->filesize()) || m_names_size == 0) {
+		delete mp_file;
+		throw TRException("CSR_Graph::CSR_Graph(const char*):\n\t\"%s\" is truncated.", path);
+	}
+
+	mp_offsets = reinterpret_cast<const unsigned*>(mp_file->data() + sizeof(GraphFileHeader));
+	mp_targets = mp_offsets + m_node_count+1;
+	mp_reverse_offsets = mp_targets + m_arc_count;
+	mp_reverse_targets = mp_reverse_offsets + m_node_count+1;
+	mp_name_offsets = mp_reverse_targets + m_arc_count;
+	mp_names = reinterpret_cast<const char*>(mp_name_offsets + m_node_count);
+
+	// everything is used as an index without further checks, so check it once.
+	bool ok = mp_names[m_names_size-1] == '\0' && mp_offsets[m_node_count] == m_arc_count && mp_reverse_offsets[m_node_count] == m_arc_count;
+	for (unsigned i = 0; i < m_node_count && ok; ++ i)
+		ok = mp_offsets[i] <= mp_offsets[i+1] && mp_reverse_offsets[i] <= mp_reverse_offsets[i+1] && mp_name_offsets[i] < m_names_size;
+	for (unsigned i = 0; i < m_arc_count && ok; ++ i)
+		ok = mp_targets[i] < m_node_count && mp_reverse_targets[i] < m_node_count;
+	if (!ok) {
+		delete mp_file;
+		throw TRException("CSR_Graph::CSR_Graph(const char*):\n\t\"%s\" is corrupted.", path);
+	}
+}
+
+CSR_Graph::~CSR_Graph() throw() {
+	delete mp_file;
+}
+
+bool CSR_Graph::write(const char* path) const {
+	GraphFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GraphFileMagic, 8);
+	header.version = GraphFileVersion;
+	header.node_count = m_node_count;
+	header.arc_count = m_arc_count;
+	header.names_size = m_names_size;
+
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(mp_offsets, sizeof(unsigned), m_node_count+1, f) == m_node_count+1
+		&& fwrite(mp_targets, sizeof(unsigned), m_arc_count, f) == m_arc_count
+		&& fwrite(mp_reverse_offsets, sizeof(unsigned), m_node_count+1, f) == m_node_count+1
+		&& fwrite(mp_reverse_targets, sizeof(unsigned), m_arc_count, f) == m_arc_count
+		&& fwrite(mp_name_offsets, sizeof(unsigned), m_node_count, f) == m_node_count
+		&& fwrite(mp_names, 1, m_names_size, f) == m_names_size;
+	return (fclose(f) == 0) && written;
+}
+
+int CSR_Graph::find(const char* path) const throw() {
+	int by_file_name = -1;
+	for (unsigned i = 0; i < m_node_count; ++ i) {
+		const char* node_name = name(i);
+		if (strcmp(node_name, path) == 0)
+			return static_cast<int>(i);
+		if (by_file_name < 0) {
+			const char* slash = strrchr(node_name, '/');
+			if (slash != NULL && strcmp(slash+1, path) == 0)
+				by_file_name = static_cast<int>(i);
+		}
+	}
+	return by_file_name;
+}
+
+void CSR_Graph::closure(unsigned node, bool reverse, vector<unsigned>& bitset) const {
+	const unsigned* offsets = reverse ? mp_reverse_offsets : mp_offsets;
+	const unsigned* targets = reverse ? mp_reverse_targets : mp_targets;
+
+	bitset.assign((m_node_count + 31) / 32, 0);
+	vector<unsigned> stack;
+	stack.push_back(node);
+	while (!stack.empty()) {
+		unsigned current = stack.back();
+		stack.pop_back();
+		for (const unsigned* p = targets + offsets[current]; p != targets + offsets[current+1]; ++ p) {
+			unsigned& word = bitset[*p >> 5];
+			unsigned bit = 1u << (*p & 31);
+			if (!(word & bit)) {
+				word |= bit;
+				stack.push_back(*p);
+			}
+		}
+	}
+}
+
+vector<unsigned> CSR_Graph::topological_layers() const {
+	// Kahn's algorithm from the leaves: a node is ready when all of its
+	// dependencies have a layer.
+	vector<unsigned> layers (m_node_count, ~0u);
+	vector<unsigned> remaining (m_node_count);
+	vector<unsigned> ready;
+	for (unsigned i = 0; i < m_node_count; ++ i) {
+		remaining[i] = mp_offsets[i+1] - mp_offsets[i];
+		if (remaining[i] == 0) {
+			layers[i] = 0;
+			ready.push_back(i);
+		}
+	}
+	for (size_t k = 0; k < ready.size(); ++ k) {
+		unsigned node = ready[k];
+		for (const unsigned* p = dependents_begin(node); p != dependents_end(node); ++ p) {
+			if (layers[*p] == ~0u || layers[*p] < layers[node] + 1)
+				layers[*p] = layers[node] + 1;
+			if (-- remaining[*p] == 0)
+				ready.push_back(*p);
+		}
+	}
+	// nodes which never became ready only have a lower bound.
+	for (unsigned i = 0; i < m_node_count; ++ i)
+		if (remaining[i] != 0)
+			layers[i] = ~0u;
+	return layers;
+}
@@ -0,0 +1,92 @@
+/*
+
+CSR_Graph.h ... Compressed sparse row form of the dependency graph.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CSR_GRAPH_H
+#define CSR_GRAPH_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+class DataFile;
+
+// The arcs of node i (its dependencies) are targets[offsets[i]] to
+// targets[offsets[i+1]-1], in the order they were found, and likewise for the
+// reverse arcs (its dependents). Every array either lives in this object, or
+// points into a mapped binary file written by write(), so loading a graph
+// costs no parsing.
+class CSR_Graph {
+private:
+	unsigned m_node_count, m_arc_count;
+	const unsigned* mp_offsets, *mp_targets;
+	const unsigned* mp_reverse_offsets, *mp_reverse_targets;
+	const unsigned* mp_name_offsets;
+	const char* mp_names;
+	unsigned m_names_size;
+
+	std::vector<unsigned> ma_storage;
+	std::vector<char> ma_names_storage;
+	DataFile* mp_file;
+
+	void closure(unsigned node, bool reverse, std::vector<unsigned>& bitset) const;
+
+	CSR_Graph(const CSR_Graph&);
+	CSR_Graph& operator= (const CSR_Graph&);
+
+public:
+	// names[i] is the path of node i, which may be empty for an unused number.
+	CSR_Graph(const std::vector<std::string>& names, const std::vector<std::pair<int, int> >& arcs);
+	// load a file written by write(). Throws a TRException if it is not one.
+	explicit CSR_Graph(const char* path);
+	~CSR_Graph() throw();
+
+	// returns false if the file cannot be written.
+	bool write(const char* path) const;
+
+	inline unsigned node_count() const throw() { return m_node_count; }
+	inline unsigned arc_count() const throw() { return m_arc_count; }
+	inline const char* name(unsigned node) const throw() { return mp_names + mp_name_offsets[node]; }
+
+	// the node with this path, or else the first one with this file name.
+	// Returns -1 if there is none.
+	int find(const char* path) const throw();
+
+	// the nodes which node directly depends on, and which directly depend on it.
+	inline const unsigned* dependencies_begin(unsigned node) const throw() { return mp_targets + mp_offsets[node]; }
+	inline const unsigned* dependencies_end(unsigned node) const throw() { return mp_targets + mp_offsets[node+1]; }
+	inline const unsigned* dependents_begin(unsigned node) const throw() { return mp_reverse_targets + mp_reverse_offsets[node]; }
+	inline const unsigned* dependents_end(unsigned node) const throw() { return mp_reverse_targets + mp_reverse_offsets[node+1]; }
+
+	// every node reachable from node (not including itself unless it is in a
+	// cycle), as a bitset of node_count() bits.
+	inline void dependency_closure(unsigned node, std::vector<unsigned>& bitset) const { closure(node, false, bitset); }
+	// every node from which node is reachable.
+	inline void dependent_closure(unsigned node, std::vector<unsigned>& bitset) const { closure(node, true, bitset); }
+
+	static inline bool test(const std::vector<unsigned>& bitset, unsigned node) throw() { return (bitset[node >> 5] >> (node & 31)) & 1; }
+
+	// the layer of every node: 0 for nodes without dependencies, otherwise one
+	// more than the highest layer of its dependencies. Nodes in or depending
+	// on a cycle have no layer, and get ~0u.
+	std::vector<unsigned> topological_layers() const;
+};
+
+#endif
@@ -23,84 +23,437 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Yes, you'll need Windows for Pajek.
 
 #include "MachO_File.h"
+#include "MachO_Header_View.h"
+#include "SharedCache_File.h"
+#include "ThreadPool.h"
+#include "CSR_Graph.h"
 #include <utility>
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <tr1/unordered_map>
 #include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace std;
 
+// the index of a library which is not extracted but exists in the shared cache,
+// or -1.
+static int in_shared_cache(const SharedCache_File* shared_cache, const string& filename, const string& sysroot) {
+	if (shared_cache == NULL || !shared_cache->valid() || filename.compare(0, sysroot.size(), sysroot) != 0)
+		return -1;
+	if (access(filename.c_str(), F_OK) == 0)
+		return -1;
+	return shared_cache->image_index(filename.c_str() + sysroot.size());
+}
+
+#pragma mark -
+#pragma mark Native scan
+
+// what was found in a file before it is added to the graph.
+struct ScannedFile {
+	string filename;
+	bool is_candidate;	// starts with a Mach-O or fat magic.
+	bool valid;
+	bool has_error;
+	string error;
+	vector<string> links;
+	
+	ScannedFile() : is_candidate(false), valid(false), has_error(false) {}
+};
+
+static string join_path(const string& directory, const char* name) {
+	if (!directory.empty() && directory[directory.size()-1] != '/')
+		return directory + '/' + name;
+	else
+		return directory + name;
+}
+
+// list the files under directory in the order of scan_for_macho.py (i.e.
+// os.walk): the files of a directory in readdir order, then its
+// subdirectories. Symbolic links to directories are not followed.
+static void walk_directory(const string& directory, vector<string>& files) {
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL)
+		return;
+	vector<string> subdirectories;
+	while (const dirent* entry = readdir(dir)) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		string path = join_path(directory, entry->d_name);
+		bool is_directory = false, is_link = false;
+#ifdef DT_DIR
+		if (entry->d_type == DT_DIR)
+			is_directory = true;
+		else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+#endif
+		{
+			struct stat st;
+			if (lstat(path.c_str(), &st) == 0) {
+				is_link = S_ISLNK(st.st_mode);
+				is_directory = S_ISDIR(st.st_mode) || (is_link && stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+			}
+		}
+		if (!is_directory)
+			files.push_back(path);
+		else if (!is_link)
+			subdirectories.push_back(path);
+	}
+	closedir(dir);
+	for (vector<string>::const_iterator cit = subdirectories.begin(); cit != subdirectories.end(); ++ cit)
+		walk_directory(*cit, files);
+}
+
+static bool has_macho_magic(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	unsigned char magic[4];
+	bool retval = pread(fd, magic, 4, 0) == 4 && ((magic[0] == 0xCA && magic[1] == 0xFE && magic[2] == 0xBA && magic[3] == 0xBE) || (magic[0] == 0xCE && magic[1] == 0xFA && magic[2] == 0xED && magic[3] == 0xFE));
+	close(fd);
+	return retval;
+}
+
+struct ScanJob {
+	vector<ScannedFile>* files;
+	const string* sysroot;
+	unsigned batch_size;
+};
+
+// each batch of files is written to its own slots, so the workers share
+// nothing but the pool's index.
+static void scan_batch(unsigned index, void* context) {
+	ScanJob* job = reinterpret_cast<ScanJob*>(context);
+	vector<ScannedFile>& files = *job->files;
+	size_t end = min(files.size(), static_cast<size_t>(index+1) * job->batch_size);
+	MachO_Header_View view;
+	for (size_t i = static_cast<size_t>(index) * job->batch_size; i < end; ++ i) {
+		ScannedFile& file = files[i];
+		file.is_candidate = has_macho_magic(file.filename.c_str());
+		if (!file.is_candidate)
+			continue;
+		try {
+			file.valid = view.open(file.filename.c_str());
+			if (file.valid)
+				file.links = view.linked_libraries(*job->sysroot);
+		} catch (const TRException& e) {
+			file.has_error = true;
+			file.error = e.what();
+		}
+	}
+}
+
+#pragma mark -
+#pragma mark Graph
+
+// The nodes are numbered in the order the files are added, so the files
+// scanned in parallel are added one by one in the order of the serial scan.
+class DependencyGraph {
+private:
+	string m_sysroot;
+	const SharedCache_File* mp_shared_cache;
+	
+	tr1::unordered_map<string, int> m_nodelist;
+	tr1::unordered_set<int> m_processedlist;
+	int m_nodes;
+	vector<pair<int, int> > m_arclist;
+	
+	// only the load commands are needed, so read them into one buffer
+	// instead of mapping every file.
+	MachO_Header_View m_file;
+	
+public:
+	// libraries found only in the shared cache, checked after the rest.
+	vector<string> cache_queue;
+	
+	DependencyGraph(const string& sysroot, const SharedCache_File* shared_cache) : m_sysroot(sysroot), mp_shared_cache(shared_cache), m_nodes(0) {}
+	
+	// read filename now if scanned is NULL.
+	void add(const string& filename, const ScannedFile* scanned) {
+		tr1::unordered_map<string, int>::const_iterator cit = m_nodelist.find(filename);
+		
+		bool need_insert_nodelist = false;
+		int current_node_id = m_nodes;
+		
+		if (cit != m_nodelist.end()) {
+			if (m_processedlist.find(cit->second) != m_processedlist.end())
+				return;
+			else
+				current_node_id = cit->second;
+		} else
+			need_insert_nodelist = true;
+		
+		int image_index = in_shared_cache(mp_shared_cache, filename, m_sysroot);
+		
+		try {
+			if (scanned != NULL && scanned->has_error)
+				throw TRException("%s", scanned->error.c_str());
+			if (image_index < 0 && !(scanned != NULL ? scanned->valid : m_file.open(filename.c_str())))
+				fprintf(stderr, "Warning: %s is not a valid Mach-O file. Ignoring it.\n", filename.c_str());
+			else {
+				m_processedlist.insert(current_node_id);
+				if (need_insert_nodelist)
+					m_nodelist.insert(pair<string,int>(filename, current_node_id));
+				++m_nodes;
+				
+				vector<string> links;
+				if (image_index >= 0)
+					links = MachO_File_Simple(*mp_shared_cache, static_cast<unsigned>(image_index)).linked_libraries(m_sysroot);
+				else if (scanned == NULL)
+					links = m_file.linked_libraries(m_sysroot);
+				const vector<string>& actual_links = (image_index < 0 && scanned != NULL) ? scanned->links : links;
+				for (vector<string>::const_iterator cit2 = actual_links.begin(); cit2 != actual_links.end(); ++ cit2) {
+					tr1::unordered_map<string, int>::const_iterator cit3 = m_nodelist.find(*cit2);
+					int other_node_id = m_nodes;
+					if (cit3 == m_nodelist.end()) {
+						m_nodelist.insert(pair<string,int>(*cit2, other_node_id));
+						++m_nodes;
+						if (in_shared_cache(mp_shared_cache, *cit2, m_sysroot) >= 0)
+							cache_queue.push_back(*cit2);
+					} else
+						other_node_id = cit3->second;
+					m_arclist.push_back(pair<int,int>(current_node_id, other_node_id));
+				}
+			}
+		} catch (const TRException& e) {
+			fprintf(stderr, "A TRException was thrown for '%s'.\n", e.what());
+		}
+	}
+	
+	void add_cache_queue() {
+		while (!cache_queue.empty()) {
+			string filename = cache_queue.back();
+			cache_queue.pop_back();
+			add(filename, NULL);
+		}
+	}
+	
+	CSR_Graph* to_csr() const {
+		vector<string> names (static_cast<size_t>(m_nodes));
+		for (tr1::unordered_map<string, int>::const_iterator cit = m_nodelist.begin(); cit != m_nodelist.end(); ++ cit)
+			names[static_cast<size_t>(cit->second)] = cit->first;
+		return new CSR_Graph(names, m_arclist);
+	}
+	
+	void print() const {
+		printf("*NETWORK Dependency graph.\r\n");
+		printf("*VERTICES %d\r\n", m_nodes);
+		for (tr1::unordered_map<string, int>::const_iterator cit = m_nodelist.begin(); cit != m_nodelist.end(); ++ cit)
+			printf(" %d \"%s\" # %s\r\n", cit->second+1, strrchr(cit->first.c_str(), '/')+1, cit->first.c_str());
+		printf("*ARCS\r\n");
+		for (vector<pair<int, int> >::const_iterator cit = m_arclist.begin(); cit != m_arclist.end(); ++ cit)
+			printf(" %d %d 1\r\n", cit->first+1, cit->second+1);
+	}
+};
+
+#pragma mark -
+#pragma mark Queries
+
+enum GraphQuery {
+	GQ_None,
+	GQ_Dependents,			// -R: who links to the library directly.
+	GQ_AllDependents,		// -d: who depends on the library, directly or not.
+	GQ_AllDependencies,		// -D: what the library depends on, directly or not.
+	GQ_Layers				// -L: the topological layer of every node.
+};
+
+static void print_bitset(const CSR_Graph& graph, const vector<unsigned>& bitset) {
+	for (unsigned i = 0; i < graph.node_count(); ++ i)
+		if (CSR_Graph::test(bitset, i) && graph.name(i)[0] != '\0')
+			printf("%s\n", graph.name(i));
+}
+
+static int run_query(const CSR_Graph& graph, GraphQuery query, const char* library) {
+	int node = -1;
+	if (query != GQ_Layers) {
+		node = graph.find(library);
+		if (node < 0) {
+			fprintf(stderr, "Error: %s is not in the graph.\n", library);
+			return 1;
+		}
+	}
+	
+	vector<unsigned> bitset;
+	switch (query) {
+		case GQ_Dependents:
+			bitset.assign((graph.node_count() + 31) / 32, 0);
+			for (const unsigned* p = graph.dependents_begin(static_cast<unsigned>(node)); p != graph.dependents_end(static_cast<unsigned>(node)); ++ p)
+				bitset[*p >> 5] |= 1u << (*p & 31);
+			print_bitset(graph, bitset);
+			break;
+		case GQ_AllDependents:
+			graph.dependent_closure(static_cast<unsigned>(node), bitset);
+			print_bitset(graph, bitset);
+			break;
+		case GQ_AllDependencies:
+			graph.dependency_closure(static_cast<unsigned>(node), bitset);
+			print_bitset(graph, bitset);
+			break;
+		case GQ_Layers: {
+			vector<unsigned> layers = graph.topological_layers();
+			vector<vector<unsigned> > by_layer;
+			vector<unsigned> cyclic;
+			for (unsigned i = 0; i < graph.node_count(); ++ i) {
+				if (graph.name(i)[0] == '\0')
+					continue;
+				if (layers[i] == ~0u)
+					cyclic.push_back(i);
+				else {
+					if (by_layer.size() <= layers[i])
+						by_layer.resize(layers[i]+1);
+					by_layer[layers[i]].push_back(i);
+				}
+			}
+			for (unsigned layer = 0; layer < by_layer.size(); ++ layer)
+				for (vector<unsigned>::const_iterator cit = by_layer[layer].begin(); cit != by_layer[layer].end(); ++ cit)
+					printf("%u\t%s\n", layer, graph.name(*cit));
+			for (vector<unsigned>::const_iterator cit = cyclic.begin(); cit != cyclic.end(); ++ cit)
+				printf("cycle\t%s\n", graph.name(*cit));
+			break;
+		}
+		default:
+			break;
+	}
+	return 0;
+}
+
+#pragma mark -
+
 int main (int argc, const char* argv[]) {
 	if (argc >= 2 && strcmp(argv[1], "-h") == 0) {
-		fprintf(stderr, "Usage: dependency_graph [<sys-root>]\n\nIn the stdin, type in the list of executables you want to check.\n");
+		fprintf(stderr, "Usage: dependency_graph [-c <dyld_shared_cache>] [-s [-j <threads>]] [-o <graph-file>] [<query>] [<sys-root>]\n"
+		               "       dependency_graph -g <graph-file> <query>\n"
+		               "\n"
+		               "In the stdin, type in the list of executables you want to check.\n"
+		               "With -s, every Mach-O file in the sys-root is checked instead, on <threads> threads\n"
+		               "(default: one per processor).\n"
+		               "Libraries inside the shared cache are read from it when they are not extracted.\n"
+		               "\n"
+		               "The graph is printed in Pajek format, unless it is written as a binary graph file\n"
+		               "with -o, or a query is given. -g reads a graph file instead of Mach-O files.\n"
+		               "\n"
+		               "Queries (<lib> is a full path or a file name):\n"
+		               "  -R <lib>   files which link to <lib> directly.\n"
+		               "  -d <lib>   files which depend on <lib>, directly or not.\n"
+		               "  -D <lib>   libraries which <lib> depends on, directly or not.\n"
+		               "  -L         the topological layer of every file, from the leaves.\n");
 	} else {
+		SharedCache_File* shared_cache = NULL;
+		bool scan_sysroot = false;
+		unsigned threads = 0;
+		const char* graph_output = NULL, *graph_input = NULL, *query_library = NULL;
+		GraphQuery query = GQ_None;
+		while (argc >= 2 && argv[1][0] == '-') {
+			if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+				delete shared_cache;
+				try {
+					shared_cache = new SharedCache_File(argv[2]);
+				} catch (const TRException& e) {
+					fprintf(stderr, "%s\n", e.what());
+					return 1;
+				}
+				if (!shared_cache->valid())
+					fprintf(stderr, "Warning: %s is not a dyld shared cache. Ignoring it.\n", argv[2]);
+				argc -= 2;
+				argv += 2;
+			} else if (argc >= 3 && strcmp(argv[1], "-j") == 0) {
+				threads = static_cast<unsigned>(strtoul(argv[2], NULL, 0));
+				argc -= 2;
+				argv += 2;
+			} else if (argc >= 3 && (strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "-g") == 0)) {
+				if (argv[1][1] == 'o')
+					graph_output = argv[2];
+				else
+					graph_input = argv[2];
+				argc -= 2;
+				argv += 2;
+			} else if (argc >= 3 && (strcmp(argv[1], "-R") == 0 || strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "-D") == 0)) {
+				query = argv[1][1] == 'R' ? GQ_Dependents : argv[1][1] == 'd' ? GQ_AllDependents : GQ_AllDependencies;
+				query_library = argv[2];
+				argc -= 2;
+				argv += 2;
+			} else if (strcmp(argv[1], "-L") == 0) {
+				query = GQ_Layers;
+				-- argc;
+				++ argv;
+			} else if (strcmp(argv[1], "-s") == 0) {
+				scan_sysroot = true;
+				-- argc;
+				++ argv;
+			} else
+				break;
+		}
 		string sysroot = string((argc <= 1) ? "" : argv[1]);
 		
-		tr1::unordered_map<string, int> nodelist;
-		tr1::unordered_set<int> processedlist;
-		int nodes = 0;
-		vector<pair<int, int> > arclist;
+		if (graph_input != NULL) {
+			delete shared_cache;
+			if (query == GQ_None) {
+				fprintf(stderr, "Error: -g needs a query.\n");
+				return 1;
+			}
+			try {
+				CSR_Graph graph (graph_input);
+				return run_query(graph, query, query_library);
+			} catch (const TRException& e) {
+				fprintf(stderr, "%s\n", e.what());
+				return 1;
+			}
+		}
 		
-		while (!feof(stdin)) {
-			char filename_buffer[2048];
-			fgets(filename_buffer, 2048, stdin);
-			size_t filename_length = strlen(filename_buffer);
-			if (filename_buffer[filename_length-1] == '\n')
-				filename_buffer[filename_length-1] = '\0';
-			
-			string filename = string(filename_buffer);
-			tr1::unordered_map<string, int>::const_iterator cit = nodelist.find(filename);
-			
-			bool need_insert_nodelist = false;
-			int current_node_id = nodes;
-			
-			if (cit != nodelist.end()) {
-				if (processedlist.find(cit->second) != processedlist.end())
-					continue;
-				else
-					current_node_id = cit->second;
-			} else
-				need_insert_nodelist = true;
+		DependencyGraph graph (sysroot, shared_cache);
+		
+		if (scan_sysroot) {
+			vector<string> filenames;
+			walk_directory(sysroot, filenames);
+			vector<ScannedFile> files (filenames.size());
+			for (size_t i = 0; i < filenames.size(); ++ i)
+				files[i].filename.swap(filenames[i]);
 			
-
+			ThreadPool pool (threads);
+			ScanJob job;
+			job.files = &files;
+			job.sysroot = &sysroot;
+			// small batches, so a slow file does not hold up a whole share.
+			job.batch_size = 16;
 			try {
-				MachO_File_Simple file = MachO_File_Simple(filename_buffer);
-			
-				if (!file.valid())
-					fprintf(stderr, "Warning: %s is not a valid Mach-O file. Ignoring it.\n", filename_buffer);
-				else {
-					processedlist.insert(current_node_id);
-					if (need_insert_nodelist)
-						nodelist.insert(pair<string,int>(filename, current_node_id));
-					++nodes;
-					
-					vector<string> links = file.linked_libraries(sysroot);
-					for (vector<string>::const_iterator cit2 = links.begin(); cit2 != links.end(); ++ cit2) {
-						tr1::unordered_map<string, int>::const_iterator cit3 = nodelist.find(*cit2);
-						int other_node_id = nodes;
-						if (cit3 == nodelist.end()) {
-							nodelist.insert(pair<string,int>(*cit2, other_node_id));
-							++nodes;
-						} else
-							other_node_id = cit3->second;
-						arclist.push_back(pair<int,int>(current_node_id, other_node_id));
-					}
-				}
+				pool.parallel_for(static_cast<unsigned>((files.size() + job.batch_size - 1) / job.batch_size), scan_batch, &job);
 			} catch (const TRException& e) {
-				fprintf(stderr, "A TRException was thrown for '%s'.\n", e.what());
-				continue;
+				fprintf(stderr, "%s\n", e.what());
+				return 1;
 			}
 			
+			for (vector<ScannedFile>::const_iterator cit = files.begin(); cit != files.end(); ++ cit)
+				if (cit->is_candidate)
+					graph.add(cit->filename, &*cit);
+		} else {
+			while (!feof(stdin)) {
+				char filename_buffer[2048];
+				fgets(filename_buffer, 2048, stdin);
+				size_t filename_length = strlen(filename_buffer);
+				if (filename_buffer[filename_length-1] == '\n')
+					filename_buffer[filename_length-1] = '\0';
+				graph.add(string(filename_buffer), NULL);
+			}
 		}
+		graph.add_cache_queue();
 		
-		printf("*NETWORK Dependency graph.\r\n");
-		printf("*VERTICES %d\r\n", nodes);
-		for (tr1::unordered_map<string, int>::const_iterator cit = nodelist.begin(); cit != nodelist.end(); ++ cit)
-			printf(" %d \"%s\" # %s\r\n", cit->second+1, strrchr(cit->first.c_str(), '/')+1, cit->first.c_str());
-		printf("*ARCS\r\n");
-		for (vector<pair<int, int> >::const_iterator cit = arclist.begin(); cit != arclist.end(); ++ cit)
-			printf(" %d %d 1\r\n", cit->first+1, cit->second+1);
+		if (graph_output == NULL && query == GQ_None)
+			graph.print();
+		else {
+			CSR_Graph* csr = graph.to_csr();
+			if (graph_output != NULL && !csr->write(graph_output))
+				fprintf(stderr, "Warning: Cannot write the graph file \"%s\".\n", graph_output);
+			int retval = query != GQ_None ? run_query(*csr, query, query_library) : 0;
+			delete csr;
+			delete shared_cache;
+			return retval;
+		}
+		
+		delete shared_cache;
 	}
 	
 	return 0;
-}
\ No newline at end of file
+}
@@ -4,6 +4,13 @@
 #include_next <unistd.h>
 #else
 #include <direct.h>
+#include <io.h>
+typedef long ssize_t;
 static inline int mkdir (const char* path, int mode) { return _mkdir(path); }
+static inline ssize_t pread (int fildes, void* buf, size_t nbyte, off_t offset) {
+	if (_lseek(fildes, offset, SEEK_SET) == -1)
+		return -1;
+	return _read(fildes, buf, nbyte);
+}
 #endif
 #endif
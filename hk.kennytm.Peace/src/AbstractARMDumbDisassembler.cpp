@@ -111,10 +111,7 @@ const char* AbstractARMDumbDisassembler::compute_reg_list (unsigned list) throw(
 	return RegListScratchMemory;
 }
 
-AbstractARMDumbDisassembler::AbstractARMDumbDisassembler(MachO_File& file, FILE* stream) : m_file(file), m_text_segment_index(file.segment_index_having_name("__TEXT")), m_data_segment_index(file.segment_index_having_name("__DATA")), m_stream(stream) {
-	if (m_text_segment_index == -1) m_text_segment_index = 0;
-	if (m_data_segment_index == -1) m_data_segment_index = 0;
-}
+AbstractARMDumbDisassembler::AbstractARMDumbDisassembler(MachO_File& file, FILE* stream) : m_file(file), m_text_hint(0), m_data_hint(0), m_stream(stream) {}
 
 void AbstractARMDumbDisassembler::print_references(unsigned vm_address, unsigned depth) const throw() {
 #define MAX_DEPTH 8
@@ -152,8 +149,7 @@ void AbstractARMDumbDisassembler::print_references(unsigned vm_address, unsigned
 }
 
 void AbstractARMDumbDisassembler::disassemble_in_range(unsigned start_at, size_t range_bytes) {
-	int guess_index = m_text_segment_index;
-	m_file.seek_vm_address(start_at, &guess_index);
+	m_file.seek_vm_address(start_at, &m_text_hint);
 	
 	off_t cur_file_offset = m_file.tell();
 	
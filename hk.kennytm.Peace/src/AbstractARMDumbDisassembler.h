@@ -34,13 +34,15 @@ protected:
 	unsigned stack[StackSize];
 	
 	MachO_File& m_file;
-	int m_text_segment_index, m_data_segment_index;
+	// locality hints for the address index of m_file.
+	int m_text_hint;
+	mutable int m_data_hint;
 	std::FILE* m_stream;
 	
 	// some convenient functions....
 	static inline unsigned ror (unsigned value, int shift) throw() { shift &= 31; return (value >> shift) | (value << (32 - shift)); }
 	
-	inline unsigned dereference (unsigned R) const throw() { return (R < StackSize) ? stack[R/sizeof(unsigned)] : m_file.dereference(R); }
+	inline unsigned dereference (unsigned R) const throw() { return (R < StackSize) ? stack[R/sizeof(unsigned)] : m_file.dereference(R, &m_data_hint); }
 	
 	void store_reference (unsigned R, unsigned value, unsigned mask = ~0) throw();
 	void load_reference (unsigned R, unsigned Rd, unsigned mask = ~0, bool isSigned = false) throw();
@@ -28,14 +28,69 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include "DataFile.h"
 
+#if _MSC_VER && !defined(va_copy)
+#define va_copy(dest, src) ((dest) = (src))
+#endif
+
+// the string scanners classify 16 bytes per step with SSE2 (-msse3 in the
+// Makefile), and fall back to one byte per step elsewhere (ARM, MSVC).
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <stdint.h>
+#define DATAFILE_USE_SSE2 1
+#else
+#define DATAFILE_USE_SSE2 0
+#endif
+
 using namespace std;
 
+static inline bool is_ascii_text(char c, bool accept_cr) throw() {
+	return c == '\t' || c == '\n' || (accept_cr && c == '\r') || (c >= ' ' && c <= '~');
+}
+
+// the length of the longest prefix of [begin, end) made of printable ASCII
+// characters, '\t' and '\n', and also '\r' if accept_cr.
+static size_t ascii_run_length(const char* begin, const char* end, bool accept_cr) throw() {
+	// most scans through binary data stop at the first byte.
+	if (begin >= end || !is_ascii_text(*begin, accept_cr))
+		return 0;
+	
+#if DATAFILE_USE_SSE2
+	const __m128i space_minus_1 = _mm_set1_epi8(' '-1), del = _mm_set1_epi8(0x7f);
+	const __m128i tab = _mm_set1_epi8('\t'), lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8(accept_cr ? '\r' : '\n');
+	
+	// aligned loads never cross a page, so the bytes of the first and last
+	// blocks outside [begin, end) can be read safely and are masked off.
+	const char* block = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(begin) & ~static_cast<uintptr_t>(15));
+	unsigned first_mask = (0xFFFFu << (begin - block)) & 0xFFFFu;
+	for (; block < end; block += 16, first_mask = 0xFFFFu) {
+		__m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+		// bytes >= 0x80 are negative, and fail the first comparison.
+		__m128i good = _mm_and_si128(_mm_cmpgt_epi8(v, space_minus_1), _mm_cmplt_epi8(v, del));
+		good = _mm_or_si128(good, _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+		unsigned bad = ~static_cast<unsigned>(_mm_movemask_epi8(good)) & first_mask;
+		if (bad != 0) {
+			const char* stop = block + __builtin_ctz(bad);
+			return static_cast<size_t>((stop < end ? stop : end) - begin);
+		}
+	}
+	return static_cast<size_t>(end - begin);
+#else
+	const char* x = begin + 1;
+	while (x < end && is_ascii_text(*x, accept_cr))
+		++ x;
+	return static_cast<size_t>(x - begin);
+#endif
+}
+
 TRException::TRException(const char* format, ...) {
-	va_list arguments;
+	va_list arguments, arguments_copy;
 	va_start(arguments, format);
+	va_copy(arguments_copy, arguments);
 	int string_length = vsnprintf(NULL, 0, format, arguments);
 	m_error = new char[string_length+1];
-	vsnprintf(m_error, string_length, format, arguments);
+	vsnprintf(m_error, string_length+1, format, arguments_copy);
+	va_end(arguments_copy);
 	va_end(arguments);
 }
 
@@ -44,7 +99,7 @@ TRException::~TRException() throw() {
 }
 
 
-DataFile::DataFile(const char* path) : m_fd(open(path, O_RDONLY)), m_location(0) {
+DataFile::DataFile(const char* path) : m_fd(open(path, O_RDONLY)), m_location(0), m_owns_mapping(true) {
 	if (m_fd == -1) {
 		throw TRException("DataFile::DataFile(const char*):\n\tFail to open \"%s\".", path);
 	}
@@ -59,6 +114,8 @@ DataFile::DataFile(const char* path) : m_fd(open(path, O_RDONLY)), m_location(0)
 		throw TRException("DataFile::DataFile(const char*):\n\tFail to map \"%s\" into memory.", path);
 	}
 }
+
+DataFile::DataFile(const DataFile& other, BorrowTag) throw() : m_data(other.m_data), m_filesize(other.m_filesize), m_fd(other.m_fd), m_location(0), m_owns_mapping(false) {}
 		
 unsigned DataFile::read_integer() throw() {
 	union {
@@ -80,13 +137,7 @@ const char* DataFile::read_string(size_t* p_string_length) throw() {
 }
 const char* DataFile::read_ASCII_string(size_t* p_string_length) throw() {
 	const char* retval = m_data+m_location;
-	const char* x = retval;
-	
-	size_t string_length = 0;
-	while (*x == '\t' || *x == '\n' || *x == '\r' || (*x >= ' ' && *x <= '~')) {
-		++x;
-		++string_length;
-	}
+	size_t string_length = m_location < m_filesize ? ascii_run_length(retval, m_data + m_filesize, true) : 0;
 	
 	if (p_string_length != NULL)
 		*p_string_length = string_length;
@@ -103,22 +154,12 @@ const char* DataFile::peek_ASCII_Cstring_at(off_t offset, size_t* p_string_lengt
 		return NULL;
 	
 	const char* retval = m_data + offset;
-	const char* x = retval;
+	size_t string_length = ascii_run_length(retval, m_data + m_filesize, false);
 	
-	off_t string_length = 0;
-	while (*x == '\t' || *x == '\n' || (*x >= ' ' && *x <= '~')) {
-		++x;
-		++string_length;
-		if (offset + string_length >= m_filesize) {
-			if (p_string_length != NULL)
-				*p_string_length = 0;
-			return NULL;
-		}
-	}
-	
-	if (*x == '\0') {
+	// the string must be terminated before the end of the file.
+	if (offset + static_cast<off_t>(string_length) < m_filesize && retval[string_length] == '\0') {
 		if (p_string_length != NULL)
-			*p_string_length = static_cast<size_t>(string_length);
+			*p_string_length = string_length;
 		return retval;
 	} else {
 		if (p_string_length != NULL)
@@ -134,29 +175,55 @@ const char* DataFile::read_raw_data(size_t data_size) throw() {
 }
 
 DataFile::~DataFile() throw() {
-	munmap(m_data, static_cast<size_t>(m_filesize));
-	close(m_fd);
+	if (m_owns_mapping) {
+		munmap(m_data, static_cast<size_t>(m_filesize));
+		close(m_fd);
+	}
 }
 
 bool DataFile::search_forward(const char* data, size_t length) throw() {
-	if (length > 0) {
-		while (true) {
-			if (static_cast<off_t>(length) + m_location > m_filesize) goto eof;
-			
-			const char* loc = reinterpret_cast<const char*>(std::memchr(m_data + m_location, data[0], m_filesize - m_location - length));
-			if (loc == NULL) goto eof;
-			
-			m_location = loc - m_data;
-			if (static_cast<off_t>(length) + m_location > m_filesize) goto eof;
-			
-			if (std::memcmp(m_data + m_location, data, length) == 0)
+	if (length == 0)
+		return true;
+	if (static_cast<off_t>(length) + m_location > m_filesize)
+		goto eof;
+	
+	{
+		const char* p = m_data + m_location;
+		// the last position where a match can start.
+		const char* last_start = m_data + m_filesize - static_cast<off_t>(length);
+		
+#if DATAFILE_USE_SSE2
+		// compare the first and the last byte of the needle at 16 positions
+		// per step, and check the rest only where both match.
+		if (length > 1) {
+			const __m128i first = _mm_set1_epi8(data[0]), last = _mm_set1_epi8(data[length-1]);
+			for (; p + 15 <= last_start; p += 16) {
+				__m128i at_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				__m128i at_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + length - 1));
+				unsigned candidates = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_first, first), _mm_cmpeq_epi8(at_last, last))));
+				while (candidates != 0) {
+					const char* loc = p + __builtin_ctz(candidates);
+					if (std::memcmp(loc + 1, data + 1, length - 2) == 0) {
+						m_location = loc - m_data;
+						return true;
+					}
+					candidates &= candidates - 1;
+				}
+			}
+		}
+#endif
+		
+		while (p <= last_start) {
+			const char* loc = reinterpret_cast<const char*>(std::memchr(p, data[0], static_cast<size_t>(last_start - p) + 1));
+			if (loc == NULL)
+				break;
+			if (std::memcmp(loc, data, length) == 0) {
+				m_location = loc - m_data;
 				return true;
-			
-			++ m_location;
+			}
+			p = loc + 1;
 		}
-	} else
-		return true;
-
+	}
 	
 eof:
 	m_location = m_filesize;
@@ -43,8 +43,20 @@ protected:
 	int m_fd;
 	off_t m_location;
 	
+	// false if the mapping is borrowed from another DataFile.
+	bool m_owns_mapping;
+	
+private:
+	DataFile(const DataFile&);
+	DataFile& operator= (const DataFile&);
+	
 public:
+	enum BorrowTag { borrow_mapping };
+	
 	DataFile(const char* path);
+	// borrow the mapping of another DataFile, which must outlive this object.
+	// The new object has its own cursor, starting at the beginning of the file.
+	DataFile(const DataFile& other, BorrowTag) throw();
 	
 	inline const char* data() const throw() { return m_data; }
 	inline off_t filesize() const throw() { return m_filesize; }
@@ -144,6 +156,46 @@ public:
 		return res;		
 	}
 	
+	// decode an unsigned LEB128 number directly from memory, leaving the cursor
+	// alone. p is advanced past the number, but never beyond end.
+	template<typename T>
+	static T decode_uleb128(const char*& p, const char* end) throw() {
+		T res = 0;
+		int bit = 0;
+		unsigned char c = 0;
+		do {
+			if (p >= end)
+				break;
+			c = static_cast<unsigned char>(*p++);
+			T s = c & 0x7F;
+			if (bit < static_cast<int>(sizeof(T)*8))
+				res |= s << bit;
+			bit += 7;
+		} while (c & 0x80);
+		return res;
+	}
+	
+	template<typename T>
+	static T decode_sleb128(const char*& p, const char* end) throw() {
+		T res = 0;
+		int bit = 0;
+		signed char c = 0;
+		do {
+			if (p >= end)
+				break;
+			c = *p++;
+			T s = c & 0x7F;
+			if (bit < static_cast<int>(sizeof(T)*8))
+				res |= s << bit;
+			bit += 7;
+		} while (c & 0x80);
+		if ((c & 0x40) && bit < static_cast<int>(sizeof(T)*8)) {
+			T n1 = -1;
+			res |= n1 << bit;
+		}
+		return res;
+	}
+	
 	bool search_forward(const char* data, size_t length) throw();
 	
 	~DataFile() throw();
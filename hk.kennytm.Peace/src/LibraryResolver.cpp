@@ -0,0 +1,258 @@
+/*
+
+LibraryResolver.cpp ... Resolve and cache the dependencies of Mach-O files.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "LibraryResolver.h"
+#include "MachO_Header_View.h"
+#include "ThreadPool.h"
+#include "DataFile.h"
+#include <cstring>
+#include <deque>
+#include <sys/stat.h>
+
+using namespace std;
+
+#if !_MSC_VER
+namespace {
+	class ScopedLock {
+	private:
+		pthread_mutex_t& m_mutex;
+	public:
+		ScopedLock(pthread_mutex_t& mutex) : m_mutex(mutex) { pthread_mutex_lock(&m_mutex); }
+		~ScopedLock() throw() { pthread_mutex_unlock(&m_mutex); }
+	};
+}
+#define LOCK_RESOLVER ScopedLock scoped_lock (m_mutex)
+#else
+#define LOCK_RESOLVER
+#endif
+
+static const char* lc_str_at(const load_command* p_cmd, unsigned name_offset) throw() {
+	if (name_offset >= p_cmd->cmdsize)
+		return NULL;
+	const char* name = reinterpret_cast<const char*>(p_cmd) + name_offset;
+	if (memchr(name, '\0', p_cmd->cmdsize - name_offset) == NULL)
+		return NULL;
+	return name;
+}
+
+static string directory_of(const string& path) {
+	string::size_type slash = path.rfind('/');
+	return slash == string::npos ? string(".") : path.substr(0, slash);
+}
+
+static bool file_exists(const string& path) throw() {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+// the part of "@xxx/yyy" after the first slash, which is what
+// MachO_Header_View::linked_libraries() returns when nothing better is known.
+static string strip_at_prefix(const string& install_name) {
+	string::size_type slash = install_name.find('/');
+	return slash == string::npos ? install_name : install_name.substr(slash+1);
+}
+
+static bool has_prefix(const string& s, const char* prefix, string::size_type prefix_length) throw() {
+	return s.compare(0, prefix_length, prefix) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+LibraryResolver::LibraryResolver(const string& sysroot, const char* arch) : m_sysroot(sysroot), m_arch(arch) {
+#if !_MSC_VER
+	pthread_mutex_init(&m_mutex, NULL);
+#endif
+}
+
+LibraryResolver::~LibraryResolver() throw() {
+	for (tr1::unordered_map<string, const LibraryInfo*>::const_iterator cit = ma_libraries.begin(); cit != ma_libraries.end(); ++ cit)
+		delete cit->second;
+#if !_MSC_VER
+	pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+size_t LibraryResolver::cached_count() const {
+	LOCK_RESOLVER;
+	return ma_libraries.size();
+}
+
+const LibraryResolver::LibraryInfo& LibraryResolver::library(const string& path) {
+	{
+		LOCK_RESOLVER;
+		tr1::unordered_map<string, const LibraryInfo*>::const_iterator cit = ma_libraries.find(path);
+		if (cit != ma_libraries.end())
+			return *cit->second;
+	}
+
+	// read the file without holding the lock. If another thread wins the race
+	// its copy is kept, and the two are identical anyway.
+	LibraryInfo* info = new LibraryInfo;
+	info->depends_on_executable = false;
+	try {
+		MachO_Header_View view;
+		if (view.open(path.c_str(), m_arch.c_str())) {
+			const vector<const load_command*>& load_commands = view.load_commands();
+			for (vector<const load_command*>::const_iterator cit = load_commands.begin(); cit != load_commands.end(); ++ cit) {
+				const load_command* p_cmd = *cit;
+				if ((p_cmd->cmd == LC_LOAD_DYLIB || p_cmd->cmd == LC_LOAD_WEAK_DYLIB) && p_cmd->cmdsize >= sizeof(dylib_command)) {
+					const char* name = lc_str_at(p_cmd, reinterpret_cast<const dylib_command*>(p_cmd)->dylib.name.offset);
+					if (name != NULL)
+						info->install_names.push_back(name);
+				} else if (p_cmd->cmd == LC_RPATH && p_cmd->cmdsize >= sizeof(rpath_command)) {
+					const char* name = lc_str_at(p_cmd, reinterpret_cast<const rpath_command*>(p_cmd)->path.offset);
+					if (name != NULL)
+						info->rpaths.push_back(name);
+				}
+			}
+		}
+	} catch (const TRException&) {
+		// missing file or arch, treated as a library without dependencies.
+	}
+	for (vector<string>::const_iterator cit = info->install_names.begin(); cit != info->install_names.end(); ++ cit)
+		if (has_prefix(*cit, "@executable_path/", 17) || has_prefix(*cit, "@rpath/", 7))
+			info->depends_on_executable = true;
+	if (!info->depends_on_executable)
+		resolve_all(*info, path, "", info->dependencies);
+
+	LOCK_RESOLVER;
+	pair<tr1::unordered_map<string, const LibraryInfo*>::iterator, bool> res = ma_libraries.insert(make_pair(path, static_cast<const LibraryInfo*>(info)));
+	if (!res.second)
+		delete info;
+	return *res.first->second;
+}
+
+//------------------------------------------------------------------------------
+
+string LibraryResolver::resolve_rpath(const string& suffix, const string& loader_path, const string& executable_path) {
+	const string* owners[2] = {&loader_path, &executable_path};
+	for (unsigned i = 0; i < 2; ++ i) {
+		if (owners[i]->empty() || (i == 1 && executable_path == loader_path))
+			continue;
+		const LibraryInfo& info = library(*owners[i]);
+		for (vector<string>::const_iterator cit = info.rpaths.begin(); cit != info.rpaths.end(); ++ cit) {
+			// an LC_RPATH may itself start with @loader_path or @executable_path,
+			// which refer to the file that carries it.
+			string candidate = (cit->empty() || (*cit)[0] == '@') ? resolve(*cit, *owners[i], executable_path) : m_sysroot + *cit;
+			candidate += '/';
+			candidate += suffix;
+			if (file_exists(candidate))
+				return candidate;
+		}
+	}
+	return string();
+}
+
+string LibraryResolver::resolve(const string& install_name, const string& loader_path, const string& executable_path) {
+	if (install_name.empty() || install_name[0] != '@')
+		return m_sysroot + install_name;
+
+	static const char executable_prefix[] = "@executable_path/";
+	static const char loader_prefix[] = "@loader_path/";
+	static const char rpath_prefix[] = "@rpath/";
+
+	if (has_prefix(install_name, executable_prefix, sizeof(executable_prefix)-1)) {
+		if (!executable_path.empty())
+			return directory_of(executable_path) + install_name.substr(sizeof(executable_prefix)-2);
+	} else if (has_prefix(install_name, loader_prefix, sizeof(loader_prefix)-1)) {
+		if (!loader_path.empty())
+			return directory_of(loader_path) + install_name.substr(sizeof(loader_prefix)-2);
+	} else if (has_prefix(install_name, rpath_prefix, sizeof(rpath_prefix)-1)) {
+		string candidate = resolve_rpath(install_name.substr(sizeof(rpath_prefix)-1), loader_path, executable_path);
+		if (!candidate.empty())
+			return candidate;
+	}
+
+	return strip_at_prefix(install_name);
+}
+
+void LibraryResolver::resolve_all(const LibraryInfo& info, const string& path, const string& executable_path, vector<string>& result) {
+	result.reserve(result.size() + info.install_names.size());
+	for (vector<string>::const_iterator cit = info.install_names.begin(); cit != info.install_names.end(); ++ cit)
+		result.push_back(resolve(*cit, path, executable_path));
+}
+
+vector<string> LibraryResolver::dependencies(const string& path, const string& executable_path) {
+	const LibraryInfo& info = library(path);
+	if (!info.depends_on_executable)
+		return info.dependencies;
+	vector<string> retval;
+	resolve_all(info, path, executable_path, retval);
+	return retval;
+}
+
+//------------------------------------------------------------------------------
+
+void LibraryResolver::closure_into(const vector<string>& first_level, const string& executable_path, tr1::unordered_set<string>& result) {
+	deque<string> queue;
+	for (vector<string>::const_iterator cit = first_level.begin(); cit != first_level.end(); ++ cit)
+		if (result.insert(*cit).second)
+			queue.push_back(*cit);
+
+	vector<string> scratch;
+	while (!queue.empty()) {
+		const LibraryInfo& info = library(queue.front());
+		const vector<string>* next_level = &info.dependencies;
+		if (info.depends_on_executable) {
+			scratch.clear();
+			resolve_all(info, queue.front(), executable_path, scratch);
+			next_level = &scratch;
+		}
+		queue.pop_front();
+		for (vector<string>::const_iterator cit = next_level->begin(); cit != next_level->end(); ++ cit)
+			if (result.insert(*cit).second)
+				queue.push_back(*cit);
+	}
+}
+
+tr1::unordered_set<string> LibraryResolver::closure(const vector<string>& first_level, const string& executable_path) {
+	tr1::unordered_set<string> retval;
+	closure_into(first_level, executable_path, retval);
+	return retval;
+}
+
+tr1::unordered_set<string> LibraryResolver::closure(const string& root) {
+	tr1::unordered_set<string> retval;
+	closure_into(dependencies(root, root), root, retval);
+	retval.erase(root);
+	return retval;
+}
+
+struct ClosureJob {
+	LibraryResolver* resolver;
+	const vector<string>* roots;
+	vector<tr1::unordered_set<string> >* results;
+};
+
+void LibraryResolver::closure_job(unsigned index, void* context) {
+	ClosureJob* job = reinterpret_cast<ClosureJob*>(context);
+	(*job->results)[index] = job->resolver->closure((*job->roots)[index]);
+}
+
+vector<tr1::unordered_set<string> > LibraryResolver::closures(const vector<string>& roots, ThreadPool& pool) {
+	vector<tr1::unordered_set<string> > retval (roots.size());
+	ClosureJob job;
+	job.resolver = this;
+	job.roots = &roots;
+	job.results = &retval;
+	pool.parallel_for(static_cast<unsigned>(roots.size()), closure_job, &job);
+	return retval;
+}
@@ -0,0 +1,97 @@
+/*
+
+LibraryResolver.h ... Resolve and cache the dependencies of Mach-O files.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LIBRARY_RESOLVER_H
+#define LIBRARY_RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#if !_MSC_VER
+#include <pthread.h>
+#endif
+
+class ThreadPool;
+
+// Reads the load commands of every library once, and resolves install names
+// the way dyld does:
+//
+//   /usr/lib/libfoo.dylib        -> <sysroot>/usr/lib/libfoo.dylib
+//   @executable_path/libfoo.dylib -> relative to the main executable.
+//   @loader_path/libfoo.dylib     -> relative to the file which loads it.
+//   @rpath/libfoo.dylib           -> the first existing file under the
+//                                    LC_RPATHs of the loader or the executable.
+//
+// A name which cannot be resolved is kept as it is. The cache is shared by
+// every thread, so one resolver can compute the closures of many roots.
+class LibraryResolver {
+private:
+	// what is read from a file.
+	struct LibraryInfo {
+		std::vector<std::string> install_names;	// LC_LOAD_DYLIB and LC_LOAD_WEAK_DYLIB.
+		std::vector<std::string> rpaths;
+		// install_names resolved once, when none of them depends on which
+		// executable loads the library (@executable_path or @rpath).
+		bool depends_on_executable;
+		std::vector<std::string> dependencies;
+	};
+
+	std::string m_sysroot, m_arch;
+	std::tr1::unordered_map<std::string, const LibraryInfo*> ma_libraries;
+#if !_MSC_VER
+	mutable pthread_mutex_t m_mutex;
+#endif
+
+	const LibraryInfo& library(const std::string& path);
+	std::string resolve_rpath(const std::string& suffix, const std::string& loader_path, const std::string& executable_path);
+	void resolve_all(const LibraryInfo& info, const std::string& path, const std::string& executable_path, std::vector<std::string>& result);
+	void closure_into(const std::vector<std::string>& first_level, const std::string& executable_path, std::tr1::unordered_set<std::string>& result);
+
+	static void closure_job(unsigned index, void* context);
+
+	LibraryResolver(const LibraryResolver&);
+	LibraryResolver& operator= (const LibraryResolver&);
+
+public:
+	LibraryResolver(const std::string& sysroot, const char* arch = "any");
+	~LibraryResolver() throw();
+
+	// install_name as seen from loader_path, for the executable at
+	// executable_path. Either path may be empty if it is unknown.
+	std::string resolve(const std::string& install_name, const std::string& loader_path, const std::string& executable_path);
+
+	// the resolved direct dependencies of a file. Empty if it is not a Mach-O
+	// file or does not exist.
+	std::vector<std::string> dependencies(const std::string& path, const std::string& executable_path);
+
+	// every library reachable from root, not including root itself.
+	std::tr1::unordered_set<std::string> closure(const std::string& root);
+	// every library reachable from the given libraries, which are included.
+	std::tr1::unordered_set<std::string> closure(const std::vector<std::string>& first_level, const std::string& executable_path);
+	// the closures of many roots, computed on a pool.
+	std::vector<std::tr1::unordered_set<std::string> > closures(const std::vector<std::string>& roots, ThreadPool& pool);
+
+	// the number of files whose load commands have been read.
+	std::size_t cached_count() const;
+};
+
+#endif
@@ -20,6 +20,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "MachO_File.h"
+#include "MachO_Header_View.h"
+#include "SharedCache_File.h"
+#include "LibraryResolver.h"
 #include <cstring>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -31,33 +34,128 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
-MachO_File_Simple::MachO_File_Simple(const char* path, const char* arch) : DataFile(path), m_origin(0), m_crypt_begin(0), m_crypt_end(0) {
+static bool slice_matches(const MachO_File_Simple::Slice& slice, const arch_flag& target_arch) throw() {
+	return target_arch.cputype == CPU_TYPE_ANY || (slice.cputype == target_arch.cputype && (target_arch.cpusubtype == 0 || slice.cpusubtype == target_arch.cpusubtype));
+}
+
+vector<MachO_File_Simple::Slice> MachO_File_Simple::slices(const DataFile& file) {
+	vector<Slice> retval;
 	
-	const mach_header* mp_header = this->read_data<mach_header>();
+	const fat_header* p_fat_header = file.peek_data_at<fat_header>(0);
+	if (p_fat_header != NULL && OSSwapBigToHostInt32(p_fat_header->magic) == FAT_MAGIC) {
+		unsigned nfat_arch = OSSwapBigToHostInt32(p_fat_header->nfat_arch);
+		retval.reserve(nfat_arch);
+		for (unsigned i = 0; i < nfat_arch; ++ i) {
+			const fat_arch* arch = file.peek_data_at<fat_arch>(static_cast<off_t>(sizeof(fat_header) + i * sizeof(fat_arch)));
+			if (arch == NULL)
+				break;
+			Slice slice;
+			slice.cputype = static_cast<cpu_type_t>(OSSwapBigToHostInt32(arch->cputype));
+			slice.cpusubtype = static_cast<cpu_subtype_t>(OSSwapBigToHostInt32(arch->cpusubtype));
+			slice.offset = OSSwapBigToHostInt32(arch->offset);
+			slice.arch = get_arch_name_from_types(slice.cputype, slice.cpusubtype);
+			retval.push_back(slice);
+		}
+	} else {
+		const mach_header* p_header = file.peek_data_at<mach_header>(0);
+		Slice slice;
+		slice.cputype = p_header != NULL ? p_header->cputype : CPU_TYPE_ANY;
+		slice.cpusubtype = p_header != NULL ? p_header->cpusubtype : 0;
+		slice.offset = 0;
+		slice.arch = get_arch_name_from_types(slice.cputype, slice.cpusubtype);
+		retval.push_back(slice);
+	}
+	
+	return retval;
+}
+
+vector<MachO_File_Simple::Slice> MachO_File_Simple::select_slices(const DataFile& file, const char* arch_list) {
+	vector<Slice> all_slices = slices(file);
+	if (strcmp(arch_list, "all") == 0)
+		return all_slices;
 	
-	if (OSSwapBigToHostInt32(mp_header->magic) == FAT_MAGIC) {
+	vector<Slice> retval;
+	const char* arch_begin = arch_list;
+	while (true) {
+		const char* arch_end = strchr(arch_begin, ',');
+		string arch_name = arch_end != NULL ? string(arch_begin, arch_end) : string(arch_begin);
+		
+		struct arch_flag target_arch;
+		if (get_arch_from_flag(arch_name.c_str(), &target_arch) == 0) {
+			target_arch.cputype = CPU_TYPE_ANY;
+			target_arch.cpusubtype = 0;
+		}
+		
+		bool found_arch = false;
+		for (vector<Slice>::const_iterator cit = all_slices.begin(); cit != all_slices.end(); ++ cit) {
+			if (slice_matches(*cit, target_arch)) {
+				found_arch = true;
+				bool selected = false;
+				for (vector<Slice>::const_iterator sit = retval.begin(); sit != retval.end(); ++ sit)
+					if (sit->offset == cit->offset)
+						selected = true;
+				if (!selected)
+					retval.push_back(*cit);
+				break;
+			}
+		}
+		// a thin file is used whatever the requested arch is, as before.
+		if (!found_arch && all_slices.size() == 1 && all_slices[0].offset == 0) {
+			if (retval.empty())
+				retval.push_back(all_slices[0]);
+			found_arch = true;
+		}
+		if (!found_arch)
+			throw TRException("MachO_File_Simple::select_slices(const DataFile&, const char*):\n\tArchitecture \"%s\" not found.", arch_name.c_str());
+		
+		if (arch_end == NULL)
+			break;
+		arch_begin = arch_end + 1;
+	}
+	
+	return retval;
+}
+
+MachO_File_Simple::MachO_File_Simple(const char* path, const char* arch) : DataFile(path), m_origin(0), m_crypt_begin(0), m_crypt_end(0), mp_shared_cache(NULL) {
+	const fat_header* p_fat_header = this->peek_data_at<fat_header>(0);
+	if (p_fat_header != NULL && OSSwapBigToHostInt32(p_fat_header->magic) == FAT_MAGIC) {
 		struct arch_flag target_arch;
 		if (get_arch_from_flag(arch, &target_arch) == 0) {
 			target_arch.cputype = CPU_TYPE_ANY;
 			target_arch.cpusubtype = 0;
 		}
-		this->retreat(sizeof(mach_header) - sizeof(fat_header));
+		vector<Slice> all_slices = slices(*this);
 		bool found_arch = false;
-		for (unsigned c = OSSwapBigToHostInt32(reinterpret_cast<const fat_header*>(mp_header)->nfat_arch); c != 0; --c) {
-			const fat_arch* arch = this->read_data<fat_arch>();
-			if (target_arch.cputype == CPU_TYPE_ANY || (static_cast<cpu_type_t>(OSSwapBigToHostInt32(arch->cputype)) == target_arch.cputype && (target_arch.cpusubtype == 0 || static_cast<cpu_subtype_t>(OSSwapBigToHostInt32(arch->cpusubtype)) == target_arch.cpusubtype))) {
-				m_origin = OSSwapBigToHostInt32(arch->offset);
-				this->seek(m_origin);
+		for (vector<Slice>::const_iterator cit = all_slices.begin(); cit != all_slices.end(); ++ cit) {
+			if (slice_matches(*cit, target_arch)) {
+				m_origin = cit->offset;
 				found_arch = true;
 				break;
 			}
 		}
 		if (!found_arch)
 			throw TRException("MachO_File_Simple::MachO_File_Simple(const char*, const char*):\n\tArchitecture \"%s\" not found in \"%s\".", arch, path);
-		mp_header = this->read_data<mach_header>();
 	}
 	
-	if (mp_header->magic != MH_MAGIC) {
+	load_slice();
+}
+
+MachO_File_Simple::MachO_File_Simple(const DataFile& file, const Slice& slice) : DataFile(file, borrow_mapping), m_origin(slice.offset), m_crypt_begin(0), m_crypt_end(0), mp_shared_cache(NULL) {
+	load_slice();
+}
+
+MachO_File_Simple::MachO_File_Simple(const SharedCache_File& cache, unsigned image_index) : DataFile(cache, borrow_mapping), m_origin(0), m_crypt_begin(0), m_crypt_end(0), mp_shared_cache(&cache) {
+	if (image_index >= cache.images().size())
+		throw TRException("MachO_File_Simple::MachO_File_Simple(const SharedCache_File&, unsigned):\n\tImage %u not found in the cache.", image_index);
+	m_origin = cache.images()[image_index].offset;
+	load_slice();
+}
+
+void MachO_File_Simple::load_slice() {
+	this->seek(m_origin);
+	const mach_header* mp_header = this->read_data<mach_header>();
+	
+	if (mp_header == NULL || mp_header->magic != MH_MAGIC) {
 		m_is_valid = false;
 		return;
 	} else
@@ -92,64 +190,123 @@ MachO_File_Simple::MachO_File_Simple(const char* path, const char* arch) : DataF
 		
 		this->advance(p_cur_cmd->cmdsize);
 	}
+	
+	build_address_index();
 }
 
-off_t MachO_File_Simple::to_file_offset (unsigned vm_address, int* p_guess_segment) const throw() {
-	if (!m_is_valid)
-		return vm_address;
-	if (vm_address == 0)
-		return 0;
+void MachO_File_Simple::build_address_index() throw() {
+	ma_vm_intervals.clear();
+	ma_file_intervals.clear();
+	ma_vm_intervals.reserve(ma_sections.size());
+	ma_file_intervals.reserve(ma_sections.size());
 	
-	const section* seg;
-	if (p_guess_segment != NULL) {
-		seg = ma_sections[*p_guess_segment];
-		if (seg->addr <= vm_address && seg->addr + seg->size > vm_address)
-			return m_origin + vm_address - seg->addr + seg->offset;
+	for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
+		const section* s = *cit;
+		if (s->size == 0)
+			continue;
+		
+		unsigned offset = s->offset;
+		if (mp_shared_cache != NULL) {
+			// the section and the header may be in different mappings.
+			off_t cache_offset = mp_shared_cache->to_file_offset(s->addr);
+			if (cache_offset < m_origin || mp_shared_cache->to_file_offset(s->addr + s->size - 1) != cache_offset + (s->size - 1))
+				continue;
+			offset = static_cast<unsigned>(cache_offset - m_origin);
+		}
+		
+		AddressInterval vm_interval = {s->addr, s->addr + s->size, offset};
+		ma_vm_intervals.push_back(vm_interval);
+		
+		unsigned sect_type = s->flags & SECTION_TYPE;
+		if (sect_type != S_ZEROFILL && sect_type != S_GB_ZEROFILL) {
+			AddressInterval file_interval = {offset, offset + s->size, s->addr};
+			ma_file_intervals.push_back(file_interval);
+		}
 	}
 	
-	unsigned i = 0;
-	for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
-		seg = *cit;
-		if (seg->addr <= vm_address && seg->addr + seg->size > vm_address) {
-			if (p_guess_segment != NULL)
-				*p_guess_segment = i;
-			return m_origin + vm_address - seg->addr + seg->offset;
+	// malformed files may have overlapping sections. Clip each interval against
+	// its predecessor so that the binary search stays well-defined.
+	vector<AddressInterval>* tables[] = {&ma_vm_intervals, &ma_file_intervals};
+	for (unsigned i = 0; i < 2; ++ i) {
+		vector<AddressInterval>& table = *tables[i];
+		stable_sort(table.begin(), table.end());
+		
+		vector<AddressInterval>::iterator out = table.begin();
+		for (vector<AddressInterval>::const_iterator cit = table.begin(); cit != table.end(); ++ cit) {
+			AddressInterval interval = *cit;
+			if (out != table.begin() && (out-1)->end > interval.begin) {
+				unsigned clip = (out-1)->end - interval.begin;
+				if (clip >= interval.end - interval.begin)
+					continue;
+				interval.begin += clip;
+				interval.target += clip;
+			}
+			*out++ = interval;
 		}
-		++ i;
+		table.erase(out, table.end());
 	}
-	return 0;
 }
 
-unsigned MachO_File_Simple::to_vm_address (off_t file_offset, int* p_guess_segment) const throw() {
-	if (!m_is_valid)
-		return static_cast<unsigned>(file_offset);
+int MachO_File_Simple::find_interval(const vector<AddressInterval>& table, unsigned key, int* p_hint) throw() {
+	size_t n = table.size();
+	if (n == 0)
+		return -1;
+	const AddressInterval* first = &table[0];
 	
-	file_offset -= m_origin;
+	if (p_hint != NULL && static_cast<unsigned>(*p_hint) < n) {
+		const AddressInterval& guess = first[*p_hint];
+		if (guess.begin <= key && guess.end > key)
+			return *p_hint;
+	}
 	
-	const section* seg;
-	if (p_guess_segment != NULL) {
-		seg = ma_sections[*p_guess_segment];
-		if (seg->offset <= static_cast<size_t>(file_offset) && seg->offset + seg->size > static_cast<size_t>(file_offset))
-			return static_cast<unsigned>(file_offset + seg->addr - seg->offset);
+	// branchless binary search for the last interval with begin <= key.
+	const AddressInterval* base = first;
+	while (n > 1) {
+		size_t half = n / 2;
+		base = (base[half].begin <= key) ? base + half : base;
+		n -= half;
 	}
 	
-	unsigned i = 0;
-	for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
-		seg = *cit;
-		if (seg->offset <= static_cast<size_t>(file_offset) && seg->offset + seg->size > static_cast<size_t>(file_offset)) {
-			if (p_guess_segment != NULL)
-				*p_guess_segment = i;
-			return static_cast<unsigned>(file_offset + seg->addr - seg->offset);
-		}
-		++ i;
+	if (base->begin <= key && base->end > key) {
+		int index = static_cast<int>(base - first);
+		if (p_hint != NULL)
+			*p_hint = index;
+		return index;
 	}
-	return 0;
+	return -1;
+}
+
+off_t MachO_File_Simple::to_file_offset (unsigned vm_address, int* p_hint) const throw() {
+	if (!m_is_valid)
+		return vm_address;
+	if (vm_address == 0)
+		return 0;
+	
+	int i = find_interval(ma_vm_intervals, vm_address, p_hint);
+	if (i < 0)
+		return 0;
+	const AddressInterval& interval = ma_vm_intervals[i];
+	return m_origin + (vm_address - interval.begin) + interval.target;
+}
+
+unsigned MachO_File_Simple::to_vm_address (off_t file_offset, int* p_hint) const throw() {
+	if (!m_is_valid)
+		return static_cast<unsigned>(file_offset);
+	
+	file_offset -= m_origin;
+	if (file_offset < 0 || static_cast<off_t>(static_cast<unsigned>(file_offset)) != file_offset)
+		return 0;
+	
+	int i = find_interval(ma_file_intervals, static_cast<unsigned>(file_offset), p_hint);
+	if (i < 0)
+		return 0;
+	const AddressInterval& interval = ma_file_intervals[i];
+	return static_cast<unsigned>(file_offset) - interval.begin + interval.target;
 }
 
 // try to dereference this vm_address.
-unsigned MachO_File_Simple::dereference(unsigned vm_address) const throw() {
-	static int last_deref_section = 0;
-	const unsigned* ptr = this->peek_data_at_vm_address<unsigned>(vm_address, &last_deref_section);
+unsigned MachO_File_Simple::dereference(unsigned vm_address, int* p_hint) const throw() {
+	const unsigned* ptr = this->peek_data_at_vm_address<unsigned>(vm_address, p_hint);
 	if (ptr == NULL)
 		return 0;
 	else
@@ -177,51 +334,19 @@ const section* MachO_File_Simple::section_having_name (const char* segment_name,
 	return NULL;
 }
 vector<string> MachO_File_Simple::linked_libraries(const std::string& sysroot) const {
-	vector<string> retval;
-	if (m_is_valid) {
-		for (vector<const load_command*>::const_iterator cit = ma_load_commands.begin(); cit != ma_load_commands.end(); ++ cit) {
-			if ((*cit)->cmd == LC_LOAD_DYLIB || (*cit)->cmd == LC_LOAD_WEAK_DYLIB) {
-				const dylib_command* p_dylib_cmd = reinterpret_cast<const dylib_command*>(*cit);
-				const char* lib_path = reinterpret_cast<const char*>(p_dylib_cmd) + p_dylib_cmd->dylib.name.offset;
-				if (lib_path[0] == '@')
-					retval.push_back(string(strchr(lib_path, '/')+1));
-				else 
-					retval.push_back(sysroot + string(lib_path));
-				
-			}
-		}
-	}
-	return retval;
+	if (m_is_valid)
+		return MachO_Header_View::linked_libraries(ma_load_commands, sysroot);
+	else
+		return vector<string>();
 }
 tr1::unordered_set<string> MachO_File_Simple::linked_libraries_recursive(const std::string& sysroot) const {
-	vector<string> first_level = linked_libraries(sysroot);
-	tr1::unordered_set<string> retval (first_level.begin(), first_level.end());
-
-	while (first_level.size() > 0) {
-		vector<string> second_level = MachO_File_Simple(first_level.back().c_str()).linked_libraries(sysroot);
-		
-		for (vector<string>::const_iterator cit = second_level.begin(); cit != second_level.end(); ++ cit) {
-			tr1::unordered_set<string>::const_iterator rv_cit = retval.find(*cit);
-			if (rv_cit == retval.end()) {
-				first_level.push_back(*cit);
-				retval.insert(*cit);
-			}
-		}
-	}
-	
-	return retval;
+	// each library is read once, and only its load commands are read.
+	LibraryResolver resolver (sysroot);
+	return resolver.closure(linked_libraries(sysroot), "");
 }
 
 const char* MachO_File_Simple::self_path() const throw() {
-	if (m_is_valid) {
-		for (vector<const load_command*>::const_iterator cit = ma_load_commands.begin(); cit != ma_load_commands.end(); ++ cit) {
-			if ((*cit)->cmd == LC_ID_DYLIB) {
-				const dylib_command* p_dylib_cmd = reinterpret_cast<const dylib_command*>(*cit);
-				return reinterpret_cast<const char*>(p_dylib_cmd) + p_dylib_cmd->dylib.name.offset;
-			}
-		}
-	}
-	return NULL;
+	return m_is_valid ? MachO_Header_View::self_path(ma_load_commands) : NULL;
 }
 
 //------------------------------------------------------------------------------
@@ -256,15 +381,21 @@ static const char* print_string_representation_format_strings_suffix[] = {"", "\
 
 #define PRINT_BIND_OPCODE(...) //printf(__VA_ARGS__)
 
-void MachO_File::bind(uint32_t size) throw() {
-	unsigned libord = 0;
-	const char* sym = NULL;
-	unsigned addr = 0;
+// pointers are 4 bytes in the 32-bit Mach-O files we read.
+static const unsigned BindPointerSize = 4;
+
+void MachO_File::decode_bind_stream(unsigned offset, unsigned size, BindKind kind) {
+	const char* p = this->peek_data_at<char>(m_origin + offset);
+	if (p == NULL || m_origin + offset + size > m_filesize)
+		return;
+	const char* end = p + size;
 	
-	off_t end = this->tell() + size;
+	BindRecord record = {0, NULL, 0, 0, BIND_TYPE_POINTER, 0, static_cast<unsigned char>(kind)};
 	
-	while (this->tell() < end) {
-		unsigned char c = static_cast<unsigned char>(this->read_char());
+#define EMIT_BIND_RECORD() if (record.symbol != NULL) ma_bindings.push_back(record)
+	
+	while (p < end) {
+		unsigned char c = static_cast<unsigned char>(*p++);
 		
 		uint8_t imm = c & BIND_IMMEDIATE_MASK, opcode = c & BIND_OPCODE_MASK;
 		
@@ -275,76 +406,81 @@ void MachO_File::bind(uint32_t size) throw() {
 				
 			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:	// 1x
 				PRINT_BIND_OPCODE("SetDylibOrdinalIMM(%d).\n", imm);
-				libord = imm;
+				record.library_ordinal = imm;
 				break;
 				
 			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:	// 2x
-				libord = this->read_uleb128<unsigned>();
-				PRINT_BIND_OPCODE("SetDylibOrdinalULEB(%d).\n", libord);
+				record.library_ordinal = static_cast<int>(DataFile::decode_uleb128<unsigned>(p, end));
+				PRINT_BIND_OPCODE("SetDylibOrdinalULEB(%d).\n", record.library_ordinal);
 				break;
 				
 			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM: {	// 3x
-				int8_t immx = BIND_OPCODE_MASK|imm;
-				libord = imm ? immx : 0;
-				PRINT_BIND_OPCODE("SetDylibSpecialIMM(%d).\n", libord);
+				int8_t immx = static_cast<int8_t>(BIND_OPCODE_MASK|imm);
+				record.library_ordinal = imm ? immx : 0;
+				PRINT_BIND_OPCODE("SetDylibSpecialIMM(%d).\n", record.library_ordinal);
 				break;
 			}
 				
 			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:	// 4x
-				sym = this->read_string();
-				PRINT_BIND_OPCODE("SetSymbolTrailingFlagsIMM(%s).\n", sym);
+				record.symbol = p;
+				record.symbol_flags = imm;
+				while (p < end && *p != '\0')
+					++ p;
+				if (p >= end)
+					record.symbol = NULL;
+				++ p;
+				PRINT_BIND_OPCODE("SetSymbolTrailingFlagsIMM(%s).\n", record.symbol);
 				break;
 				
 			case BIND_OPCODE_SET_TYPE_IMM:	// 5x.
+				record.type = imm;
 				PRINT_BIND_OPCODE("SetTypeIMM(%d).\n", imm);
 				break;
 				
-				// seems to do nothing?
 			case BIND_OPCODE_SET_ADDEND_SLEB:	// 6x.
-				this->read_sleb128<int>();
-				PRINT_BIND_OPCODE("SetAddend(...).\n");
+				record.addend = DataFile::decode_sleb128<int>(p, end);
+				PRINT_BIND_OPCODE("SetAddend(%d).\n", record.addend);
 				break;
 				
 			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:	// 7x
-				addr = ma_segments[imm]->vmaddr + this->read_uleb128<unsigned>();
-				PRINT_BIND_OPCODE("SetSegmentAndOffsetULEB(%d -> %x).\n", imm, addr);
+				record.address = (imm < ma_segments.size() ? ma_segments[imm]->vmaddr : 0) + DataFile::decode_uleb128<unsigned>(p, end);
+				PRINT_BIND_OPCODE("SetSegmentAndOffsetULEB(%d -> %x).\n", imm, record.address);
 				break;
 			
 			case BIND_OPCODE_ADD_ADDR_ULEB:	// 8x
-				addr += this->read_uleb128<unsigned>();
-				PRINT_BIND_OPCODE("AddAddrULEB(-> %x).\n", addr);
+				record.address += DataFile::decode_uleb128<unsigned>(p, end);
+				PRINT_BIND_OPCODE("AddAddrULEB(-> %x).\n", record.address);
 				break;
 				
 			case BIND_OPCODE_DO_BIND:	// 9x
-				ma_symbol_references.insert(std::pair<unsigned, const char*>(addr, sym));
-				ma_library_ordinals.insert(std::pair<unsigned, unsigned>(addr, libord));
-				addr += sizeof(void*);
-				PRINT_BIND_OPCODE("DoBind(-> %x).\n", addr);
+				EMIT_BIND_RECORD();
+				record.address += BindPointerSize;
+				PRINT_BIND_OPCODE("DoBind(-> %x).\n", record.address);
 				break;
 				
 			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:	// Ax
-				ma_symbol_references.insert(std::pair<unsigned, const char*>(addr, sym));
-				ma_library_ordinals.insert(std::pair<unsigned, unsigned>(addr, libord));
-				addr += sizeof(void*) + this->read_uleb128<unsigned>();
-				PRINT_BIND_OPCODE("DoBindAddAddrULEB(-> %x).\n", addr);
+				EMIT_BIND_RECORD();
+				record.address += BindPointerSize + DataFile::decode_uleb128<unsigned>(p, end);
+				PRINT_BIND_OPCODE("DoBindAddAddrULEB(-> %x).\n", record.address);
 				break;
 				
 			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:	// Bx
-				ma_symbol_references.insert(std::pair<unsigned, const char*>(addr, sym));
-				ma_library_ordinals.insert(std::pair<unsigned, unsigned>(addr, libord));
-				addr += (imm+1)*sizeof(void*);
-				PRINT_BIND_OPCODE("DoBindAddAddrIMMScaled(%d -> %x).\n", imm, addr);
+				EMIT_BIND_RECORD();
+				record.address += (imm+1)*BindPointerSize;
+				PRINT_BIND_OPCODE("DoBindAddAddrIMMScaled(%d -> %x).\n", imm, record.address);
 				break;
 				
 			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB: {	// Cx
-				unsigned count = this->read_uleb128<unsigned>();
-				unsigned skip = this->read_uleb128<unsigned>();
+				unsigned count = DataFile::decode_uleb128<unsigned>(p, end);
+				unsigned skip = DataFile::decode_uleb128<unsigned>(p, end);
+				// a count larger than the stream itself is certainly corrupted.
+				if (count > size * 8)
+					count = 0;
 				for (unsigned i = 0; i < count; ++ i) {
-					ma_symbol_references.insert(std::pair<unsigned, const char*>(addr, sym));
-					ma_library_ordinals.insert(std::pair<unsigned, unsigned>(addr, libord));
-					addr += skip + sizeof(void*);
+					EMIT_BIND_RECORD();
+					record.address += skip + BindPointerSize;
 				}
-				PRINT_BIND_OPCODE("DoBindULEBTimesSkippingULEB(%d, %d -> %x).\n", count, skip, addr);
+				PRINT_BIND_OPCODE("DoBindULEBTimesSkippingULEB(%d, %d -> %x).\n", count, skip, record.address);
 				break;
 			}
 				
@@ -353,63 +489,114 @@ void MachO_File::bind(uint32_t size) throw() {
 				break;
 		}
 	}
+	
+#undef EMIT_BIND_RECORD
 }
 
-void MachO_File::process_export_trie_node(off_t start, off_t cur, off_t end, const std::string& prefix) {
-	if (cur < end) {
-		this->seek(cur);
-		unsigned char term_size = static_cast<unsigned char>(this->read_char());
+// a node of the export trie waiting to be visited. It remembers how much of
+// the prefix belongs to its parent, and the edge label to append.
+struct PendingNode {
+	unsigned offset;
+	size_t parent_prefix_length;
+	const char* label;
+	size_t label_length;
+};
+
+bool MachO_File::for_each_export (void(*p_func)(const char* name, unsigned flags, unsigned address, void* context), void* context) const {
+	if (!m_is_valid || mp_dyld_info == NULL || mp_dyld_info->export_size == 0)
+		return true;
+	
+	const char* start = this->peek_data_at<char>(m_origin + mp_dyld_info->export_off);
+	if (start == NULL || m_origin + mp_dyld_info->export_off + mp_dyld_info->export_size > m_filesize)
+		return false;
+	const char* end = start + mp_dyld_info->export_size;
+	
+	// depth-first walk with an explicit stack.
+	vector<PendingNode> stack;
+	string prefix;
+	PendingNode root = {0, 0, NULL, 0};
+	stack.push_back(root);
+	
+	// every node is at least 2 bytes long, so a well-formed trie cannot have
+	// more nodes than this. Anything beyond is a cycle.
+	size_t visits_left = mp_dyld_info->export_size / 2 + 1;
+	
+	while (!stack.empty()) {
+		PendingNode node = stack.back();
+		stack.pop_back();
+		if (node.offset >= mp_dyld_info->export_size || visits_left-- == 0)
+			return false;
+		
+		prefix.resize(node.parent_prefix_length);
+		prefix.append(node.label, node.label_length);
+		
+		const char* p = start + node.offset;
+		unsigned term_size = DataFile::decode_uleb128<unsigned>(p, end);
+		const char* children = p + term_size;
 		if (term_size != 0) {
-			ma_string_store.push_back(prefix);
-			const char* sym = ma_string_store.back().c_str();
-			/*unsigned flags =*/ this->read_uleb128<unsigned>();
-			unsigned addr = this->read_uleb128<unsigned>();
-			ma_symbol_references.insert(std::pair<unsigned, const char*>(addr, sym));
-			ma_is_external_symbol.insert(addr);
+			unsigned flags = DataFile::decode_uleb128<unsigned>(p, end);
+			unsigned address = DataFile::decode_uleb128<unsigned>(p, end);
+			p_func(prefix.c_str(), flags, address, context);
 		}
-		this->seek(cur + term_size);
-		unsigned char child_count = static_cast<unsigned char>(this->read_char());
-		off_t last_pos;
-		for (unsigned char i = 0; i < child_count; ++ i) {
-			const char* suffix = this->read_string();
-			unsigned offset = this->read_uleb128<unsigned>();
-			last_pos = this->tell();
-			process_export_trie_node(start, start + offset, end, prefix + suffix);
-			this->seek(last_pos);
+		
+		if (children >= end)
+			return false;
+		p = children;
+		unsigned child_count = static_cast<unsigned char>(*p++);
+		size_t first_child = stack.size();
+		for (unsigned i = 0; i < child_count; ++ i) {
+			const char* label = p;
+			while (p < end && *p != '\0')
+				++ p;
+			if (p >= end)
+				return false;
+			PendingNode child = {0, prefix.size(), label, static_cast<size_t>(p - label)};
+			++ p;
+			child.offset = DataFile::decode_uleb128<unsigned>(p, end);
+			stack.push_back(child);
 		}
+		// visit the children in their order in the file.
+		reverse(stack.begin() + first_child, stack.end());
 	}
+	
+	return true;
 }
 
-MachO_File::MachO_File(const char* path, const char* arch) : MachO_File_Simple(path, arch), ma_symbols(NULL), m_symbols_length(0), ma_indirect_symbols(NULL), m_indirect_symbols_length(0), ma_strings(NULL), ma_cstrings(NULL), m_cstring_vmaddr(0), m_relocations_length(0) {
+struct ExportLoadContext {
+	StringArena* arena;
+	vector<pair<unsigned, const char*> > exports;
+};
+
+static void load_export(const char* name, unsigned flags, unsigned address, void* context) {
+	// re-exported symbols have no address in this image.
+	if (flags & EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION)
+		return;
+	ExportLoadContext* ctx = reinterpret_cast<ExportLoadContext*>(context);
+	ctx->exports.push_back(pair<unsigned, const char*>(address, ctx->arena->store(name)));
+}
+
+MachO_File::MachO_File(const char* path, const char* arch) : MachO_File_Simple(path, arch), ma_symbols(NULL), m_symbols_length(0), ma_indirect_symbols(NULL), m_indirect_symbols_length(0), ma_strings(NULL), ma_cstrings(NULL), m_cstring_vmaddr(0), m_cstring_table_size(0), ma_relocations(NULL), m_relocations_length(0), mp_dyld_info(NULL), m_analyzed_facets(0), m_cache_mode(CM_Bypass), mp_symbol_cache(NULL) {
+	locate_tables();
+}
+
+MachO_File::MachO_File(const DataFile& file, const Slice& slice) : MachO_File_Simple(file, slice), ma_symbols(NULL), m_symbols_length(0), ma_indirect_symbols(NULL), m_indirect_symbols_length(0), ma_strings(NULL), ma_cstrings(NULL), m_cstring_vmaddr(0), m_cstring_table_size(0), ma_relocations(NULL), m_relocations_length(0), mp_dyld_info(NULL), m_analyzed_facets(0), m_cache_mode(CM_Bypass), mp_symbol_cache(NULL) {
+	locate_tables();
+}
+
+MachO_File::~MachO_File() throw() {
+	delete mp_symbol_cache;
+}
+
+void MachO_File::locate_tables() {
+	// only locate the tables here. They are analyzed on demand.
 	bool ignore_dysymtab = false;
 	for (vector<const load_command*>::const_iterator cit = ma_load_commands.begin(); cit != ma_load_commands.end(); ++ cit) {
 		switch ((*cit)->cmd) {
 			case LC_DYLD_INFO:
-			case LC_DYLD_INFO_ONLY: {
-				const dyld_info_command* p_cur_dyld_info = reinterpret_cast<const dyld_info_command*>(*cit);
-				
-				if (p_cur_dyld_info->bind_size != 0) {
-					this->seek(m_origin + p_cur_dyld_info->bind_off);
-					bind(p_cur_dyld_info->bind_size);
-				}
-				
-				if (p_cur_dyld_info->weak_bind_size != 0) {
-					this->seek(m_origin + p_cur_dyld_info->weak_bind_off);
-					bind(p_cur_dyld_info->weak_bind_size);
-				}
-				
-				if (p_cur_dyld_info->lazy_bind_size != 0) {
-					this->seek(m_origin + p_cur_dyld_info->lazy_bind_off);
-					bind(p_cur_dyld_info->lazy_bind_size);
-				}
-				
-				if (p_cur_dyld_info->export_size != 0) {
-					off_t start = m_origin + p_cur_dyld_info->export_off;
-					process_export_trie_node(start, start, start + p_cur_dyld_info->export_size, "");
-				}
-				
+			case LC_DYLD_INFO_ONLY:
+				mp_dyld_info = reinterpret_cast<const dyld_info_command*>(*cit);
 				ignore_dysymtab = true;
-			}
+				break;
 				
 			case LC_SYMTAB: {
 				const symtab_command* p_cur_symtab = reinterpret_cast<const symtab_command*>(*cit);
@@ -445,7 +632,82 @@ MachO_File::MachO_File(const char* path, const char* arch) : MachO_File_Simple(p
 				break;
 		}
 	}
+	
+	for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
+		const section* s = *cit;
+		if ((s->flags & SECTION_TYPE) == S_CSTRING_LITERALS && !file_offset_encrypted(s->offset)) {
+			this->seek(m_origin + s->offset);
+			ma_cstrings = this->peek_data<char>();
+			m_cstring_vmaddr = s->addr;
+			m_cstring_table_size = s->size;
+		}
+	}
+}
+
+void MachO_File::analyze(unsigned facets) {
+	if (!m_is_valid || analyzed(facets))
+		return;
+	
+	if (facets & AF_SymbolNames)
+		facets |= AF_Symbols;
+	
+	if (!analyzed(facets & AF_All)) {
+		off_t old_location = tell();
+		bool cached = false;
+		if (m_cache_mode != CM_Bypass) {
+			cached = m_analyzed_facets == 0 && m_cache_mode == CM_Use && load_symbol_cache();
+			facets |= AF_All;
+		}
+		if (!cached) {
+			if ((facets & AF_Symbols) && !analyzed(AF_Symbols)) {
+				analyze_symbols();
+				m_analyzed_facets |= AF_Symbols;
+			}
+			if ((facets & AF_ObjCReferences) && !analyzed(AF_ObjCReferences)) {
+				analyze_objc_references();
+				m_analyzed_facets |= AF_ObjCReferences;
+			}
+			seek(old_location);
+			
+			if (m_cache_mode != CM_Bypass)
+				save_symbol_cache();
+		}
+	}
+	
+	if ((facets & AF_SymbolNames) && !analyzed(AF_SymbolNames)) {
+		build_symbol_name_index();
+		m_analyzed_facets |= AF_SymbolNames;
+	}
+}
+
+void MachO_File::analyze_symbols() {
+	if (mp_dyld_info != NULL) {
+		// decode all 3 streams first, then fill the tables in one go. The first
+		// binding of an address wins.
+		decode_bind_stream(mp_dyld_info->bind_off, mp_dyld_info->bind_size, BK_Bind);
+		decode_bind_stream(mp_dyld_info->weak_bind_off, mp_dyld_info->weak_bind_size, BK_WeakBind);
+		decode_bind_stream(mp_dyld_info->lazy_bind_off, mp_dyld_info->lazy_bind_size, BK_LazyBind);
+		
+		ma_symbol_references.rehash(ma_bindings.size());
+		ma_library_ordinals.rehash(ma_bindings.size());
+		for (vector<BindRecord>::const_iterator cit = ma_bindings.begin(); cit != ma_bindings.end(); ++ cit) {
+			ma_symbol_references.insert(pair<unsigned, const char*>(cit->address, cit->symbol));
+			ma_library_ordinals.insert(pair<unsigned, unsigned>(cit->address, static_cast<unsigned>(cit->library_ordinal)));
+		}
 		
+		// collect all exports first, then load them in bulk. Bound addresses
+		// take precedence, as before.
+		ExportLoadContext ctx;
+		ctx.arena = &ma_string_store;
+		for_each_export(load_export, &ctx);
+		ma_symbol_references.rehash(ma_symbol_references.size() + ctx.exports.size());
+		ma_is_external_symbol.rehash(ma_is_external_symbol.size() + ctx.exports.size());
+		for (vector<pair<unsigned, const char*> >::const_iterator cit = ctx.exports.begin(); cit != ctx.exports.end(); ++ cit) {
+			ma_symbol_references.insert(*cit);
+			ma_is_external_symbol.insert(cit->first);
+		}
+	}
+	
 	for (unsigned i = 0; i < m_symbols_length; ++ i) {
 		ma_symbol_references[ma_symbols[i].n_value & ~1] = ma_strings + ma_symbols[i].n_un.n_strx;
 		if (ma_symbols[i].n_type & N_EXT) {
@@ -462,91 +724,175 @@ MachO_File::MachO_File(const char* path, const char* arch) : MachO_File_Simple(p
 	}
 	
 	// analyze the sections (to short-cut the indirect symbols)
+	if (ma_symbols && ma_indirect_symbols) {
+		for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
+			const section* s = *cit;
+			if (file_offset_encrypted(s->offset))
+				continue;
+			
+			unsigned sect_type = s->flags & SECTION_TYPE;
+			if (sect_type == S_NON_LAZY_SYMBOL_POINTERS || sect_type == S_LAZY_SYMBOL_POINTERS || sect_type == S_SYMBOL_STUBS) {
+				unsigned stride = s->reserved2 ? s->reserved2 : 4;
+				unsigned end_index = s->reserved1 + s->size/stride;
+				
+				for (unsigned i = s->reserved1, vm_address = s->addr; i < end_index; ++ i, vm_address += stride)
+					ma_symbol_references[vm_address & ~1] = ma_strings + ma_symbols[ma_indirect_symbols[i]].n_un.n_strx;
+			}
+		}
+	}
+	
+	merge_into_symbol_index();
+	
+	ma_external_symbols.assign(ma_is_external_symbol.begin(), ma_is_external_symbol.end());
+	sort(ma_external_symbols.begin(), ma_external_symbols.end());
+	ma_library_ordinal_list.assign(ma_library_ordinals.begin(), ma_library_ordinals.end());
+	sort(ma_library_ordinal_list.begin(), ma_library_ordinal_list.end());
+	tr1::unordered_set<unsigned>().swap(ma_is_external_symbol);
+	tr1::unordered_map<unsigned,unsigned>().swap(ma_library_ordinals);
+}
+
+void MachO_File::analyze_objc_references() {
 	for (vector<const section*>::const_iterator cit = ma_sections.begin(); cit != ma_sections.end(); ++ cit) {
 		const section* s = *cit;
 		if (file_offset_encrypted(s->offset))
 			continue;
 		
-		unsigned sect_type = s->flags & SECTION_TYPE;
-		switch (sect_type) {
-			case S_NON_LAZY_SYMBOL_POINTERS:
-			case S_LAZY_SYMBOL_POINTERS:
-			case S_SYMBOL_STUBS: {
-				unsigned stride = s->reserved2 ? s->reserved2 : 4;
-				unsigned end_index = s->reserved1 + s->size/stride;
+		if (!strncmp(s->sectname, "__cfstring", 16)) {
+			this->seek(m_origin + s->offset + 8);
+			for (unsigned i = 0; i < s->size; i += 16) {
+				unsigned vm_address = this->read_integer();
+				this->advance(12);
 				
-				if (ma_symbols && ma_indirect_symbols)
-					for (unsigned i = s->reserved1, vm_address = s->addr; i < end_index; ++ i, vm_address += stride)
-						ma_symbol_references[vm_address & ~1] = ma_strings + ma_symbols[ma_indirect_symbols[i]].n_un.n_strx;
-				
-				break;
+				ma_cfstrings[s->addr + i] = ma_cstrings + vm_address - m_cstring_vmaddr;
 			}
+		} else if (!strncmp(s->sectname, "__class_list", 16) || !strncmp(s->sectname, "__objc_classlist", 16)) {
+			int sid_data = 1, sid_text = 0;
+			this->seek(m_origin + s->offset);
+			for (unsigned i = 0; i < s->size; i += 4) {
+				unsigned vm_address = this->read_integer();
+				off_t old_location = this->tell();
+
+				this->seek_vm_address(vm_address + 16, &sid_data);		// get to the data field class.
+				unsigned data_loc = this->read_integer();
 				
-			case S_CSTRING_LITERALS:
-				this->seek(m_origin + s->offset);
-				ma_cstrings = this->peek_data<char>();
-				m_cstring_vmaddr = s->addr;
-				m_cstring_table_size = s->size;
-				break;
+				// skip classes whose data cannot be found in this file.
+				off_t data_offset = this->to_file_offset(data_loc, &sid_data);
+				if (data_offset == 0 || data_offset + 24 > this->filesize()) {
+					this->seek(old_location);
+					continue;
+				}
+
+				this->seek(data_offset);		// get to the name field of the data.
+				unsigned flag = this->read_integer();
+				this->advance(12);
+				this->seek_vm_address(this->read_integer(), &sid_text);	// resolve the location of the string.
 				
-			default:
-				if (!strncmp(s->sectname, "__cfstring", 16)) {
-					this->seek(m_origin + s->offset + 8);
-					for (unsigned i = 0; i < s->size; i += 16) {
-						unsigned vm_address = this->read_integer();
-						this->advance(12);
-						
-						ma_cfstrings[s->addr + i] = ma_cstrings + vm_address - m_cstring_vmaddr;
-					}
-				} else if (!strncmp(s->sectname, "__class_list", 16) || !strncmp(s->sectname, "__objc_classlist", 16)) {
-					int sid_data = 1, sid_text = 0;
-					this->seek(m_origin + s->offset);
-					for (unsigned i = 0; i < s->size; i += 4) {
-						unsigned vm_address = this->read_integer();
-						off_t old_location = this->tell();
-
-						this->seek_vm_address(vm_address + 16, &sid_data);		// get to the data field class.
-						unsigned data_loc = this->read_integer();
-
-						this->seek_vm_address(data_loc, &sid_data);		// get to the name field of the data.
-						unsigned flag = this->read_integer();
-						this->advance(12);
-						this->seek_vm_address(this->read_integer(), &sid_text);	// resolve the location of the string.
-						
-						ObjCMethod m;
-						m.is_class_method = flag & 1;
-						m.class_name = this->peek_data<char>();
-						ma_objc_classes[vm_address] = m.class_name;
-						
-						this->seek_vm_address(data_loc + 20, &sid_data);		// get to the baseMethod field of the data.
-						unsigned baseMethod_loc = this->read_integer();
-						if (baseMethod_loc != 0) {
-							this->seek_vm_address(baseMethod_loc + 4, &sid_data);	// get to the count field of the data.
-							unsigned count = this->read_integer();
-								
-							for (unsigned j = 0; j < count; ++ j) {
-								m.sel_name = this->peek_data_at_vm_address<char>(this->read_integer(), &sid_text);
-								m.types = this->peek_data_at_vm_address<char>(this->read_integer(), &sid_text);
-								ma_objc_methods[this->read_integer() & ~1] = m;
-							}
-						}
+				ObjCMethod m;
+				m.is_class_method = flag & 1;
+				m.class_name = this->peek_data<char>();
+				ma_objc_classes[vm_address] = m.class_name;
+				
+				this->seek_vm_address(data_loc + 20, &sid_data);		// get to the baseMethod field of the data.
+				unsigned baseMethod_loc = this->read_integer();
+				if (baseMethod_loc != 0) {
+					this->seek_vm_address(baseMethod_loc + 4, &sid_data);	// get to the count field of the data.
+					unsigned count = this->read_integer();
 						
-						this->seek(old_location);
-					}
-				} else if (!strncmp(s->sectname, "__objc_selrefs", 16)) {
-					this->seek(m_origin + s->offset);
-					
-					for (unsigned i = 0; i < s->size; i += 4) {
-						unsigned vm_address = this->read_integer();
-						ma_objc_selectors[vm_address] = this->peek_data_at_vm_address<char>(vm_address);
+					for (unsigned j = 0; j < count; ++ j) {
+						m.sel_name = this->peek_data_at_vm_address<char>(this->read_integer(), &sid_text);
+						m.types = this->peek_data_at_vm_address<char>(this->read_integer(), &sid_text);
+						ma_objc_methods[this->read_integer() & ~1] = m;
 					}
 				}
 				
-				break;
+				this->seek(old_location);
+			}
+		} else if (!strncmp(s->sectname, "__objc_selrefs", 16)) {
+			this->seek(m_origin + s->offset);
+			
+			for (unsigned i = 0; i < s->size; i += 4) {
+				unsigned vm_address = this->read_integer();
+				ma_objc_selectors[vm_address] = this->peek_data_at_vm_address<char>(vm_address);
+			}
 		}
 	}
+	
+	merge_into_symbol_index();
 }
-		
+
+#pragma mark -
+#pragma mark Symbol index
+
+// lookup priority of each StringType when several share an address.
+static const unsigned symbol_index_rank[] = {
+	1,	// MOST_Symbol
+	0,	// MOST_CFString
+	5,	// MOST_CString
+	3,	// MOST_ObjCSelector
+	2,	// MOST_ObjCClass
+	6,	// MOST_ObjCProtocol
+	7,	// MOST_ObjCIvar
+	4	// MOST_ObjCMethod
+};
+
+struct MachO_File::SymbolIndexComparator {
+	inline bool operator() (const SymbolIndexEntry& a, const SymbolIndexEntry& b) const throw() {
+		return a.address < b.address || (a.address == b.address && symbol_index_rank[a.type] < symbol_index_rank[b.type]);
+	}
+	inline bool operator() (const SymbolIndexEntry& a, unsigned b) const throw() { return a.address < b; }
+	inline bool operator() (unsigned a, const SymbolIndexEntry& b) const throw() { return a < b.address; }
+};
+
+void MachO_File::merge_into_symbol_index() {
+	size_t string_count = ma_symbol_references.size() + ma_cfstrings.size() + ma_objc_classes.size() + ma_objc_selectors.size();
+	size_t old_size = ma_symbol_index.size();
+	ma_index_strings.reserve(ma_index_strings.size() + string_count);
+	ma_symbol_index.reserve(old_size + string_count + ma_objc_methods.size());
+	ma_objc_method_list.reserve(ma_objc_method_list.size() + ma_objc_methods.size());
+	
+	const tr1::unordered_map<unsigned,const char*>* tables[] = {&ma_symbol_references, &ma_cfstrings, &ma_objc_classes, &ma_objc_selectors};
+	const StringType types[] = {MOST_Symbol, MOST_CFString, MOST_ObjCClass, MOST_ObjCSelector};
+	for (unsigned i = 0; i < 4; ++ i) {
+		for (tr1::unordered_map<unsigned,const char*>::const_iterator cit = tables[i]->begin(); cit != tables[i]->end(); ++ cit) {
+			SymbolIndexEntry entry = {cit->first, static_cast<unsigned>(ma_index_strings.size()), types[i]};
+			ma_index_strings.push_back(cit->second);
+			ma_symbol_index.push_back(entry);
+		}
+	}
+	for (tr1::unordered_map<unsigned,ObjCMethod>::const_iterator cit = ma_objc_methods.begin(); cit != ma_objc_methods.end(); ++ cit) {
+		SymbolIndexEntry entry = {cit->first, static_cast<unsigned>(ma_objc_method_list.size()), MOST_ObjCMethod};
+		ma_objc_method_list.push_back(cit->second);
+		ma_symbol_index.push_back(entry);
+	}
+	
+	// each facet adds different types, so the merged index stays unique.
+	sort(ma_symbol_index.begin() + old_size, ma_symbol_index.end(), SymbolIndexComparator());
+	inplace_merge(ma_symbol_index.begin(), ma_symbol_index.begin() + old_size, ma_symbol_index.end(), SymbolIndexComparator());
+	
+	tr1::unordered_map<unsigned,const char*>().swap(ma_symbol_references);
+	tr1::unordered_map<unsigned,const char*>().swap(ma_cfstrings);
+	tr1::unordered_map<unsigned,const char*>().swap(ma_objc_classes);
+	tr1::unordered_map<unsigned,const char*>().swap(ma_objc_selectors);
+	tr1::unordered_map<unsigned,ObjCMethod>().swap(ma_objc_methods);
+}
+
+// whether the entries are in the order merge_into_symbol_index() leaves them,
+// without duplicates.
+bool MachO_File::is_sorted_symbol_index(const SymbolIndexEntry* begin, const SymbolIndexEntry* end) throw() {
+	for (const SymbolIndexEntry* p = begin; p != end && p+1 != end; ++ p)
+		if (p->type > MOST_ObjCMethod || (p+1)->type > MOST_ObjCMethod || !SymbolIndexComparator()(*p, *(p+1)))
+			return false;
+	return true;
+}
+
+vector<MachO_File::SymbolIndexEntry>::const_iterator MachO_File::find_in_symbol_index(unsigned vm_address, unsigned type) const throw() {
+	vector<SymbolIndexEntry>::const_iterator cit = lower_bound(ma_symbol_index.begin(), ma_symbol_index.end(), vm_address, SymbolIndexComparator());
+	for (; cit != ma_symbol_index.end() && cit->address == vm_address; ++ cit)
+		if (cit->type == type)
+			return cit;
+	return ma_symbol_index.end();
+}
+
 // try to obtain a string related to this vm_address.
 const char* MachO_File::string_representation (unsigned vm_address, MachO_File::StringType* p_strtype) const throw() {
 	if (!m_is_valid) {
@@ -558,22 +904,14 @@ const char* MachO_File::string_representation (unsigned vm_address, MachO_File::
 	if (vm_address == 0)
 		return NULL;
 	
-	tr1::unordered_map<unsigned,const char*>::const_iterator cit;
-	
-#define TrySearchIn(table, stringType) \
-	cit = (table).find(vm_address); \
-	if (cit != (table).end()) { \
-		if (p_strtype != NULL) *p_strtype = (stringType); \
-		return cit->second; \
+	// the first entry at this address has the highest priority.
+	vector<SymbolIndexEntry>::const_iterator cit = lower_bound(ma_symbol_index.begin(), ma_symbol_index.end(), vm_address, SymbolIndexComparator());
+	if (cit != ma_symbol_index.end() && cit->address == vm_address && cit->type != MOST_ObjCMethod) {
+		if (p_strtype != NULL)
+			*p_strtype = static_cast<StringType>(cit->type);
+		return ma_index_strings[cit->string_id];
 	}
 	
-	TrySearchIn(ma_cfstrings, MOST_CFString);
-	TrySearchIn(ma_symbol_references, MOST_Symbol);
-	TrySearchIn(ma_objc_classes, MOST_ObjCClass);
-	TrySearchIn(ma_objc_selectors, MOST_ObjCSelector);
-	
-#undef TrySearchIn
-	
 	if (m_cstring_vmaddr <= vm_address && m_cstring_vmaddr+m_cstring_table_size >= vm_address) {
 		if (p_strtype != NULL)
 			*p_strtype = MOST_CString;
@@ -592,25 +930,12 @@ const char* MachO_File::nearest_string_representation (unsigned vm_address, unsi
 		return this->peek_data_at<char>(vm_address);
 	}
 	
-	tr1::unordered_map<unsigned, const char*>::const_iterator cit, best_iter;
-	bool first = true;
-	
-#define TrySearchIn(table, stringType) \
-	for (cit = (table).begin(); cit != (table).end(); ++ cit) \
-		if (cit->first > vm_address) { \
-			if (first || best_iter->first > cit->first) { \
-				first = false; \
-				best_iter = cit; \
-				if (p_strtype != NULL) *p_strtype = (stringType); \
-			} \
-		}
-	
-	// TrySearchIn(ma_cfstrings, MOST_CFString);
-	TrySearchIn(ma_symbol_references, MOST_Symbol);
-	// TrySearchIn(ma_objc_classes, MOST_ObjCClass);
-	// TrySearchIn(ma_objc_selectors, MOST_ObjCSelector);
+	// the nearest symbol strictly after vm_address.
+	vector<SymbolIndexEntry>::const_iterator cit = upper_bound(ma_symbol_index.begin(), ma_symbol_index.end(), vm_address, SymbolIndexComparator());
+	while (cit != ma_symbol_index.end() && cit->type != MOST_Symbol)
+		++ cit;
 	
-	if (first) {
+	if (cit == ma_symbol_index.end()) {
 		if (m_cstring_vmaddr <= vm_address && m_cstring_vmaddr+m_cstring_table_size >= vm_address) {
 			if (p_strtype != NULL)
 				*p_strtype = MOST_CString;
@@ -620,9 +945,11 @@ const char* MachO_File::nearest_string_representation (unsigned vm_address, unsi
 		} else
 			return NULL;
 	} else {
+		if (p_strtype != NULL)
+			*p_strtype = MOST_Symbol;
 		if (offset != NULL)
-			*offset = best_iter->first - vm_address;
-		return best_iter->second;
+			*offset = cit->address - vm_address;
+		return ma_index_strings[cit->string_id];
 	}
 }
 	
@@ -634,28 +961,31 @@ void MachO_File::print_string_representation(FILE* stream, const char* str, Mach
 
 const MachO_File::ObjCMethod* MachO_File::objc_method_at_vm_address(unsigned vm_address) const throw() {
 	if (m_is_valid) {
-		tr1::unordered_map<unsigned,MachO_File::ObjCMethod>::const_iterator cit = ma_objc_methods.find(vm_address);
-		if (cit == ma_objc_methods.end())
+		vector<SymbolIndexEntry>::const_iterator cit = find_in_symbol_index(vm_address, MOST_ObjCMethod);
+		if (cit == ma_symbol_index.end())
 			return NULL;
 		else
-			return &(cit->second);
+			return &(ma_objc_method_list[cit->string_id]);
 	} else
 		return NULL;
 }
 
 const char* MachO_File::library_of_relocated_symbol(unsigned vm_address) const throw() {
-	tr1::unordered_map<unsigned,unsigned>::const_iterator lit = ma_library_ordinals.find(vm_address & ~1);
-	if (lit == ma_library_ordinals.end())
+	vector<pair<unsigned,unsigned> >::const_iterator lit = lower_bound(ma_library_ordinal_list.begin(), ma_library_ordinal_list.end(), pair<unsigned,unsigned>(vm_address & ~1, 0));
+	if (lit == ma_library_ordinal_list.end() || lit->first != (vm_address & ~1))
 		return NULL;
+	
+	return library_with_ordinal(static_cast<int>(lit->second));
+}
 
-	unsigned cur_ordinal = lit->second;
-	if (cur_ordinal == 0)
+const char* MachO_File::library_with_ordinal(int ordinal) const throw() {
+	if (ordinal <= 0)
 		return NULL;
 	
 	for (vector<const load_command*>::const_iterator cit = ma_load_commands.begin(); cit != ma_load_commands.end(); ++ cit)
 		if ((*cit)->cmd == LC_LOAD_DYLIB || (*cit)->cmd == LC_LOAD_WEAK_DYLIB) {
-			-- cur_ordinal;
-			if (cur_ordinal == 0) {
+			-- ordinal;
+			if (ordinal == 0) {
 				const dylib_command* p_dylib_cmd = reinterpret_cast<const dylib_command*>(*cit);
 				return reinterpret_cast<const char*>(p_dylib_cmd) + p_dylib_cmd->dylib.name.offset;
 			}
@@ -664,36 +994,71 @@ const char* MachO_File::library_of_relocated_symbol(unsigned vm_address) const t
 	return NULL;
 }
 
-void MachO_File::for_each_symbol (void(*p_func)(unsigned addr, const char* symbol, StringType type, void* context), void* context) const {
-	std::tr1::unordered_map<unsigned,const char*>::const_iterator cit;
-	
-	for (cit = ma_symbol_references.begin(); cit != ma_symbol_references.end(); ++ cit)
-		p_func(cit->first, cit->second, MOST_Symbol, context);
-	
-	for (cit = ma_cfstrings.begin(); cit != ma_cfstrings.end(); ++ cit)
-		p_func(cit->first, cit->second, MOST_CFString, context);
-	
-	for (cit = ma_objc_classes.begin(); cit != ma_objc_classes.end(); ++ cit)
-		p_func(cit->first, cit->second, MOST_ObjCClass, context);
-	
-	for (cit = ma_objc_selectors.begin(); cit != ma_objc_selectors.end(); ++ cit)
-		p_func(cit->first, cit->second, MOST_ObjCSelector, context);
-	
+void MachO_File::for_each_symbol (void(*p_func)(unsigned addr, const char* symbol, StringType type, void* context), void* context, unsigned facets) const {
 	std::string str;
-	for (std::tr1::unordered_map<unsigned, ObjCMethod>::const_iterator cit2 = ma_objc_methods.begin(); cit2 != ma_objc_methods.end(); ++ cit2) {
-		str = cit2->second.is_class_method ? "+[" : "-[";
-		str += cit2->second.class_name;
-		str += ' ';
-		str += cit2->second.sel_name;
-		str += ']';
-		p_func(cit2->first, str.c_str(), MOST_ObjCMethod, context);
+	for (vector<SymbolIndexEntry>::const_iterator cit = ma_symbol_index.begin(); cit != ma_symbol_index.end(); ++ cit) {
+		if (!(facets & (cit->type == MOST_Symbol ? AF_Symbols : AF_ObjCReferences)))
+			continue;
+		if (cit->type == MOST_ObjCMethod) {
+			const ObjCMethod& method = ma_objc_method_list[cit->string_id];
+			str = method.is_class_method ? "+[" : "-[";
+			str += method.class_name;
+			str += ' ';
+			str += method.sel_name;
+			str += ']';
+			p_func(cit->address, str.c_str(), MOST_ObjCMethod, context);
+		} else
+			p_func(cit->address, ma_index_strings[cit->string_id], static_cast<StringType>(cit->type), context);
 	}
 }
 
-unsigned MachO_File::address_of_symbol(const char* sym) const throw() {
-	for (std::tr1::unordered_map<unsigned,const char*>::const_iterator cit = ma_symbol_references.begin(); cit != ma_symbol_references.end(); ++ cit) {
-		if (strcmp(sym, cit->second) == 0)
-			return cit->first;
-	}
-	return 0;
+#pragma mark -
+#pragma mark Symbol name index
+
+// FNV-1a.
+size_t MachO_File::CStringHash::operator() (const char* s) const throw() {
+	size_t h = 2166136261u;
+	for (; *s != '\0'; ++ s)
+		h = (h ^ static_cast<unsigned char>(*s)) * 16777619u;
+	return h;
+}
+bool MachO_File::CStringEqual::operator() (const char* a, const char* b) const throw() { return a == b || strcmp(a, b) == 0; }
+
+void MachO_File::build_symbol_name_index() {
+	size_t count = 0;
+	for (vector<SymbolIndexEntry>::const_iterator cit = ma_symbol_index.begin(); cit != ma_symbol_index.end(); ++ cit)
+		if (cit->type == MOST_Symbol)
+			++ count;
+	ma_symbol_names.rehash(count);
+	
+	for (vector<SymbolIndexEntry>::const_iterator cit = ma_symbol_index.begin(); cit != ma_symbol_index.end(); ++ cit)
+		if (cit->type == MOST_Symbol)
+			ma_symbol_names.insert(SymbolNameIndex::value_type(ma_index_strings[cit->string_id], cit->address));
+}
+
+unsigned MachO_File::address_of_symbol(const char* sym) const {
+	pair<SymbolNameIndex::const_iterator, SymbolNameIndex::const_iterator> range = ma_symbol_names.equal_range(sym);
+	if (range.first == range.second)
+		return 0;
+	unsigned lowest = range.first->second;
+	for (SymbolNameIndex::const_iterator cit = range.first; cit != range.second; ++ cit)
+		lowest = min(lowest, cit->second);
+	return lowest;
+}
+
+vector<unsigned> MachO_File::addresses_of_symbol(const char* sym) const {
+	vector<unsigned> retval;
+	pair<SymbolNameIndex::const_iterator, SymbolNameIndex::const_iterator> range = ma_symbol_names.equal_range(sym);
+	for (SymbolNameIndex::const_iterator cit = range.first; cit != range.second; ++ cit)
+		retval.push_back(cit->second);
+	sort(retval.begin(), retval.end());
+	return retval;
+}
+
+vector<unsigned> MachO_File::addresses_of_symbols(const vector<const char*>& syms) const {
+	vector<unsigned> retval;
+	retval.reserve(syms.size());
+	for (vector<const char*>::const_iterator cit = syms.begin(); cit != syms.end(); ++ cit)
+		retval.push_back(address_of_symbol(*cit));
+	return retval;
 }
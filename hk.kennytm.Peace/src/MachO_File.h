@@ -34,6 +34,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 #include <string>
 #include "DataFile.h"
+#include "StringArena.h"
+
+class SharedCache_File;
 
 class MachO_File_Simple : public DataFile {
 public:
@@ -44,6 +47,15 @@ public:
 		bool is_class_method;
 	};
 	
+	// an architecture in a (possibly fat) file. A thin file has one slice at
+	// offset 0.
+	struct Slice {
+		cpu_type_t cputype;
+		cpu_subtype_t cpusubtype;
+		off_t offset;
+		const char* arch;	// NULL if the cputype is unknown.
+	};
+	
 protected:
 	std::vector<const load_command*> ma_load_commands;
 	std::vector<const segment_command*> ma_segments;
@@ -53,26 +65,65 @@ protected:
 	off_t m_origin;
 	off_t m_crypt_begin, m_crypt_end;
 	
+	// the cache this image is read from, if any. Its sections are located
+	// through the mapping table of the cache instead of their offsets.
+	const SharedCache_File* mp_shared_cache;
+	
+	// Sorted, non-overlapping address intervals, built once from the sections.
+	// [begin, end) maps to target + (x - begin). ma_vm_intervals is keyed by
+	// VM address and targets the file offset relative to m_origin;
+	// ma_file_intervals is the reverse and does not contain zerofill sections.
+	struct AddressInterval {
+		unsigned begin, end, target;
+		inline bool operator< (const AddressInterval& other) const throw() { return begin < other.begin; }
+	};
+	std::vector<AddressInterval> ma_vm_intervals, ma_file_intervals;
+	
+	void load_slice();
+	void build_address_index() throw();
+	static int find_interval(const std::vector<AddressInterval>& table, unsigned key, int* p_hint) throw();
+	
 public:
 	inline bool valid() const throw() { return m_is_valid; }
+	// the file offset of the mach_header.
+	inline off_t origin() const throw() { return m_origin; }
 	MachO_File_Simple(const char* path, const char* arch = "any");
+	// use a slice of a file which is already mapped. The mapping is borrowed,
+	// so file must outlive this object.
+	MachO_File_Simple(const DataFile& file, const Slice& slice);
+	// an image inside a dyld shared cache, read in place. The mapping is
+	// borrowed, so cache must outlive this object. File offsets are relative
+	// to the cache.
+	MachO_File_Simple(const SharedCache_File& cache, unsigned image_index);
+	
+	static std::vector<Slice> slices(const DataFile& file);
+	// the slices named in a comma-separated list of archs (e.g. "armv6,armv7"),
+	// in that order, or every slice for "all".
+	static std::vector<Slice> select_slices(const DataFile& file, const char* arch_list);
 	
-	off_t to_file_offset (unsigned vm_address, int* p_guess_segment = NULL) const throw();
-	unsigned to_vm_address (off_t file_offset, int* p_guess_segment = NULL) const throw();
+	// The optional hint is a per-cursor locality hint: an index into the
+	// address index which was valid for the last lookup. Any value is
+	// accepted, and it is updated on every successful lookup.
+	off_t to_file_offset (unsigned vm_address, int* p_hint = NULL) const throw();
+	unsigned to_vm_address (off_t file_offset, int* p_hint = NULL) const throw();
 	
 	// try to dereference this vm_address.
-	unsigned dereference(unsigned vm_address) const throw();
+	unsigned dereference(unsigned vm_address, int* p_hint = NULL) const throw();
 	int segment_index_having_name(const char* name) const;
+	inline const segment_command* segment_having_name(const char* name) const {
+		int i = segment_index_having_name(name);
+		return i >= 0 ? ma_segments[i] : NULL;
+	}
 	const section* section_having_name (const char* segment_name, const char* section_name) const;
 	
 	template<typename T>
-	inline const T* peek_data_at_vm_address(unsigned vm_address, int* p_guess_segment = NULL) const throw() {
-		off_t file_offset = this->to_file_offset(vm_address, p_guess_segment);
+	inline const T* peek_data_at_vm_address(unsigned vm_address, int* p_hint = NULL) const throw() {
+		off_t file_offset = this->to_file_offset(vm_address, p_hint);
 		return file_offset != 0 ? this->peek_data_at<T>(file_offset) : NULL;
 	}
 	
-	inline void seek_vm_address(unsigned vm_address, int* p_guess_segment = NULL) throw() {
-		this->seek(this->to_file_offset(vm_address, p_guess_segment));
+	inline void seek_vm_address(unsigned vm_address, int* p_hint = NULL) throw() {
+		this->seek(this->to_file_offset(vm_address, p_hint));
 	}
 	
 	inline void for_each_section (void(*p_func)(const section*)) const {
@@ -87,7 +138,7 @@ public:
 	
 	inline bool encrypted() const throw() { return m_crypt_begin != m_crypt_end; }
 	inline bool file_offset_encrypted(off_t offset) const throw() { return offset >= m_crypt_begin && offset < m_crypt_end; }
-	inline bool vm_address_encrypted(unsigned vm_address, int* p_guess_segment = NULL) { return file_offset_encrypted(to_file_offset(vm_address, p_guess_segment)); } 
+	inline bool vm_address_encrypted(unsigned vm_address, int* p_hint = NULL) { return file_offset_encrypted(to_file_offset(vm_address, p_hint)); } 
 	
 	inline unsigned text_segment_vm_adress() const { return m_is_valid ? ma_segments[segment_index_having_name("__TEXT")]->vmaddr : 0; }
 };
@@ -95,6 +146,36 @@ public:
 //------------------------------------------------------------------------------
 
 class MachO_File : public MachO_File_Simple {
+public:
+	enum BindKind {
+		BK_Bind,
+		BK_WeakBind,
+		BK_LazyBind
+	};
+	
+	// a pointer bound by dyld, decoded from the dyld info (10.6+).
+	struct BindRecord {
+		unsigned address;
+		const char* symbol;
+		int library_ordinal;	// may be one of the BIND_SPECIAL_DYLIB_* values.
+		int addend;
+		unsigned char type;		// BIND_TYPE_*
+		unsigned char symbol_flags;	// BIND_SYMBOL_FLAGS_*
+		unsigned char kind;		// BindKind
+	};
+	
+protected:
+	// strings synthesized from the file, e.g. export trie symbols.
+	StringArena ma_string_store;
+	
+	// the key of this slice in the cache directory (see set_symbol_cache()),
+	// and the path of its cache file with the given extension.
+	void cache_key(unsigned char key[16]) const throw();
+	std::string cache_file_path(const char* extension) const;
+	// replace the file at path with content without exposing a partial file,
+	// creating the cache directory if needed.
+	bool write_cache_file(const std::string& path, const std::string& content) const;
+	
 private:
 	const struct nlist* ma_symbols;
 	std::size_t m_symbols_length;
@@ -111,7 +192,13 @@ private:
 	const relocation_info* ma_relocations;
 	unsigned m_relocations_length;
 	
-	// VMAddress :-> string
+	const dyld_info_command* mp_dyld_info;
+	
+	unsigned m_analyzed_facets;
+	
+	// VMAddress :-> string. These 7 tables are only filled while analyzing a
+	// facet, and are then merged into ma_symbol_index (or the sorted lists
+	// below) and released.
 	std::tr1::unordered_map<unsigned,const char*> ma_symbol_references;
 	std::tr1::unordered_map<unsigned,const char*> ma_cfstrings;
 	
@@ -123,12 +210,55 @@ private:
 	std::tr1::unordered_set<unsigned> ma_is_external_symbol;
 	std::tr1::unordered_map<unsigned,unsigned> ma_library_ordinals;
 	
-	std::vector<std::string> ma_string_store;
+	// flattened ma_is_external_symbol and ma_library_ordinals, sorted by address.
+	std::vector<unsigned> ma_external_symbols;
+	std::vector<std::pair<unsigned,unsigned> > ma_library_ordinal_list;
+	
+	// All named addresses, sorted by address and then by lookup priority
+	// (CFString, symbol, class, selector, method). There is at most one entry
+	// per address and type.
+	struct SymbolIndexEntry {
+		unsigned address;
+		unsigned string_id;	// index to ma_index_strings, or ma_objc_method_list for MOST_ObjCMethod.
+		unsigned type;
+	};
+	struct SymbolIndexComparator;
+	std::vector<SymbolIndexEntry> ma_symbol_index;
+	std::vector<const char*> ma_index_strings;
+	std::vector<ObjCMethod> ma_objc_method_list;
+	
+	void merge_into_symbol_index();
+	std::vector<SymbolIndexEntry>::const_iterator find_in_symbol_index(unsigned vm_address, unsigned type) const throw();
+	static bool is_sorted_symbol_index(const SymbolIndexEntry* begin, const SymbolIndexEntry* end) throw();
+	
+	// symbol name :-> address, keyed by the strings of ma_index_strings. Built
+	// by the AF_SymbolNames facet. A name may map to several addresses.
+	struct CStringHash { size_t operator() (const char* s) const throw(); };
+	struct CStringEqual { bool operator() (const char* a, const char* b) const throw(); };
+	typedef std::tr1::unordered_multimap<const char*, unsigned, CStringHash, CStringEqual> SymbolNameIndex;
+	SymbolNameIndex ma_symbol_names;
+	
+	void build_symbol_name_index();
 	
 	// 10.6 compressed mach-o formats.
-	void bind(uint32_t size) throw();
-	void process_export_trie_node(off_t start, off_t cur, off_t end, const std::string& prefix);
-	void process_export_trie(off_t start, off_t end) throw();
+	std::vector<BindRecord> ma_bindings;
+	void decode_bind_stream(unsigned offset, unsigned size, BindKind kind);
+	
+	void locate_tables();
+	void analyze_symbols();
+	void analyze_objc_references();
+	
+	// see set_symbol_cache(). The tables loaded from a cache point into
+	// mp_symbol_cache, which stays mapped until the file is destroyed.
+	std::string m_cache_directory;
+	unsigned m_cache_mode;
+	DataFile* mp_symbol_cache;
+	
+	bool load_symbol_cache();
+	void save_symbol_cache() const;
+	
+	MachO_File(const MachO_File&);
+	MachO_File& operator= (const MachO_File&);
 	
 public:
 	enum StringType {
@@ -142,7 +272,39 @@ public:
 		MOST_ObjCMethod
 	};
 	
+	// The tables of a MachO_File are built in groups called analysis facets,
+	// only when analyze() is called for them. The queries below only read the
+	// tables, and find nothing in a facet which has not been analyzed. Once
+	// analyzed, a file may be queried from many threads at once.
+	enum AnalysisFacet {
+		AF_Symbols = 1,				// symbol table, dyld binding & exports, relocations, indirect symbols.
+		AF_ObjCReferences = 2,		// CFStrings, ObjC classes, methods & selector references.
+		AF_All = AF_Symbols | AF_ObjCReferences,	// everything stored in the symbol cache.
+		AF_SymbolNames = 4			// the index of address_of_symbol() and co. Implies AF_Symbols.
+	};
+	
+	enum CacheMode {
+		CM_Bypass,		// neither read nor write the cache.
+		CM_Use,			// read the cache if it is valid, otherwise analyze and write it.
+		CM_Rebuild		// analyze and overwrite the cache.
+	};
+	
 	MachO_File(const char* path, const char* arch = "any");
+	MachO_File(const DataFile& file, const Slice& slice);
+	~MachO_File() throw();
+	
+	// analyze the facets which are not analyzed yet. Throws TRException if the
+	// tables are malformed.
+	void analyze(unsigned facets);
+	inline bool analyzed(unsigned facets) const throw() { return (m_analyzed_facets & facets) == facets; }
+	
+	// keep the analyzed tables in a cache file in directory, keyed by LC_UUID
+	// (or by the size, mtime and load commands without one). With a cache, the
+	// first analysis analyzes all facets. Call this before any analysis.
+	void set_symbol_cache(const char* directory, CacheMode mode = CM_Use);
+	inline const char* symbol_cache_directory() const throw() { return m_cache_mode != CM_Bypass ? m_cache_directory.c_str() : NULL; }
+	inline CacheMode symbol_cache_mode() const throw() { return static_cast<CacheMode>(m_cache_mode); }
+	inline bool loaded_from_symbol_cache() const throw() { return mp_symbol_cache != NULL; }
 	
 	// try to obtain a string related to this vm_address.
 	const char* string_representation (unsigned vm_address, StringType* p_strtype = NULL) const throw();
@@ -151,20 +313,40 @@ public:
 	static void print_string_representation(std::FILE* stream, const char* str, StringType strtype = MOST_Symbol) throw();
 	
 	inline bool is_extern_symbol(unsigned vm_address) const throw() {
-		return ma_is_external_symbol.find(vm_address) != ma_is_external_symbol.end();
+		return std::binary_search(ma_external_symbols.begin(), ma_external_symbols.end(), vm_address);
 	}
 	
 	inline bool is_symbol(unsigned vm_address) const throw() {
-		return ma_symbol_references.find(vm_address) != ma_symbol_references.end();
+		return find_in_symbol_index(vm_address, MOST_Symbol) != ma_symbol_index.end();
 	}
 	
-	unsigned address_of_symbol(const char* sym) const throw();
+	// the lowest address of the symbol, or 0 if not found. The lookups by name
+	// need the AF_SymbolNames facet.
+	unsigned address_of_symbol(const char* sym) const;
+	// all addresses of the symbol in ascending order.
+	std::vector<unsigned> addresses_of_symbol(const char* sym) const;
+	// resolve many symbols at once. The result is parallel to syms, as if
+	// address_of_symbol were called on each of them.
+	std::vector<unsigned> addresses_of_symbols(const std::vector<const char*>& syms) const;
 	
 	const ObjCMethod* objc_method_at_vm_address(unsigned vm_address) const throw();
 	
 	const char* library_of_relocated_symbol(unsigned vm_address) const throw();
+	// the path of the n-th linked library (1-based), or NULL.
+	const char* library_with_ordinal(int ordinal) const throw();
+	
+	// all bindings, weak bindings and lazy bindings in stream order.
+	inline const std::vector<BindRecord>& bindings() const throw() {
+		return ma_bindings;
+	}
+	
+	// walk the export trie of the dyld info (10.6+), calling p_func for every
+	// exported symbol in trie order. The name is only valid during the call.
+	// Returns false if the trie is malformed; symbols already reported stay.
+	bool for_each_export (void(*p_func)(const char* name, unsigned flags, unsigned address, void* context), void* context) const;
 	
-	void for_each_symbol (void(*p_func)(unsigned addr, const char* symbol, StringType type, void* context), void* context) const;
+	// enumerate the named addresses of the given facets in address order.
+	void for_each_symbol (void(*p_func)(unsigned addr, const char* symbol, StringType type, void* context), void* context, unsigned facets = AF_All) const;
 };
 
 #endif
@@ -0,0 +1,365 @@
+/*
+
+MachO_File_cache.cpp ... Persistent cache of the analyzed tables of a Mach-O file.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MachO_File.h"
+#include "cache_file.h"
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// The cache is one file per slice. Every reference inside it is an offset, so
+// it can be mapped anywhere:
+//
+//   SymbolCacheHeader
+//   SymbolIndexEntry   index[index_count]
+//   unsigned           index_strings[string_count]		(offsets into the string pool)
+//   CachedObjCMethod   methods[method_count]
+//   unsigned           external_symbols[external_count]
+//   CachedOrdinal      ordinals[ordinal_count]
+//   CachedBindRecord   bindings[binding_count]
+//   char               strings[strings_size]			(NUL-terminated, deduplicated)
+//
+// All integers are in host byte order. A file written by another host or
+// version fails the magic or version check and is rebuilt.
+
+static const char SymbolCacheMagic[8] = {'P', 'e', 'a', 'c', 'e', 'S', 'C', '\0'};
+static const unsigned SymbolCacheVersion = 2;
+
+enum SymbolCacheTable {
+	SCT_Index,
+	SCT_IndexStrings,
+	SCT_ObjCMethods,
+	SCT_ExternalSymbols,
+	SCT_LibraryOrdinals,
+	SCT_Bindings,
+	SCT_Strings,
+	SCT_Count
+};
+
+struct SymbolCacheHeader {
+	char magic[8];
+	unsigned version;
+	unsigned header_size;
+	unsigned char key[16];
+	int cputype, cpusubtype;
+	unsigned facets;
+	unsigned counts[SCT_Count];		// the count of SCT_Strings is the size of the pool in bytes.
+	unsigned offsets[SCT_Count];
+};
+
+struct CachedObjCMethod {
+	unsigned class_name, sel_name, types;
+	unsigned is_class_method;
+};
+
+struct CachedOrdinal {
+	unsigned address;
+	unsigned library_ordinal;
+};
+
+struct CachedBindRecord {
+	unsigned address;
+	unsigned symbol;
+	int library_ordinal;
+	int addend;
+	unsigned char type, symbol_flags, kind, reserved;
+};
+
+static const size_t SymbolCacheRecordSizes[SCT_Count] = {
+	3 * sizeof(unsigned),		// SymbolIndexEntry
+	sizeof(unsigned),
+	sizeof(CachedObjCMethod),
+	sizeof(unsigned),
+	sizeof(CachedOrdinal),
+	sizeof(CachedBindRecord),
+	1
+};
+
+// the LC_UUID of the slice, or a hash of its load commands, the file size and
+// the modification time.
+static void compute_cache_key(const vector<const load_command*>& load_commands, const mach_header* p_header, int fd, unsigned char key[16]) throw() {
+	for (vector<const load_command*>::const_iterator cit = load_commands.begin(); cit != load_commands.end(); ++ cit) {
+		if ((*cit)->cmd == LC_UUID && (*cit)->cmdsize >= sizeof(uuid_command)) {
+			memcpy(key, reinterpret_cast<const uuid_command*>(*cit)->uuid, 16);
+			return;
+		}
+	}
+
+	struct stat file_stat;
+	memset(&file_stat, 0, sizeof(file_stat));
+	fstat(fd, &file_stat);
+	unsigned long long h = fnv1a_64(p_header, sizeof(mach_header) + p_header->sizeofcmds);
+	unsigned long long stamp[2] = {static_cast<unsigned long long>(file_stat.st_size), static_cast<unsigned long long>(file_stat.st_mtime)};
+	unsigned long long h2 = fnv1a_64(stamp, sizeof(stamp), h);
+	memcpy(key, &h, 8);
+	memcpy(key+8, &h2, 8);
+}
+
+void MachO_File::set_symbol_cache(const char* directory, CacheMode mode) {
+	m_cache_directory = directory != NULL ? directory : "";
+	m_cache_mode = (directory != NULL && m_is_valid) ? mode : CM_Bypass;
+}
+
+void MachO_File::cache_key(unsigned char key[16]) const throw() {
+	compute_cache_key(ma_load_commands, this->peek_data_at<mach_header>(m_origin), m_fd, key);
+}
+
+string MachO_File::cache_file_path(const char* extension) const {
+	unsigned char key[16];
+	cache_key(key);
+
+	const mach_header* p_header = this->peek_data_at<mach_header>(m_origin);
+	char name[64];
+	for (unsigned i = 0; i < 16; ++ i)
+		sprintf(name + 2*i, "%02x", key[i]);
+	sprintf(name + 32, "-%d-%d", p_header->cputype, p_header->cpusubtype & 0xffffff);
+
+	string path = m_cache_directory;
+	if (!path.empty() && path[path.size()-1] != '/')
+		path.push_back('/');
+	return path + name + extension;
+}
+
+bool MachO_File::write_cache_file(const string& path, const string& content) const {
+	// write to a temporary file first, so concurrent readers never see a
+	// partial cache. The name is unique among the files being analyzed at
+	// the same time, also by other threads.
+	mkdir(m_cache_directory.c_str(), 0755);
+	char suffix[64];
+	sprintf(suffix, ".%d.%p.tmp", static_cast<int>(getpid()), static_cast<const void*>(this));
+	string temp_path = path + suffix;
+
+	FILE* f = fopen(temp_path.c_str(), "wb");
+	bool written = f != NULL && fwrite(content.data(), 1, content.size(), f) == content.size();
+	if (f != NULL)
+		written = (fclose(f) == 0) && written;
+	if (written)
+		written = rename(temp_path.c_str(), path.c_str()) == 0;
+	if (!written)
+		remove(temp_path.c_str());
+	return written;
+}
+
+#pragma mark -
+#pragma mark Loading
+
+bool MachO_File::load_symbol_cache() {
+	string path = cache_file_path(".symcache");
+	if (access(path.c_str(), R_OK) != 0)
+		return false;
+
+	DataFile* cache;
+	try {
+		cache = new DataFile(path.c_str());
+	} catch (const TRException&) {
+		return false;
+	}
+
+	const SymbolCacheHeader* p_cache_header = cache->peek_data_at<SymbolCacheHeader>(0);
+	const mach_header* p_header = this->peek_data_at<mach_header>(m_origin);
+	unsigned char key[16];
+	cache_key(key);
+
+	bool ok = p_cache_header != NULL
+		&& memcmp(p_cache_header->magic, SymbolCacheMagic, 8) == 0
+		&& p_cache_header->version == SymbolCacheVersion
+		&& p_cache_header->header_size == sizeof(SymbolCacheHeader)
+		&& memcmp(p_cache_header->key, key, 16) == 0
+		&& p_cache_header->cputype == p_header->cputype
+		&& p_cache_header->cpusubtype == p_header->cpusubtype
+		&& p_cache_header->facets == AF_All;
+	for (unsigned t = 0; ok && t < SCT_Count; ++ t) {
+		unsigned long long end = static_cast<unsigned long long>(p_cache_header->offsets[t]) + static_cast<unsigned long long>(p_cache_header->counts[t]) * SymbolCacheRecordSizes[t];
+		ok = p_cache_header->offsets[t] % 4 == 0 && end <= static_cast<unsigned long long>(cache->filesize());
+	}
+
+	const char* base = cache->data();
+	const char* pool = NULL;
+	unsigned pool_size = 0;
+	if (ok) {
+		pool = base + p_cache_header->offsets[SCT_Strings];
+		pool_size = p_cache_header->counts[SCT_Strings];
+		ok = pool_size == 0 || pool[pool_size-1] == '\0';
+	}
+
+#define CACHED_TABLE(T, table) reinterpret_cast<const T*>(base + p_cache_header->offsets[table])
+#define CACHED_STRING(offset) ((offset) == NullStringOffset ? NULL : pool + (offset))
+#define CHECK_STRING(offset) if ((offset) != NullStringOffset && (offset) >= pool_size) { ok = false; break; }
+
+	if (ok) {
+		const SymbolIndexEntry* index = CACHED_TABLE(SymbolIndexEntry, SCT_Index);
+		unsigned index_count = p_cache_header->counts[SCT_Index];
+		unsigned string_count = p_cache_header->counts[SCT_IndexStrings];
+		unsigned method_count = p_cache_header->counts[SCT_ObjCMethods];
+		for (unsigned i = 0; i < index_count; ++ i) {
+			if (index[i].type > MOST_ObjCMethod || index[i].string_id >= (index[i].type == MOST_ObjCMethod ? method_count : string_count)) {
+				ok = false;
+				break;
+			}
+		}
+		// the lookups binary search these tables.
+		if (ok)
+			ok = is_sorted_symbol_index(index, index + index_count);
+		if (ok)
+			ma_symbol_index.assign(index, index + index_count);
+
+		const unsigned* strings = CACHED_TABLE(unsigned, SCT_IndexStrings);
+		ma_index_strings.reserve(string_count);
+		for (unsigned i = 0; ok && i < string_count; ++ i) {
+			CHECK_STRING(strings[i]);
+			ma_index_strings.push_back(CACHED_STRING(strings[i]));
+		}
+
+		const CachedObjCMethod* methods = CACHED_TABLE(CachedObjCMethod, SCT_ObjCMethods);
+		ma_objc_method_list.reserve(method_count);
+		for (unsigned i = 0; ok && i < method_count; ++ i) {
+			CHECK_STRING(methods[i].class_name);
+			CHECK_STRING(methods[i].sel_name);
+			CHECK_STRING(methods[i].types);
+			ObjCMethod m;
+			m.class_name = CACHED_STRING(methods[i].class_name);
+			m.sel_name = CACHED_STRING(methods[i].sel_name);
+			m.types = CACHED_STRING(methods[i].types);
+			m.is_class_method = methods[i].is_class_method != 0;
+			ma_objc_method_list.push_back(m);
+		}
+
+		if (ok) {
+			const unsigned* externals = CACHED_TABLE(unsigned, SCT_ExternalSymbols);
+			unsigned external_count = p_cache_header->counts[SCT_ExternalSymbols];
+			for (unsigned i = 1; ok && i < external_count; ++ i)
+				ok = externals[i-1] < externals[i];
+			if (ok)
+				ma_external_symbols.assign(externals, externals + external_count);
+
+			const CachedOrdinal* ordinals = CACHED_TABLE(CachedOrdinal, SCT_LibraryOrdinals);
+			unsigned ordinal_count = p_cache_header->counts[SCT_LibraryOrdinals];
+			ma_library_ordinal_list.reserve(ordinal_count);
+			for (unsigned i = 0; ok && i < ordinal_count; ++ i) {
+				ok = i == 0 || ordinals[i-1].address < ordinals[i].address;
+				ma_library_ordinal_list.push_back(pair<unsigned,unsigned>(ordinals[i].address, ordinals[i].library_ordinal));
+			}
+		}
+
+		const CachedBindRecord* bindings = CACHED_TABLE(CachedBindRecord, SCT_Bindings);
+		unsigned binding_count = p_cache_header->counts[SCT_Bindings];
+		ma_bindings.reserve(binding_count);
+		for (unsigned i = 0; ok && i < binding_count; ++ i) {
+			CHECK_STRING(bindings[i].symbol);
+			BindRecord record;
+			record.address = bindings[i].address;
+			record.symbol = CACHED_STRING(bindings[i].symbol);
+			record.library_ordinal = bindings[i].library_ordinal;
+			record.addend = bindings[i].addend;
+			record.type = bindings[i].type;
+			record.symbol_flags = bindings[i].symbol_flags;
+			record.kind = bindings[i].kind;
+			ma_bindings.push_back(record);
+		}
+	}
+
+#undef CHECK_STRING
+#undef CACHED_STRING
+#undef CACHED_TABLE
+
+	if (!ok) {
+		vector<SymbolIndexEntry>().swap(ma_symbol_index);
+		vector<const char*>().swap(ma_index_strings);
+		vector<ObjCMethod>().swap(ma_objc_method_list);
+		vector<unsigned>().swap(ma_external_symbols);
+		vector<pair<unsigned,unsigned> >().swap(ma_library_ordinal_list);
+		vector<BindRecord>().swap(ma_bindings);
+		delete cache;
+		return false;
+	}
+
+	mp_symbol_cache = cache;
+	m_analyzed_facets = AF_All;
+	return true;
+}
+
+#pragma mark -
+#pragma mark Saving
+
+template<typename T>
+static void append_table(string& out, SymbolCacheHeader& header, SymbolCacheTable table, const vector<T>& records) {
+	append_cache_table(out, records, header.offsets[table], header.counts[table]);
+}
+
+void MachO_File::save_symbol_cache() const {
+	CacheStringPool strings;
+
+	vector<unsigned> index_strings;
+	index_strings.reserve(ma_index_strings.size());
+	for (vector<const char*>::const_iterator cit = ma_index_strings.begin(); cit != ma_index_strings.end(); ++ cit)
+		index_strings.push_back(strings.offset_of(*cit));
+
+	vector<CachedObjCMethod> methods;
+	methods.reserve(ma_objc_method_list.size());
+	for (vector<ObjCMethod>::const_iterator cit = ma_objc_method_list.begin(); cit != ma_objc_method_list.end(); ++ cit) {
+		CachedObjCMethod m = {strings.offset_of(cit->class_name), strings.offset_of(cit->sel_name), strings.offset_of(cit->types), cit->is_class_method ? 1u : 0u};
+		methods.push_back(m);
+	}
+
+	vector<CachedOrdinal> ordinals;
+	ordinals.reserve(ma_library_ordinal_list.size());
+	for (vector<pair<unsigned,unsigned> >::const_iterator cit = ma_library_ordinal_list.begin(); cit != ma_library_ordinal_list.end(); ++ cit) {
+		CachedOrdinal ordinal = {cit->first, cit->second};
+		ordinals.push_back(ordinal);
+	}
+
+	vector<CachedBindRecord> bindings;
+	bindings.reserve(ma_bindings.size());
+	for (vector<BindRecord>::const_iterator cit = ma_bindings.begin(); cit != ma_bindings.end(); ++ cit) {
+		CachedBindRecord record = {cit->address, strings.offset_of(cit->symbol), cit->library_ordinal, cit->addend, cit->type, cit->symbol_flags, cit->kind, 0};
+		bindings.push_back(record);
+	}
+
+	const mach_header* p_header = this->peek_data_at<mach_header>(m_origin);
+	SymbolCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SymbolCacheMagic, 8);
+	header.version = SymbolCacheVersion;
+	header.header_size = sizeof(SymbolCacheHeader);
+	cache_key(header.key);
+	header.cputype = p_header->cputype;
+	header.cpusubtype = p_header->cpusubtype;
+	header.facets = AF_All;
+
+	string out (sizeof(SymbolCacheHeader), '\0');
+	append_table(out, header, SCT_Index, ma_symbol_index);
+	append_table(out, header, SCT_IndexStrings, index_strings);
+	append_table(out, header, SCT_ObjCMethods, methods);
+	append_table(out, header, SCT_ExternalSymbols, ma_external_symbols);
+	append_table(out, header, SCT_LibraryOrdinals, ordinals);
+	append_table(out, header, SCT_Bindings, bindings);
+	header.offsets[SCT_Strings] = static_cast<unsigned>(out.size());
+	header.counts[SCT_Strings] = static_cast<unsigned>(strings.pool.size());
+	out.append(strings.pool);
+	memcpy(&out[0], &header, sizeof(header));
+
+	string path = cache_file_path(".symcache");
+	if (!write_cache_file(path, out))
+		fprintf(stderr, "Warning: Cannot write the symbol cache \"%s\".\n", path.c_str());
+}
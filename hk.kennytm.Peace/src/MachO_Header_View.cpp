@@ -0,0 +1,174 @@
+/*
+
+MachO_Header_View.cpp ... Load commands of a Mach-O file, without mapping it.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MachO_Header_View.h"
+#include "MachO_File.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mach-o/fat.h>
+#include <libkern/OSByteOrder.h>
+#include "get_arch_from_flag.h"
+
+using namespace std;
+
+// enough for the load commands of almost every file.
+static const size_t InitialReadSize = 4096;
+
+MachO_Header_View::MachO_Header_View() : m_origin(0), m_is_valid(false), mp_full_file(NULL) {
+	ma_buffer.reserve(InitialReadSize);
+}
+
+MachO_Header_View::MachO_Header_View(const char* path, const char* arch) : m_origin(0), m_is_valid(false), mp_full_file(NULL) {
+	ma_buffer.reserve(InitialReadSize);
+	open(path, arch);
+}
+
+MachO_Header_View::~MachO_Header_View() throw() {
+	delete mp_full_file;
+}
+
+size_t MachO_Header_View::read_at(int fd, off_t offset, size_t size) {
+	if (ma_buffer.size() < size)
+		ma_buffer.resize(size);
+	size_t total = 0;
+	while (total < size) {
+		ssize_t res = pread(fd, &ma_buffer[total], size - total, offset + static_cast<off_t>(total));
+		if (res <= 0)
+			break;
+		total += static_cast<size_t>(res);
+	}
+	return total;
+}
+
+bool MachO_Header_View::open(const char* path, const char* arch) {
+	delete mp_full_file;
+	mp_full_file = NULL;
+	m_path = path;
+	m_arch = arch;
+	m_origin = 0;
+	m_is_valid = false;
+	ma_load_commands.clear();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd == -1)
+		throw TRException("MachO_Header_View::open(const char*, const char*):\n\tFail to open \"%s\".", path);
+
+	size_t length = read_at(fd, 0, InitialReadSize);
+
+	if (length >= sizeof(fat_header) && OSSwapBigToHostInt32(reinterpret_cast<const fat_header*>(&ma_buffer[0])->magic) == FAT_MAGIC) {
+		unsigned nfat_arch = OSSwapBigToHostInt32(reinterpret_cast<const fat_header*>(&ma_buffer[0])->nfat_arch);
+		size_t fat_size = sizeof(fat_header) + nfat_arch * sizeof(fat_arch);
+		if (fat_size > length)
+			length = read_at(fd, 0, fat_size);
+
+		struct arch_flag target_arch;
+		if (get_arch_from_flag(arch, &target_arch) == 0) {
+			target_arch.cputype = CPU_TYPE_ANY;
+			target_arch.cpusubtype = 0;
+		}
+		bool found_arch = false;
+		for (unsigned i = 0; i < nfat_arch && sizeof(fat_header) + (i+1) * sizeof(fat_arch) <= length; ++ i) {
+			const fat_arch* p_arch = reinterpret_cast<const fat_arch*>(&ma_buffer[sizeof(fat_header) + i * sizeof(fat_arch)]);
+			cpu_type_t cputype = static_cast<cpu_type_t>(OSSwapBigToHostInt32(p_arch->cputype));
+			cpu_subtype_t cpusubtype = static_cast<cpu_subtype_t>(OSSwapBigToHostInt32(p_arch->cpusubtype));
+			if (target_arch.cputype == CPU_TYPE_ANY || (cputype == target_arch.cputype && (target_arch.cpusubtype == 0 || cpusubtype == target_arch.cpusubtype))) {
+				m_origin = OSSwapBigToHostInt32(p_arch->offset);
+				found_arch = true;
+				break;
+			}
+		}
+		if (!found_arch) {
+			::close(fd);
+			throw TRException("MachO_Header_View::open(const char*, const char*):\n\tArchitecture \"%s\" not found in \"%s\".", arch, path);
+		}
+
+		length = read_at(fd, m_origin, InitialReadSize);
+	}
+
+	if (length >= sizeof(mach_header) && reinterpret_cast<const mach_header*>(&ma_buffer[0])->magic == MH_MAGIC) {
+		size_t commands_end = sizeof(mach_header) + reinterpret_cast<const mach_header*>(&ma_buffer[0])->sizeofcmds;
+		if (commands_end > length)
+			length = read_at(fd, m_origin, commands_end);
+		if (length >= commands_end)
+			m_is_valid = true;
+	}
+	::close(fd);
+
+	if (m_is_valid) {
+		// the buffer does not move from here on.
+		const mach_header* p_header = reinterpret_cast<const mach_header*>(&ma_buffer[0]);
+		size_t commands_end = sizeof(mach_header) + p_header->sizeofcmds;
+		size_t offset = sizeof(mach_header);
+		ma_load_commands.reserve(p_header->ncmds);
+		for (unsigned i = 0; i < p_header->ncmds && offset + sizeof(load_command) <= commands_end; ++ i) {
+			const load_command* p_cmd = reinterpret_cast<const load_command*>(&ma_buffer[offset]);
+			if (p_cmd->cmdsize < sizeof(load_command) || offset + p_cmd->cmdsize > commands_end)
+				break;
+			ma_load_commands.push_back(p_cmd);
+			offset += p_cmd->cmdsize;
+		}
+	}
+
+	return m_is_valid;
+}
+
+const MachO_File_Simple& MachO_Header_View::full_file() {
+	if (mp_full_file == NULL)
+		mp_full_file = new MachO_File_Simple(m_path.c_str(), m_arch.c_str());
+	return *mp_full_file;
+}
+
+// the name of a dylib_command, or NULL if it is not inside the command.
+static const char* dylib_name(const load_command* p_cmd) throw() {
+	const dylib_command* p_dylib_cmd = reinterpret_cast<const dylib_command*>(p_cmd);
+	unsigned name_offset = p_dylib_cmd->dylib.name.offset;
+	if (p_cmd->cmdsize < sizeof(dylib_command) || name_offset >= p_cmd->cmdsize)
+		return NULL;
+	const char* name = reinterpret_cast<const char*>(p_cmd) + name_offset;
+	if (memchr(name, '\0', p_cmd->cmdsize - name_offset) == NULL)
+		return NULL;
+	return name;
+}
+
+vector<string> MachO_Header_View::linked_libraries(const vector<const load_command*>& load_commands, const string& sysroot) {
+	vector<string> retval;
+	for (vector<const load_command*>::const_iterator cit = load_commands.begin(); cit != load_commands.end(); ++ cit) {
+		if ((*cit)->cmd == LC_LOAD_DYLIB || (*cit)->cmd == LC_LOAD_WEAK_DYLIB) {
+			const char* lib_path = dylib_name(*cit);
+			if (lib_path == NULL)
+				continue;
+			if (lib_path[0] == '@') {
+				const char* slash = strchr(lib_path, '/');
+				retval.push_back(string(slash != NULL ? slash+1 : lib_path));
+			} else
+				retval.push_back(sysroot + string(lib_path));
+		}
+	}
+	return retval;
+}
+
+const char* MachO_Header_View::self_path(const vector<const load_command*>& load_commands) throw() {
+	for (vector<const load_command*>::const_iterator cit = load_commands.begin(); cit != load_commands.end(); ++ cit)
+		if ((*cit)->cmd == LC_ID_DYLIB)
+			return dylib_name(*cit);
+	return NULL;
+}
@@ -0,0 +1,81 @@
+/*
+
+MachO_Header_View.h ... Load commands of a Mach-O file, without mapping it.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef MACH_O_HEADER_VIEW_H
+#define MACH_O_HEADER_VIEW_H
+
+#include <mach-o/loader.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+class MachO_File_Simple;
+
+// Reads the fat header, the mach_header and the load commands with pread()
+// into a buffer which is reused by every open(), so scanning many files costs
+// no mmap or page faults. Everything returned points into the buffer, and is
+// invalidated by the next open().
+class MachO_Header_View {
+private:
+	std::string m_path, m_arch;
+	std::vector<char> ma_buffer;
+	off_t m_origin;
+	bool m_is_valid;
+	std::vector<const load_command*> ma_load_commands;
+	MachO_File_Simple* mp_full_file;
+
+	// read size bytes at offset to the start of the buffer. Returns the number
+	// of bytes read.
+	std::size_t read_at(int fd, off_t offset, std::size_t size);
+
+	MachO_Header_View(const MachO_Header_View&);
+	MachO_Header_View& operator= (const MachO_Header_View&);
+
+public:
+	MachO_Header_View();
+	MachO_Header_View(const char* path, const char* arch = "any");
+	~MachO_Header_View() throw();
+
+	// read the headers of a file, replacing the current one. Throws a
+	// TRException if the file cannot be opened or the arch is not in a fat
+	// file, like MachO_File_Simple. Returns valid().
+	bool open(const char* path, const char* arch = "any");
+
+	inline bool valid() const throw() { return m_is_valid; }
+	inline const char* path() const throw() { return m_path.c_str(); }
+	inline off_t origin() const throw() { return m_origin; }
+	inline const mach_header* header() const throw() { return m_is_valid ? reinterpret_cast<const mach_header*>(&ma_buffer[0]) : NULL; }
+	inline const std::vector<const load_command*>& load_commands() const throw() { return ma_load_commands; }
+
+	inline std::vector<std::string> linked_libraries(const std::string& sysroot) const { return linked_libraries(ma_load_commands, sysroot); }
+	inline const char* self_path() const throw() { return self_path(ma_load_commands); }
+
+	// map the whole file, for consumers which need more than the load
+	// commands. The result is cached until the next open().
+	const MachO_File_Simple& full_file();
+
+	// shared with MachO_File_Simple. Names outside their load command are
+	// skipped.
+	static std::vector<std::string> linked_libraries(const std::vector<const load_command*>& load_commands, const std::string& sysroot);
+	static const char* self_path(const std::vector<const load_command*>& load_commands) throw();
+};
+
+#endif
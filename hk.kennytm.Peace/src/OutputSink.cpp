@@ -0,0 +1,103 @@
+/*
+
+OutputSink.cpp ... Append-only output buffer, written out in bulk.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "OutputSink.h"
+#include "snprintf.h"
+#include <cstdarg>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#define vsnprintf _vsnprintf
+#endif
+
+using namespace std;
+
+OutputSink::OutputSink(FILE* f, size_t flush_threshold) : mp_buffer(NULL), m_size(0), m_capacity(0), mp_file(f), m_flush_threshold(flush_threshold) {}
+
+OutputSink::~OutputSink() throw() {
+	flush();
+	free(mp_buffer);
+}
+
+void OutputSink::grow(size_t min_capacity) {
+	size_t new_capacity = m_capacity == 0 ? 4096 : m_capacity;
+	while (new_capacity < min_capacity)
+		new_capacity *= 2;
+	char* new_buffer = reinterpret_cast<char*>(realloc(mp_buffer, new_capacity));
+	if (new_buffer == NULL)
+		throw bad_alloc();
+	mp_buffer = new_buffer;
+	m_capacity = new_capacity;
+}
+
+void OutputSink::append_format(const char* format, ...) {
+	char buffer[256];
+	va_list va;
+	va_start(va, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, va);
+	va_end(va);
+	// MSVC returns -1 instead of the full length when the result is cut.
+	if (length < 0 || static_cast<size_t>(length) >= sizeof(buffer))
+		length = sizeof(buffer)-1;
+	append(buffer, static_cast<size_t>(length));
+}
+
+bool OutputSink::flush() {
+	if (mp_file == NULL)
+		return false;
+	bool written = m_size == 0 || fwrite(mp_buffer, 1, m_size, mp_file) == m_size;
+	m_size = 0;
+	return written;
+}
+
+static bool file_has_content(const char* path, const char* data, size_t size) {
+	FILE* f = fopen(path, "rt");
+	if (f == NULL)
+		return false;
+	char chunk[8192];
+	size_t offset = 0;
+	bool same = true;
+	while (same) {
+		size_t read_count = fread(chunk, 1, sizeof(chunk), f);
+		if (read_count == 0)
+			break;
+		same = read_count <= size - offset && memcmp(chunk, data + offset, read_count) == 0;
+		offset += read_count;
+	}
+	fclose(f);
+	return same && offset == size;
+}
+
+OutputSink::FileStatus OutputSink::write_file(const char* path) const {
+	if (file_has_content(path, mp_buffer, m_size))
+		return FS_Unchanged;
+	FILE* f = fopen(path, "wt");
+	if (f == NULL)
+		return FS_Failed;
+	// the whole buffer goes to the file at once, so there is no need for
+	// the stdio buffer.
+	setvbuf(f, NULL, _IONBF, 0);
+	bool written = m_size == 0 || fwrite(mp_buffer, 1, m_size, f) == m_size;
+	if (fclose(f) != 0)
+		written = false;
+	return written ? FS_Written : FS_Failed;
+}
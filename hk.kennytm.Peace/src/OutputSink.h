@@ -0,0 +1,101 @@
+/*
+
+OutputSink.h ... Append-only output buffer, written out in bulk.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Formatters append to the sink, and the owner writes the buffer to its
+// file with flush() or flush_if_full(). Nothing leaves the buffer between
+// those calls, so a formatter may take back what it appended since the
+// last flush (see truncate()).
+//
+// The file is written with fwrite(), so the output stays in order with
+// anything else printed to the same FILE*.
+class OutputSink {
+private:
+	char* mp_buffer;
+	std::size_t m_size;
+	std::size_t m_capacity;
+	std::FILE* mp_file;
+	std::size_t m_flush_threshold;
+
+	void grow(std::size_t min_capacity);
+
+	OutputSink(const OutputSink&);
+	OutputSink& operator= (const OutputSink&);
+
+public:
+	// if f is NULL, the sink only collects the output in memory.
+	explicit OutputSink(std::FILE* f = NULL, std::size_t flush_threshold = 65536);
+	// flushes the remaining output.
+	~OutputSink() throw();
+
+	inline void append(const char* str, std::size_t length) {
+		if (m_size + length > m_capacity)
+			grow(m_size + length);
+		std::memcpy(mp_buffer + m_size, str, length);
+		m_size += length;
+	}
+	inline void append(const char* str) { append(str, std::strlen(str)); }
+	inline void append(const std::string& str) { append(str.data(), str.size()); }
+	inline void append(std::size_t count, char c) {
+		if (m_size + count > m_capacity)
+			grow(m_size + count);
+		std::memset(mp_buffer + m_size, c, count);
+		m_size += count;
+	}
+	inline void push_back(char c) {
+		if (m_size == m_capacity)
+			grow(m_size + 1);
+		mp_buffer[m_size++] = c;
+	}
+	// snprintf() a short piece of text, e.g. a number. The result is cut
+	// at 255 characters.
+	void append_format(const char* format, ...);
+
+	inline std::size_t size() const throw() { return m_size; }
+	inline bool empty() const throw() { return m_size == 0; }
+	inline const char* data() const throw() { return mp_buffer; }
+	inline char& operator[] (std::size_t i) throw() { return mp_buffer[i]; }
+	inline char operator[] (std::size_t i) const throw() { return mp_buffer[i]; }
+	inline std::string str(std::size_t from = 0) const { return std::string(mp_buffer + from, m_size - from); }
+
+	// drop everything appended after the first "size" characters.
+	inline void truncate(std::size_t size) throw() { if (size < m_size) m_size = size; }
+	inline void clear() throw() { m_size = 0; }
+
+	// write the buffer to the file and empty it. Returns false on a write
+	// error, or if there is no file (then the buffer is kept).
+	bool flush();
+	inline bool flush_if_full() { return m_size < m_flush_threshold || flush(); }
+
+	enum FileStatus { FS_Written, FS_Unchanged, FS_Failed };
+	// replace the file at path with the buffer, in one write. If the file
+	// already has the same content it is left untouched, so its
+	// modification time is kept.
+	FileStatus write_file(const char* path) const;
+};
+
+#endif
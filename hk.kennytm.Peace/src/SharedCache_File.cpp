@@ -0,0 +1,111 @@
+/*
+
+SharedCache_File.cpp ... Images in a dyld shared cache, without extracting them.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SharedCache_File.h"
+#include <mach-o/loader.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+struct SharedCache_File::ImagePathComparator {
+	const vector<Image>& images;
+	ImagePathComparator(const vector<Image>& images_) : images(images_) {}
+
+	bool operator() (unsigned a, unsigned b) const throw() { return strcmp(images[a].path, images[b].path) < 0; }
+	bool operator() (unsigned a, const char* b) const throw() { return strcmp(images[a].path, b) < 0; }
+	bool operator() (const char* a, unsigned b) const throw() { return strcmp(a, images[b].path) < 0; }
+};
+
+SharedCache_File::SharedCache_File(const char* path) : DataFile(path), m_is_valid(false) {
+	const dyld_cache_header* p_header = this->peek_data_at<dyld_cache_header>(0);
+	if (p_header == NULL || strncmp(p_header->magic, "dyld_v1 ", 8) != 0 || memchr(p_header->magic, '\0', sizeof(p_header->magic)) == NULL)
+		return;
+
+	const char* arch = p_header->magic + 7;
+	while (*arch == ' ')
+		++ arch;
+	m_arch = arch;
+
+	// both tables must lie inside the file, so a damaged count cannot make
+	// the vectors below huge.
+	if (static_cast<uint64_t>(p_header->mappingOffset) + static_cast<uint64_t>(p_header->mappingCount) * sizeof(dyld_cache_mapping_info) > static_cast<uint64_t>(m_filesize))
+		throw TRException("SharedCache_File::SharedCache_File(const char*):\n\tThe mapping table of \"%s\" runs past the end of the file.", path);
+	if (static_cast<uint64_t>(p_header->imagesOffset) + static_cast<uint64_t>(p_header->imagesCount) * sizeof(dyld_cache_image_info) > static_cast<uint64_t>(m_filesize))
+		throw TRException("SharedCache_File::SharedCache_File(const char*):\n\tThe image table of \"%s\" runs past the end of the file.", path);
+
+	// the mapping table. Only the 32-bit address space is used.
+	ma_mappings.reserve(p_header->mappingCount);
+	for (unsigned i = 0; i < p_header->mappingCount; ++ i) {
+		const dyld_cache_mapping_info* p_mapping = this->peek_data_at<dyld_cache_mapping_info>(static_cast<off_t>(p_header->mappingOffset) + static_cast<off_t>(i * sizeof(dyld_cache_mapping_info)));
+		if (p_mapping->size == 0 || p_mapping->address + p_mapping->size >= 0x100000000ULL || p_mapping->fileOffset >= static_cast<uint64_t>(m_filesize))
+			continue;
+		Mapping mapping;
+		mapping.begin = static_cast<unsigned>(p_mapping->address);
+		mapping.end = static_cast<unsigned>(p_mapping->address + p_mapping->size);
+		mapping.file_offset = static_cast<off_t>(p_mapping->fileOffset);
+		// a mapping must not run past the end of the file.
+		if (mapping.file_offset + static_cast<off_t>(mapping.end - mapping.begin) > m_filesize)
+			mapping.end = mapping.begin + static_cast<unsigned>(m_filesize - mapping.file_offset);
+		ma_mappings.push_back(mapping);
+	}
+	sort(ma_mappings.begin(), ma_mappings.end());
+
+	ma_images.reserve(p_header->imagesCount);
+	for (unsigned i = 0; i < p_header->imagesCount; ++ i) {
+		const dyld_cache_image_info* p_image = this->peek_data_at<dyld_cache_image_info>(static_cast<off_t>(p_header->imagesOffset) + static_cast<off_t>(i * sizeof(dyld_cache_image_info)));
+		if (p_image->address >= 0x100000000ULL || p_image->pathFileOffset >= m_filesize)
+			continue;
+
+		Image image;
+		image.address = static_cast<unsigned>(p_image->address);
+		image.offset = to_file_offset(image.address);
+		image.path = m_data + p_image->pathFileOffset;
+		const mach_header* p_image_header = this->peek_data_at<mach_header>(image.offset);
+		if (image.offset == 0 || p_image_header == NULL || p_image_header->magic != MH_MAGIC)
+			continue;
+		if (memchr(image.path, '\0', static_cast<size_t>(m_filesize - p_image->pathFileOffset)) == NULL)
+			continue;
+		ma_images.push_back(image);
+	}
+
+	ma_images_by_path.reserve(ma_images.size());
+	for (unsigned i = 0; i < ma_images.size(); ++ i)
+		ma_images_by_path.push_back(i);
+	sort(ma_images_by_path.begin(), ma_images_by_path.end(), ImagePathComparator(ma_images));
+
+	m_is_valid = true;
+}
+
+int SharedCache_File::image_index(const char* path) const throw() {
+	vector<unsigned>::const_iterator cit = lower_bound(ma_images_by_path.begin(), ma_images_by_path.end(), path, ImagePathComparator(ma_images));
+	if (cit != ma_images_by_path.end() && strcmp(ma_images[*cit].path, path) == 0)
+		return static_cast<int>(*cit);
+	return -1;
+}
+
+off_t SharedCache_File::to_file_offset(unsigned vm_address) const throw() {
+	// there are only a few mappings (usually 3).
+	for (vector<Mapping>::const_iterator cit = ma_mappings.begin(); cit != ma_mappings.end(); ++ cit)
+		if (cit->begin <= vm_address && cit->end > vm_address)
+			return cit->file_offset + (vm_address - cit->begin);
+	return 0;
+}
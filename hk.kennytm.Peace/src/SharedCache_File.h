@@ -0,0 +1,105 @@
+/*
+
+SharedCache_File.h ... Images in a dyld shared cache, without extracting them.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SHARED_CACHE_FILE_H
+#define SHARED_CACHE_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "DataFile.h"
+
+// the on-disk structures of dyld_shared_cache_<arch> (iPhoneOS 3.1+). All
+// integers are little-endian.
+struct dyld_cache_header {
+	char magic[16];				// "dyld_v1   armv7", padded with spaces.
+	uint32_t mappingOffset;
+	uint32_t mappingCount;
+	uint32_t imagesOffset;
+	uint32_t imagesCount;
+	uint64_t dyldBaseAddress;
+};
+
+struct dyld_cache_mapping_info {
+	uint64_t address;
+	uint64_t size;
+	uint64_t fileOffset;
+	uint32_t maxProt;
+	uint32_t initProt;
+};
+
+struct dyld_cache_image_info {
+	uint64_t address;
+	uint64_t modTime;
+	uint64_t inode;
+	uint32_t pathFileOffset;
+	uint32_t pad;
+};
+
+// The cache is mapped once. Images are described by where their mach_header
+// lies in the file, and MachO_File_Simple(cache, index) borrows the mapping to
+// read one of them in place, translating its addresses through the mapping
+// table of the cache.
+class SharedCache_File : public DataFile {
+public:
+	struct Image {
+		unsigned address;
+		off_t offset;		// file offset of the mach_header.
+		const char* path;	// points into the cache.
+	};
+
+private:
+	bool m_is_valid;
+	std::string m_arch;
+
+	struct Mapping {
+		unsigned begin, end;
+		off_t file_offset;
+		inline bool operator< (const Mapping& other) const throw() { return begin < other.begin; }
+	};
+	std::vector<Mapping> ma_mappings;
+	std::vector<Image> ma_images;
+	// indices to ma_images, sorted by path.
+	std::vector<unsigned> ma_images_by_path;
+
+	struct ImagePathComparator;
+
+	SharedCache_File(const SharedCache_File&);
+
+public:
+	// throws TRException if the mapping or image table runs past the end of
+	// the file. Other damage only makes the cache invalid.
+	SharedCache_File(const char* path);
+
+	inline bool valid() const throw() { return m_is_valid; }
+	// e.g. "armv7".
+	inline const char* arch() const throw() { return m_arch.c_str(); }
+
+	// images whose header or path is outside the cache are skipped.
+	inline const std::vector<Image>& images() const throw() { return ma_images; }
+	// the index of the image with this install name, or -1.
+	int image_index(const char* path) const throw();
+
+	// the file offset of a vm_address, or 0 if it is not mapped.
+	off_t to_file_offset(unsigned vm_address) const throw();
+};
+
+#endif
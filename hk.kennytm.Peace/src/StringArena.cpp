@@ -0,0 +1,81 @@
+/*
+
+StringArena.cpp ... Bump-pointer storage for C strings.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "StringArena.h"
+#include <new>
+
+using namespace std;
+
+// FNV-1a.
+size_t StringArena::SpanHash::operator() (const Span& s) const throw() {
+	size_t h = 2166136261u;
+	for (size_t i = 0; i < s.length; ++ i)
+		h = (h ^ static_cast<unsigned char>(s.data[i])) * 16777619u;
+	return h;
+}
+
+StringArena::StringArena(size_t block_size) : m_cursor(NULL), m_remaining(0), m_block_size(block_size), m_bytes_used(0) {}
+
+StringArena::~StringArena() throw() {
+	for (vector<char*>::iterator it = ma_blocks.begin(); it != ma_blocks.end(); ++ it)
+		delete[] *it;
+}
+
+char* StringArena::allocate(size_t size) {
+	if (size > m_remaining) {
+		if (ma_blocks.size() == ma_blocks.capacity())
+			ma_blocks.reserve(ma_blocks.size() * 2 + 4);
+		// oversized strings get a block of their own, so the current block
+		// can still be filled.
+		if (size > m_block_size / 4) {
+			char* block = new char[size];
+			ma_blocks.push_back(block);
+			m_bytes_used += size;
+			return block;
+		}
+		m_cursor = new char[m_block_size];
+		ma_blocks.push_back(m_cursor);
+		m_remaining = m_block_size;
+	}
+	char* retval = m_cursor;
+	m_cursor += size;
+	m_remaining -= size;
+	m_bytes_used += size;
+	return retval;
+}
+
+const char* StringArena::store(const char* str, size_t length) {
+	char* retval = allocate(length + 1);
+	memcpy(retval, str, length);
+	retval[length] = '\0';
+	return retval;
+}
+
+const char* StringArena::intern(const char* str, size_t length) {
+	Span key = {str, length};
+	tr1::unordered_set<Span, SpanHash, SpanEqual>::const_iterator cit = ma_interned.find(key);
+	if (cit != ma_interned.end())
+		return cit->data;
+
+	key.data = store(str, length);
+	ma_interned.insert(key);
+	return key.data;
+}
@@ -0,0 +1,79 @@
+/*
+
+StringArena.h ... Bump-pointer storage for C strings.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <tr1/unordered_set>
+
+// Strings are copied into large blocks which are never moved or freed
+// before the arena itself, so the returned pointers stay valid for the
+// lifetime of the arena. Every string is NUL-terminated.
+class StringArena {
+private:
+	struct Span {
+		const char* data;
+		std::size_t length;
+	};
+	struct SpanHash { std::size_t operator() (const Span& s) const throw(); };
+	struct SpanEqual {
+		inline bool operator() (const Span& a, const Span& b) const throw() {
+			return a.length == b.length && std::memcmp(a.data, b.data, a.length) == 0;
+		}
+	};
+
+	std::vector<char*> ma_blocks;
+	char* m_cursor;
+	std::size_t m_remaining;
+	std::size_t m_block_size;
+	std::size_t m_bytes_used;
+
+	// strings added with intern().
+	std::tr1::unordered_set<Span, SpanHash, SpanEqual> ma_interned;
+
+	char* allocate(std::size_t size);
+
+	StringArena(const StringArena&);
+	StringArena& operator= (const StringArena&);
+
+public:
+	explicit StringArena(std::size_t block_size = 65536);
+	~StringArena() throw();
+
+	// copy a string into the arena.
+	const char* store(const char* str, std::size_t length);
+	inline const char* store(const char* str) { return store(str, std::strlen(str)); }
+	inline const char* store(const std::string& str) { return store(str.data(), str.size()); }
+
+	// same as store(), but return the existing copy if an equal string was
+	// interned before.
+	const char* intern(const char* str, std::size_t length);
+	inline const char* intern(const char* str) { return intern(str, std::strlen(str)); }
+	inline const char* intern(const std::string& str) { return intern(str.data(), str.size()); }
+
+	inline std::size_t block_count() const throw() { return ma_blocks.size(); }
+	inline std::size_t bytes_used() const throw() { return m_bytes_used; }
+};
+
+#endif
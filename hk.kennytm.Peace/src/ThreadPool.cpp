@@ -0,0 +1,150 @@
+/*
+
+ThreadPool.cpp ... Fixed-size pool of worker threads.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ThreadPool.h"
+#include "DataFile.h"
+#include <exception>
+#if !_MSC_VER
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+unsigned ThreadPool::processor_count() throw() {
+#if !_MSC_VER && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? static_cast<unsigned>(n) : 1;
+#else
+	return 1;
+#endif
+}
+
+ThreadPool::ThreadPool(unsigned thread_count) : mp_func(NULL), m_context(NULL), m_count(0), m_next_index(0), m_finished(0), m_thread_count(thread_count != 0 ? thread_count : processor_count()), m_stopping(false), m_has_error(false) {
+#if _MSC_VER
+	m_thread_count = 1;
+#else
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_job_available, NULL);
+	pthread_cond_init(&m_job_finished, NULL);
+
+	// the calling thread is one of the workers.
+	ma_workers.reserve(m_thread_count - 1);
+	for (unsigned i = 1; i < m_thread_count; ++ i) {
+		pthread_t worker;
+		if (pthread_create(&worker, NULL, worker_main, this) != 0)
+			break;
+		ma_workers.push_back(worker);
+	}
+	m_thread_count = static_cast<unsigned>(ma_workers.size()) + 1;
+#endif
+}
+
+ThreadPool::~ThreadPool() throw() {
+#if !_MSC_VER
+	pthread_mutex_lock(&m_mutex);
+	m_stopping = true;
+	pthread_cond_broadcast(&m_job_available);
+	pthread_mutex_unlock(&m_mutex);
+
+	for (vector<pthread_t>::const_iterator cit = ma_workers.begin(); cit != ma_workers.end(); ++ cit)
+		pthread_join(*cit, NULL);
+
+	pthread_cond_destroy(&m_job_finished);
+	pthread_cond_destroy(&m_job_available);
+	pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+#if !_MSC_VER
+void* ThreadPool::worker_main(void* self) {
+	ThreadPool* pool = static_cast<ThreadPool*>(self);
+	pthread_mutex_lock(&pool->m_mutex);
+	while (true) {
+		while (!pool->m_stopping && pool->m_next_index >= pool->m_count)
+			pthread_cond_wait(&pool->m_job_available, &pool->m_mutex);
+		if (pool->m_stopping)
+			break;
+		pool->run_iterations();
+	}
+	pthread_mutex_unlock(&pool->m_mutex);
+	return NULL;
+}
+
+void ThreadPool::run_iterations() {
+	while (m_next_index < m_count) {
+		unsigned index = m_next_index ++;
+		pthread_mutex_unlock(&m_mutex);
+
+		const char* error = NULL;
+		string error_message;
+		try {
+			mp_func(index, m_context);
+		} catch (const exception& e) {
+			error_message = e.what();
+			error = error_message.c_str();
+		} catch (...) {
+			error = "Unknown exception.";
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		if (error != NULL && !m_has_error) {
+			m_has_error = true;
+			m_error = error;
+		}
+		if (++ m_finished == m_count)
+			pthread_cond_broadcast(&m_job_finished);
+	}
+}
+#endif
+
+void ThreadPool::parallel_for(unsigned count, void(*p_func)(unsigned index, void* context), void* context) {
+#if _MSC_VER
+	for (unsigned i = 0; i < count; ++ i)
+		p_func(i, context);
+#else
+	if (count == 0)
+		return;
+
+	pthread_mutex_lock(&m_mutex);
+	mp_func = p_func;
+	m_context = context;
+	m_finished = 0;
+	m_next_index = 0;
+	m_count = count;
+	m_has_error = false;
+	if (!ma_workers.empty())
+		pthread_cond_broadcast(&m_job_available);
+
+	run_iterations();
+	while (m_finished < m_count)
+		pthread_cond_wait(&m_job_finished, &m_mutex);
+
+	m_count = 0;
+	m_next_index = 0;
+	bool has_error = m_has_error;
+	string error;
+	error.swap(m_error);
+	pthread_mutex_unlock(&m_mutex);
+
+	if (has_error)
+		throw TRException("%s", error.c_str());
+#endif
+}
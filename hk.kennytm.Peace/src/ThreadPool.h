@@ -0,0 +1,76 @@
+/*
+
+ThreadPool.h ... Fixed-size pool of worker threads.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <string>
+#include <vector>
+#if !_MSC_VER
+#include <pthread.h>
+#endif
+
+// The workers are started once and sleep between jobs. A job is a loop over
+// [0, count) whose iterations are handed out one at a time, so the calling
+// thread also takes part and a pool of 1 thread runs everything inline.
+// Without pthreads (MSVC), every job runs serially.
+class ThreadPool {
+private:
+	void (*mp_func)(unsigned index, void* context);
+	void* m_context;
+	unsigned m_count, m_next_index, m_finished;
+	unsigned m_thread_count;
+	bool m_stopping;
+
+	// the message of the first exception thrown by the current job.
+	bool m_has_error;
+	std::string m_error;
+
+#if !_MSC_VER
+	std::vector<pthread_t> ma_workers;
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_job_available, m_job_finished;
+
+	static void* worker_main(void* self);
+	// run iterations of the current job until none is left. m_mutex must be
+	// locked, and is locked again on return.
+	void run_iterations();
+#endif
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator= (const ThreadPool&);
+
+public:
+	// 0 threads means one per online processor.
+	explicit ThreadPool(unsigned thread_count = 0);
+	~ThreadPool() throw();
+
+	inline unsigned thread_count() const throw() { return m_thread_count; }
+	static unsigned processor_count() throw();
+
+	// call p_func(i, context) for every i in [0, count), in no particular order,
+	// and return when all calls have returned. If any call throws, the message
+	// of the first exception is rethrown as a TRException after the rest of the
+	// job has finished. Must not be called from inside a job.
+	void parallel_for(unsigned count, void(*p_func)(unsigned index, void* context), void* context);
+};
+
+#endif
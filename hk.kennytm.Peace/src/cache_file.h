@@ -0,0 +1,81 @@
+/*
+
+cache_file.h ... Building blocks of the mappable cache files.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <tr1/unordered_map>
+
+// A cache file is a header followed by tables of fixed-size records and a
+// pool of strings. Records refer to strings by their offset in the pool.
+
+static const unsigned NullStringOffset = ~0u;
+
+// FNV-1a, 64-bit.
+static inline unsigned long long fnv1a_64(const void* data, std::size_t length, unsigned long long h = 14695981039346656037ULL) throw() {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (std::size_t i = 0; i < length; ++ i)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+// deduplicated pool of NUL-terminated strings. The strings must outlive the
+// pool.
+class CacheStringPool {
+private:
+	struct Hash {
+		inline std::size_t operator() (const char* s) const throw() { return static_cast<std::size_t>(fnv1a_64(s, std::strlen(s))); }
+	};
+	struct Equal {
+		inline bool operator() (const char* a, const char* b) const throw() { return std::strcmp(a, b) == 0; }
+	};
+	std::tr1::unordered_map<const char*, unsigned, Hash, Equal> ma_offsets;
+
+public:
+	std::string pool;
+
+	unsigned offset_of(const char* s) {
+		if (s == NULL)
+			return NullStringOffset;
+		std::tr1::unordered_map<const char*, unsigned, Hash, Equal>::const_iterator cit = ma_offsets.find(s);
+		if (cit != ma_offsets.end())
+			return cit->second;
+		unsigned offset = static_cast<unsigned>(pool.size());
+		pool.append(s, std::strlen(s) + 1);
+		ma_offsets.insert(std::pair<const char*, unsigned>(s, offset));
+		return offset;
+	}
+};
+
+// append a table to out, and record where it is.
+template<typename T>
+static inline void append_cache_table(std::string& out, const std::vector<T>& records, unsigned& offset, unsigned& count) {
+	offset = static_cast<unsigned>(out.size());
+	count = static_cast<unsigned>(records.size());
+	if (!records.empty())
+		out.append(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(T));
+}
+
+#endif
@@ -96,3 +96,24 @@ int get_arch_from_flag(const char *name, struct arch_flag *arch_flag) {
 	}
 	return(0);
 }
+
+/*
+ * Returns the name of the architecture with the given cputype and cpusubtype,
+ * or the family name if the subtype is unknown. Returns NULL if the cputype is
+ * unknown.
+ */
+const char* get_arch_name_from_types(cpu_type_t cputype, cpu_subtype_t cpusubtype) {
+	unsigned long i;
+	const char* family = NULL;
+	
+	cpusubtype &= (cpu_subtype_t)~CPU_SUBTYPE_MASK;
+	for(i = 0; arch_flags[i].name != NULL; i++){
+	    if(arch_flags[i].cputype == cputype){
+			if(arch_flags[i].cpusubtype == cpusubtype)
+				return(arch_flags[i].name);
+			if(family == NULL)
+				family = arch_flags[i].name;
+	    }
+	}
+	return(family);
+}
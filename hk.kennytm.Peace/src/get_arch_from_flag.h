@@ -287,6 +287,7 @@ extern "C" {
 	};
 
 	int get_arch_from_flag(const char *name, struct arch_flag *arch_flag);
+	const char* get_arch_name_from_types(cpu_type_t cputype, cpu_subtype_t cpusubtype);
 	
 #if __cplusplus
 }
@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "MachO_File.h"
+#include "ThreadPool.h"
 #include <cstdio>
 #include <cstring>
 
@@ -48,20 +49,68 @@ static void g(unsigned addr, const char* symbol, MachO_File::StringType type, vo
 	printf("%08x %c %s%s%s\n", addr, tns[type], lefts[type], symbol, rights[type]);
 }
 
+static const char* const bind_kinds[] = {"bind", "weak", "lazy"};
+static const char* const bind_types[] = {"?", "pointer", "text abs32", "text rel32"};
+
+static void print_bindings(const MachO_File& f) {
+	const std::vector<MachO_File::BindRecord>& bindings = f.bindings();
+	printf("address  kind type        addend dylib                symbol\n");
+	for (std::vector<MachO_File::BindRecord>::const_iterator cit = bindings.begin(); cit != bindings.end(); ++ cit) {
+		const char* dylib;
+		switch (cit->library_ordinal) {
+			case BIND_SPECIAL_DYLIB_SELF: dylib = "this-image"; break;
+			case BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE: dylib = "main-executable"; break;
+			case BIND_SPECIAL_DYLIB_FLAT_LOOKUP: dylib = "flat-namespace"; break;
+			default:
+				dylib = f.library_with_ordinal(cit->library_ordinal);
+				if (dylib == NULL)
+					dylib = "?";
+				else if (std::strrchr(dylib, '/') != NULL)
+					dylib = std::strrchr(dylib, '/') + 1;
+				break;
+		}
+		printf("%08x %-4s %-11s %6d %-20s %s%s\n", cit->address, bind_kinds[cit->kind], cit->type < 4 ? bind_types[cit->type] : "?", cit->addend, dylib, cit->symbol, (cit->symbol_flags & BIND_SYMBOL_FLAGS_WEAK_IMPORT) ? " (weak import)" : "");
+	}
+}
+
+struct SliceAnalysis {
+	std::vector<MachO_File*> files;
+	unsigned facets;
+};
+
+static void analyze_slice(unsigned index, void* context) {
+	SliceAnalysis* analysis = static_cast<SliceAnalysis*>(context);
+	analysis->files[index]->analyze(analysis->facets);
+}
+
 int main (int argc, const char* argv[]) {
 	if (argc == 1) {
-		std::printf("Usage: list_symbols [-arch <arch>] <file>\n");
+		std::printf("Usage: list_symbols [-arch <arch>[,<arch>...] | -arch all] [-s | -b] [-cache <dir> [-rebuild-cache]] <file>\n\t-s\tList symbols only, without CFStrings and Objective-C references.\n\t-b\tList the dyld bind information instead.\n\t-cache\tReuse the analysis of earlier runs, stored in <dir>.\n\t-rebuild-cache\tAnalyze again and overwrite the stored analysis.\n");
 	} else {
-		const char* filename = NULL, *arch = "any";
-		bool read_arch = false;
+		const char* filename = NULL, *arch = "any", *cache_directory = NULL;
+		bool read_arch = false, read_cache_directory = false;
+		MachO_File::CacheMode cache_mode = MachO_File::CM_Use;
+		unsigned facets = MachO_File::AF_All;
+		bool list_bindings = false;
 		
 		for (int i = 1; i < argc; ++ i) {
 			if (std::strcmp(argv[i], "-arch") == 0) {
 				read_arch = true;
+			} else if (std::strcmp(argv[i], "-s") == 0) {
+				facets = MachO_File::AF_Symbols;
+			} else if (std::strcmp(argv[i], "-b") == 0) {
+				list_bindings = true;
+			} else if (std::strcmp(argv[i], "-cache") == 0) {
+				read_cache_directory = true;
+			} else if (std::strcmp(argv[i], "-rebuild-cache") == 0) {
+				cache_mode = MachO_File::CM_Rebuild;
 			} else {
 				if (read_arch) {
 					arch = argv[i];
 					read_arch = false;
+				} else if (read_cache_directory) {
+					cache_directory = argv[i];
+					read_cache_directory = false;
 				} else {
 					filename = argv[i];
 				}
@@ -69,8 +118,43 @@ int main (int argc, const char* argv[]) {
 		}
 		
 		if (filename) {
-			MachO_File f (filename, arch);
-			f.for_each_symbol(g, &f);
+			if (std::strcmp(arch, "all") != 0 && std::strchr(arch, ',') == NULL) {
+				MachO_File f (filename, arch);
+				f.set_symbol_cache(cache_directory, cache_mode);
+				f.analyze(list_bindings ? static_cast<unsigned>(MachO_File::AF_Symbols) : facets);
+				if (list_bindings)
+					print_bindings(f);
+				else
+					f.for_each_symbol(g, &f, facets);
+			} else {
+				// map the file once, analyze the slices concurrently, then print
+				// them in the requested order.
+				DataFile file (filename);
+				std::vector<MachO_File::Slice> slices = MachO_File::select_slices(file, arch);
+				
+				SliceAnalysis analysis;
+				analysis.facets = list_bindings ? static_cast<unsigned>(MachO_File::AF_Symbols) : facets;
+				for (std::vector<MachO_File::Slice>::const_iterator cit = slices.begin(); cit != slices.end(); ++ cit) {
+					analysis.files.push_back(new MachO_File(file, *cit));
+					analysis.files.back()->set_symbol_cache(cache_directory, cache_mode);
+				}
+				
+				ThreadPool pool;
+				pool.parallel_for(static_cast<unsigned>(analysis.files.size()), analyze_slice, &analysis);
+				
+				for (unsigned i = 0; i < slices.size(); ++ i) {
+					MachO_File& f = *analysis.files[i];
+					if (slices[i].arch != NULL)
+						printf("\n%s (for architecture %s):\n", filename, slices[i].arch);
+					else
+						printf("\n%s (for cputype %d cpusubtype %d):\n", filename, slices[i].cputype, slices[i].cpusubtype);
+					if (list_bindings)
+						print_bindings(f);
+					else
+						f.for_each_symbol(g, &f, facets);
+					delete analysis.files[i];
+				}
+			}
 		}
 	}
-}
\ No newline at end of file
+}
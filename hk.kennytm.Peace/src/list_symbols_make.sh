@@ -1,3 +1,3 @@
 #!/bin/sh
 
-g++ -m32 -O2 list_symbols.cpp get_arch_from_flag.c MachO_File.cpp DataFile.cpp -I../include -I/opt/local/include -o list_symbols
+g++ -m32 -O2 list_symbols.cpp get_arch_from_flag.c MachO_File.cpp MachO_File_cache.cpp LibraryResolver.cpp MachO_Header_View.cpp SharedCache_File.cpp StringArena.cpp ThreadPool.cpp DataFile.cpp -lpthread -I../include -I/opt/local/include -o list_symbols
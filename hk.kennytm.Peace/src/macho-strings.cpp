@@ -0,0 +1,377 @@
+/*
+
+macho-strings.cpp ... Dump the strings of Mach-O files, tagged by section.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// One line per string: [<file>\t]<section>\t<string>, with \t, \n, \\ and
+// non-ASCII bytes escaped. Each file is mapped once, its sections are cut into
+// chunks which are scanned in parallel, and the strings are then deduplicated
+// and written in file order. Strings are never copied out of the mapping.
+
+#include "MachO_File.h"
+#include "ThreadPool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+enum StringTag {
+	ST_CString,
+	ST_CFString,
+	ST_Selector,
+	ST_Text
+};
+static const char* const tag_names[] = {"cstring", "cfstring", "selector", "text"};
+
+static const off_t RawChunkSize = 256 * 1024;
+static const unsigned PointerChunkSize = 16384;
+
+struct FoundString {
+	const char* string;
+	unsigned length;
+	unsigned tag;
+};
+
+// the strings which start in [begin, end) of the section [section_begin, limit).
+struct Chunk {
+	const MachO_File_Simple* file;
+	unsigned tag;
+	off_t section_begin, begin, end, limit;
+	vector<FoundString> strings;
+};
+
+struct ScanJob {
+	vector<Chunk> chunks;
+	unsigned min_text_length;
+};
+
+#pragma mark -
+#pragma mark Scanning
+
+static void scan_cstrings(Chunk& chunk) {
+	const char* data = chunk.file->data();
+	const char* p = data + chunk.begin, *end = data + chunk.end, *limit = data + chunk.limit;
+
+	// a string running into this chunk belongs to the previous one.
+	if (chunk.begin > chunk.section_begin && p[-1] != '\0') {
+		p = static_cast<const char*>(memchr(p, '\0', static_cast<size_t>(limit - p)));
+		if (p == NULL)
+			return;
+		++ p;
+	}
+
+	while (p < end) {
+		const char* nul = static_cast<const char*>(memchr(p, '\0', static_cast<size_t>(limit - p)));
+		const char* string_end = nul != NULL ? nul : limit;
+		if (string_end > p) {
+			FoundString found = {p, static_cast<unsigned>(string_end - p), chunk.tag};
+			chunk.strings.push_back(found);
+		}
+		p = string_end + 1;
+	}
+}
+
+// printable runs, like strings(1).
+static void scan_text(Chunk& chunk, unsigned min_length) {
+	DataFile cursor (*chunk.file, DataFile::borrow_mapping);
+	cursor.seek(chunk.begin);
+
+	// skip a run which started in the previous chunk.
+	if (chunk.begin > chunk.section_begin) {
+		cursor.seek(chunk.begin - 1);
+		if (cursor.read_ASCII_string() == NULL)
+			cursor.seek(chunk.begin);
+	}
+
+	while (cursor.tell() < chunk.end) {
+		off_t start = cursor.tell();
+		size_t length;
+		const char* run = cursor.read_ASCII_string(&length);
+		if (run == NULL) {
+			cursor.advance(1);
+			continue;
+		}
+		if (start + static_cast<off_t>(length) > chunk.limit)
+			length = static_cast<size_t>(chunk.limit - start);
+		if (length >= min_length) {
+			FoundString found = {run, static_cast<unsigned>(length), chunk.tag};
+			chunk.strings.push_back(found);
+		}
+	}
+}
+
+// __cfstring and __objc_selrefs point to the strings.
+static void scan_pointers(Chunk& chunk) {
+	// CFString: {isa, flags, string, length}.
+	off_t element_size = chunk.tag == ST_CFString ? 16 : 4;
+	off_t pointer_offset = chunk.tag == ST_CFString ? 8 : 0;
+	int hint = 0;
+
+	for (off_t offset = chunk.begin; offset + element_size <= chunk.end; offset += element_size) {
+		const unsigned* p_pointer = chunk.file->peek_data_at<unsigned>(offset + pointer_offset);
+		if (p_pointer == NULL)
+			break;
+		off_t string_offset = chunk.file->to_file_offset(*p_pointer, &hint);
+		if (string_offset == 0)
+			continue;
+		size_t length;
+		const char* string = chunk.file->peek_ASCII_Cstring_at(string_offset, &length);
+		if (string != NULL && length > 0) {
+			FoundString found = {string, static_cast<unsigned>(length), chunk.tag};
+			chunk.strings.push_back(found);
+		}
+	}
+}
+
+static void scan_chunk(unsigned index, void* context) {
+	ScanJob* job = static_cast<ScanJob*>(context);
+	Chunk& chunk = job->chunks[index];
+	switch (chunk.tag) {
+		case ST_CString: scan_cstrings(chunk); break;
+		case ST_Text: scan_text(chunk, job->min_text_length); break;
+		default: scan_pointers(chunk); break;
+	}
+}
+
+// cut [begin, begin+size) of the file into chunks. Pointer sections are cut at
+// element boundaries.
+static void add_chunks(ScanJob& job, const MachO_File_Simple* file, unsigned tag, off_t begin, off_t size) {
+	if (size <= 0 || begin < 0 || begin + size > file->filesize())
+		return;
+	off_t step = tag == ST_CFString ? 16 * PointerChunkSize : tag == ST_Selector ? 4 * PointerChunkSize : RawChunkSize;
+	for (off_t offset = 0; offset < size; offset += step) {
+		Chunk chunk;
+		chunk.file = file;
+		chunk.tag = tag;
+		chunk.section_begin = begin;
+		chunk.begin = begin + offset;
+		chunk.end = begin + (offset + step < size ? offset + step : size);
+		chunk.limit = begin + size;
+		job.chunks.push_back(chunk);
+	}
+}
+
+static void add_section(ScanJob& job, const MachO_File_Simple* file, unsigned tag, const char* segment_name, const char* section_name) {
+	const section* s = file->section_having_name(segment_name, section_name);
+	if (s == NULL || (s->flags & SECTION_TYPE) == S_ZEROFILL)
+		return;
+	off_t offset = file->to_file_offset(s->addr);
+	if (offset != 0)
+		add_chunks(job, file, tag, offset, s->size);
+}
+
+#pragma mark -
+#pragma mark Output
+
+// collects the output and writes it with few fwrite calls.
+class BufferedWriter {
+private:
+	vector<char> ma_buffer;
+	size_t m_used;
+	FILE* m_stream;
+
+	BufferedWriter(const BufferedWriter&);
+	BufferedWriter& operator= (const BufferedWriter&);
+
+public:
+	BufferedWriter(FILE* stream, size_t capacity = 1 << 20) : ma_buffer(capacity), m_used(0), m_stream(stream) {}
+	~BufferedWriter() throw() { flush(); }
+
+	void flush() throw() {
+		if (m_used > 0)
+			fwrite(&ma_buffer[0], 1, m_used, m_stream);
+		m_used = 0;
+	}
+
+	inline void write(const char* s, size_t length) {
+		if (m_used + length > ma_buffer.size()) {
+			flush();
+			if (length > ma_buffer.size()) {
+				fwrite(s, 1, length, m_stream);
+				return;
+			}
+		}
+		memcpy(&ma_buffer[m_used], s, length);
+		m_used += length;
+	}
+	inline void put(char c) {
+		if (m_used == ma_buffer.size())
+			flush();
+		ma_buffer[m_used++] = c;
+	}
+
+	void write_escaped(const char* s, size_t length) {
+		const char* end = s + length;
+		while (s < end) {
+			// copy the plain characters in one go.
+			const char* plain_end = s;
+			while (plain_end < end && *plain_end >= ' ' && *plain_end <= '~' && *plain_end != '\\')
+				++ plain_end;
+			write(s, static_cast<size_t>(plain_end - s));
+			if (plain_end == end)
+				break;
+
+			char escaped[5];
+			switch (*plain_end) {
+				case '\t': write("\\t", 2); break;
+				case '\n': write("\\n", 2); break;
+				case '\r': write("\\r", 2); break;
+				case '\\': write("\\\\", 2); break;
+				default:
+					sprintf(escaped, "\\x%02x", static_cast<unsigned char>(*plain_end));
+					write(escaped, 4);
+					break;
+			}
+			s = plain_end + 1;
+		}
+	}
+};
+
+// an open-addressing set of (tag, string) pairs, sized for all strings at once.
+class StringSet {
+private:
+	vector<FoundString> ma_slots;
+	size_t m_mask;
+
+	static size_t hash(const FoundString& s) throw() {
+		size_t h = 2166136261u ^ s.tag;
+		for (unsigned i = 0; i < s.length; ++ i)
+			h = (h ^ static_cast<unsigned char>(s.string[i])) * 16777619u;
+		return h;
+	}
+
+public:
+	explicit StringSet(size_t count) {
+		size_t capacity = 16;
+		while (capacity < 2 * count)
+			capacity *= 2;
+		FoundString empty = {NULL, 0, 0};
+		ma_slots.assign(capacity, empty);
+		m_mask = capacity - 1;
+	}
+
+	// returns whether s was not in the set.
+	bool insert(const FoundString& s) throw() {
+		for (size_t i = hash(s) & m_mask; ; i = (i + 1) & m_mask) {
+			FoundString& slot = ma_slots[i];
+			if (slot.string == NULL) {
+				slot = s;
+				return true;
+			}
+			if (slot.tag == s.tag && slot.length == s.length && memcmp(slot.string, s.string, s.length) == 0)
+				return false;
+		}
+	}
+};
+
+#pragma mark -
+
+static void dump_file(const char* filename, const char* arch, bool scan_raw_text, unsigned min_text_length, bool print_filename, ThreadPool& pool, BufferedWriter& writer) {
+	DataFile file (filename);
+	vector<MachO_File::Slice> slices = MachO_File::select_slices(file, arch);
+
+	vector<MachO_File_Simple*> slice_files;
+	ScanJob job;
+	job.min_text_length = min_text_length;
+	for (vector<MachO_File::Slice>::const_iterator cit = slices.begin(); cit != slices.end(); ++ cit) {
+		MachO_File_Simple* f = new MachO_File_Simple(file, *cit);
+		slice_files.push_back(f);
+		if (!f->valid()) {
+			fprintf(stderr, "Warning: %s is not a valid Mach-O file. Ignoring it.\n", filename);
+			continue;
+		}
+		add_section(job, f, ST_CString, "__TEXT", "__cstring");
+		add_section(job, f, ST_CFString, "__DATA", "__cfstring");
+		add_section(job, f, ST_Selector, "__DATA", "__objc_selrefs");
+		add_section(job, f, ST_Selector, "__OBJC", "__message_refs");
+		if (scan_raw_text) {
+			const segment_command* text_segment = f->segment_having_name("__TEXT");
+			if (text_segment != NULL)
+				add_chunks(job, f, ST_Text, f->origin() + static_cast<off_t>(text_segment->fileoff), text_segment->filesize);
+		}
+	}
+
+	pool.parallel_for(static_cast<unsigned>(job.chunks.size()), scan_chunk, &job);
+
+	size_t total = 0;
+	for (vector<Chunk>::const_iterator cit = job.chunks.begin(); cit != job.chunks.end(); ++ cit)
+		total += cit->strings.size();
+
+	StringSet seen (total);
+	size_t filename_length = strlen(filename);
+	for (vector<Chunk>::const_iterator cit = job.chunks.begin(); cit != job.chunks.end(); ++ cit) {
+		for (vector<FoundString>::const_iterator sit = cit->strings.begin(); sit != cit->strings.end(); ++ sit) {
+			if (!seen.insert(*sit))
+				continue;
+			if (print_filename) {
+				writer.write(filename, filename_length);
+				writer.put('\t');
+			}
+			writer.write(tag_names[sit->tag], strlen(tag_names[sit->tag]));
+			writer.put('\t');
+			writer.write_escaped(sit->string, sit->length);
+			writer.put('\n');
+		}
+	}
+
+	for (vector<MachO_File_Simple*>::const_iterator cit = slice_files.begin(); cit != slice_files.end(); ++ cit)
+		delete *cit;
+}
+
+int main (int argc, const char* argv[]) {
+	const char* arch = "any";
+	bool scan_raw_text = false;
+	unsigned min_text_length = 4, threads = 0;
+	vector<const char*> filenames;
+
+	for (int i = 1; i < argc; ++ i) {
+		if (strcmp(argv[i], "-arch") == 0 && i+1 < argc)
+			arch = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0)
+			scan_raw_text = true;
+		else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			min_text_length = static_cast<unsigned>(strtoul(argv[++i], NULL, 0));
+		else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+			threads = static_cast<unsigned>(strtoul(argv[++i], NULL, 0));
+		else
+			filenames.push_back(argv[i]);
+	}
+
+	if (filenames.empty()) {
+		printf("Usage: macho-strings [-arch <arch>[,<arch>...] | -arch all] [-t [-n <length>]] [-j <threads>] <file>...\n\t-t\tAlso list the printable runs in the whole __TEXT segment.\n\t-n\tThe shortest run listed by -t (default 4).\n\t-j\tThe number of threads (default: one per processor).\n");
+		return 0;
+	}
+
+	int retval = 0;
+	ThreadPool pool (threads);
+	BufferedWriter writer (stdout);
+	for (vector<const char*>::const_iterator cit = filenames.begin(); cit != filenames.end(); ++ cit) {
+		try {
+			dump_file(*cit, arch, scan_raw_text, min_text_length, filenames.size() > 1, pool, writer);
+		} catch (const TRException& e) {
+			writer.flush();
+			fprintf(stderr, "%s\n", e.what());
+			retval = 1;
+		}
+	}
+
+	return retval;
+}
@@ -0,0 +1,710 @@
+/*
+
+macho_bench.cpp ... Micro-benchmarks for MachO_File lookups.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MachO_File.h"
+#include "ThreadPool.h"
+#include "SharedCache_File.h"
+#include "LibraryResolver.h"
+#include "wall_clock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sys/resource.h>
+
+using namespace std;
+
+static void report(const char* name, size_t count, double seconds) {
+	printf("%-28s %10lu lookups in %8.3f ms, %14.0f lookups/s\n", name, static_cast<unsigned long>(count), seconds * 1000, seconds > 0 ? static_cast<double>(count) / seconds : 0.);
+}
+
+#pragma mark -
+#pragma mark Address translation
+
+static vector<const section*> g_sections;
+static void collect_section(const section* s) { g_sections.push_back(s); }
+
+// the linear scan MachO_File_Simple used before the address index.
+static off_t linear_to_file_offset(unsigned vm_address) {
+	for (vector<const section*>::const_iterator cit = g_sections.begin(); cit != g_sections.end(); ++ cit) {
+		const section* s = *cit;
+		if (s->addr <= vm_address && s->addr + s->size > vm_address)
+			return vm_address - s->addr + s->offset;
+	}
+	return 0;
+}
+
+static bool bench_address_translation(const MachO_File& f, size_t count) {
+	f.for_each_section(collect_section);
+	if (g_sections.empty()) {
+		printf("address translation: no sections.\n");
+		return true;
+	}
+
+	// 15 in 16 addresses are inside some section, the rest are misses.
+	vector<unsigned> addresses;
+	addresses.reserve(count);
+	srand(1);
+	for (size_t i = 0; i < count; ++ i) {
+		const section* s = g_sections[rand() % g_sections.size()];
+		if (i % 16 == 15 || s->size == 0)
+			addresses.push_back(static_cast<unsigned>(rand()));
+		else
+			addresses.push_back(s->addr + static_cast<unsigned>(rand()) % s->size);
+	}
+	vector<unsigned> sorted_addresses (addresses);
+	sort(sorted_addresses.begin(), sorted_addresses.end());
+
+	// verify the index agrees with the linear scan before timing anything.
+	bool ok = true;
+	off_t origin = -1;
+	for (vector<unsigned>::const_iterator cit = addresses.begin(); cit != addresses.end() && ok; ++ cit) {
+		off_t expected = linear_to_file_offset(*cit), actual = f.to_file_offset(*cit);
+		if (expected == 0 || actual == 0)
+			ok = (expected == 0) == (actual == 0);
+		else if (origin == -1)
+			origin = actual - expected;
+		else
+			ok = (actual - expected == origin);
+		if (!ok)
+			printf("address translation: mismatch at 0x%08x (linear 0x%llx, index 0x%llx).\n", *cit, static_cast<unsigned long long>(expected), static_cast<unsigned long long>(actual));
+	}
+
+	off_t checksum = 0;
+	double t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = addresses.begin(); cit != addresses.end(); ++ cit)
+		checksum += linear_to_file_offset(*cit);
+	report("linear scan, random", count, wall_clock() - t);
+
+	t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = addresses.begin(); cit != addresses.end(); ++ cit)
+		checksum += f.to_file_offset(*cit);
+	report("index, random", count, wall_clock() - t);
+
+	int hint = 0;
+	t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = sorted_addresses.begin(); cit != sorted_addresses.end(); ++ cit)
+		checksum += f.to_file_offset(*cit, &hint);
+	report("index + hint, sequential", count, wall_clock() - t);
+
+	t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = sorted_addresses.begin(); cit != sorted_addresses.end(); ++ cit)
+		checksum += linear_to_file_offset(*cit);
+	report("linear scan, sequential", count, wall_clock() - t);
+
+	printf("(checksum %llx)\n", static_cast<unsigned long long>(checksum));
+	return ok;
+}
+
+#pragma mark -
+#pragma mark Symbol lookup
+
+static vector<unsigned> g_symbol_addresses;
+static vector<const char*> g_symbol_names;
+static void collect_symbol(unsigned addr, const char* symbol, MachO_File::StringType type, void*) {
+	if (type == MachO_File::MOST_Symbol) {
+		g_symbol_addresses.push_back(addr);
+		g_symbol_names.push_back(symbol);
+	}
+}
+
+// the full scan nearest_string_representation used before the symbol index.
+static unsigned linear_nearest_symbol(unsigned vm_address) {
+	unsigned best = 0;
+	bool first = true;
+	for (vector<unsigned>::const_iterator cit = g_symbol_addresses.begin(); cit != g_symbol_addresses.end(); ++ cit)
+		if (*cit > vm_address && (first || *cit < best)) {
+			best = *cit;
+			first = false;
+		}
+	return best;
+}
+
+static bool bench_symbol_lookup(const MachO_File& f, size_t count) {
+	f.for_each_symbol(collect_symbol, NULL);
+	if (g_symbol_addresses.empty()) {
+		printf("symbol lookup: no symbols.\n");
+		return true;
+	}
+	// the linear scan is O(n) per query, so it only gets a sample.
+	size_t linear_count = count / g_symbol_addresses.size() + 1;
+	if (linear_count > count)
+		linear_count = count;
+
+	vector<unsigned> addresses;
+	addresses.reserve(count);
+	srand(2);
+	for (size_t i = 0; i < count; ++ i)
+		addresses.push_back(g_symbol_addresses[rand() % g_symbol_addresses.size()] + (i % 4 == 0 ? 0 : rand() % 64));
+
+	bool ok = true;
+	for (size_t i = 0; i < linear_count && ok; ++ i) {
+		unsigned offset = 0;
+		const char* nearest = f.nearest_string_representation(addresses[i], &offset);
+		unsigned expected = linear_nearest_symbol(addresses[i]);
+		ok = (expected == 0 && (nearest == NULL || offset == 0)) || (nearest != NULL && addresses[i] + offset == expected);
+		if (!ok)
+			printf("symbol lookup: nearest symbol mismatch at 0x%08x.\n", addresses[i]);
+	}
+
+	unsigned checksum = 0;
+	double t = wall_clock();
+	for (size_t i = 0; i < linear_count; ++ i)
+		checksum += linear_nearest_symbol(addresses[i]);
+	report("nearest symbol, full scan", linear_count, wall_clock() - t);
+
+	t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = addresses.begin(); cit != addresses.end(); ++ cit) {
+		unsigned offset = 0;
+		f.nearest_string_representation(*cit, &offset);
+		checksum += offset;
+	}
+	report("nearest symbol, index", count, wall_clock() - t);
+
+	t = wall_clock();
+	for (vector<unsigned>::const_iterator cit = addresses.begin(); cit != addresses.end(); ++ cit)
+		checksum += f.string_representation(*cit) != NULL;
+	report("string_representation", count, wall_clock() - t);
+
+	printf("(checksum %x)\n", checksum);
+	return ok;
+}
+
+// the strcmp scan address_of_symbol used before the name index.
+static unsigned linear_address_of_symbol(const char* sym) {
+	unsigned lowest = 0;
+	for (size_t i = 0; i < g_symbol_names.size(); ++ i)
+		if (strcmp(sym, g_symbol_names[i]) == 0 && (lowest == 0 || g_symbol_addresses[i] < lowest))
+			lowest = g_symbol_addresses[i];
+	return lowest;
+}
+
+static bool bench_symbol_names(MachO_File& f, size_t count) {
+	if (g_symbol_names.empty())
+		return true;
+	size_t linear_count = count / g_symbol_names.size() + 1;
+	if (linear_count > count)
+		linear_count = count;
+
+	// copy the names so that the lookups cannot compare pointers only.
+	vector<string> name_store;
+	name_store.reserve(count);
+	vector<const char*> names;
+	names.reserve(count);
+	srand(3);
+	for (size_t i = 0; i < count; ++ i) {
+		name_store.push_back(g_symbol_names[rand() % g_symbol_names.size()]);
+		if (i % 8 == 7)
+			name_store.back() += "$missing";
+		names.push_back(name_store.back().c_str());
+	}
+
+	unsigned checksum = 0;
+	double t = wall_clock();
+	for (size_t i = 0; i < linear_count; ++ i)
+		checksum += linear_address_of_symbol(names[i]);
+	report("symbol name, strcmp scan", linear_count, wall_clock() - t);
+
+	t = wall_clock();
+	f.analyze(MachO_File::AF_SymbolNames);
+	report("symbol name, index build", 1, wall_clock() - t);
+
+	t = wall_clock();
+	for (vector<const char*>::const_iterator cit = names.begin(); cit != names.end(); ++ cit)
+		checksum += f.address_of_symbol(*cit);
+	report("symbol name, index", count, wall_clock() - t);
+
+	t = wall_clock();
+	vector<unsigned> batch = f.addresses_of_symbols(names);
+	report("symbol name, batch", count, wall_clock() - t);
+
+	bool ok = true;
+	for (size_t i = 0; i < linear_count && ok; ++ i) {
+		ok = (batch[i] == linear_address_of_symbol(names[i]));
+		if (!ok)
+			printf("symbol name: mismatch for %s.\n", names[i]);
+	}
+
+	printf("(checksum %x)\n", checksum);
+	return ok;
+}
+
+#pragma mark -
+#pragma mark Export trie
+
+static void count_export(const char* name, unsigned, unsigned address, void* context) {
+	unsigned* counts = reinterpret_cast<unsigned*>(context);
+	++ counts[0];
+	counts[1] += address + static_cast<unsigned>(strlen(name));
+}
+
+static bool bench_export_trie(const MachO_File& f, size_t count) {
+	unsigned counts[2] = {0, 0};
+	bool ok = f.for_each_export(count_export, counts);
+	if (!ok)
+		printf("export trie: malformed.\n");
+	if (counts[0] == 0) {
+		printf("export trie: no exports.\n");
+		return ok;
+	}
+
+	size_t rounds = count / counts[0] + 1;
+	double t = wall_clock();
+	for (size_t i = 0; i < rounds; ++ i)
+		f.for_each_export(count_export, counts);
+	report("export trie walk", rounds * (counts[0] / (rounds + 1)), wall_clock() - t);
+
+	printf("(%u exports, checksum %x)\n", counts[0] / static_cast<unsigned>(rounds + 1), counts[1]);
+	return ok;
+}
+
+#pragma mark -
+#pragma mark Fat binaries
+
+static void count_symbol(unsigned, const char*, MachO_File::StringType, void* context) {
+	++ *reinterpret_cast<unsigned*>(context);
+}
+
+struct SliceBench {
+	vector<MachO_File*> files;
+	vector<unsigned> symbol_counts;
+};
+
+static void analyze_bench_slice(unsigned index, void* context) {
+	SliceBench* bench = reinterpret_cast<SliceBench*>(context);
+	bench->files[index]->analyze(MachO_File::AF_All);
+	bench->files[index]->for_each_symbol(count_symbol, &bench->symbol_counts[index]);
+}
+
+// analyze every slice of a fat file with the given number of threads, sharing
+// one mapping. Returns the total number of symbols.
+static unsigned analyze_all_slices(const char* filename, unsigned threads, double* p_seconds) {
+	double t = wall_clock();
+	DataFile file (filename);
+	vector<MachO_File::Slice> slices = MachO_File::slices(file);
+	SliceBench bench;
+	for (vector<MachO_File::Slice>::const_iterator cit = slices.begin(); cit != slices.end(); ++ cit)
+		bench.files.push_back(new MachO_File(file, *cit));
+	bench.symbol_counts.resize(slices.size());
+	
+	ThreadPool pool (threads);
+	pool.parallel_for(static_cast<unsigned>(slices.size()), analyze_bench_slice, &bench);
+	
+	unsigned total = 0;
+	for (unsigned i = 0; i < slices.size(); ++ i) {
+		total += bench.symbol_counts[i];
+		delete bench.files[i];
+	}
+	*p_seconds = wall_clock() - t;
+	return total;
+}
+
+static int bench_fat_slices(const char* filename) {
+	vector<string> arch_names;
+	{
+		DataFile file (filename);
+		vector<MachO_File::Slice> slices = MachO_File::slices(file);
+		for (vector<MachO_File::Slice>::const_iterator cit = slices.begin(); cit != slices.end(); ++ cit) {
+			if (cit->arch == NULL) {
+				printf("fat slices: unknown cputype %d.\n", cit->cputype);
+				return 1;
+			}
+			arch_names.push_back(cit->arch);
+		}
+	}
+	
+	// what running the tool once per arch did: map and parse the file again
+	// for every slice.
+	double t = wall_clock();
+	unsigned reopen_total = 0;
+	for (vector<string>::const_iterator cit = arch_names.begin(); cit != arch_names.end(); ++ cit) {
+		MachO_File f (filename, cit->c_str());
+		f.analyze(MachO_File::AF_All);
+		f.for_each_symbol(count_symbol, &reopen_total);
+	}
+	double t_reopen = wall_clock() - t;
+	
+	double t_serial, t_parallel;
+	unsigned serial_total = analyze_all_slices(filename, 1, &t_serial);
+	unsigned threads = ThreadPool::processor_count();
+	unsigned parallel_total = analyze_all_slices(filename, threads, &t_parallel);
+	
+	printf("%lu slices: reopen per arch %.3f ms, shared mapping %.3f ms, %u threads %.3f ms\n", static_cast<unsigned long>(arch_names.size()), t_reopen * 1000, t_serial * 1000, threads, t_parallel * 1000);
+	if (reopen_total != serial_total || serial_total != parallel_total) {
+		printf("fat slices: mismatch (%u, %u, %u symbols).\n", reopen_total, serial_total, parallel_total);
+		return 1;
+	}
+	printf("(%u symbols)\n", parallel_total);
+	return 0;
+}
+
+#pragma mark -
+#pragma mark Shared cache
+
+static vector<const section*> g_image_sections;
+static void collect_image_section(const section* s) { g_image_sections.push_back(s); }
+
+// open every image of a shared cache in place and read its linked libraries.
+// With an extracted directory, also open the same images from there, which is
+// what reading the cache required before. "macho_file_test -shared-cache
+// <file> <images>" writes a synthetic cache to try this on.
+static int bench_shared_cache(const char* filename, const char* extracted_dir) {
+	double t = wall_clock();
+	SharedCache_File cache (filename);
+	double t_open = wall_clock() - t;
+	if (!cache.valid()) {
+		printf("shared cache: %s is not a dyld shared cache.\n", filename);
+		return 1;
+	}
+	
+	bool ok = true;
+	size_t links = 0;
+	t = wall_clock();
+	for (unsigned i = 0; i < cache.images().size(); ++ i) {
+		MachO_File_Simple image (cache, i);
+		links += image.linked_libraries("").size();
+	}
+	double t_images = wall_clock() - t;
+	
+	// every section must be found where the mapping table says it is.
+	for (unsigned i = 0; i < cache.images().size() && ok; ++ i) {
+		MachO_File_Simple image (cache, i);
+		g_image_sections.clear();
+		image.for_each_section(collect_image_section);
+		for (vector<const section*>::const_iterator cit = g_image_sections.begin(); cit != g_image_sections.end(); ++ cit) {
+			if ((*cit)->size != 0 && image.to_file_offset((*cit)->addr) != cache.to_file_offset((*cit)->addr)) {
+				printf("shared cache: section %.16s of %s is misplaced.\n", (*cit)->sectname, cache.images()[i].path);
+				ok = false;
+				break;
+			}
+		}
+	}
+	
+	printf("%lu images (%s): map %.3f ms, open all in place %.3f ms (%lu links)\n", static_cast<unsigned long>(cache.images().size()), cache.arch(), t_open * 1000, t_images * 1000, static_cast<unsigned long>(links));
+	
+	if (extracted_dir != NULL) {
+		size_t extracted_links = 0;
+		t = wall_clock();
+		for (vector<SharedCache_File::Image>::const_iterator cit = cache.images().begin(); cit != cache.images().end(); ++ cit) {
+			MachO_File_Simple image ((string(extracted_dir) + cit->path).c_str());
+			extracted_links += image.linked_libraries("").size();
+		}
+		printf("open all extracted %.3f ms (%lu links)\n", (wall_clock() - t) * 1000, static_cast<unsigned long>(extracted_links));
+		if (extracted_links != links) {
+			printf("shared cache: the extracted images differ.\n");
+			ok = false;
+		}
+	}
+	
+	return ok ? 0 : 1;
+}
+
+#pragma mark -
+#pragma mark Dependency closures
+
+// the closure of a root as linked_libraries_recursive() computed it before the
+// resolver: every library is mapped and parsed again for each root.
+static size_t reparse_closure_size(const string& root, const string& sysroot) {
+	vector<string> queue = MachO_File_Simple(root.c_str()).linked_libraries(sysroot);
+	tr1::unordered_set<string> seen (queue.begin(), queue.end());
+	while (!queue.empty()) {
+		string path = queue.back();
+		queue.pop_back();
+		vector<string> next_level = MachO_File_Simple(path.c_str()).linked_libraries(sysroot);
+		for (vector<string>::const_iterator cit = next_level.begin(); cit != next_level.end(); ++ cit)
+			if (seen.insert(*cit).second)
+				queue.push_back(*cit);
+	}
+	seen.erase(root);
+	return seen.size();
+}
+
+static size_t total_size(const vector<tr1::unordered_set<string> >& closures) {
+	size_t total = 0;
+	for (vector<tr1::unordered_set<string> >::const_iterator cit = closures.begin(); cit != closures.end(); ++ cit)
+		total += cit->size();
+	return total;
+}
+
+// the closures of every image of a shared cache, read from its extracted copy.
+static int bench_closures(const char* filename, const char* extracted_dir) {
+	SharedCache_File cache (filename);
+	if (!cache.valid()) {
+		printf("closures: %s is not a dyld shared cache.\n", filename);
+		return 1;
+	}
+	string sysroot (extracted_dir);
+	vector<string> roots;
+	for (vector<SharedCache_File::Image>::const_iterator cit = cache.images().begin(); cit != cache.images().end(); ++ cit)
+		roots.push_back(sysroot + cit->path);
+	
+	double t = wall_clock();
+	size_t reparse_total = 0;
+	for (vector<string>::const_iterator cit = roots.begin(); cit != roots.end(); ++ cit)
+		reparse_total += reparse_closure_size(*cit, sysroot);
+	double t_reparse = wall_clock() - t;
+	
+	t = wall_clock();
+	LibraryResolver serial_resolver (sysroot);
+	vector<tr1::unordered_set<string> > serial_closures;
+	serial_closures.reserve(roots.size());
+	for (vector<string>::const_iterator cit = roots.begin(); cit != roots.end(); ++ cit)
+		serial_closures.push_back(serial_resolver.closure(*cit));
+	double t_serial = wall_clock() - t;
+	
+	ThreadPool pool;
+	t = wall_clock();
+	LibraryResolver parallel_resolver (sysroot);
+	vector<tr1::unordered_set<string> > parallel_closures = parallel_resolver.closures(roots, pool);
+	double t_parallel = wall_clock() - t;
+	
+	printf("%lu roots, %lu libraries in all closures (%lu files read)\n", static_cast<unsigned long>(roots.size()), static_cast<unsigned long>(total_size(serial_closures)), static_cast<unsigned long>(serial_resolver.cached_count()));
+	printf("re-parse every visit    %10.3f ms\n", t_reparse * 1000);
+	printf("resolver, 1 thread      %10.3f ms\n", t_serial * 1000);
+	printf("resolver, %2u threads    %10.3f ms\n", pool.thread_count(), t_parallel * 1000);
+	
+	if (serial_closures != parallel_closures || total_size(serial_closures) != reparse_total) {
+		printf("closures: the results differ.\n");
+		return 1;
+	}
+	return 0;
+}
+
+#pragma mark -
+#pragma mark String scanning
+
+static double megabytes_per_second(double bytes, double seconds) {
+	return seconds > 0 ? bytes / seconds / 1048576 : 0.;
+}
+
+// the byte loops DataFile used before the SSE2 scanners. Not inlined, like
+// the DataFile methods they are compared with.
+__attribute__((noinline)) static size_t bytewise_ascii_run(const char* x, const char* end, bool accept_cr) {
+	const char* begin = x;
+	while (x < end && (*x == '\t' || *x == '\n' || (accept_cr && *x == '\r') || (*x >= ' ' && *x <= '~')))
+		++ x;
+	return static_cast<size_t>(x - begin);
+}
+
+__attribute__((noinline)) static const char* bytewise_search(const char* p, const char* end, const char* needle, size_t length) {
+	while (p + length <= end) {
+		const char* loc = reinterpret_cast<const char*>(memchr(p, needle[0], static_cast<size_t>(end - p) - length + 1));
+		if (loc == NULL)
+			return NULL;
+		if (memcmp(loc, needle, length) == 0)
+			return loc;
+		p = loc + 1;
+	}
+	return NULL;
+}
+
+// scan every printable run of the file with read_ASCII_string, test every run
+// as a C string with peek_ASCII_Cstring_at, and search for needles in the
+// whole file.
+static int bench_string_scanning(const char* filename, unsigned repeats) {
+	DataFile file (filename);
+	const char* begin = file.data(), *end = begin + file.filesize();
+	double total_bytes = static_cast<double>(file.filesize()) * repeats;
+	bool ok = true;
+	
+	// printable runs.
+	vector<off_t> run_starts;
+	size_t run_bytes = 0, reference_run_bytes = 0;
+	double t = wall_clock();
+	for (unsigned r = 0; r < repeats; ++ r) {
+		run_starts.clear();
+		run_bytes = 0;
+		file.rewind();
+		while (!file.is_eof()) {
+			size_t length;
+			off_t start = file.tell();
+			if (file.read_ASCII_string(&length) == NULL)
+				file.advance(1);
+			else {
+				run_starts.push_back(start);
+				run_bytes += length;
+			}
+		}
+	}
+	double t_runs = wall_clock() - t;
+	
+	t = wall_clock();
+	for (unsigned r = 0; r < repeats; ++ r) {
+		reference_run_bytes = 0;
+		for (const char* p = begin; p < end; ) {
+			size_t length = bytewise_ascii_run(p, end, true);
+			reference_run_bytes += length;
+			p += length != 0 ? length : 1;
+		}
+	}
+	double t_reference_runs = wall_clock() - t;
+	ok = (run_bytes == reference_run_bytes);
+	printf("%-28s %10.1f MB/s (byte loop %10.1f MB/s), %lu runs\n", "printable runs", megabytes_per_second(total_bytes, t_runs), megabytes_per_second(total_bytes, t_reference_runs), static_cast<unsigned long>(run_starts.size()));
+	
+	// C strings, starting at every run.
+	size_t cstring_bytes = 0, reference_cstring_bytes = 0, cstrings = 0, reference_cstrings = 0;
+	t = wall_clock();
+	for (unsigned r = 0; r < repeats; ++ r) {
+		cstring_bytes = cstrings = 0;
+		for (vector<off_t>::const_iterator cit = run_starts.begin(); cit != run_starts.end(); ++ cit) {
+			size_t length;
+			if (file.peek_ASCII_Cstring_at(*cit, &length) != NULL) {
+				cstring_bytes += length;
+				++ cstrings;
+			}
+		}
+	}
+	double t_cstrings = wall_clock() - t;
+	
+	t = wall_clock();
+	for (unsigned r = 0; r < repeats; ++ r) {
+		reference_cstring_bytes = reference_cstrings = 0;
+		for (vector<off_t>::const_iterator cit = run_starts.begin(); cit != run_starts.end(); ++ cit) {
+			size_t length = bytewise_ascii_run(begin + *cit, end, false);
+			if (begin + *cit + length < end && begin[*cit + static_cast<off_t>(length)] == '\0') {
+				reference_cstring_bytes += length;
+				++ reference_cstrings;
+			}
+		}
+	}
+	double t_reference_cstrings = wall_clock() - t;
+	if (cstring_bytes != reference_cstring_bytes || cstrings != reference_cstrings) {
+		printf("string scanning: C string mismatch (%lu vs %lu).\n", static_cast<unsigned long>(cstrings), static_cast<unsigned long>(reference_cstrings));
+		ok = false;
+	}
+	printf("%-28s %10.1f MB/s (byte loop %10.1f MB/s), %lu strings\n", "C strings", megabytes_per_second(static_cast<double>(run_bytes) * repeats, t_cstrings), megabytes_per_second(static_cast<double>(run_bytes) * repeats, t_reference_cstrings), static_cast<unsigned long>(cstrings));
+	
+	// a needle which is not in the file, and the last 12 bytes of the file.
+	const char absent[] = "\x01\x7fNoSuchNeedle";
+	const char* needles[2] = {absent, end - 12};
+	size_t needle_lengths[2] = {sizeof(absent) - 1, 12};
+	const char* names[2] = {"search, absent", "search, at the end"};
+	for (unsigned i = 0; i < 2 && file.filesize() >= 12; ++ i) {
+		off_t found = 0, reference_found = 0;
+		t = wall_clock();
+		for (unsigned r = 0; r < repeats; ++ r) {
+			file.rewind();
+			found = file.search_forward(needles[i], needle_lengths[i]) ? file.tell() : -1;
+		}
+		double t_search = wall_clock() - t;
+		t = wall_clock();
+		for (unsigned r = 0; r < repeats; ++ r) {
+			const char* loc = bytewise_search(begin, end, needles[i], needle_lengths[i]);
+			reference_found = loc != NULL ? loc - begin : -1;
+		}
+		double t_reference_search = wall_clock() - t;
+		if (found != reference_found) {
+			printf("string scanning: search mismatch (%lld vs %lld).\n", static_cast<long long>(found), static_cast<long long>(reference_found));
+			ok = false;
+		}
+		printf("%-28s %10.1f MB/s (memchr loop %8.1f MB/s)\n", names[i], megabytes_per_second(total_bytes, t_search), megabytes_per_second(total_bytes, t_reference_search));
+	}
+	
+	return ok ? 0 : 1;
+}
+
+#pragma mark -
+#pragma mark Cold start
+
+static long peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+// open the file and analyze only the given facets. Run once per process, as
+// the peak RSS cannot be reset.
+static int bench_cold_start(const char* filename, const char* arch, unsigned facets) {
+	long rss_before = peak_rss_kb();
+	double t = wall_clock();
+	MachO_File f (filename, arch);
+	double t_open = wall_clock() - t;
+	t = wall_clock();
+	f.analyze(facets);
+	double t_analyze = wall_clock() - t;
+	printf("cold start, facets %u: open %.3f ms, analyze %.3f ms, peak RSS %ld KiB (+%ld KiB)\n", facets, t_open * 1000, t_analyze * 1000, peak_rss_kb(), peak_rss_kb() - rss_before);
+	return 0;
+}
+
+#pragma mark -
+
+int main (int argc, const char* argv[]) {
+	const char* filename = NULL, *arch = "any";
+	size_t count = 1000000;
+	int cold_facets = -1;
+	bool fat = false, shared_cache = false, scan = false, closures = false;
+	const char* extracted_dir = NULL;
+
+	for (int i = 1; i < argc; ++ i) {
+		if (strcmp(argv[i], "-arch") == 0 && i+1 < argc)
+			arch = argv[++i];
+		else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			count = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-cold") == 0 && i+1 < argc)
+			cold_facets = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-fat") == 0)
+			fat = true;
+		else if (strcmp(argv[i], "-shared-cache") == 0)
+			shared_cache = true;
+		else if (strcmp(argv[i], "-scan") == 0)
+			scan = true;
+		else if (strcmp(argv[i], "-closures") == 0)
+			closures = true;
+		else if (strcmp(argv[i], "-extracted") == 0 && i+1 < argc)
+			extracted_dir = argv[++i];
+		else
+			filename = argv[i];
+	}
+
+	if (filename == NULL) {
+		printf("Usage: macho_bench [-arch <arch>] [-n <lookups>] [-cold <facets> | -fat | -shared-cache [-extracted <dir>] | -closures -extracted <dir> | -scan] <file>\n");
+		return 0;
+	}
+
+	try {
+		if (cold_facets >= 0)
+			return bench_cold_start(filename, arch, static_cast<unsigned>(cold_facets));
+		if (fat)
+			return bench_fat_slices(filename);
+		if (closures && extracted_dir != NULL)
+			return bench_closures(filename, extracted_dir);
+		if (shared_cache)
+			return bench_shared_cache(filename, extracted_dir);
+		if (scan)
+			return bench_string_scanning(filename, count >= 1000000 ? 10 : static_cast<unsigned>(count));
+		
+		MachO_File f (filename, arch);
+		f.analyze(MachO_File::AF_All);
+		bool ok = bench_address_translation(f, count);
+		ok = bench_symbol_lookup(f, count) && ok;
+		ok = bench_symbol_names(f, count) && ok;
+		ok = bench_export_trie(f, count) && ok;
+		return ok ? 0 : 1;
+	} catch (const TRException& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
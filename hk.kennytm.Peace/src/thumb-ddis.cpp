@@ -22,16 +22,52 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "DataFile.h"
 #include "MachO_File.h"
 #include "ThumbDumbDisassembler.h"
+#include <cstdlib>
+#include <cstring>
 
 void print_section(const section* s) {
 	printf(" ; %8x\t%08x\t%8x\t%s,%s\n", s->offset, s->addr, s->size, s->segname, s->sectname);
 }
 
+// an address is either a hex number or a symbol name.
+static void parse_address(const MachO_File& f, const char* str, unsigned* p_vm_address) {
+	char* end;
+	unsigned long value = std::strtoul(str, &end, 16);
+	if (*str != '\0' && *end == '\0')
+		*p_vm_address = static_cast<unsigned>(value);
+	else {
+		unsigned vm_address = f.address_of_symbol(str);
+		if (vm_address == 0)
+			fprintf(stderr, "Warning: Symbol \"%s\" not found.\n", str);
+		else
+			*p_vm_address = vm_address & ~1;
+	}
+}
+
 int main (int argc, char* argv[]) {
+	// leading options.
+	const char* cache_directory = NULL;
+	MachO_File::CacheMode cache_mode = MachO_File::CM_Use;
+	while (argc >= 2 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-cache") == 0 && argc >= 3) {
+			cache_directory = argv[2];
+			-- argc;
+			++ argv;
+		} else if (strcmp(argv[1], "-rebuild-cache") == 0)
+			cache_mode = MachO_File::CM_Rebuild;
+		else
+			break;
+		-- argc;
+		++ argv;
+	}
+	
 	if (argc < 2) {
-		printf("thumb-ddis <filename> [<start-vmaddr> [<end-vmaddr>]]");
+		printf("thumb-ddis [-cache <dir> [-rebuild-cache]] <filename> [<start-vmaddr-or-symbol> [<end-vmaddr-or-symbol>]]");
 	} else {
-		MachO_File f = MachO_File(argv[1]);
+		MachO_File f (argv[1]);
+		f.set_symbol_cache(cache_directory, cache_mode);
+		// the symbol names are only needed to parse the addresses.
+		f.analyze(argc >= 3 ? MachO_File::AF_All | MachO_File::AF_SymbolNames : MachO_File::AF_All);
 		
 		printf(" ;  FileLoc\t  VMAddr\t    Size\tSectName\n");
 		f.for_each_section(&print_section);
@@ -50,9 +86,9 @@ int main (int argc, char* argv[]) {
 		}
 		
 		if (argc >= 3)
-			sscanf(argv[2], "%x", &start_vm);
+			parse_address(f, argv[2], &start_vm);
 		if (argc >= 4)
-			sscanf(argv[3], "%x", &end_vm);
+			parse_address(f, argv[3], &end_vm);
 		
 		d.disassemble_in_range(start_vm, end_vm-start_vm+2);
 	}
@@ -0,0 +1,42 @@
+/*
+
+wall_clock.h ... Wall clock time in seconds, for timing summaries and benchmarks.
+
+Copyright (C) 2009  KennyTM~
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#if !_MSC_VER
+#include <sys/time.h>
+#else
+#include <ctime>
+#endif
+
+// seconds since an arbitrary point. Only differences are meaningful.
+static inline double wall_clock() {
+#if !_MSC_VER
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) * 1e-6;
+#else
+	return static_cast<double>(clock()) / static_cast<double>(CLOCKS_PER_SEC);
+#endif
+}
+
+#endif